@@ -1,10 +1,40 @@
 #include "vp8frame.h"
 
+#include <QtEndian>
+
 VP8Frame::VP8Frame() :
 	time(0),
 	type(NORMAL)
 {}
 
+int VP8Frame::peekType(const char* data, int size)
+{
+	// Serialized by QDataStream (big-endian): time (quint64), type (qint32), data.
+	if (size < 12)
+		return -1;
+	const auto p = (const uchar*)data + 8;
+	return (int)(((quint32)p[0] << 24) | ((quint32)p[1] << 16) | ((quint32)p[2] << 8) | (quint32)p[3]);
+}
+
+bool VP8Frame::fromSerialized(const QByteArray& buffer, int size, VP8Frame& frame)
+{
+	// Serialized by QDataStream (big-endian): time (quint64), type (qint32), data (quint32 length + bytes).
+	if (size < 16 || size > buffer.size())
+		return false;
+	const auto p = (const uchar*)buffer.constData();
+	auto length = qFromBigEndian<quint32>(p + 12);
+	if (length == 0xFFFFFFFF)
+		length = 0;  // Null QByteArray.
+	if (length > (quint32)(size - 16))
+		return false;
+
+	frame.time = qFromBigEndian<quint64>(p);
+	frame.type = qFromBigEndian<qint32>(p + 8);
+	frame.buffer = buffer;
+	frame.data = QByteArray::fromRawData(buffer.constData() + 16, (int)length);
+	return true;
+}
+
 QDataStream& operator<<(QDataStream& ds, const VP8Frame& frame)
 {
 	ds << frame.time << frame.type;
@@ -19,10 +19,24 @@ public:
 
 	VP8Frame();
 
+	/*! Reads the type of a serialized VP8Frame without deserializing it.
+		\return -1, if "data" is too short.
+	*/
+	static int peekType(const char* data, int size);
+
+	/*! Reads a serialized VP8Frame from the first "size" bytes of "buffer",
+		like operator>>(), but "data" refers to the buffer without a copy.
+		\return false, if the frame is incomplete.
+	*/
+	static bool fromSerialized(const QByteArray& buffer, int size, VP8Frame& frame);
+
 public:
 	quint64 time;
 	int type;
 	QByteArray data;
+
+	// Keeps the memory of "data" alive, see fromSerialized().
+	QByteArray buffer;
 };
 typedef QSharedPointer<VP8Frame> VP8FrameRefPtr;
 
@@ -0,0 +1,62 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/*!
+	Bounded lock-free queue for a single producer and a single consumer thread.
+
+	push() must only be called by the producer, pop() only by the consumer.
+	Neither blocks, push() fails when the queue is full and pop() when it is
+	empty. The queue does not wake up the consumer, e.g. use a semaphore,
+	which the producer releases after each push().
+*/
+template <class T>
+class SpscQueue
+{
+	std::vector<T> _buffer;
+
+	// Written by the consumer, separated from "_tail" to avoid false sharing.
+	std::atomic<size_t> _head;
+	char _padding[64];
+
+	// Written by the producer.
+	std::atomic<size_t> _tail;
+
+public:
+	SpscQueue(size_t capacity)
+		: _buffer(capacity + 1), _head(0), _tail(0)
+	{}
+
+	bool push(const T& data)
+	{
+		const auto tail = _tail.load(std::memory_order_relaxed);
+		const auto next = (tail + 1) % _buffer.size();
+		if (next == _head.load(std::memory_order_acquire))
+			return false;
+		_buffer[tail] = data;
+		_tail.store(next, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T& data)
+	{
+		const auto head = _head.load(std::memory_order_relaxed);
+		if (head == _tail.load(std::memory_order_acquire))
+			return false;
+		data = _buffer[head];
+		_buffer[head] = T();
+		_head.store((head + 1) % _buffer.size(), std::memory_order_release);
+		return true;
+	}
+
+	bool empty() const
+	{
+		return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+	}
+
+	size_t capacity() const
+	{
+		return _buffer.size() - 1;
+	}
+};
@@ -5,11 +5,16 @@
 #include <QHash>
 #include <QString>
 #include <memory>
+#include <cmath>
 #include "humblelogging/api.h"
+#include "libmediaprotocol/protocol.h"
 #include "opusencoder.h"
 
 HUMBLE_LOGGER(HL, "networkclient.audioencodingthread");
 
+// Frames louder than this level (in -dBov) are flagged as voice activity.
+static const int VOICE_ACTIVITY_LEVEL = 50;
+
 AudioEncodingThread::AudioEncodingThread(QObject* parent) :
 	_stopFlag(0), _recoveryFlag(OpusFrame::NORMAL)
 {
@@ -43,6 +48,24 @@ void AudioEncodingThread::enqueueRecovery()
 	// TODO Not yet implemented!
 }
 
+quint8 AudioEncodingThread::audioLevel(const PcmFrame& f)
+{
+	const auto samples = (const qint16*)f.data;
+	const auto count = f.numSamples * f.numChannels;
+	if (!samples || count <= 0)
+		return UDP::AudioFrameDatagram::SILENCE;
+
+	// RMS of the frame relative to full scale.
+	double sum = 0.0;
+	for (auto i = 0; i < count; ++i)
+		sum += (double)samples[i] * samples[i];
+	const auto rms = std::sqrt(sum / count) / 32768.0;
+	const auto dBov = rms > 0.0 ? -20.0 * std::log10(rms) : (double)UDP::AudioFrameDatagram::SILENCE;
+
+	const auto level = (quint8)qBound(0, (int)dBov, (int)UDP::AudioFrameDatagram::SILENCE);
+	return level < VOICE_ACTIVITY_LEVEL ? (level | UDP::AudioFrameDatagram::VOICE_ACTIVITY) : level;
+}
+
 void AudioEncodingThread::run()
 {
 	QHash<int, OpusAudioEncoder*> encoders;
@@ -85,7 +108,7 @@ void AudioEncodingThread::run()
 		QByteArray data;
 		QDataStream out(&data, QIODevice::WriteOnly);
 		out << *f.get();
-		emit encoded(data, item.second);
+		emit encoded(data, item.second, audioLevel(*item.first.data()));
 	}
 
 	qDeleteAll(encoders);
@@ -23,11 +23,14 @@ public:
 	void enqueue(const PcmFrameRefPtr& f, int senderId);
 	void enqueueRecovery();
 
+	/*! Level of the frame for UDP::AudioFrameDatagram::level. */
+	static quint8 audioLevel(const PcmFrame& f);
+
 protected:
 	void run();
 
 signals:
-	void encoded(const QByteArray& f, int senderId);
+	void encoded(const QByteArray& f, int senderId, quint8 level);
 
 private:
 	QMutex _m;
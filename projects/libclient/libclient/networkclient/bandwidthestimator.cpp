@@ -0,0 +1,317 @@
+#include "bandwidthestimator.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "libmediaprotocol/datagramview.h"
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Number of sent datagrams, which can be acknowledged.
+static const size_t SENT_HISTORY = 1024;
+
+// Datagrams sent within this time belong to the same group.
+static const qint64 GROUP_LENGTH_US = 5 * 1000;
+
+// Linear regression over the delays of the last groups.
+static const size_t TREND_WINDOW = 20;
+static const double TREND_SMOOTHING = 0.9;
+static const double TREND_GAIN = 4.0;
+static const int TREND_MAX_DELTAS = 60;
+
+// Adaptive overuse threshold.
+static const double THRESHOLD_INITIAL_MS = 12.5;
+static const double THRESHOLD_MIN_MS = 6.0;
+static const double THRESHOLD_MAX_MS = 600.0;
+static const double THRESHOLD_K_UP = 0.0087;
+static const double THRESHOLD_K_DOWN = 0.039;
+static const double OVERUSE_TIME_MS = 10.0;
+
+// Rate control.
+static const qint64 ACKED_WINDOW_US = 500 * 1000;
+static const qint64 DECREASE_INTERVAL_US = 200 * 1000;
+static const double DECREASE_FACTOR = 0.85;
+static const double INCREASE_PER_SECOND = 1.08;
+static const double HIGH_LOSS_RATIO = 0.1;
+
+///////////////////////////////////////////////////////////////////////////////
+
+BandwidthEstimator::BandwidthEstimator(int minBitrate, int maxBitrate) :
+	_minBitrate(minBitrate),
+	_maxBitrate(std::max(minBitrate, maxBitrate)),
+	_targetBitrate(_maxBitrate),
+	_sent(SENT_HISTORY),
+	_hasReference(false),
+	_lastReference(0),
+	_referenceUs(0),
+	_accumulatedDelayMs(0.0),
+	_smoothedDelayMs(0.0),
+	_firstArrivalTimeUs(-1),
+	_deltas(0),
+	_state(Normal),
+	_thresholdMs(THRESHOLD_INITIAL_MS),
+	_lastThresholdUpdateUs(-1),
+	_overusingTimeMs(-1.0),
+	_overuseCount(0),
+	_previousTrend(0.0),
+	_fractionLost(0),
+	_lastUpdateUs(-1),
+	_lastDecreaseUs(-1)
+{
+}
+
+void BandwidthEstimator::setBitrateRange(int minBitrate, int maxBitrate)
+{
+	_minBitrate = minBitrate;
+	_maxBitrate = std::max(minBitrate, maxBitrate);
+	_targetBitrate = std::min(std::max(_targetBitrate, _minBitrate), _maxBitrate);
+}
+
+void BandwidthEstimator::onSent(UDP::TransportDatagram::dg_sequence_t sequence, qint64 sendTimeUs, size_t size)
+{
+	auto& dg = _sent[sequence % SENT_HISTORY];
+	dg.sequence = sequence;
+	dg.valid = true;
+	dg.sendTimeUs = sendTimeUs;
+	dg.size = size;
+}
+
+void BandwidthEstimator::onFeedback(const UDP::TransportFeedbackDatagramView& feedback, qint64 nowUs)
+{
+	// The reference time wraps around after ~71 minutes.
+	const auto reference = feedback.referenceTime();
+	if (!_hasReference)
+		_referenceUs = reference;
+	else
+		_referenceUs += (qint32)(reference - _lastReference);
+	_lastReference = reference;
+	_hasReference = true;
+
+	// Arrivals in the order in which the server received them.
+	std::vector<std::pair<qint64, const SentDatagram*> > arrivals;
+	arrivals.reserve(feedback.count());
+	auto lost = 0;
+	auto known = 0;
+	for (size_t i = 0; i < feedback.count(); ++i)
+	{
+		const auto sequence = (UDP::TransportDatagram::dg_sequence_t)(feedback.baseSequence() + i);
+		auto& dg = _sent[sequence % SENT_HISTORY];
+		if (!dg.valid || dg.sequence != sequence)
+			continue;
+		++known;
+		const auto arrival = feedback.arrival(i);
+		if (arrival == UDP::TransportFeedbackDatagram::NOT_RECEIVED)
+		{
+			++lost;
+		}
+		else
+		{
+			arrivals.push_back(std::make_pair(_referenceUs + (qint64)arrival * UDP::TransportFeedbackDatagram::ARRIVAL_TICK_US, &dg));
+		}
+		// Reported once, a datagram arriving later is not part of any feedback.
+		dg.valid = false;
+	}
+	if (known == 0)
+	{
+		return;
+	}
+	std::stable_sort(arrivals.begin(), arrivals.end(), [](const std::pair<qint64, const SentDatagram*>& l, const std::pair<qint64, const SentDatagram*>& r)
+	{
+		return l.first < r.first;
+	});
+	for (const auto& a : arrivals)
+	{
+		addArrival(a.second->sendTimeUs, a.first, a.second->size);
+	}
+
+	const auto lossRatio = (double)lost / known;
+	_fractionLost = (int)(lossRatio * 255);
+	updateTarget(lossRatio, nowUs);
+}
+
+void BandwidthEstimator::addArrival(qint64 sendTimeUs, qint64 arrivalTimeUs, size_t size)
+{
+	_acked.push_back(std::make_pair(arrivalTimeUs, size));
+	while (!_acked.empty() && _acked.front().first < arrivalTimeUs - ACKED_WINDOW_US)
+		_acked.pop_front();
+
+	if (!_group.valid)
+	{
+		_group.valid = true;
+		_group.firstSendTimeUs = sendTimeUs;
+		_group.lastSendTimeUs = sendTimeUs;
+		_group.lastArrivalTimeUs = arrivalTimeUs;
+		return;
+	}
+	if (sendTimeUs < _group.firstSendTimeUs)
+	{
+		// Reordered, belongs to a previous group.
+		return;
+	}
+	if (sendTimeUs - _group.firstSendTimeUs <= GROUP_LENGTH_US)
+	{
+		_group.lastSendTimeUs = std::max(_group.lastSendTimeUs, sendTimeUs);
+		_group.lastArrivalTimeUs = std::max(_group.lastArrivalTimeUs, arrivalTimeUs);
+		return;
+	}
+
+	// The group is complete, compare it with the previous one.
+	if (_previousGroup.valid)
+	{
+		const auto sendDeltaMs = (_group.lastSendTimeUs - _previousGroup.lastSendTimeUs) / 1000.0;
+		const auto arrivalDeltaMs = (_group.lastArrivalTimeUs - _previousGroup.lastArrivalTimeUs) / 1000.0;
+		updateTrend(arrivalDeltaMs - sendDeltaMs, sendDeltaMs, _group.lastArrivalTimeUs);
+	}
+	_previousGroup = _group;
+	_group.firstSendTimeUs = sendTimeUs;
+	_group.lastSendTimeUs = sendTimeUs;
+	_group.lastArrivalTimeUs = arrivalTimeUs;
+}
+
+void BandwidthEstimator::updateTrend(double delayMs, double sendDeltaMs, qint64 arrivalTimeUs)
+{
+	if (_firstArrivalTimeUs == -1)
+		_firstArrivalTimeUs = arrivalTimeUs;
+
+	_accumulatedDelayMs += delayMs;
+	_smoothedDelayMs = TREND_SMOOTHING * _smoothedDelayMs + (1.0 - TREND_SMOOTHING) * _accumulatedDelayMs;
+	_delays.push_back(std::make_pair((arrivalTimeUs - _firstArrivalTimeUs) / 1000.0, _smoothedDelayMs));
+	if (_delays.size() > TREND_WINDOW)
+		_delays.pop_front();
+	_deltas = std::min(_deltas + 1, TREND_MAX_DELTAS);
+
+	auto trend = _previousTrend;
+	if (_delays.size() == TREND_WINDOW)
+	{
+		// Slope of the least squares fit.
+		auto sumX = 0.0, sumY = 0.0;
+		for (const auto& d : _delays)
+		{
+			sumX += d.first;
+			sumY += d.second;
+		}
+		const auto avgX = sumX / _delays.size();
+		const auto avgY = sumY / _delays.size();
+		auto numerator = 0.0, denominator = 0.0;
+		for (const auto& d : _delays)
+		{
+			numerator += (d.first - avgX) * (d.second - avgY);
+			denominator += (d.first - avgX) * (d.first - avgX);
+		}
+		if (denominator != 0.0)
+			trend = numerator / denominator;
+	}
+	detect(trend, sendDeltaMs, arrivalTimeUs);
+}
+
+void BandwidthEstimator::detect(double trend, double sendDeltaMs, qint64 arrivalTimeUs)
+{
+	if (_deltas < 2)
+	{
+		_state = Normal;
+		return;
+	}
+
+	const auto modifiedTrend = std::min(_deltas, TREND_MAX_DELTAS) * trend * TREND_GAIN;
+	if (modifiedTrend > _thresholdMs)
+	{
+		// Overuse has to last for a while and may not be decreasing.
+		if (_overusingTimeMs == -1.0)
+			_overusingTimeMs = sendDeltaMs / 2;
+		else
+			_overusingTimeMs += sendDeltaMs;
+		++_overuseCount;
+		if (_overusingTimeMs > OVERUSE_TIME_MS && _overuseCount > 1 && trend >= _previousTrend)
+		{
+			_overusingTimeMs = 0.0;
+			_overuseCount = 0;
+			_state = Overusing;
+		}
+	}
+	else if (modifiedTrend < -_thresholdMs)
+	{
+		_overusingTimeMs = -1.0;
+		_overuseCount = 0;
+		_state = Underusing;
+	}
+	else
+	{
+		_overusingTimeMs = -1.0;
+		_overuseCount = 0;
+		_state = Normal;
+	}
+	_previousTrend = trend;
+	updateThreshold(modifiedTrend, arrivalTimeUs);
+}
+
+void BandwidthEstimator::updateThreshold(double modifiedTrend, qint64 arrivalTimeUs)
+{
+	if (_lastThresholdUpdateUs == -1)
+		_lastThresholdUpdateUs = arrivalTimeUs;
+
+	// Spikes (e.g. a rerouted path) do not adapt the threshold.
+	const auto absTrend = std::fabs(modifiedTrend);
+	if (absTrend > _thresholdMs + 15.0)
+	{
+		_lastThresholdUpdateUs = arrivalTimeUs;
+		return;
+	}
+
+	// Follows the trend slowly upwards and faster downwards, which keeps
+	// the estimator from being starved by concurrent TCP flows.
+	const auto k = absTrend < _thresholdMs ? THRESHOLD_K_DOWN : THRESHOLD_K_UP;
+	const auto deltaMs = std::min((arrivalTimeUs - _lastThresholdUpdateUs) / 1000.0, 100.0);
+	_thresholdMs += k * (absTrend - _thresholdMs) * deltaMs;
+	_thresholdMs = std::min(std::max(_thresholdMs, THRESHOLD_MIN_MS), THRESHOLD_MAX_MS);
+	_lastThresholdUpdateUs = arrivalTimeUs;
+}
+
+void BandwidthEstimator::updateTarget(double lossRatio, qint64 nowUs)
+{
+	const auto elapsedUs = _lastUpdateUs == -1 ? 0 : std::min(nowUs - _lastUpdateUs, (qint64)1000000);
+	_lastUpdateUs = nowUs;
+
+	const auto acked = ackedBitrate();
+	const auto canDecrease = _lastDecreaseUs == -1 || nowUs - _lastDecreaseUs >= DECREASE_INTERVAL_US;
+	switch (_state)
+	{
+		case Overusing:
+			if (canDecrease)
+			{
+				_targetBitrate = DECREASE_FACTOR * (acked > 0.0 ? std::min(acked, _targetBitrate) : _targetBitrate);
+				_lastDecreaseUs = nowUs;
+			}
+			break;
+		case Underusing:
+			break;
+		case Normal:
+			_targetBitrate *= std::pow(INCREASE_PER_SECOND, elapsedUs / 1000000.0);
+			if (acked > 0.0)
+				_targetBitrate = std::min(_targetBitrate, 1.5 * acked + 10000.0);
+			break;
+	}
+
+	if (lossRatio > HIGH_LOSS_RATIO && _state != Overusing && canDecrease)
+	{
+		_targetBitrate *= 1.0 - 0.5 * lossRatio;
+		_lastDecreaseUs = nowUs;
+	}
+	_targetBitrate = std::min(std::max(_targetBitrate, _minBitrate), _maxBitrate);
+}
+
+double BandwidthEstimator::ackedBitrate() const
+{
+	if (_acked.size() < 2)
+	{
+		return 0.0;
+	}
+	const auto spanUs = _acked.back().first - _acked.front().first;
+	if (spanUs < ACKED_WINDOW_US / 4)
+	{
+		return 0.0;
+	}
+	size_t bytes = 0;
+	for (const auto& a : _acked)
+		bytes += a.second;
+	return bytes * 8.0 * 1000000.0 / spanUs;
+}
@@ -0,0 +1,128 @@
+#ifndef BANDWIDTHESTIMATOR_H
+#define BANDWIDTHESTIMATOR_H
+
+#include <deque>
+#include <utility>
+#include <vector>
+
+#include <QtGlobal>
+
+#include "libmediaprotocol/protocol.h"
+
+namespace UDP { class TransportFeedbackDatagramView; }
+
+/*!
+	Delay-based estimation of the available upstream bandwidth, similar to
+	the Google Congestion Control (GCC) of WebRTC.
+
+	Every sent datagram is registered with its transport sequence number
+	(see UDP::TransportDatagram). The server reports their arrival times
+	(see UDP::TransportFeedbackDatagram), from which the estimator computes
+	the change of the one-way delay between groups of datagrams. A growing
+	delay means that a queue on the path fills up, long before datagrams
+	are dropped:
+
+	  - Overuse: The target drops to 85% of the rate, which actually
+	    arrived at the server.
+	  - Normal: The target grows by 8% per second, up to 1.5 times the
+	    rate, which actually arrived at the server.
+	  - Underuse: The queues drain, the target is kept.
+
+	High loss (> 10%) lowers the target as well.
+
+	\note This class is NOT thread-safe.
+*/
+class BandwidthEstimator
+{
+public:
+	enum State { Normal, Overusing, Underusing };
+
+	/*! \param minBitrate Lower bound of the target in bits per second.
+		\param maxBitrate Upper bound and initial target in bits per second.
+	*/
+	BandwidthEstimator(int minBitrate = 50000, int maxBitrate = 2000000);
+
+	/*! Changes the bounds, the target is kept within them. */
+	void setBitrateRange(int minBitrate, int maxBitrate);
+
+	/*! Registers a sent datagram. */
+	void onSent(UDP::TransportDatagram::dg_sequence_t sequence, qint64 sendTimeUs, size_t size);
+
+	/*! Updates the target with the feedback of the server. */
+	void onFeedback(const UDP::TransportFeedbackDatagramView& feedback, qint64 nowUs);
+
+	/*! Target bitrate in bits per second. */
+	int targetBitrate() const { return (int)_targetBitrate; }
+
+	State state() const { return _state; }
+
+	/*! Lost datagrams of the last feedback (0 = None, 255 = All). */
+	int fractionLost() const { return _fractionLost; }
+
+private:
+	class SentDatagram
+	{
+	public:
+		UDP::TransportDatagram::dg_sequence_t sequence = 0;
+		bool valid = false;
+		qint64 sendTimeUs = 0;
+		size_t size = 0;
+	};
+
+	// Datagrams, which have been sent within a few milliseconds (a frame)
+	// are a single group, the delay is measured between groups.
+	class DatagramGroup
+	{
+	public:
+		bool valid = false;
+		qint64 firstSendTimeUs = 0;
+		qint64 lastSendTimeUs = 0;
+		qint64 lastArrivalTimeUs = 0;
+	};
+
+	void addArrival(qint64 sendTimeUs, qint64 arrivalTimeUs, size_t size);
+	void updateTrend(double delayMs, double sendDeltaMs, qint64 arrivalTimeUs);
+	void detect(double trend, double sendDeltaMs, qint64 arrivalTimeUs);
+	void updateThreshold(double modifiedTrend, qint64 arrivalTimeUs);
+	void updateTarget(double lossRatio, qint64 nowUs);
+	double ackedBitrate() const;
+
+private:
+	double _minBitrate;
+	double _maxBitrate;
+	double _targetBitrate;
+
+	std::vector<SentDatagram> _sent;
+
+	// Arrival times on the server's clock, unwrapped.
+	bool _hasReference;
+	UDP::TransportDatagram::dg_time_t _lastReference;
+	qint64 _referenceUs;
+
+	DatagramGroup _group;
+	DatagramGroup _previousGroup;
+
+	// Trend of the accumulated delay (linear regression over the last groups).
+	std::deque<std::pair<double, double> > _delays;
+	double _accumulatedDelayMs;
+	double _smoothedDelayMs;
+	qint64 _firstArrivalTimeUs;
+	int _deltas;
+
+	// Overuse detection with adaptive threshold.
+	State _state;
+	double _thresholdMs;
+	qint64 _lastThresholdUpdateUs;
+	double _overusingTimeMs;
+	int _overuseCount;
+	double _previousTrend;
+
+	// Acknowledged datagrams (arrival time, size) of the last ACKED_WINDOW_US.
+	std::deque<std::pair<qint64, size_t> > _acked;
+
+	int _fractionLost;
+	qint64 _lastUpdateUs;
+	qint64 _lastDecreaseUs;
+};
+
+#endif
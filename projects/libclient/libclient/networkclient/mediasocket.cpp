@@ -1,14 +1,45 @@
 #include "mediasocket_p.h"
 
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <netinet/in.h>
+#include <sys/stat.h>
+#endif
+
+#include <QFile>
 #include <QTimer>
 #include <QTimerEvent>
 
 #include "humblelogging/api.h"
 
+#include "libmediaprotocol/datagramview.h"
+#include "libmediaprotocol/fec.h"
+
 #include "libapp/timeutil.h"
+#include "libapp/vp8frame.h"
 
 HUMBLE_LOGGER(HL, "networkclient.mediasocket");
 
+// Probed datagram sizes, largest first (see UDP::MtuProbeDatagram).
+static const int MTU_PROBE_SIZES[] = { UDP::MtuProbeDatagram::MAXDATAGRAMSIZE, 1200, 1000 };
+static const int MTU_PROBE_INTERVAL = 250;
+static const int MTU_PROBE_ROUNDS = 3;
+
+// Interval to check the video decoders for missing datagrams.
+static const int NACK_INTERVAL = 20;
+
+// Interval to release the frames of the jitter buffers.
+static const int JITTER_BUFFER_INTERVAL = 5;
+
+// Lower bound of the estimated bandwidth (bit/s) and of the encoder bitrate (kbit/s).
+static const int MIN_VIDEO_BANDWIDTH = 50000;
+static const int MIN_VIDEO_BITRATE = 30;
+
+// Holds about a second of video from a few senders.
+static const int RECEIVE_BUFFER_SIZE = 4 * 1024 * 1024;
+
 ///////////////////////////////////////////////////////////////////////
 
 #if __linux__
@@ -29,11 +60,22 @@ QDataStream& operator>>(QDataStream& in, UDP::VideoFrameDatagram::dg_frame_id_t&
 #endif
 #endif
 
+// Whether the datagram belongs to a key frame, older clients flag only the first datagram.
+static bool isVideoKeyFrameStart(const UDP::VideoFrameDatagramView& dg)
+{
+	if (dg.flags() & UDP::VideoFrameDatagram::KeyFrame)
+		return true;
+	if (dg.index() != 0 || (dg.flags() & UDP::VideoFrameDatagram::Redundant))
+		return false;
+	return VP8Frame::peekType((const char*)dg.payload(), dg.payloadSize()) == VP8Frame::KEY;
+}
+
 ///////////////////////////////////////////////////////////////////////
 
-MediaSocket::MediaSocket(const QString& token, QObject* parent) :
-	QUdpSocket(parent),
-	d(new MediaSocketPrivate(this))
+MediaSocket::MediaSocket(const QString& token) :
+	QUdpSocket(nullptr),
+	d(new MediaSocketPrivate(this)),
+	_bandwidthTimer(this)
 {
 	connect(this, &MediaSocket::stateChanged, this, &MediaSocket::onSocketStateChanged);
 	connect(this, static_cast<void(MediaSocket::*)(QAbstractSocket::SocketError)>(&MediaSocket::error), this, &MediaSocket::onSocketError);
@@ -46,24 +88,24 @@ MediaSocket::MediaSocket(const QString& token, QObject* parent) :
 	{
 		// Encoding (Delayed start, when the user enables his video)
 		connect(d->videoEncodingThread, &VideoEncodingThread::encoded, this, &MediaSocket::onVideoFrameEncoded);
+		connect(d->videoEncodingThread, &VideoEncodingThread::bitrateApplied, this, &MediaSocket::onVideoBitrateApplied);
 
-		// Decoding
+		// Decoding (Decoded frames bypass the I/O thread)
 		d->videoDecodingThread->start();
-		connect(d->videoDecodingThread, &VideoDecodingThread::decoded, this, &MediaSocket::onVideoFrameDecoded);
+		connect(d->videoDecodingThread, &VideoDecodingThread::decoded, this, &MediaSocket::newVideoFrame, Qt::DirectConnection);
 	}
 
 #if defined(OCS_INCLUDE_AUDIO)
 	// Audio
 	if (true)
 	{
-		// Encoding
-		static quint64 __nextAudioFrameId = 1;
+		// Encoding (Queued into the I/O thread, which owns the socket)
 		d->audioEncodingThread->start();
 		connect(d->audioEncodingThread,
-				&AudioEncodingThread::encoded, [this](const QByteArray & f,
-						ocs::clientid_t senderId)
+				&AudioEncodingThread::encoded, this, [this](const QByteArray & f,
+						ocs::clientid_t senderId, quint8 level)
 		{
-			sendAudioFrame(f, __nextAudioFrameId++, senderId);
+			sendAudioFrame(f, d->nextAudioFrameId++, senderId, level);
 		});
 
 		// Decoding
@@ -80,19 +122,43 @@ MediaSocket::MediaSocket(const QString& token, QObject* parent) :
 	{
 		d->networkUsageHelper.recalculate();
 		emit networkUsageUpdated(d->networkUsage);
+
+		// The I/O thread did not keep up with the arriving datagrams.
+		const auto drops = receiveBufferDrops();
+		if (drops > d->receiveBufferDrops)
+		{
+			HL_WARN(HL, QString("Receive buffer overflow (dropped=%1; total=%2; decoder-dropped=%3)")
+					.arg(drops - d->receiveBufferDrops).arg(drops).arg(d->videoDecodingThread->droppedFrames()).toStdString());
+			d->receiveBufferDrops = drops;
+		}
+
+		for (auto it = d->videoJitterBuffers.constBegin(); it != d->videoJitterBuffers.constEnd(); ++it)
+		{
+			const auto& stats = it.value()->stats();
+			HL_DEBUG(HL, QString("Video jitter buffer (sender-id=%1; delay=%2; jitter=%3; frames=%4; late=%5; dropped=%6)")
+					 .arg(it.key()).arg(it.value()->delay()).arg(it.value()->jitter(), 0, 'f', 1)
+					 .arg(stats.frames).arg(stats.late).arg(stats.dropped).toStdString());
+		}
 	});
+
+	// Everything else happens in the I/O thread, timers included.
+	moveToThread(d->ioThread);
+	d->ioThread->start();
 }
 
 MediaSocket::~MediaSocket()
 {
-	if (_bandwidthTimer.isActive())
-		_bandwidthTimer.stop();
-
-	if (d->authenticationTimerId != -1)
-		killTimer(d->authenticationTimerId);
+	if (QThread::currentThread() == thread())
+		shutdown();
+	else
+		QMetaObject::invokeMethod(this, "shutdown", Qt::BlockingQueuedConnection);
+	d->ioThread->quit();
+	d->ioThread->wait();
+	delete d->ioThread;
+	d->ioThread = nullptr;
 
-	if (d->keepAliveTimerId != -1)
-		killTimer(d->keepAliveTimerId);
+	qDeleteAll(d->videoJitterBuffers);
+	d->videoJitterBuffers.clear();
 
 	while (!d->videoFrameDatagramDecoders.isEmpty())
 	{
@@ -131,22 +197,51 @@ MediaSocket::~MediaSocket()
 #endif
 }
 
+void MediaSocket::connectToServer(const QHostAddress& address, quint16 port)
+{
+	if (QThread::currentThread() != thread())
+	{
+		QMetaObject::invokeMethod(this, "connectToServer", Qt::QueuedConnection, Q_ARG(QHostAddress, address), Q_ARG(quint16, port));
+		return;
+	}
+	connectToHost(address, port);
+}
+
+bool MediaSocket::isConnected() const
+{
+	return d->connected.load() != 0;
+}
+
 bool MediaSocket::isAuthenticated() const
 {
-	return d->authenticated;
+	return d->authenticated.load() != 0;
 }
 
 void MediaSocket::setAuthenticated(bool yesno)
 {
-	d->authenticated = yesno;
-	if (d->authenticated && d->authenticationTimerId != -1)
+	if (QThread::currentThread() != thread())
+	{
+		QMetaObject::invokeMethod(this, "setAuthenticated", Qt::QueuedConnection, Q_ARG(bool, yesno));
+		return;
+	}
+	d->authenticated = yesno ? 1 : 0;
+	if (yesno && d->authenticationTimerId != -1)
 	{
 		killTimer(d->authenticationTimerId);
 		d->authenticationTimerId = -1;
 	}
-	if (d->authenticated)
+	if (yesno)
 	{
 		d->keepAliveTimerId = startTimer(1000);
+		if (d->nackTimerId == -1)
+			d->nackTimerId = startTimer(NACK_INTERVAL);
+
+		// Without "don't fragment" a fragmented probe would pass as well.
+		if (d->mtuProbeTimerId == -1 && setDontFragment())
+		{
+			d->mtuProbeRounds = 0;
+			d->mtuProbeTimerId = startTimer(MTU_PROBE_INTERVAL);
+		}
 	}
 }
 
@@ -160,18 +255,59 @@ void MediaSocket::sendVideoFrame(const QImage& image, ocs::clientid_t senderId)
 	d->videoEncodingThread->enqueue(image, senderId);
 }
 
-void MediaSocket::initVideoEncoder(int width, int height, int bitrate, int fps)
+void MediaSocket::sendEncodedVideoFrame(const QByteArray& frame, ocs::clientid_t senderId, int layer, int temporalCode)
+{
+	if (QThread::currentThread() != thread())
+	{
+		QMetaObject::invokeMethod(this, "sendEncodedVideoFrame", Qt::QueuedConnection, Q_ARG(QByteArray, frame), Q_ARG(ocs::clientid_t, senderId), Q_ARG(int, layer), Q_ARG(int, temporalCode));
+		return;
+	}
+	sendVideoFrame(frame, d->nextVideoFrameIds[layer]++, senderId, layer, temporalCode);
+}
+
+void MediaSocket::initVideoEncoder(int width, int height, int bitrate, int fps, int layers, int temporalLayers)
 {
+	if (QThread::currentThread() != thread())
+	{
+		QMetaObject::invokeMethod(this, "initVideoEncoder", Qt::QueuedConnection, Q_ARG(int, width), Q_ARG(int, height), Q_ARG(int, bitrate), Q_ARG(int, fps), Q_ARG(int, layers), Q_ARG(int, temporalLayers));
+		return;
+	}
 	if (!d->videoEncodingThread)
 		return;
-	d->videoEncodingThread->stop();
-	d->videoEncodingThread->wait();
-	d->videoEncodingThread->init(width, height, bitrate, fps);
-	d->videoEncodingThread->start();
+
+	// The same geometry only changes the settings of the running encoders.
+	layers = qBound(1, layers, (int)UDP::VideoFrameDatagram::MAXLAYERS);
+	if (d->videoEncodingThread->isRunning() && d->videoSize == QSize(width, height) && d->videoLayerCount == layers && d->videoTemporalLayers == temporalLayers)
+	{
+		d->videoEncodingThread->reconfigure(bitrate, fps, 100);
+	}
+	else
+	{
+		d->videoEncodingThread->stop();
+		d->videoEncodingThread->wait();
+		d->videoEncodingThread->init(width, height, bitrate, fps, layers, temporalLayers);
+		d->videoEncodingThread->start();
+		d->appliedVideoBitrate = bitrate;
+	}
+	d->videoSize = QSize(width, height);
+	d->videoTemporalLayers = temporalLayers;
+
+	// The estimate includes headers and parity, it may exceed the bitrate of the encoders.
+	d->videoBitrate = bitrate;
+	d->videoLayerCount = layers;
+	auto total = 0;
+	for (auto layer = 0; layer < d->videoLayerCount; ++layer)
+		total += VideoEncodingThread::layerBitrate(bitrate, layer);
+	d->bandwidthEstimator.setBitrateRange(MIN_VIDEO_BANDWIDTH, total * 1000 * 3 / 2);
 }
 
 void MediaSocket::resetVideoEncoder()
 {
+	if (QThread::currentThread() != thread())
+	{
+		QMetaObject::invokeMethod(this, "resetVideoEncoder", Qt::QueuedConnection);
+		return;
+	}
 	if (d->videoEncodingThread)
 	{
 		d->videoEncodingThread->stop();
@@ -179,12 +315,55 @@ void MediaSocket::resetVideoEncoder()
 	}
 }
 
+void MediaSocket::setVideoFec(int groupSize)
+{
+	if (QThread::currentThread() != thread())
+	{
+		QMetaObject::invokeMethod(this, "setVideoFec", Qt::QueuedConnection, Q_ARG(int, groupSize));
+		return;
+	}
+	d->videoFecMode = groupSize;
+	updateVideoFec();
+}
+
+void MediaSocket::setVideoJitterDelay(int minDelay, int maxDelay)
+{
+	if (QThread::currentThread() != thread())
+	{
+		QMetaObject::invokeMethod(this, "setVideoJitterDelay", Qt::QueuedConnection, Q_ARG(int, minDelay), Q_ARG(int, maxDelay));
+		return;
+	}
+	d->videoJitterMinDelay = minDelay;
+	d->videoJitterMaxDelay = maxDelay;
+	for (auto jitterBuffer : d->videoJitterBuffers)
+		jitterBuffer->setDelayRange(minDelay, maxDelay);
+}
+
+void MediaSocket::setVideoDatagramLimit(int size)
+{
+	if (QThread::currentThread() != thread())
+	{
+		QMetaObject::invokeMethod(this, "setVideoDatagramLimit", Qt::QueuedConnection, Q_ARG(int, size));
+		return;
+	}
+	d->videoDatagramLimit = qBound((int)UDP::MtuProbeDatagram::DEFAULTDATAGRAMSIZE, size, (int)UDP::MtuProbeDatagram::MAXDATAGRAMSIZE);
+	HL_DEBUG(HL, QString("Video datagram limit of receivers (size=%1)").arg(d->videoDatagramLimit).toStdString());
+}
+
 void MediaSocket::resetVideoDecoderOfClient(ocs::clientid_t senderId)
 {
+	if (QThread::currentThread() != thread())
+	{
+		QMetaObject::invokeMethod(this, "resetVideoDecoderOfClient", Qt::QueuedConnection, Q_ARG(ocs::clientid_t, senderId));
+		return;
+	}
 	if (!d->videoDecodingThread)
 		return;
+	// The held frames belong to the previous decoder.
+	delete d->videoJitterBuffers.take(senderId);
 	d->videoDecodingThread->enqueue(nullptr, senderId);
 	delete d->videoFrameDatagramDecoders.take(senderId);
+	d->videoLayers.remove(senderId);
 }
 
 #if defined(OCS_INCLUDE_AUDIO)
@@ -250,10 +429,99 @@ void MediaSocket::sendAuthTokenDatagram(const QString& token)
 		d->networkUsage.bytesWritten += written;
 }
 
-void MediaSocket::sendVideoFrame(const QByteArray& frame_, quint64 frameId_, ocs::clientid_t senderId_)
+void MediaSocket::sendMtuProbeDatagram(int size)
+{
+	HL_TRACE(HL, QString("Send MTU probe datagram (size=%1)").arg(size).toStdString());
+
+	UDP::MtuProbeDatagram dg;
+	dg.size = size;
+
+	QByteArray datagram;
+	QDataStream out(&datagram, QIODevice::WriteOnly);
+	out.setByteOrder(QDataStream::BigEndian);
+	out << dg.magic;
+	out << dg.type;
+	out << dg.size;
+	datagram.append(QByteArray(size - datagram.size(), 0));
+
+	auto written = writeDatagram(datagram, peerAddress(), peerPort());
+	if (written < 0)
+		HL_DEBUG(HL, QString("Can not write MTU probe datagram (size=%1; error=%2; msg=%3)")
+				 .arg(size).arg(error()).arg(errorString()).toStdString());
+	else
+		d->networkUsage.bytesWritten += written;
+}
+
+bool MediaSocket::setDontFragment()
 {
-	HL_TRACE(HL, QString("Send video frame datagram (frame-size=%1; frame-id=%2; sender-id=%3)")
-			 .arg(frame_.size()).arg(frameId_).arg(senderId_).toStdString());
+#ifdef __linux__
+	const auto fd = socketDescriptor();
+	if (fd == -1)
+		return false;
+	auto ret = -1;
+	if (peerAddress().protocol() == QAbstractSocket::IPv6Protocol)
+	{
+		int value = IPV6_PMTUDISC_DO;
+		ret = ::setsockopt((int)fd, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &value, sizeof(value));
+	}
+	else
+	{
+		int value = IP_PMTUDISC_DO;
+		ret = ::setsockopt((int)fd, IPPROTO_IP, IP_MTU_DISCOVER, &value, sizeof(value));
+	}
+	if (ret != 0)
+	{
+		HL_WARN(HL, QString("Can not set don't fragment (errno=%1)").arg(errno).toStdString());
+		return false;
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+void MediaSocket::setReceiveBufferSize(int size)
+{
+	setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption, size);
+
+	// The kernel limits the size (e.g. net.core.rmem_max on Linux).
+	const auto effective = socketOption(QAbstractSocket::ReceiveBufferSizeSocketOption).toInt();
+	if (effective < size)
+		HL_WARN(HL, QString("Receive buffer is smaller than requested (size=%1; requested=%2)").arg(effective).arg(size).toStdString());
+	else
+		HL_DEBUG(HL, QString("Receive buffer size (size=%1)").arg(effective).toStdString());
+}
+
+qint64 MediaSocket::receiveBufferDrops() const
+{
+#ifdef __linux__
+	// The "drops" column of the socket's line in /proc/net/udp(6), the inode identifies the socket.
+	const auto fd = socketDescriptor();
+	struct stat st;
+	if (fd == -1 || ::fstat((int)fd, &st) != 0)
+		return -1;
+	const auto inode = QByteArray::number((qulonglong)st.st_ino);
+
+	QFile file(peerAddress().protocol() == QAbstractSocket::IPv6Protocol ? "/proc/net/udp6" : "/proc/net/udp");
+	if (!file.open(QIODevice::ReadOnly))
+		return -1;
+	file.readLine(); // Header
+	while (!file.atEnd())
+	{
+		const auto columns = file.readLine().simplified().split(' ');
+		if (columns.size() > 12 && columns[9] == inode)
+			return columns[12].toLongLong();
+	}
+	return -1;
+#else
+	return -1;
+#endif
+}
+
+void MediaSocket::sendVideoFrame(const QByteArray& frame_, quint64 frameId_, ocs::clientid_t senderId_, int layer, int temporalCode)
+{
+	HL_TRACE(HL, QString("Send video frame datagram (frame-size=%1; frame-id=%2; sender-id=%3; layer=%4; temporal-code=%5)")
+			 .arg(frame_.size()).arg(frameId_).arg(senderId_).arg(layer).arg(temporalCode).toStdString());
 
 	if (frame_.isEmpty() || frameId_ == 0)
 	{
@@ -262,52 +530,31 @@ void MediaSocket::sendVideoFrame(const QByteArray& frame_, quint64 frameId_, ocs
 		return;
 	}
 
-	UDP::VideoFrameDatagram::dg_frame_id_t frameId = frameId_;
-	UDP::VideoFrameDatagram::dg_sender_t senderId = senderId_;
-
-	// Split frame into datagrams.
-	UDP::VideoFrameDatagram** datagrams = 0;
-	UDP::VideoFrameDatagram::dg_data_count_t datagramsLength;
-	if (UDP::VideoFrameDatagram::split((UDP::dg_byte_t*)frame_.data(), frame_.size(), frameId, senderId, &datagrams, datagramsLength) != 0)
+	// Serialize the headers into the reused arena, the payload is sent from "frame_".
+	UDP::VideoFrameDatagram::dg_flags_t flags = UDP::VideoFrameDatagram::None;
+	if (VP8Frame::peekType(frame_.constData(), frame_.size()) == VP8Frame::KEY)
+		flags |= UDP::VideoFrameDatagram::KeyFrame;
+	flags = UDP::VideoFrameDatagram::withLayer(flags, layer);
+	flags = UDP::VideoFrameDatagram::withTemporalCode(flags, temporalCode);
+	// The server forwards the datagrams as they are, the receivers must be able to take them.
+	const auto datagramSize = qMin(d->videoDatagramSize, d->videoDatagramLimit);
+	const auto maxPayloadSize = (UDP::dg_size_t)(datagramSize - UDP::TransportDatagramView::HEADER_SIZE - UDP::VideoFrameDatagramView::HEADER_SIZE);
+	if (d->videoSendBuffers.writer.writeVideoFrame((const UDP::dg_byte_t*)frame_.constData(), frame_.size(), frameId_, senderId_, flags, maxPayloadSize, d->videoFecGroupSize) == 0)
 	{
 		HL_ERROR(HL, QString("Can not split frame data into multiple parts").toStdString());
 		return;
 	}
+	writeFrameDatagrams(d->videoSendBuffers);
 
-	// Send datagrams.
-	for (auto i = 0; i < datagramsLength; ++i)
+	// Cache the data datagrams for retransmissions, parity datagrams follow them.
+	const auto& writer = d->videoSendBuffers.writer;
+	for (size_t i = 0; i < writer.count(); ++i)
 	{
-		const auto& dgvideo = *datagrams[i];
-		QByteArray datagram;
-		QDataStream out(&datagram, QIODevice::WriteOnly);
-		out.setByteOrder(QDataStream::BigEndian);
-		out << dgvideo.magic;
-		out << dgvideo.type;
-		out << dgvideo.flags;
-		out << dgvideo.sender;
-		out << dgvideo.frameId;
-		out << dgvideo.index;
-		out << dgvideo.count;
-		out << dgvideo.size;
-		out.writeRawData((char*)dgvideo.data, dgvideo.size);
-
-		auto written = writeDatagram(datagram, peerAddress(), peerPort());
-		if (written < 0)
-		{
-			HL_ERROR(HL, QString("Can not write datagram (error=%1; msg=%2)")
-					 .arg(error())
-					 .arg(errorString()).toStdString());
-		}
-		else
-		{
-			d->networkUsage.bytesWritten += written;
-		}
+		const auto& slice = writer.slice(i);
+		if (slice.header[UDP::VideoFrameDatagramView::OFFSET_FLAGS] & UDP::VideoFrameDatagram::Redundant)
+			break;
+		d->sentVideoDatagrams.add(layer, frameId_, (UDP::VideoFrameDatagram::dg_data_index_t)i, slice.header, slice.headerSize, slice.payload, slice.payloadSize);
 	}
-	UDP::VideoFrameDatagram::freeData(datagrams, datagramsLength);
-
-	// Cache video.
-	if (d->videoFrameCache.maxCost() > 0)
-		d->videoFrameCache.insert(frameId_, new QByteArray(frame_), frame_.size());
 }
 
 void MediaSocket::sendVideoFrameRecoveryDatagram(quint64 frameId_,
@@ -344,13 +591,225 @@ void MediaSocket::sendVideoFrameRecoveryDatagram(quint64 frameId_,
 		d->networkUsage.bytesWritten += written;
 }
 
+void MediaSocket::requestVideoFrameRecovery(quint64 frameId, ocs::clientid_t fromSenderId)
+{
+	auto now = get_local_timestamp();
+	if (get_local_timestamp_diff(d->lastFrameRequestTimestamp, now) > 1000)
+	{
+		d->lastFrameRequestTimestamp = now;
+		sendVideoFrameRecoveryDatagram(frameId, fromSenderId);
+	}
+}
+
+void MediaSocket::releaseVideoFrames()
+{
+	const auto nowUs = d->transportClock.nsecsElapsed() / 1000;
+	auto holding = false;
+	for (auto it = d->videoJitterBuffers.begin(); it != d->videoJitterBuffers.end(); ++it)
+	{
+		VP8Frame* frame = nullptr;
+		auto dropped = false;
+		while ((frame = it.value()->next(nowUs)) != nullptr)
+		{
+			if (!d->videoDecodingThread->enqueue(frame, it.key()))
+				dropped = true;
+		}
+		// A dropped frame breaks the references of the following ones.
+		if (dropped)
+		{
+			const auto decoder = d->videoFrameDatagramDecoders.value(it.key());
+			if (decoder)
+				requestVideoFrameRecovery(decoder->newestFrameId(), it.key());
+		}
+		holding = holding || !it.value()->isEmpty();
+	}
+
+	if (holding && d->jitterTimerId == -1)
+	{
+		d->jitterTimerId = startTimer(JITTER_BUFFER_INTERVAL, Qt::PreciseTimer);
+	}
+	else if (!holding && d->jitterTimerId != -1)
+	{
+		killTimer(d->jitterTimerId);
+		d->jitterTimerId = -1;
+	}
+}
+
+void MediaSocket::sendVideoFrameNackDatagram(ocs::clientid_t senderId_, quint64 frameId_, int layer_, const std::vector<UDP::VideoFrameDatagram::dg_data_index_t>& indices_)
+{
+	HL_TRACE(HL, QString("Send video frame NACK datagram (sender-id=%1; frame-id=%2; layer=%3; count=%4)")
+			 .arg(senderId_).arg(frameId_).arg(layer_).arg(indices_.size()).toStdString());
+
+	UDP::VideoFrameNackDatagram dg;
+	dg.sender = senderId_;
+	dg.frameId = frameId_;
+	dg.layer = (UDP::VideoFrameNackDatagram::dg_layer_t)layer_;
+	dg.count = (UDP::VideoFrameNackDatagram::dg_index_count_t)qMin(indices_.size(), (size_t)UDP::VideoFrameNackDatagram::MAXINDICES);
+
+	QByteArray datagram;
+	QDataStream out(&datagram, QIODevice::WriteOnly);
+	out.setByteOrder(QDataStream::BigEndian);
+	out << dg.magic;
+	out << dg.type;
+	out << dg.sender;
+	out << dg.frameId;
+	out << dg.layer;
+	out << dg.count;
+	for (auto i = 0; i < dg.count; ++i)
+		out << indices_[i];
+
+	auto written = writeDatagram(datagram, peerAddress(), peerPort());
+	if (written < 0)
+		HL_ERROR(HL, QString("Can not write datagram (error=%1; msg=%2)")
+				 .arg(error()).arg(errorString()).toStdString());
+	else
+		d->networkUsage.bytesWritten += written;
+}
+
+void MediaSocket::sendVideoFrameNacks()
+{
+	const auto now = get_local_timestamp();
+	std::vector<MissingDatagrams> missing;
+	for (auto it = d->videoFrameDatagramDecoders.begin(); it != d->videoFrameDatagramDecoders.end(); ++it)
+	{
+		missing.clear();
+		it.value()->missingDatagrams(now, missing);
+		for (const auto& m : missing)
+			sendVideoFrameNackDatagram(it.key(), m.frame_id, d->videoLayers.value(it.key()), m.indices);
+	}
+}
+
+void MediaSocket::resendVideoDatagrams(const UDP::VideoFrameNackDatagramView& nack)
+{
+	for (size_t i = 0; i < nack.count(); ++i)
+	{
+		const auto dg = d->sentVideoDatagrams.find(nack.layer(), nack.frameId(), nack.index(i));
+		if (!dg)
+		{
+			HL_DEBUG(HL, QString("Requested video datagram is not cached anymore (frame-id=%1; layer=%2; index=%3)")
+					 .arg(nack.frameId()).arg(nack.layer()).arg(nack.index(i)).toStdString());
+			continue;
+		}
+
+		// A retransmission has its own transport sequence number.
+		QByteArray datagram((int)(UDP::TransportDatagramView::HEADER_SIZE + dg->size()), Qt::Uninitialized);
+		writeTransportHeader((UDP::dg_byte_t*)datagram.data(), dg->size());
+		memcpy(datagram.data() + UDP::TransportDatagramView::HEADER_SIZE, dg->data(), dg->size());
+		auto written = writeDatagram(datagram, peerAddress(), peerPort());
+		if (written < 0)
+			HL_ERROR(HL, QString("Can not write datagram (error=%1; msg=%2)")
+					 .arg(error()).arg(errorString()).toStdString());
+		else
+			d->networkUsage.bytesWritten += written;
+	}
+}
+
+void MediaSocket::writeTransportHeader(UDP::dg_byte_t* header, size_t size)
+{
+	const auto sequence = d->nextTransportSequence++;
+	const auto nowUs = d->transportClock.nsecsElapsed() / 1000;
+	const auto sendTime = (UDP::TransportDatagram::dg_time_t)nowUs;
+	header[0] = UDP::Datagram::MAGIC;
+	header[1] = UDP::TransportDatagram::TYPE;
+	header[UDP::TransportDatagramView::OFFSET_SEQUENCE] = (UDP::dg_byte_t)(sequence >> 8);
+	header[UDP::TransportDatagramView::OFFSET_SEQUENCE + 1] = (UDP::dg_byte_t)sequence;
+	header[UDP::TransportDatagramView::OFFSET_SENDTIME] = (UDP::dg_byte_t)(sendTime >> 24);
+	header[UDP::TransportDatagramView::OFFSET_SENDTIME + 1] = (UDP::dg_byte_t)(sendTime >> 16);
+	header[UDP::TransportDatagramView::OFFSET_SENDTIME + 2] = (UDP::dg_byte_t)(sendTime >> 8);
+	header[UDP::TransportDatagramView::OFFSET_SENDTIME + 3] = (UDP::dg_byte_t)sendTime;
+	d->bandwidthEstimator.onSent(sequence, nowUs, UDP::TransportDatagramView::HEADER_SIZE + size);
+}
+
+void MediaSocket::updateVideoBitrate()
+{
+	if (d->videoBitrate <= 0 || !d->videoEncodingThread->isRunning())
+	{
+		return;
+	}
+
+	// The estimate covers all simulcast layers and the parity datagrams.
+	auto estimate = (qint64)d->bandwidthEstimator.targetBitrate() / 1000;
+	if (d->videoFecGroupSize > 0)
+		estimate = estimate * d->videoFecGroupSize / (d->videoFecGroupSize + 1);
+	auto total = 0;
+	for (auto layer = 0; layer < d->videoLayerCount; ++layer)
+		total += VideoEncodingThread::layerBitrate(d->videoBitrate, layer);
+	const auto bitrate = qBound(MIN_VIDEO_BITRATE, (int)(estimate * d->videoBitrate / total), d->videoBitrate);
+
+	// Small changes are not worth a reconfiguration. The target is sent again
+	// on every update, until the encoders confirmed it (see onVideoBitrateApplied()).
+	if (qAbs(bitrate - d->appliedVideoBitrate) * 20 < d->appliedVideoBitrate)
+	{
+		return;
+	}
+	HL_DEBUG(HL, QString("Change video bitrate (bitrate=%1; previous=%2; estimate=%3; state=%4; fraction-lost=%5)")
+			 .arg(bitrate).arg(d->appliedVideoBitrate).arg(d->bandwidthEstimator.targetBitrate())
+			 .arg(d->bandwidthEstimator.state()).arg(d->bandwidthEstimator.fractionLost()).toStdString());
+	d->videoEncodingThread->reconfigure(bitrate);
+}
+
+void MediaSocket::onVideoBitrateApplied(int bitrate)
+{
+	d->appliedVideoBitrate = bitrate;
+}
+
+void MediaSocket::sendVideoReceiverReportDatagram(ocs::clientid_t senderId_, int fractionLost_)
+{
+	HL_TRACE(HL, QString("Send video receiver report datagram (sender-id=%1; fraction-lost=%2)")
+			 .arg(senderId_).arg(fractionLost_).toStdString());
+
+	UDP::VideoReceiverReportDatagram dg;
+	dg.sender = senderId_;
+	dg.fractionLost = (quint8)fractionLost_;
+
+	QByteArray datagram;
+	QDataStream out(&datagram, QIODevice::WriteOnly);
+	out.setByteOrder(QDataStream::BigEndian);
+	out << dg.magic;
+	out << dg.type;
+	out << dg.sender;
+	out << dg.fractionLost;
+
+	auto written = writeDatagram(datagram, peerAddress(), peerPort());
+	if (written < 0)
+		HL_ERROR(HL, QString("Can not write datagram (error=%1; msg=%2)")
+				 .arg(error()).arg(errorString()).toStdString());
+	else
+		d->networkUsage.bytesWritten += written;
+}
+
+void MediaSocket::sendVideoReceiverReports()
+{
+	for (auto it = d->videoFrameDatagramDecoders.begin(); it != d->videoFrameDatagramDecoders.end(); ++it)
+	{
+		const auto fractionLost = it.value()->takeFractionLost();
+		if (fractionLost >= 0)
+			sendVideoReceiverReportDatagram(it.key(), fractionLost);
+	}
+}
+
+void MediaSocket::updateVideoFec()
+{
+	// Rises with the worst receiver immediately, decays slowly.
+	d->videoFecLoss = qMax(d->videoFecReportedLoss, d->videoFecLoss * 3 / 4);
+	d->videoFecReportedLoss = 0;
+
+	const auto groupSize = d->videoFecMode >= 0 ? d->videoFecMode : UDP::VideoFrameFec::groupSizeForLoss(d->videoFecLoss);
+	if (groupSize != d->videoFecGroupSize)
+	{
+		HL_DEBUG(HL, QString("Changed video FEC (group-size=%1; fraction-lost=%2)")
+				 .arg(groupSize).arg(d->videoFecLoss).toStdString());
+		d->videoFecGroupSize = groupSize;
+	}
+}
+
 #if defined(OCS_INCLUDE_AUDIO)
 void MediaSocket::sendAudioFrame(const QByteArray& f, quint64 fid,
-								 ocs::clientid_t sid)
+								 ocs::clientid_t sid, quint8 level)
 {
 	HL_TRACE(HL,
-			 QString("Send audio frame datagram (frame-size=%1; frame-id=%2; sender-id=%3)").arg(
-				 f.size()).arg(fid).arg(sid).toStdString());
+			 QString("Send audio frame datagram (frame-size=%1; frame-id=%2; sender-id=%3; level=%4)").arg(
+				 f.size()).arg(fid).arg(sid).arg(level).toStdString());
 	if (f.isEmpty() || fid == 0)
 	{
 		HL_ERROR(HL,
@@ -359,46 +818,115 @@ void MediaSocket::sendAudioFrame(const QByteArray& f, quint64 fid,
 		return;
 	}
 
-	UDP::AudioFrameDatagram::dg_frame_id_t frameId = fid;
-	UDP::AudioFrameDatagram::dg_sender_t senderId = sid;
-
-	// Split frame into datagrams.
-	UDP::AudioFrameDatagram** datagrams = 0;
-	UDP::AudioFrameDatagram::dg_data_count_t datagramsLength;
-	if (UDP::AudioFrameDatagram::split((UDP::dg_byte_t*)f.data(), f.size(), frameId,
-									   senderId, &datagrams, datagramsLength) != 0)
+	if (d->audioSendBuffers.writer.writeAudioFrame((const UDP::dg_byte_t*)f.constData(), f.size(), fid, sid, level) == 0)
 	{
 		HL_ERROR(HL,
 				 QString("Can not split frame data into multiple parts").toStdString());
 		return;
 	}
+	writeFrameDatagrams(d->audioSendBuffers);
+}
+#endif
+
+void MediaSocket::writeFrameDatagrams(FrameSendBuffers& buffers)
+{
+	const auto& writer = buffers.writer;
+	const auto count = writer.count();
 
-	// Send datagrams.
-	for (auto i = 0; i < datagramsLength; ++i)
+	// The transport headers are written right before sending.
+	const size_t transportHeaderSize = buffers.transport ? UDP::TransportDatagramView::HEADER_SIZE : 0;
+	if (buffers.transport)
 	{
-		const auto& dgvideo = *datagrams[i];
-		QByteArray datagram;
-		QDataStream out(&datagram, QIODevice::WriteOnly);
-		out.setByteOrder(QDataStream::BigEndian);
-		out << dgvideo.magic;
-		out << dgvideo.type;
-		out << dgvideo.sender;
-		out << dgvideo.frameId;
-		out << dgvideo.index;
-		out << dgvideo.count;
-		out << dgvideo.size;
-		out.writeRawData((char*)dgvideo.data, dgvideo.size);
+		if (buffers.transportHeaders.size() < count * transportHeaderSize)
+			buffers.transportHeaders.resize(count * transportHeaderSize);
+		for (size_t i = 0; i < count; ++i)
+		{
+			const auto& slice = writer.slice(i);
+			writeTransportHeader(buffers.transportHeaders.data() + i * transportHeaderSize, slice.headerSize + slice.payloadSize);
+		}
+	}
 
-		auto written = writeDatagram(datagram, peerAddress(), peerPort());
+#ifdef __linux__
+	// Transport header, header and payload of each datagram are sent as
+	// separate iovecs, all datagrams of the frame with a single system call.
+	const auto fd = socketDescriptor();
+	if (fd != -1 && state() == QAbstractSocket::ConnectedState)
+	{
+		if (buffers.messages.size() < count)
+		{
+			buffers.messages.resize(count);
+			buffers.vectors.resize(count * 3);
+		}
+		for (size_t i = 0; i < count; ++i)
+		{
+			const auto& slice = writer.slice(i);
+			auto iov = &buffers.vectors[i * 3];
+			auto iovlen = 0;
+			if (buffers.transport)
+			{
+				iov[iovlen].iov_base = buffers.transportHeaders.data() + i * transportHeaderSize;
+				iov[iovlen].iov_len = transportHeaderSize;
+				++iovlen;
+			}
+			iov[iovlen].iov_base = const_cast<UDP::dg_byte_t*>(slice.header);
+			iov[iovlen].iov_len = slice.headerSize;
+			++iovlen;
+			iov[iovlen].iov_base = const_cast<UDP::dg_byte_t*>(slice.payload);
+			iov[iovlen].iov_len = slice.payloadSize;
+			++iovlen;
+
+			auto& msg = buffers.messages[i];
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_hdr.msg_iov = iov;
+			msg.msg_hdr.msg_iovlen = iovlen;
+		}
+
+		size_t sent = 0;
+		while (sent < count)
+		{
+			const auto n = ::sendmmsg((int)fd, buffers.messages.data() + sent, (unsigned int)(count - sent), 0);
+			if (n < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				// The path MTU dropped below the probed size.
+				if (errno == EMSGSIZE && &buffers == &d->videoSendBuffers && d->videoDatagramSize > UDP::MtuProbeDatagram::DEFAULTDATAGRAMSIZE)
+				{
+					HL_WARN(HL, QString("Datagrams too large for path, falling back to default size (size=%1)").arg(d->videoDatagramSize).toStdString());
+					d->videoDatagramSize = UDP::MtuProbeDatagram::DEFAULTDATAGRAMSIZE;
+				}
+				HL_ERROR(HL, QString("Can not write datagrams (errno=%1; msg=%2; dropped=%3)")
+						 .arg(errno).arg(QString::fromLocal8Bit(strerror(errno))).arg(count - sent).toStdString());
+				break;
+			}
+			for (auto i = 0; i < n; ++i)
+				d->networkUsage.bytesWritten += buffers.messages[sent + i].msg_len;
+			sent += n;
+		}
+		return;
+	}
+#endif
+
+	// Assembles each datagram in a reused buffer.
+	for (size_t i = 0; i < count; ++i)
+	{
+		const auto& slice = writer.slice(i);
+		const auto size = transportHeaderSize + slice.headerSize + slice.payloadSize;
+		if (buffers.buffer.size() < size)
+			buffers.buffer.resize(size);
+		if (buffers.transport)
+			memcpy(buffers.buffer.data(), buffers.transportHeaders.data() + i * transportHeaderSize, transportHeaderSize);
+		memcpy(buffers.buffer.data() + transportHeaderSize, slice.header, slice.headerSize);
+		memcpy(buffers.buffer.data() + transportHeaderSize + slice.headerSize, slice.payload, slice.payloadSize);
+
+		auto written = writeDatagram(buffers.buffer.data(), size, peerAddress(), peerPort());
 		if (written < 0)
-			HL_ERROR(HL, QString("Can not write datagram (error=%1; msg=%2)").arg(
-						 error()).arg(errorString()).toStdString());
+			HL_ERROR(HL, QString("Can not write datagram (error=%1; msg=%2)")
+					 .arg(error()).arg(errorString()).toStdString());
 		else
 			d->networkUsage.bytesWritten += written;
 	}
-	UDP::AudioFrameDatagram::freeData(datagrams, datagramsLength);
 }
-#endif
 
 void MediaSocket::timerEvent(QTimerEvent* ev)
 {
@@ -406,9 +934,34 @@ void MediaSocket::timerEvent(QTimerEvent* ev)
 	{
 		sendAuthTokenDatagram(d->token);
 	}
+	else if (ev->timerId() == d->jitterTimerId)
+	{
+		releaseVideoFrames();
+	}
+	else if (ev->timerId() == d->nackTimerId)
+	{
+		sendVideoFrameNacks();
+	}
 	else if (ev->timerId() == d->keepAliveTimerId)
 	{
 		sendKeepAliveDatagram();
+		sendVideoReceiverReports();
+		updateVideoFec();
+	}
+	else if (ev->timerId() == d->mtuProbeTimerId)
+	{
+		// Each round sends all sizes above the confirmed one,
+		// lost probes are covered by the following rounds.
+		for (auto size : MTU_PROBE_SIZES)
+		{
+			if (size > d->videoDatagramSize)
+				sendMtuProbeDatagram(size);
+		}
+		if (++d->mtuProbeRounds >= MTU_PROBE_ROUNDS || d->videoDatagramSize >= MTU_PROBE_SIZES[0])
+		{
+			killTimer(d->mtuProbeTimerId);
+			d->mtuProbeTimerId = -1;
+		}
 	}
 }
 
@@ -419,12 +972,16 @@ void MediaSocket::onSocketStateChanged(QAbstractSocket::SocketState state)
 	switch (state)
 	{
 		case QAbstractSocket::ConnectedState:
+			d->connected = 1;
+			setReceiveBufferSize(RECEIVE_BUFFER_SIZE);
+			d->receiveBufferDrops = qMax(receiveBufferDrops(), (qint64)0);
 			if (d->authenticationTimerId == -1)
 			{
 				d->authenticationTimerId = startTimer(1000);
 			}
 			break;
 		case QAbstractSocket::UnconnectedState:
+			d->connected = 0;
 			if (d->authenticationTimerId != -1)
 			{
 				killTimer(d->authenticationTimerId);
@@ -435,6 +992,21 @@ void MediaSocket::onSocketStateChanged(QAbstractSocket::SocketState state)
 				killTimer(d->keepAliveTimerId);
 				d->keepAliveTimerId = -1;
 			}
+			if (d->mtuProbeTimerId != -1)
+			{
+				killTimer(d->mtuProbeTimerId);
+				d->mtuProbeTimerId = -1;
+			}
+			if (d->nackTimerId != -1)
+			{
+				killTimer(d->nackTimerId);
+				d->nackTimerId = -1;
+			}
+			if (d->jitterTimerId != -1)
+			{
+				killTimer(d->jitterTimerId);
+				d->jitterTimerId = -1;
+			}
 			break;
 	}
 }
@@ -450,23 +1022,23 @@ void MediaSocket::onReadyRead()
 {
 	while (hasPendingDatagrams())
 	{
-		// Read datagram.
-		QByteArray data;
+		// Read datagram into the receive buffer, the handlers read it with views.
+		const auto pendingSize = pendingDatagramSize();
+		if (pendingSize < 0)
+			continue;
+		if (d->receiveBuffer.size() < pendingSize)
+			d->receiveBuffer.resize((int)pendingSize);
 		QHostAddress senderAddress;
 		quint16 senderPort;
-		data.resize(pendingDatagramSize());
-		auto read = readDatagram(data.data(), data.size(), &senderAddress, &senderPort);
+		auto read = readDatagram(d->receiveBuffer.data(), pendingSize, &senderAddress, &senderPort);
 		if (read <= 0)
 			continue;
 		d->networkUsage.bytesRead += read;
-
-		QDataStream in(data);
-		in.setByteOrder(QDataStream::BigEndian);
+		const auto data = QByteArray::fromRawData(d->receiveBuffer.constData(), (int)read);
 
 		// Check magic.
-		UDP::Datagram datagram;
-		in >> datagram.magic;
-		if (datagram.magic != UDP::Datagram::MAGIC)
+		const UDP::DatagramView datagram(data.constData(), data.size());
+		if (!datagram.isValid())
 		{
 			HL_WARN(HL, QString("Received invalid datagram (size=%1; data=%2)")
 					.arg(data.size()).arg(QString(data)).toStdString());
@@ -474,84 +1046,133 @@ void MediaSocket::onReadyRead()
 		}
 
 		// Handle by type.
-		in >> datagram.type;
-		switch (datagram.type)
+		switch (datagram.type())
 		{
 			// Iconming video frame part from somebody else.
 			case UDP::VideoFrameDatagram::TYPE:
 			{
-				auto dg = new UDP::VideoFrameDatagram();
-				in >> dg->flags;
-				in >> dg->sender;
-				in >> dg->frameId;
-				in >> dg->index;
-				in >> dg->count;
-				in >> dg->size;
-				if (dg->size > 0)
-				{
-					dg->data = new UDP::dg_byte_t[dg->size];
-					in.readRawData((char*)dg->data, dg->size);
-				}
-				else if (dg->size == 0)
+				// The decoder copies the payload, the datagram is not allocated.
+				const UDP::VideoFrameDatagramView dg(data.constData(), data.size());
+				if (!dg.isValid() || dg.payloadSize() == 0)
 				{
-					delete dg;
 					continue;
 				}
 
-				auto senderId = dg->sender;
-				auto frameId = dg->frameId;
+				auto senderId = dg.sender();
+				auto frameId = dg.frameId();
+
+				// The server switched to another simulcast layer of the sender,
+				// which is a different stream with its own frame-ids.
+				// Stay on the current layer until the new one starts with a key frame,
+				// late datagrams of the old layer must not reset the decoder again.
+				const auto layer = dg.layer();
+				const auto currentLayer = d->videoLayers.find(senderId);
+				if (currentLayer == d->videoLayers.end())
+				{
+					d->videoLayers.insert(senderId, layer);
+				}
+				else if (currentLayer.value() != layer)
+				{
+					if (!isVideoKeyFrameStart(dg))
+					{
+						requestVideoFrameRecovery(frameId, senderId);
+						continue;
+					}
+					resetVideoDecoderOfClient(senderId);
+					d->videoLayers.insert(senderId, layer);
+				}
 
 				// UDP Decode.
-				auto decoder = d->videoFrameDatagramDecoders.value(dg->sender);
+				auto decoder = d->videoFrameDatagramDecoders.value(senderId);
 				if (!decoder)
 				{
 					decoder = new VideoFrameUdpDecoder();
-					d->videoFrameDatagramDecoders.insert(dg->sender, decoder);
+					d->videoFrameDatagramDecoders.insert(senderId, decoder);
 				}
 				decoder->add(dg);
 
-				// Check for new decoded frame.
-				auto frame = decoder->next();
-				auto waitForType = decoder->getWaitsForType();
-				if (frame)
+				// Check for new decoded frames, the datagram may complete held back frames.
+				// They wait in the jitter buffer for their playout time.
+				auto jitterBuffer = d->videoJitterBuffers.value(senderId);
+				if (!jitterBuffer)
 				{
-					d->videoDecodingThread->enqueue(frame, senderId);
+					jitterBuffer = new VideoJitterBuffer(d->videoJitterMinDelay, d->videoJitterMaxDelay);
+					d->videoJitterBuffers.insert(senderId, jitterBuffer);
 				}
+				const auto arrivalUs = d->transportClock.nsecsElapsed() / 1000;
+				VP8Frame* frame = nullptr;
+				while ((frame = decoder->next()) != nullptr)
+				{
+					emit videoFrameReceived(frame->time, senderId);
+					jitterBuffer->add(frame, arrivalUs);
+				}
+				releaseVideoFrames();
+				auto waitForType = decoder->getWaitsForType();
 
 				// Handle the case, that the UDP decoder requires some special data.
 				if (waitForType != VP8Frame::NORMAL)
 				{
 					// Request recovery frame (for now only key-frames).
-					auto now = get_local_timestamp();
-					if (get_local_timestamp_diff(d->lastFrameRequestTimestamp, now) > 1000)
-					{
-						d->lastFrameRequestTimestamp = now;
-						sendVideoFrameRecoveryDatagram(frameId, senderId);
-					}
+					requestVideoFrameRecovery(frameId, senderId);
+				}
+				break;
+			}
+
+			// Echo of our own MTU probe, the path carries datagrams of this size in both directions.
+			case UDP::MtuProbeDatagram::TYPE:
+			{
+				const UDP::MtuProbeDatagramView dg(data.constData(), data.size());
+				if (dg.isValid() && dg.probeSize() > d->videoDatagramSize)
+				{
+					d->videoDatagramSize = dg.probeSize();
+					HL_INFO(HL, QString("Using larger video datagrams (size=%1)").arg(d->videoDatagramSize).toStdString());
+					emit videoDatagramSizeConfirmed(d->videoDatagramSize);
+				}
+				break;
+			}
+
+			// Retransmission request for datagrams of our own video.
+			case UDP::VideoFrameNackDatagram::TYPE:
+			{
+				const UDP::VideoFrameNackDatagramView dg(data.constData(), data.size());
+				if (dg.isValid())
+				{
+					resendVideoDatagrams(dg);
+				}
+				break;
+			}
+
+			// Arrival of our own datagrams at the server.
+			case UDP::TransportFeedbackDatagram::TYPE:
+			{
+				const UDP::TransportFeedbackDatagramView dg(data.constData(), data.size());
+				if (dg.isValid())
+				{
+					d->bandwidthEstimator.onFeedback(dg, d->transportClock.nsecsElapsed() / 1000);
+					updateVideoBitrate();
+				}
+				break;
+			}
+
+			// Loss of our own video at one of its receivers.
+			case UDP::VideoReceiverReportDatagram::TYPE:
+			{
+				const UDP::VideoReceiverReportDatagramView dg(data.constData(), data.size());
+				if (dg.isValid())
+				{
+					d->videoFecReportedLoss = qMax(d->videoFecReportedLoss, (int)dg.fractionLost());
 				}
 				break;
 			}
 
 			case UDP::VideoFrameRequestRecoveryDatagram::TYPE:
 			{
-				UDP::VideoFrameRequestRecoveryDatagram dg;
-				in >> dg.sender;
-				in >> dg.frameId;
-				in >> dg.index;
-				d->videoEncodingThread->enqueueRecovery();
-
-				// Note: This is not tested enough.
-				//QByteArray* frameBytes = nullptr;
-				//if (dg.frameId > 0 && d->videoFrameCache.maxCost() &&
-				//		(frameBytes = d->videoFrameCache.object(dg.frameId)) != nullptr)
-				//{
-				//	//TODO "dg.sender" should not be used here!
-				//	sendVideoFrame(*frameBytes, dg.frameId, dg.sender);
-				//}
-				//else
-				//{
-				//	d->videoEncodingThread->enqueueRecovery();
-				//}
+				const UDP::VideoFrameRequestRecoveryDatagramView dg(data.constData(), data.size());
+				// Single datagrams are requested with NACKs (see resendVideoDatagrams()).
+				if (dg.isValid())
+				{
+					d->videoEncodingThread->enqueueRecovery();
+				}
 				break;
 			}
 
@@ -562,7 +1183,11 @@ void MediaSocket::onReadyRead()
 			case UDP::AudioFrameDatagram::TYPE:
 			{
 				// Parse datagram.
+				QDataStream in(data);
+				in.setByteOrder(QDataStream::BigEndian);
+				in.skipRawData(UDP::DatagramView::HEADER_SIZE);
 				auto dg = new UDP::AudioFrameDatagram();
+				in >> dg->level;
 				in >> dg->sender;
 				in >> dg->frameId;
 				in >> dg->index;
@@ -619,13 +1244,37 @@ void MediaSocket::onReadyRead()
 	}
 }
 
-void MediaSocket::onVideoFrameEncoded(QByteArray frame, ocs::clientid_t senderId)
+void MediaSocket::onVideoFrameEncoded(QByteArray frame, ocs::clientid_t senderId, int layer, int temporalCode)
 {
-	static quint64 __nextVideoFrameId = 1;
-	sendVideoFrame(frame, __nextVideoFrameId++, senderId);
+	sendEncodedVideoFrame(frame, senderId, layer, temporalCode);
 }
 
-void MediaSocket::onVideoFrameDecoded(YuvFrameRefPtr frame, ocs::clientid_t senderId)
+void MediaSocket::shutdown()
 {
-	emit newVideoFrame(frame, senderId);
+	if (_bandwidthTimer.isActive())
+		_bandwidthTimer.stop();
+
+	if (d->authenticationTimerId != -1)
+		killTimer(d->authenticationTimerId);
+
+	if (d->keepAliveTimerId != -1)
+		killTimer(d->keepAliveTimerId);
+
+	if (d->mtuProbeTimerId != -1)
+		killTimer(d->mtuProbeTimerId);
+
+	if (d->nackTimerId != -1)
+		killTimer(d->nackTimerId);
+
+	if (d->jitterTimerId != -1)
+		killTimer(d->jitterTimerId);
+
+	d->authenticationTimerId = -1;
+	d->keepAliveTimerId = -1;
+	d->mtuProbeTimerId = -1;
+	d->nackTimerId = -1;
+	d->jitterTimerId = -1;
+
+	close();
+	moveToThread(d->ownerThread);
 }
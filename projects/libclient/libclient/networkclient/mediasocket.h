@@ -5,6 +5,8 @@
 #include <QUdpSocket>
 #include <QTimer>
 
+#include <vector>
+
 #include "libbase/defines.h"
 #include "libmediaprotocol/protocol.h"
 
@@ -14,6 +16,17 @@
 class NetworkUsageEntity;
 
 class MediaSocketPrivate;
+class FrameSendBuffers;
+namespace UDP { class VideoFrameNackDatagramView; }
+
+/*!
+	UDP socket for the media (video, audio) of a conference.
+
+	The socket lives in its own I/O thread with an event loop, which reads
+	and reassembles the received datagrams and sends the encoded frames.
+	Calls from other threads are queued to the I/O thread, the signals
+	are emitted from the I/O thread or the decoding thread (newVideoFrame()).
+*/
 class MediaSocket : public QUdpSocket
 {
 	Q_OBJECT
@@ -21,27 +34,64 @@ class MediaSocket : public QUdpSocket
 	QScopedPointer<MediaSocketPrivate> d;
 
 public:
-	MediaSocket(const QString& token, QObject* parent);
+	/*! The socket can not have a parent, it is moved to the I/O thread.
+	*/
+	explicit MediaSocket(const QString& token);
 	virtual ~MediaSocket();
 
+	/*! Connects to the media port of the server, use it instead of connectToHost().
+	*/
+	Q_INVOKABLE void connectToServer(const QHostAddress& address, quint16 port);
+	bool isConnected() const;
+
 	bool isAuthenticated() const;
-	void setAuthenticated(bool yesno);
+	Q_INVOKABLE void setAuthenticated(bool yesno);
 
-	void initVideoEncoder(int width, int height, int bitrate, int fps);
-	void resetVideoEncoder();
+	/*! \param layers Number of simulcast layers (see VideoEncodingThread::init()).
+		\param temporalLayers Number of temporal layers (see VideoEncodingThread::init()).
+	*/
+	Q_INVOKABLE void initVideoEncoder(int width, int height, int bitrate, int fps, int layers = 1, int temporalLayers = 1);
+	Q_INVOKABLE void resetVideoEncoder();
 	void sendVideoFrame(const QImage& image, ocs::clientid_t senderId);
 
-	void resetVideoDecoderOfClient(ocs::clientid_t senderId);
+	/*! Sends an already encoded and serialized VP8Frame (e.g. pre-encoded synthetic video).
+	*/
+	Q_INVOKABLE void sendEncodedVideoFrame(const QByteArray& frame, ocs::clientid_t senderId, int layer = 0, int temporalCode = 0);
+
+	Q_INVOKABLE void resetVideoDecoderOfClient(ocs::clientid_t senderId);
+
+	/*! Forward error correction of the sent video (see UDP::VideoFrameFec).
+		\param groupSize -1 = Adapts to the loss reported by the receivers (default),
+		                  0 = Disabled, >0 = One parity datagram per "groupSize" datagrams.
+	*/
+	Q_INVOKABLE void setVideoFec(int groupSize);
+
+	/*! Playout delay of the received video (see VideoJitterBuffer).
+		\param minDelay Lower bound in milliseconds.
+		\param maxDelay Upper bound in milliseconds, 0 = Frames are decoded as soon as they are complete.
+	*/
+	Q_INVOKABLE void setVideoJitterDelay(int minDelay, int maxDelay);
+
+	/*! Largest video datagram, which all receivers of the video have confirmed
+		with their MTU probes (see UDP::MtuProbeDatagram). The server sends it
+		with "notify.mediadatagramsize", the own probed size still applies.
+	*/
+	Q_INVOKABLE void setVideoDatagramLimit(int size);
 
 #if defined(OCS_INCLUDE_AUDIO)
 	void sendAudioFrame(const PcmFrameRefPtr& f, ocs::clientid_t senderId);
 #endif
 
 signals:
-	/*! Emits with every new arrived and decoded video frame.
+	/*! Emits with every new arrived and decoded video frame, from the decoding thread.
 	*/
 	void newVideoFrame(YuvFrameRefPtr frame, ocs::clientid_t senderId);
 
+	/*! Emits for every completely received video frame, before it gets decoded.
+		\param frameTime VP8Frame::time as set by the sender.
+	*/
+	void videoFrameReceived(quint64 frameTime, ocs::clientid_t senderId);
+
 #if defined(OCS_INCLUDE_AUDIO)
 	/*!	Emits with every new arrived and decoded audio frame.
 	*/
@@ -52,16 +102,68 @@ signals:
 	*/
 	void networkUsageUpdated(const NetworkUsageEntity& networkUsage);
 
+	/*! Emits for every larger echo of an MTU probe, which has been received.
+		The server may relay datagrams of this size to the client.
+	*/
+	void videoDatagramSizeConfirmed(int size);
+
 protected:
 	void sendKeepAliveDatagram();
 	void sendAuthTokenDatagram(const QString& token);
-	void sendVideoFrame(const QByteArray& frame, quint64 frameId, ocs::clientid_t senderId);
+	void sendMtuProbeDatagram(int size);
+
+	/*! Sets the "don't fragment" bit on all outgoing datagrams.
+		\return false, if it is not supported on this platform.
+	*/
+	bool setDontFragment();
+
+	/*! Enlarges the receive buffer of the kernel, which has to hold all
+		datagrams, which arrive while the I/O thread is busy.
+	*/
+	void setReceiveBufferSize(int size);
+
+	/*! Number of datagrams, which the kernel dropped, because the receive buffer was full.
+		\return -1, if it is not supported on this platform.
+	*/
+	qint64 receiveBufferDrops() const;
+	void sendVideoFrame(const QByteArray& frame, quint64 frameId, ocs::clientid_t senderId, int layer = 0, int temporalCode = 0);
 	void sendVideoFrameRecoveryDatagram(quint64 frameId, ocs::clientid_t fromSenderId);
 
+	/*! Requests a key-frame of the sender, at most once per second. */
+	void requestVideoFrameRecovery(quint64 frameId, ocs::clientid_t fromSenderId);
+	void sendVideoFrameNackDatagram(ocs::clientid_t senderId, quint64 frameId, int layer, const std::vector<UDP::VideoFrameDatagram::dg_data_index_t>& indices);
+	void sendVideoReceiverReportDatagram(ocs::clientid_t senderId, int fractionLost);
+
+	/*! Hands the frames, whose playout time has come, to the decoding thread. */
+	void releaseVideoFrames();
+
+	/*! Requests the missing datagrams of all received video streams. */
+	void sendVideoFrameNacks();
+
+	/*! Resends the requested datagrams from the cache of sent datagrams. */
+	void resendVideoDatagrams(const UDP::VideoFrameNackDatagramView& nack);
+
+	/*! Writes the header of the next transport sequence number and registers
+		the datagram of "size" bytes (without the header) for bandwidth estimation.
+	*/
+	void writeTransportHeader(UDP::dg_byte_t* header, size_t size);
+
+	/*! Adapts the encoder bitrate to the estimated bandwidth. */
+	void updateVideoBitrate();
+
+	/*! Sends the loss of every received video stream to its sender. */
+	void sendVideoReceiverReports();
+
+	/*! Picks the FEC group size for the loss reported by the receivers. */
+	void updateVideoFec();
+
 #if defined(OCS_INCLUDE_AUDIO)
-	void sendAudioFrame(const QByteArray& frame, quint64 frameId, ocs::clientid_t senderId);
+	void sendAudioFrame(const QByteArray& frame, quint64 frameId, ocs::clientid_t senderId, quint8 level);
 #endif
 
+	/*! Sends the datagrams, which have been serialized into "buffers.writer". */
+	void writeFrameDatagrams(FrameSendBuffers& buffers);
+
 	virtual void timerEvent(QTimerEvent* ev);
 
 private slots:
@@ -69,8 +171,13 @@ private slots:
 	void onSocketError(QAbstractSocket::SocketError error);
 	void onReadyRead();
 
-	void onVideoFrameEncoded(QByteArray frame, ocs::clientid_t senderId);
-	void onVideoFrameDecoded(YuvFrameRefPtr frame, ocs::clientid_t senderId);
+	void onVideoFrameEncoded(QByteArray frame, ocs::clientid_t senderId, int layer, int temporalCode);
+	void onVideoBitrateApplied(int bitrate);
+
+	/*! Stops all timers, closes the socket and moves it back to the thread,
+		which created it. Called in the I/O thread before it quits.
+	*/
+	void shutdown();
 
 private:
 	QTimer _bandwidthTimer;
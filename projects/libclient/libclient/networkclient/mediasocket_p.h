@@ -3,9 +3,25 @@
 
 #include "mediasocket.h"
 
+#include <vector>
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QThread>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+#include "libmediaprotocol/datagramwriter.h"
+
 #include "libapp/networkusageentity.h"
 
 #include "udpvideoframedecoder.h"
+#include "videojitterbuffer.h"
+#include "sentdatagramcache.h"
+#include "bandwidthestimator.h"
 #include "videoencodingthread.h"
 #include "videodecodingthread.h"
 
@@ -15,7 +31,26 @@
 #include "audioudpdecoder.h"
 #endif
 
-#include <QCache>
+
+/*!
+	Serialized datagrams of a frame and the I/O vectors to send them.
+	Reused for every frame, sending does not allocate memory per frame.
+*/
+class FrameSendBuffers
+{
+public:
+	UDP::FrameDatagramWriter writer;
+
+	// Sends every datagram with a UDP::TransportDatagram header.
+	bool transport = false;
+	std::vector<UDP::dg_byte_t> transportHeaders;
+#ifdef __linux__
+	std::vector<mmsghdr> messages;
+	std::vector<iovec> vectors;
+#endif
+	std::vector<char> buffer;
+};
+
 
 class MediaSocketPrivate : public QObject
 {
@@ -24,53 +59,131 @@ class MediaSocketPrivate : public QObject
 public:
 	MediaSocketPrivate(MediaSocket* o) :
 		owner(o),
-		authenticated(false),
+		ioThread(new QThread()),
+		ownerThread(QThread::currentThread()),
+		connected(0),
+		authenticated(0),
 		authenticationTimerId(-1),
 		keepAliveTimerId(-1),
+		mtuProbeTimerId(-1),
+		nackTimerId(-1),
+		jitterTimerId(-1),
+		receiveBufferDrops(0),
+		mtuProbeRounds(0),
+		videoDatagramSize(UDP::MtuProbeDatagram::DEFAULTDATAGRAMSIZE),
+		videoDatagramLimit(UDP::MtuProbeDatagram::DEFAULTDATAGRAMSIZE),
 		videoEncodingThread(new VideoEncodingThread(this)),
+		nextVideoFrameIds{ 1, 1, 1, 1 },
 		lastFrameRequestTimestamp(0),
+		videoFecMode(-1),
+		videoFecGroupSize(0),
+		videoFecReportedLoss(0),
+		videoFecLoss(0),
+		videoJitterMinDelay(0),
+		videoJitterMaxDelay(200),
 		videoDecodingThread(new VideoDecodingThread(this)),
-		videoFrameCache(0/*1024 * 32*/),
+		nextTransportSequence(0),
+		videoBitrate(0),
+		videoLayerCount(1),
+		videoTemporalLayers(1),
+		appliedVideoBitrate(0),
 #if defined(OCS_INCLUDE_AUDIO)
 		audioEncodingThread(new AudioEncodingThread(this)),
+		nextAudioFrameId(1),
 		audioDecodingThread(new AudioDecodingThread(this)),
 #endif
 		networkUsage(),
 		networkUsageHelper(networkUsage)
-	{}
+	{
+		videoSendBuffers.transport = true;
+		transportClock.start();
+	}
 
 public:
 	MediaSocket* owner;
 
-	bool authenticated;
+	// Runs the event loop of the socket.
+	QThread* ioThread;
+	QThread* ownerThread;
+
+	// Read from other threads.
+	QAtomicInt connected;
+	QAtomicInt authenticated;
 	QString token;
 	int authenticationTimerId;
 	int keepAliveTimerId;
 
+	// Path MTU discovery (see UDP::MtuProbeDatagram).
+	int mtuProbeTimerId;
+	int mtuProbeRounds;
+	int videoDatagramSize;   ///< Largest datagram size, which has been echoed by the server.
+	int videoDatagramLimit;  ///< Smallest datagram size of all receivers, set by the server.
+
+	// Checks the decoders for missing datagrams (see VideoFrameUdpDecoder::missingDatagrams()).
+	int nackTimerId;
+
+	// Releases the frames of the jitter buffers, runs while they hold frames.
+	int jitterTimerId;
+
+	// Datagrams dropped by the kernel (see MediaSocket::receiveBufferDrops()).
+	qint64 receiveBufferDrops;
+
+	// Reused for every received datagram, the handlers copy what they keep.
+	QByteArray receiveBuffer;
+
 	// VIDEO
 
 	// Encoding
 	VideoEncodingThread* videoEncodingThread;
+	quint64 nextVideoFrameIds[UDP::VideoFrameDatagram::MAXLAYERS];  ///< Every layer is a stream with consecutive frame-ids.
 	unsigned long long lastFrameRequestTimestamp;
 
+	// Forward error correction (see MediaSocket::setVideoFec()).
+	int videoFecMode;
+	int videoFecGroupSize;     ///< Group size in use, 0 = No parity.
+	int videoFecReportedLoss;  ///< Highest loss reported by any receiver since the last update.
+	int videoFecLoss;          ///< Smoothed loss (0-255).
+
 	// Decoding
 	QHash<ocs::clientid_t, VideoFrameUdpDecoder*>
 	videoFrameDatagramDecoders;  ///< Maps client-id to it's decoder.
+	QHash<ocs::clientid_t, int> videoLayers;  ///< Maps client-id to the simulcast layer of it's decoder, switched on key frames only.
+	QHash<ocs::clientid_t, VideoJitterBuffer*> videoJitterBuffers;  ///< Maps client-id to the playout buffer of it's frames.
+	int videoJitterMinDelay;
+	int videoJitterMaxDelay;
 	VideoDecodingThread* videoDecodingThread;
 
-	QCache<UDP::VideoFrameDatagram::dg_frame_id_t, QByteArray>
-	videoFrameCache;
+	// Sent data datagrams of all layers, for retransmissions.
+	SentDatagramCache sentVideoDatagrams;
+
+	// Bandwidth estimation from the transport feedback of the server.
+	QElapsedTimer transportClock;
+	quint16 nextTransportSequence;
+	BandwidthEstimator bandwidthEstimator;
+	int videoBitrate;         ///< Bitrate of layer 0 as configured by initVideoEncoder().
+	int videoLayerCount;
+	int videoTemporalLayers;
+	QSize videoSize;
+	int appliedVideoBitrate;  ///< Bitrate of layer 0, which the encoders confirmed.
 
 #if defined(OCS_INCLUDE_AUDIO)
 	// AUDIO
 	// Encoding
 	AudioEncodingThread* audioEncodingThread;
+	quint64 nextAudioFrameId;
 
 	// Decoding
 	QHash<ocs::clientid_t, AudioUdpDecoder*> audioFrameDatagramDecoders;
 	AudioDecodingThread* audioDecodingThread;
 #endif
 
+	// SENDING
+	// Audio frames are sent from the encoding thread, video and audio have their own buffers.
+	FrameSendBuffers videoSendBuffers;
+#if defined(OCS_INCLUDE_AUDIO)
+	FrameSendBuffers audioSendBuffers;
+#endif
+
 	// STATISTICS
 
 	// Network usage.
@@ -5,6 +5,7 @@
 #include <QImage>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QJsonArray>
 #include <QTcpSocket>
 #include <QTimer>
 #include <QTimerEvent>
@@ -19,9 +20,17 @@
 #include "libapp/ts3video.h"
 
 #include "mediasocket.h"
+#include "videoencodingthread.h"
 
 HUMBLE_LOGGER(HL, "networkclient");
 
+// Simulcast: Maximum number of layers and minimum width of the smallest layer.
+static const int MAX_VIDEO_LAYERS = 3;
+static const int MIN_VIDEO_LAYER_WIDTH = 160;
+
+// Temporal layers, which allow the server to halve the frame rate for slow receivers.
+static const int VIDEO_TEMPORAL_LAYERS = 2;
+
 ///////////////////////////////////////////////////////////////////////
 
 #define REQUEST_PRECHECK                                                                               \
@@ -112,6 +121,8 @@ NetworkClient::NetworkClient(QObject* parent)
 	qRegisterMetaType<YuvFrameRefPtr>("YuvFrameRefPtr");
 	qRegisterMetaType<PcmFrameRefPtr>("PcmFrameRefPtr");
 	qRegisterMetaType<NetworkUsageEntity>("NetworkUsageEntity");
+	qRegisterMetaType<QHostAddress>("QHostAddress");
+	qRegisterMetaType<ocs::clientid_t>("ocs::clientid_t");
 
 	d->corSocket = new QCorConnection(this);
 	connect(d->corSocket, &QCorConnection::stateChanged, this, &NetworkClient::onStateChanged);
@@ -150,7 +161,7 @@ const VirtualServerConfigEntity& NetworkClient::serverConfig() const
 
 bool NetworkClient::isReadyForStreaming() const
 {
-	if (!d->mediaSocket || d->mediaSocket->state() != QAbstractSocket::ConnectedState || !d->mediaSocket->isAuthenticated())
+	if (!d->mediaSocket || !d->mediaSocket->isConnected() || !d->mediaSocket->isAuthenticated())
 		return false;
 	return true;
 }
@@ -288,8 +299,13 @@ QCorReply* NetworkClient::enableVideoStream(int width, int height, int bitrate)
 	d->clientEntity.videoBitrate = bitrate;
 	d->clientModel->updateClient(d->clientEntity);
 
+	// Simulcast layers down to thumbnail size.
+	auto layers = 1;
+	while (layers < MAX_VIDEO_LAYERS && VideoEncodingThread::layerSize(width, height, layers).width() >= MIN_VIDEO_LAYER_WIDTH)
+		++layers;
+
 	if (d->mediaSocket)
-		d->mediaSocket->initVideoEncoder(width, height, bitrate, 15);
+		d->mediaSocket->initVideoEncoder(width, height, bitrate, 15, layers, VIDEO_TEMPORAL_LAYERS);
 
 	QJsonObject params;
 	params["width"] = width;
@@ -297,6 +313,41 @@ QCorReply* NetworkClient::enableVideoStream(int width, int height, int bitrate)
 	params["bitrate"] = bitrate;
 	params["fps"] = 15;
 
+	QJsonArray layersParam;
+	for (auto i = 0; i < layers; ++i)
+	{
+		const auto size = VideoEncodingThread::layerSize(width, height, i);
+		QJsonObject layer;
+		layer["width"] = size.width();
+		layer["height"] = size.height();
+		layer["bitrate"] = VideoEncodingThread::layerBitrate(bitrate, i);
+		layersParam.append(layer);
+	}
+	params["layers"] = layersParam;
+
+	QCorFrame req;
+	req.setData(JsonProtocolHelper::createJsonRequest("clientenablevideo", params));
+	return d->corSocket->sendRequest(req);
+}
+
+QCorReply* NetworkClient::enableEncodedVideoStream(int width, int height, int bitrate, int fps)
+{
+	REQUEST_PRECHECK
+
+	HL_DEBUG(HL, QString("Enable encoded video stream").toStdString());
+
+	d->clientEntity.videoEnabled = true;
+	d->clientEntity.videoWidth = width;
+	d->clientEntity.videoHeight = height;
+	d->clientEntity.videoBitrate = bitrate;
+	d->clientModel->updateClient(d->clientEntity);
+
+	QJsonObject params;
+	params["width"] = width;
+	params["height"] = height;
+	params["bitrate"] = bitrate;
+	params["fps"] = fps;
+
 	QCorFrame req;
 	req.setData(JsonProtocolHelper::createJsonRequest("clientenablevideo", params));
 	return d->corSocket->sendRequest(req);
@@ -347,6 +398,22 @@ QCorReply* NetworkClient::disableRemoteVideoStream(ocs::clientid_t clientId)
 	return d->corSocket->sendRequest(req);
 }
 
+QCorReply* NetworkClient::setRemoteVideoSize(ocs::clientid_t clientId, const QSize& size)
+{
+	REQUEST_PRECHECK
+
+	HL_DEBUG(HL, QString("Set remote video size (client-id=%1; width=%2; height=%3)").arg(clientId).arg(size.width()).arg(size.height()).toStdString());
+
+	QJsonObject params;
+	params["clientid"] = clientId;
+	params["width"] = size.width();
+	params["height"] = size.height();
+
+	QCorFrame req;
+	req.setData(JsonProtocolHelper::createJsonRequest("setremotevideosize", params));
+	return d->corSocket->sendRequest(req);
+}
+
 void NetworkClient::sendVideoFrame(const QImage& image)
 {
 	if (!isReadyForStreaming())
@@ -358,6 +425,30 @@ void NetworkClient::sendVideoFrame(const QImage& image)
 	d->mediaSocket->sendVideoFrame(image, d->clientEntity.id);
 }
 
+void NetworkClient::sendEncodedVideoFrame(const QByteArray& frame)
+{
+	if (!isReadyForStreaming())
+		return;
+	if (!d->clientEntity.videoEnabled)
+		return;
+	d->mediaSocket->sendEncodedVideoFrame(frame, d->clientEntity.id);
+}
+
+void NetworkClient::setVideoFec(int groupSize)
+{
+	d->videoFec = groupSize;
+	if (d->mediaSocket)
+		d->mediaSocket->setVideoFec(groupSize);
+}
+
+void NetworkClient::setVideoJitterDelay(int minDelay, int maxDelay)
+{
+	d->videoJitterMinDelay = minDelay;
+	d->videoJitterMaxDelay = maxDelay;
+	if (d->mediaSocket)
+		d->mediaSocket->setVideoJitterDelay(minDelay, maxDelay);
+}
+
 #if defined(OCS_INCLUDE_AUDIO)
 QCorReply* NetworkClient::enableAudioInputStream()
 {
@@ -442,20 +533,23 @@ void NetworkClient::initMediaSocket()
 {
 	if (d->mediaSocket)
 	{
-		d->mediaSocket->close();
 		delete d->mediaSocket;
 		d->mediaSocket = nullptr;
 	}
 
-	// Connects to server and authenticates with auth-token.
-	d->mediaSocket = new MediaSocket(d->authToken, this);
-	d->mediaSocket->connectToHost(d->corSocket->socket()->peerAddress(), d->corSocket->socket()->peerPort());
+	// Connects to server and authenticates with auth-token (in the I/O thread of the socket).
+	d->mediaSocket = new MediaSocket(d->authToken);
+	d->mediaSocket->connectToServer(d->corSocket->socket()->peerAddress(), d->corSocket->socket()->peerPort());
+	d->mediaSocket->setVideoFec(d->videoFec);
+	d->mediaSocket->setVideoJitterDelay(d->videoJitterMinDelay, d->videoJitterMaxDelay);
 
 	QObject::connect(d->mediaSocket, &MediaSocket::newVideoFrame, d->owner, &NetworkClient::newVideoFrame);
+	QObject::connect(d->mediaSocket, &MediaSocket::videoFrameReceived, d->owner, &NetworkClient::videoFrameReceived);
 #if defined(OCS_INCLUDE_AUDIO)
 	QObject::connect(d->mediaSocket, &MediaSocket::newAudioFrame, d->owner, &NetworkClient::newAudioFrame);
 #endif
 	QObject::connect(d->mediaSocket, &MediaSocket::networkUsageUpdated, d->owner, &NetworkClient::networkUsageUpdated);
+	QObject::connect(d->mediaSocket, &MediaSocket::videoDatagramSizeConfirmed, d->owner, &NetworkClient::sendMediaDatagramSize);
 }
 
 void NetworkClient::sendHeartbeat()
@@ -470,6 +564,21 @@ void NetworkClient::sendHeartbeat()
 	QObject::connect(reply, &QCorReply::finished, reply, &QCorReply::deleteLater);
 }
 
+void NetworkClient::sendMediaDatagramSize(int size)
+{
+	REQUEST_PRECHECK_VOID
+
+	HL_DEBUG(HL, QString("Confirm media datagram size (size=%1)").arg(size).toStdString());
+
+	QJsonObject params;
+	params["size"] = size;
+
+	QCorFrame req;
+	req.setData(JsonProtocolHelper::createJsonRequest("setmediadatagramsize", params));
+	auto reply = d->corSocket->sendRequest(req);
+	QObject::connect(reply, &QCorReply::finished, reply, &QCorReply::deleteLater);
+}
+
 void NetworkClient::onStateChanged(QAbstractSocket::SocketState state)
 {
 	HL_DEBUG(HL, QString("Socket connection state changed (state=%1)").arg(state).toStdString());
@@ -482,7 +591,6 @@ void NetworkClient::onStateChanged(QAbstractSocket::SocketState state)
 		case QAbstractSocket::UnconnectedState:
 			if (d->mediaSocket)
 			{
-				d->mediaSocket->close();
 				delete d->mediaSocket;
 				d->mediaSocket = nullptr;
 			}
@@ -524,6 +632,11 @@ void NetworkClient::onNewIncomingRequest(QCorFrameRefPtr frame)
 		d->mediaSocket->setAuthenticated(true);
 		emit mediaSocketAuthenticated();
 	}
+	else if (action == "notify.mediadatagramsize")
+	{
+		if (d->mediaSocket)
+			d->mediaSocket->setVideoDatagramLimit(parameters["size"].toInt());
+	}
 	else if (action == "notify.clientvideoenabled")
 	{
 		ClientEntity client;
@@ -6,6 +6,7 @@
 #include <QVariant>
 #include <QScopedPointer>
 #include <QAbstractSocket>
+#include <QSize>
 
 #include "libqtcorprotocol/qcorframe.h"
 #include "libqtcorprotocol/qcorreply.h"
@@ -90,6 +91,8 @@ public:
 
 	/*!
 	    Enables/disables sending of video stream to server.
+	    Large videos are sent in multiple resolutions (simulcast layers),
+	    the server forwards the one that fits the receiver best.
 	    Requires an authenticated connection.
 	    \see auth()
 	    \return QCorReply* Ownership goes over to caller who needs to delete it with "deleteLater()".
@@ -97,6 +100,14 @@ public:
 	QCorReply* enableVideoStream(int width, int height, int bitrate);
 	QCorReply* disableVideoStream();
 
+	/*!
+	    Enables sending of an already encoded video stream (single layer, no own encoder),
+	    e.g. for synthetic load.
+	    \see sendEncodedVideoFrame()
+	    \return QCorReply* Ownership goes over to caller who needs to delete it with "deleteLater()".
+	*/
+	QCorReply* enableEncodedVideoStream(int width, int height, int bitrate, int fps);
+
 	/*!
 	    Enables/disables receiving the video of a specific participant.
 	    Requires an authenticated connection.
@@ -106,6 +117,15 @@ public:
 	QCorReply* enableRemoteVideoStream(ocs::clientid_t clientId);
 	QCorReply* disableRemoteVideoStream(ocs::clientid_t clientId);
 
+	/*!
+	    Tells the server in which size the video of a participant is displayed.
+	    The server picks the participant's simulcast layer based on it.
+	    Requires an authenticated connection.
+	    \see auth()
+	    \return QCorReply* Ownership goes over to caller who needs to delete it with "deleteLater()".
+	*/
+	QCorReply* setRemoteVideoSize(ocs::clientid_t clientId, const QSize& size);
+
 	/*!
 	    Sends a single frame to the server, which will then broadcast it to other clients.
 	    Internally encodes the image with VPX codec.
@@ -114,6 +134,24 @@ public:
 	*/
 	void sendVideoFrame(const QImage& image);
 
+	/*!
+	    Sends a single serialized VP8Frame to the server, without encoding.
+	    \see enableEncodedVideoStream()
+	*/
+	void sendEncodedVideoFrame(const QByteArray& frame);
+
+	/*!
+	    Forward error correction of the own video, applies to the current and all later media connections.
+	    \see MediaSocket::setVideoFec()
+	*/
+	void setVideoFec(int groupSize);
+
+	/*!
+	    Playout delay of the received video, applies to the current and all later media connections.
+	    \see MediaSocket::setVideoJitterDelay()
+	*/
+	void setVideoJitterDelay(int minDelay, int maxDelay);
+
 #if defined(OCS_INCLUDE_AUDIO)
 	/*!
 		Enables/disables sending of audio-input data to server (microphone).
@@ -171,6 +209,7 @@ signals:
 	void clientDisconnected(const ClientEntity& client);
 
 	void newVideoFrame(YuvFrameRefPtr frame, ocs::clientid_t senderId);
+	void videoFrameReceived(quint64 frameTime, ocs::clientid_t senderId);
 #if defined(OCS_INCLUDE_AUDIO)
 	void newAudioFrame(PcmFrameRefPtr frame, ocs::clientid_t senderId);
 #endif
@@ -180,6 +219,7 @@ signals:
 
 private slots:
 	void sendHeartbeat();
+	void sendMediaDatagramSize(int size);
 	void onStateChanged(QAbstractSocket::SocketState state);
 	void onError(QAbstractSocket::SocketError error);
 	void onNewIncomingRequest(QCorFrameRefPtr frame);
@@ -36,6 +36,9 @@ public:
 		corSocket(nullptr),
 		mediaSocket(nullptr),
 		goodbye(false),
+		videoFec(-1),
+		videoJitterMinDelay(0),
+		videoJitterMaxDelay(200),
 		isAdmin(false)
 	{}
 	NetworkClientPrivate(const NetworkClientPrivate&);
@@ -53,6 +56,9 @@ public:
 	MediaSocket* mediaSocket;
 	QTimer heartbeatTimer;
 	bool goodbye;
+	int videoFec;
+	int videoJitterMinDelay;
+	int videoJitterMaxDelay;
 
 	// Data about self.
 	ClientEntity clientEntity;
@@ -4,8 +4,8 @@
 #include "opus.h"
 #include "humblelogging/api.h"
 #include <QString>
-#include "libapp/src/pcmframe.h"
-#include "libapp/src/opusframe.h"
+#include "libapp/pcmframe.h"
+#include "libapp/opusframe.h"
 
 HUMBLE_LOGGER(HL, "opus");
 
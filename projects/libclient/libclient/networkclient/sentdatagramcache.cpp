@@ -0,0 +1,39 @@
+#include "sentdatagramcache.h"
+
+#include <cstring>
+
+SentDatagramCache::SentDatagramCache(int capacity) :
+	_slots(capacity > 0 ? capacity : 1),
+	_next(0)
+{
+}
+
+void SentDatagramCache::add(int layer, UDP::VideoFrameDatagram::dg_frame_id_t frameId, UDP::VideoFrameDatagram::dg_data_index_t index,
+							const UDP::dg_byte_t* header, size_t headerSize, const UDP::dg_byte_t* payload, size_t payloadSize)
+{
+	auto& slot = _slots[_next];
+	_next = (_next + 1) % _slots.size();
+
+	slot.used = true;
+	slot.layer = layer;
+	slot.frameId = frameId;
+	slot.index = index;
+	slot.data.resize(headerSize + payloadSize);
+	memcpy(slot.data.data(), header, headerSize);
+	memcpy(slot.data.data() + headerSize, payload, payloadSize);
+}
+
+const std::vector<char>* SentDatagramCache::find(int layer, UDP::VideoFrameDatagram::dg_frame_id_t frameId, UDP::VideoFrameDatagram::dg_data_index_t index) const
+{
+	// Newest first, requests are usually for the last few frames.
+	const auto size = _slots.size();
+	for (size_t i = 1; i <= size; ++i)
+	{
+		const auto& slot = _slots[(_next + size - i) % size];
+		if (!slot.used)
+			break;
+		if (slot.frameId == frameId && slot.index == index && slot.layer == layer)
+			return &slot.data;
+	}
+	return nullptr;
+}
@@ -0,0 +1,42 @@
+#ifndef SENTDATAGRAMCACHE_H
+#define SENTDATAGRAMCACHE_H
+
+#include <vector>
+
+#include "libmediaprotocol/protocol.h"
+
+/*!
+	Ring of the most recently sent video datagrams, to resend single
+	datagrams on request of a receiver (see UDP::VideoFrameNackDatagram).
+
+	The slots keep their buffers, once every slot has been used
+	adding a datagram does not allocate memory anymore.
+*/
+class SentDatagramCache
+{
+public:
+	/*! \param capacity Number of cached datagrams. */
+	explicit SentDatagramCache(int capacity = 1024);
+
+	void add(int layer, UDP::VideoFrameDatagram::dg_frame_id_t frameId, UDP::VideoFrameDatagram::dg_data_index_t index,
+			 const UDP::dg_byte_t* header, size_t headerSize, const UDP::dg_byte_t* payload, size_t payloadSize);
+
+	/*! \return The serialized datagram or nullptr, if it is not cached (anymore). */
+	const std::vector<char>* find(int layer, UDP::VideoFrameDatagram::dg_frame_id_t frameId, UDP::VideoFrameDatagram::dg_data_index_t index) const;
+
+private:
+	class Slot
+	{
+	public:
+		bool used = false;
+		int layer = 0;
+		UDP::VideoFrameDatagram::dg_frame_id_t frameId = 0;
+		UDP::VideoFrameDatagram::dg_data_index_t index = 0;
+		std::vector<char> data;
+	};
+
+	std::vector<Slot> _slots;
+	size_t _next;
+};
+
+#endif
@@ -1,5 +1,11 @@
 #include "udpvideoframedecoder.h"
 
+#include <algorithm>
+#include <cstring>
+
+#include "libmediaprotocol/datagramview.h"
+#include "libmediaprotocol/fec.h"
+
 #include "libapp/vp8frame.h"
 #include "libapp/timeutil.h"
 
@@ -28,13 +34,16 @@ private:
 	bool _reverse;
 };
 
-template <class M>
-void map_remove_last_element(M& map)
-{
-	auto it = map.begin();
-	std::advance(it, map.size() - 1);
-	map.erase(it);
-}
+// Time to wait for reordered datagrams, before they are requested.
+static const unsigned long long NACK_REORDER_WINDOW_MS = 30;
+
+// Time to wait for a retransmission, before it is requested again.
+static const unsigned long long NACK_RETRY_INTERVAL_MS = 80;
+
+static const int NACK_MAX_REQUESTS = 2;
+
+// Time a completed frame is held back, while a previous frame is incomplete.
+static const unsigned long long MAX_HOLD_MS = 200;
 
 ///////////////////////////////////////////////////////////////////////////////
 // VideoFrameUdpDecoder
@@ -42,8 +51,11 @@ void map_remove_last_element(M& map)
 
 VideoFrameUdpDecoder::VideoFrameUdpDecoder() :
 	_last_error(VideoFrameUdpDecoder::NoError),
+	_frame_slots(FRAME_SLOTS),
+	_newest_frame_id(0),
+	_expected_datagrams(0),
+	_received_datagrams(0),
 	_maximum_distinct_frames(16),
-	_frame_buffers(),
 	_complete_frames_queue(),
 	_last_completed_frame_id(0),
 	_wait_for_frame_type(VP8Frame::NORMAL),
@@ -53,7 +65,6 @@ VideoFrameUdpDecoder::VideoFrameUdpDecoder() :
 
 VideoFrameUdpDecoder::~VideoFrameUdpDecoder()
 {
-	checkFrameBuffers(0);
 	checkCompleteFramesQueue(0);
 }
 
@@ -64,56 +75,120 @@ int VideoFrameUdpDecoder::add(UDP::VideoFrameDatagram* dpart)
 		_last_error = VideoFrameUdpDecoder::InvalidParameter;
 		return _last_error;
 	}
+	add(dpart->flags, dpart->frameId, dpart->index, dpart->count, dpart->data, dpart->size);
+	delete dpart;
+	return _last_error;
+}
 
-	// Comment out for (ts3video/#54) - NOT YET TESTED ENOUGH!
-	// Skip datagrams of frames, which has already been completed.
-	if (dpart->frameId <= _last_completed_frame_id && (_last_completed_frame_id - dpart->frameId) < 256)
+int VideoFrameUdpDecoder::add(const UDP::VideoFrameDatagramView& dg)
+{
+	return add(dg.flags(), dg.frameId(), dg.index(), dg.count(), dg.payload(), dg.payloadSize());
+}
+
+int VideoFrameUdpDecoder::add(UDP::VideoFrameDatagram::dg_flags_t flags, unsigned long long frame_id, UDP::VideoFrameDatagram::dg_data_index_t index,
+							  UDP::VideoFrameDatagram::dg_data_count_t count, const UDP::dg_byte_t* data, UDP::dg_size_t size)
+{
+	if (count == 0 || size == 0 || !data)
 	{
-		delete dpart;
-		dpart = nullptr;
-		_last_error = VideoFrameUdpDecoder::AlreadyProcessed;
+		_last_error = VideoFrameUdpDecoder::InvalidParameter;
 		return _last_error;
 	}
 
-	// Get existing frame buffer or create one.
-	auto found_i = _frame_buffers.find(dpart->frameId);
-	if (found_i == _frame_buffers.end())
+	// Get the slot of the frame, a later frame may have taken it over.
+	// Frames which have already passed next() are dropped there.
+	auto slot = acquireSlot(frame_id, flags, count);
+	if (!slot || slot->completed)
+	{
+		_last_error = VideoFrameUdpDecoder::AlreadyProcessed;
+		return _last_error;
+	}
+	if (slot->count != count)
 	{
-		_frame_buffers[dpart->frameId] = new DGPtrListMapValue();
-		found_i = _frame_buffers.find(dpart->frameId);
-		(*found_i).second->datagrams = DGPtrList(dpart->count);
-		(*found_i).second->first_received_datagram_time = get_local_timestamp();
+		_last_error = VideoFrameUdpDecoder::InvalidParameter;
+		return _last_error;
 	}
-	auto& buffer = (*found_i).second->datagrams;
 
-	// Due to FEC (forward error correction) or recovery,
-	// it is possible that the same datagram occurs multiple times.
-	if (buffer[dpart->index] != nullptr)
+	if (flags & UDP::VideoFrameDatagram::Redundant)
 	{
-		delete dpart;
-		dpart = nullptr;
-		_last_error = VideoFrameUdpDecoder::AlreadyProcessed;
-		return _last_error;
+		// Parity datagram, the index is the number of its group.
+		const unsigned int group = index;
+		const unsigned int group_size = size > UDP::VideoFrameFec::FEC_HEADER_SIZE ? data[UDP::VideoFrameFec::OFFSET_GROUPSIZE] : 0;
+		if (group_size == 0 || group * group_size >= count)
+		{
+			_last_error = VideoFrameUdpDecoder::InvalidParameter;
+			return _last_error;
+		}
+		if (slot->parity.size() <= group)
+			slot->parity.resize(group + 1);
+		slot->parity_groups = std::max(slot->parity_groups, group + 1);
+		if (!slot->parity[group].empty())
+		{
+			_last_error = VideoFrameUdpDecoder::AlreadyProcessed;
+			return _last_error;
+		}
+		slot->parity[group].assign(data, data + size);
+
+		// The parity is as large as the datagrams of its group, except for the last one.
+		if (slot->stride == 0 && group * group_size + 1 < count)
+			setStride(*slot, size - UDP::VideoFrameFec::FEC_HEADER_SIZE);
+		recover(*slot, group);
 	}
+	else
+	{
+		if (index >= count)
+		{
+			_last_error = VideoFrameUdpDecoder::InvalidParameter;
+			return _last_error;
+		}
+
+		// Due to FEC (forward error correction) or recovery,
+		// it is possible that the same datagram occurs multiple times.
+		if (slot->sizes[index] != 0)
+		{
+			_last_error = VideoFrameUdpDecoder::AlreadyProcessed;
+			return _last_error;
+		}
 
-	// Add datagram to buffer.
-	buffer[dpart->index] = dpart;
+		// Add datagram to buffer.
+		if (!storeData(*slot, index, data, size))
+		{
+			_last_error = VideoFrameUdpDecoder::InvalidParameter;
+			return _last_error;
+		}
+		++slot->received_datagrams;
+		slot->last_received_datagram_time = get_local_timestamp();
+		slot->highest_index = std::max(slot->highest_index, (int)index);
+
+		// The parity datagram of the group may have arrived before.
+		for (unsigned int group = 0; group < slot->parity_groups; ++group)
+		{
+			const auto& parity = slot->parity[group];
+			if (!parity.empty())
+			{
+				recover(*slot, index / parity[UDP::VideoFrameFec::OFFSET_GROUPSIZE]);
+				break;
+			}
+		}
+	}
 
 	// Do nothing more as long as the buffer is not complete.
-	if (!isComplete(buffer))
+	if (slot->present < slot->count)
 	{
-		checkFrameBuffers(_maximum_distinct_frames);
 		_last_error = VideoFrameUdpDecoder::NoError;
 		return _last_error;
 	}
 
-	// At this point the "buffer" is complete and contains an entire video-frame.
+	// At this point the slot is complete and contains an entire video-frame.
 	// Create VideoFrame object from buffer.
-	auto frame = createFrame(buffer);
+	slot->completed = true;
+	auto frame = createFrame(*slot);
+	if (!frame)
+	{
+		_last_error = VideoFrameUdpDecoder::InvalidParameter;
+		return _last_error;
+	}
 	_complete_frames_queue[frame->time] = frame;
-
-	//removeFromFrameBuffer(dpart->timestamp);
-	checkFrameBuffers(_maximum_distinct_frames);
+	_complete_frames_distance[frame->time] = UDP::VideoFrameDatagram::temporalDistance(slot->flags);
 	checkCompleteFramesQueue(_maximum_distinct_frames);
 
 	_last_error = VideoFrameUdpDecoder::NoError;
@@ -134,6 +209,14 @@ VP8Frame* VideoFrameUdpDecoder::next()
 
 	auto frame_id = (*i_begin).first;
 	auto frame    = (*i_begin).second;
+	auto distance = 1;
+
+	auto i_distance = _complete_frames_distance.find(frame_id);
+	if (i_distance != _complete_frames_distance.end())
+	{
+		distance = (*i_distance).second;
+		_complete_frames_distance.erase(i_distance);
+	}
 
 	if (_received_key_frame_count == 0 && frame->type != VP8Frame::KEY)
 	{
@@ -175,9 +258,15 @@ VP8Frame* VideoFrameUdpDecoder::next()
 			return nullptr;
 		}
 	}
-	else if (frame_id != (_last_completed_frame_id + 1))
+	else if (frame_id > _last_completed_frame_id + distance && waitsForFrame(frame_id))
+	{
+		// A previous frame may still be completed, keep this one in the queue.
+		return nullptr;
+	}
+	else if (frame_id > _last_completed_frame_id + distance || frame_id <= _last_completed_frame_id)
 	{
 		// The next frame in queue is not the correct next frame.
+		// Missing frames of higher temporal layers are not referenced by it.
 		_wait_for_frame_type = VP8Frame::KEY;
 		_complete_frames_queue.erase(i_begin);
 		_last_completed_frame_id = frame_id;
@@ -198,77 +287,253 @@ int VideoFrameUdpDecoder::getWaitsForType() const
 	return _wait_for_frame_type;
 }
 
-bool VideoFrameUdpDecoder::isComplete(const DGPtrList& buffer)
+int VideoFrameUdpDecoder::takeFractionLost()
 {
-	auto i_end = buffer.end();
-	for (auto i = buffer.begin(); i != i_end; ++i)
+	if (_expected_datagrams == 0)
 	{
-		if (*i == nullptr)
-			return false;
+		return -1;
 	}
-	return true;
+	const auto lost = _expected_datagrams > _received_datagrams ? _expected_datagrams - _received_datagrams : 0;
+	const auto fraction = (int)((lost * 255) / _expected_datagrams);
+	_expected_datagrams = 0;
+	_received_datagrams = 0;
+	return fraction;
 }
 
-VP8Frame* VideoFrameUdpDecoder::createFrame(const DGPtrList& buffer) const
+void VideoFrameUdpDecoder::missingDatagrams(unsigned long long now, std::vector<MissingDatagrams>& missing)
 {
-	QByteArray data;
-	for (auto i = buffer.begin(), i_end = buffer.end(); i != i_end; ++i)
+	const auto first_frame_id = _newest_frame_id >= FRAME_SLOTS ? _newest_frame_id - FRAME_SLOTS + 1 : 0;
+	for (auto frame_id = first_frame_id; frame_id <= _newest_frame_id; ++frame_id)
 	{
-		auto dgvideo = *i;
-		data.append(QByteArray((const char*)dgvideo->data, dgvideo->size));
+		auto& slot = _frame_slots[frame_id % FRAME_SLOTS];
+		if (!slot.used || slot.frame_id != frame_id)
+			continue;
+		if (slot.completed || slot.nack_count >= NACK_MAX_REQUESTS || slot.last_received_datagram_time == 0)
+			continue;
+		if (frame_id <= _last_completed_frame_id && (_last_completed_frame_id - frame_id) < 256)
+			continue;
+		if (now < slot.last_received_datagram_time + NACK_REORDER_WINDOW_MS)
+			continue;
+		if (slot.nack_count > 0 && now < slot.nack_time + NACK_RETRY_INTERVAL_MS)
+			continue;
+
+		// Missing datagrams at the end of the newest frame can not be
+		// distinguished from datagrams, which are still on their way.
+		const size_t end = frame_id < _newest_frame_id ? slot.count : (size_t)(slot.highest_index + 1);
+
+		MissingDatagrams m;
+		m.frame_id = frame_id;
+		for (size_t index = 0; index < end && m.indices.size() < UDP::VideoFrameNackDatagram::MAXINDICES; ++index)
+		{
+			if (slot.sizes[index] == 0)
+				m.indices.push_back((UDP::VideoFrameDatagram::dg_data_index_t)index);
+		}
+		if (m.indices.empty())
+			continue;
+
+		slot.nack_time = now;
+		++slot.nack_count;
+		missing.push_back(m);
 	}
+}
 
-	auto frame = new VP8Frame();
-	QDataStream in(data);
-	in >> *frame;
-	return frame;
+bool VideoFrameUdpDecoder::waitsForFrame(unsigned long long frame_id) const
+{
+	const auto now = get_local_timestamp();
+	auto id = _last_completed_frame_id + 1;
+	if (_newest_frame_id >= FRAME_SLOTS && id < _newest_frame_id - FRAME_SLOTS + 1)
+		id = _newest_frame_id - FRAME_SLOTS + 1;
+	for (; id < frame_id && id <= _newest_frame_id; ++id)
+	{
+		const auto& slot = _frame_slots[id % FRAME_SLOTS];
+		if (slot.used && slot.frame_id == id && !slot.completed && now < slot.first_received_datagram_time + MAX_HOLD_MS)
+			return true;
+	}
+	return false;
 }
 
-void VideoFrameUdpDecoder::checkFrameBuffers(unsigned int max_size)
+FrameSlot* VideoFrameUdpDecoder::acquireSlot(unsigned long long frame_id, UDP::VideoFrameDatagram::dg_flags_t flags, UDP::VideoFrameDatagram::dg_data_count_t count)
 {
-	// Check number of buffers, it may not be greater than "_maximum_distinct_frames".
-	// Delete buffers from map until the maximum number of buffers has been reached.
-	while (_frame_buffers.size() > max_size)
+	auto& slot = _frame_slots[frame_id % FRAME_SLOTS];
+	if (slot.used)
 	{
-		auto val = (*_frame_buffers.begin()).second;
-		auto& fb = (*_frame_buffers.begin()).second->datagrams;
-		while (!fb.empty())
+		if (slot.frame_id == frame_id)
+			return &slot;
+		if (slot.frame_id > frame_id)
+			return nullptr;
+		releaseSlot(slot);
+	}
+
+	slot.used = true;
+	slot.frame_id = frame_id;
+	slot.flags = flags & ~UDP::VideoFrameDatagram::Redundant;
+	slot.count = count;
+	if (!slot.payload.isDetached())
+		slot.payload = QByteArray();  // Still used by a frame.
+	slot.tail.clear();
+	slot.stride = 0;
+	slot.sizes.assign(count, 0);
+	slot.present = 0;
+	for (unsigned int group = 0; group < slot.parity_groups; ++group)
+		slot.parity[group].clear();
+	slot.parity_groups = 0;
+	slot.first_received_datagram_time = get_local_timestamp();
+	slot.received_datagrams = 0;
+	slot.completed = false;
+	slot.last_received_datagram_time = 0;
+	slot.highest_index = -1;
+	slot.nack_time = 0;
+	slot.nack_count = 0;
+	_newest_frame_id = std::max(_newest_frame_id, frame_id);
+	return &slot;
+}
+
+void VideoFrameUdpDecoder::releaseSlot(FrameSlot& slot)
+{
+	if (!slot.used)
+	{
+		return;
+	}
+	_expected_datagrams += slot.count;
+	_received_datagrams += slot.received_datagrams;
+	slot.used = false;
+}
+
+bool VideoFrameUdpDecoder::storeData(FrameSlot& slot, unsigned int index, const UDP::dg_byte_t* data, UDP::dg_size_t size)
+{
+	const auto last = index + 1 == slot.count;
+	if (!last)
+	{
+		if (slot.stride == 0)
+			setStride(slot, size);
+		else if (size != slot.stride)
+			return false;
+	}
+	else if (slot.stride != 0 && size > slot.stride)
+	{
+		return false;
+	}
+
+	if (last && index > 0 && slot.stride == 0)
+	{
+		slot.tail.assign(data, data + size);
+	}
+	else
+	{
+		const auto offset = index * slot.stride;
+		if ((size_t)slot.payload.size() < offset + size)
+			slot.payload.resize((int)(offset + size));
+		memcpy(slot.payload.data() + offset, data, size);
+	}
+	slot.sizes[index] = size;
+	++slot.present;
+	return true;
+}
+
+void VideoFrameUdpDecoder::setStride(FrameSlot& slot, size_t stride)
+{
+	slot.stride = stride;
+	if ((size_t)slot.payload.size() < slot.count * stride)
+		slot.payload.resize((int)(slot.count * stride));
+
+	// Move the last datagram to its place, it can not be larger than the others.
+	if (!slot.tail.empty())
+	{
+		const auto last = slot.count - 1;
+		if (slot.tail.size() <= stride)
 		{
-			auto dg = fb.back();
-			if (dg)
-				delete dg;
-			fb.pop_back();
+			memcpy(slot.payload.data() + last * stride, slot.tail.data(), slot.tail.size());
 		}
-		delete val;
-		_frame_buffers.erase(_frame_buffers.begin());
+		else
+		{
+			slot.sizes[last] = 0;
+			--slot.present;
+		}
+		slot.tail.clear();
 	}
 }
 
-void VideoFrameUdpDecoder::checkCompleteFramesQueue(unsigned int max_size)
+const UDP::dg_byte_t* VideoFrameUdpDecoder::dataAt(const FrameSlot& slot, unsigned int index) const
 {
-	while (_complete_frames_queue.size() > max_size)
+	if (index + 1 == slot.count && index > 0 && slot.stride == 0)
+		return slot.tail.data();
+	return (const UDP::dg_byte_t*)slot.payload.constData() + index * slot.stride;
+}
+
+bool VideoFrameUdpDecoder::recover(FrameSlot& slot, unsigned int group)
+{
+	if (group >= slot.parity_groups || slot.parity[group].empty())
 	{
-		auto video_frame = (*_complete_frames_queue.begin()).second;
-		delete video_frame;
-		_complete_frames_queue.erase(_complete_frames_queue.begin());
+		return false;
+	}
+	const auto& parity = slot.parity[group];
+	if (parity.size() < UDP::VideoFrameFec::FEC_HEADER_SIZE)
+	{
+		return false;
+	}
+	const unsigned int group_size = parity[UDP::VideoFrameFec::OFFSET_GROUPSIZE];
+	const size_t first = group * group_size;
+	if (group_size == 0 || first >= slot.count)
+	{
+		return false;
+	}
+	const auto last = std::min<size_t>(first + group_size, slot.count);
+
+	// A single datagram of the group may be missing.
+	size_t missing = slot.count;
+	for (auto i = first; i < last; ++i)
+	{
+		if (slot.sizes[i] != 0)
+			continue;
+		if (missing != slot.count)
+			return false;
+		missing = i;
+	}
+	if (missing == slot.count)
+	{
+		return false;
+	}
+
+	// XOR of the parity with all other datagrams of the group.
+	const size_t parity_size = parity.size() - UDP::VideoFrameFec::FEC_HEADER_SIZE;
+	auto size = (UDP::dg_size_t)((parity[UDP::VideoFrameFec::OFFSET_SIZE] << 8) | parity[UDP::VideoFrameFec::OFFSET_SIZE + 1]);
+	_recover_buffer.assign(parity.begin() + UDP::VideoFrameFec::OFFSET_DATA, parity.end());
+	for (auto i = first; i < last; ++i)
+	{
+		if (i == missing)
+			continue;
+		if (slot.sizes[i] > parity_size)
+			return false;
+		size ^= slot.sizes[i];
+		UDP::VideoFrameFec::xorBytes(_recover_buffer.data(), dataAt(slot, (unsigned int)i), slot.sizes[i]);
 	}
+	if (size == 0 || size > parity_size)
+	{
+		return false;
+	}
+	return storeData(slot, (unsigned int)missing, _recover_buffer.data(), size);
 }
 
-void VideoFrameUdpDecoder::removeFromFrameBuffer(unsigned long long ts)
+VP8Frame* VideoFrameUdpDecoder::createFrame(const FrameSlot& slot) const
 {
-	auto found_i = _frame_buffers.find(ts);
-	if (found_i == _frame_buffers.end())
+	// The payload of all datagrams is already in order, the frame refers to it.
+	const auto size = (slot.count - 1) * slot.stride + slot.sizes[slot.count - 1];
+	auto frame = new VP8Frame();
+	if (!VP8Frame::fromSerialized(slot.payload, (int)size, *frame))
 	{
-		return;
+		delete frame;
+		return nullptr;
 	}
-	auto& fb = found_i->second->datagrams;
-	while (!fb.empty())
+	return frame;
+}
+
+void VideoFrameUdpDecoder::checkCompleteFramesQueue(unsigned int max_size)
+{
+	while (_complete_frames_queue.size() > max_size)
 	{
-		auto dg = fb.back();
-		if (dg)
-			delete dg;
-		fb.pop_back();
+		auto video_frame = (*_complete_frames_queue.begin()).second;
+		delete video_frame;
+		_complete_frames_distance.erase((*_complete_frames_queue.begin()).first);
+		_complete_frames_queue.erase(_complete_frames_queue.begin());
 	}
-	delete found_i->second;
-	_frame_buffers.erase(found_i);
-}
\ No newline at end of file
+}
@@ -10,16 +10,64 @@
 
 class VP8Frame;
 
-typedef std::vector<UDP::VideoFrameDatagram*> DGPtrList;
-typedef std::map<unsigned long long, struct DGPtrListMapValue*> DGPtrListMap;
+namespace UDP { class VideoFrameDatagramView; }
 
 
-struct DGPtrListMapValue
+/*!
+	Reassembly slot of a frame (see VideoFrameUdpDecoder).
+	The buffers keep their capacity, when the slot is reused for a later frame.
+*/
+struct FrameSlot
+{
+	bool used = false;
+	unsigned long long frame_id = 0;
+	UDP::VideoFrameDatagram::dg_flags_t flags = 0;
+	UDP::VideoFrameDatagram::dg_data_count_t count = 0;
+
+	// Payload of the data datagrams, each at "index * stride". All datagrams
+	// of a frame but the last one have the same size (see UDP::FrameDatagramWriter).
+	// The last one waits in "tail", as long as the stride is unknown.
+	// The completed VP8Frame shares the payload, the slot only reuses it
+	// after the frame has been released.
+	QByteArray payload;
+	std::vector<UDP::dg_byte_t> tail;
+	size_t stride = 0;
+
+	// Payload size by index (0 = Missing) and the number of datagrams,
+	// which have been received or rebuilt from parity.
+	std::vector<UDP::dg_size_t> sizes;
+	unsigned int present = 0;
+
+	// Parity datagrams by group (empty = Missing, see UDP::VideoFrameFec).
+	std::vector<std::vector<UDP::dg_byte_t> > parity;
+	unsigned int parity_groups = 0;
+
+	// Timestamp when the the first datagram has been added.
+	unsigned long long first_received_datagram_time = 0;
+
+	// Number of data datagrams, which have been received (not rebuilt from parity).
+	unsigned int received_datagrams = 0;
+
+	// The frame has been created from the datagrams.
+	bool completed = false;
+
+	// Timestamp of the latest data datagram and the highest index received so far.
+	unsigned long long last_received_datagram_time = 0;
+	int highest_index = -1;
+
+	// Retransmission requests for missing datagrams (see missingDatagrams()).
+	unsigned long long nack_time = 0;
+	int nack_count = 0;
+};
+
+
+/*!
+	Missing data datagrams of a frame.
+*/
+struct MissingDatagrams
 {
-	// Timestamp when the the first datagram in <em>datagrams</em>
-	// has been added.
-	unsigned long long first_received_datagram_time;
-	DGPtrList datagrams;
+	unsigned long long frame_id;
+	std::vector<UDP::VideoFrameDatagram::dg_data_index_t> indices;
 };
 
 
@@ -40,35 +88,40 @@ public:
 	};
 
 	/*!
-		Initialzes the decoder with values for decoding.
-
-		\param[in,optional] maximum_distinct_frames
-		It defines the number of how many distinct frames should be kept in the
-		internal buffer for the calculation of the next frame. It makes it possible
-		that a video frame with higher id can be added to before another one but the
-		lower id returns before the higher id.
+		Initialzes the decoder with a ring of <em>FRAME_SLOTS</em> frame slots.
+		Datagrams of the frames within the ring can be added in any order,
+		the frames are still returned by next() in the order of their ids.
 	*/
 	VideoFrameUdpDecoder();
 	~VideoFrameUdpDecoder();
 
 	/*!
-		Adds another datagram to the internal buffer <em>_frame_buffers</em> of datagrams.
-		As soon as all parts available to create a <em>VideoFrame</em> object it is
-		will be removed from the <em>_frame_buffers</em> and is moved to the
-		<em>_finished_frames_queue</em>.
+		Copies the payload of another datagram into the slot of its frame
+		<em>_frame_slots[frameId % FRAME_SLOTS]</em>. As soon as all datagrams
+		of the frame are present (received or rebuilt from parity), the
+		<em>VP8Frame</em> is created from the slot and waits for next().
+
+		A slot is reused by a later frame, an incomplete frame which still
+		occupies it is dropped. Datagrams of frames older than the one in
+		their slot are rejected.
 
 		\param[in] dpart
 		The datagram which should be added to the internal buffer. The decoder
-		takes complete ownership of the datagram. It's also possible that it will
-		be deleted after calling this function.
+		takes complete ownership of the datagram and deletes it.
 
 		\return NO_ERROR on success, otherwise ERROR_*.
 	*/
 	int add(UDP::VideoFrameDatagram* dpart);
 
 	/*!
-		Trys to get the next completed <em>VP8Frame</em> object from internal
-		<em>_complete_frames_queue</em> queue.
+		Same as above, without an allocated datagram.
+		\pre-condition dg.isValid()
+	*/
+	int add(const UDP::VideoFrameDatagramView& dg);
+
+	/*!
+		Trys to get the next completed <em>VP8Frame</em> object. A completed frame
+		is held back, while an earlier frame in the slots may still be completed.
 
 		\note The decoder releases the ownership of the object to the caller.
 
@@ -77,51 +130,107 @@ public:
 	VP8Frame* next();
 	int getWaitsForType() const;
 
+	/*! Highest frame-id, of which a datagram has been received. */
+	unsigned long long newestFrameId() const { return _newest_frame_id; }
+
+	/*!
+		Fraction of lost data datagrams (0 = None, 255 = All) of the frames,
+		which have left the buffer since the last call. Datagrams which have
+		been rebuilt from parity count as lost.
+
+		\return -1, if no frame has left the buffer.
+	*/
+	int takeFractionLost();
+
+	/*!
+		Collects the missing data datagrams of incomplete frames, which did not
+		arrive within the reorder window, to request a retransmission (NACK).
+		Every frame is reported up to twice, the second time not before the
+		retransmission interval.
+
+		\param[in] now Current time, see get_local_timestamp().
+		\param[out] missing Frames with missing datagrams.
+	*/
+	void missingDatagrams(unsigned long long now, std::vector<MissingDatagrams>& missing);
+
 protected:
+	int add(UDP::VideoFrameDatagram::dg_flags_t flags, unsigned long long frame_id, UDP::VideoFrameDatagram::dg_data_index_t index,
+			UDP::VideoFrameDatagram::dg_data_count_t count, const UDP::dg_byte_t* data, UDP::dg_size_t size);
+
 	/*!
-		Checks whether the given frame buffer is complete and contains all data,
-		which is required to create a <em>VideoFrame</em> object from it.
+		Prepares the slot of "frame_id" and drops the frame, which occupied it.
+		\return nullptr, if the slot is occupied by a later frame.
+	*/
+	FrameSlot* acquireSlot(unsigned long long frame_id, UDP::VideoFrameDatagram::dg_flags_t flags, UDP::VideoFrameDatagram::dg_data_count_t count);
+	void releaseSlot(FrameSlot& slot);
 
-		\param[in] buffer
-		Container with datagrams.
+	/*!
+		Copies the payload of a data datagram into the slot.
+		\return false, if the size does not match the other datagrams.
+	*/
+	bool storeData(FrameSlot& slot, unsigned int index, const UDP::dg_byte_t* data, UDP::dg_size_t size);
 
-		\return true/false
+	/*!
+		Sets the common size of all datagrams but the last one and moves the
+		last one from the tail to its place.
 	*/
-	bool isComplete(const DGPtrList& buffer);
+	void setStride(FrameSlot& slot, size_t stride);
 
 	/*!
-		Creates a <em>VP8Frame</em> object from completed buffer.
+		Payload of a present data datagram.
+	*/
+	const UDP::dg_byte_t* dataAt(const FrameSlot& slot, unsigned int index) const;
 
-		\pre-condition isComplete(buffer)
+	/*!
+		Rebuilds the missing datagram of a group from its parity datagram,
+		if it is the only one missing in the group.
 
-		\param[in] buffer
-		The buffer which contains all required parts.
+		\return true, if a datagram has been rebuilt.
+	*/
+	bool recover(FrameSlot& slot, unsigned int group);
 
-		\return A new VP8Frame object.
+	/*!
+		Checks whether an incomplete frame between the last completed frame
+		and "frame_id" may still be completed by a retransmission or parity.
 	*/
-	VP8Frame* createFrame(const DGPtrList& buffer) const;
+	bool waitsForFrame(unsigned long long frame_id) const;
 
 	/*!
-		Checks whether the decoder has too many frame buffers and deletes the
-		oldest buffers as long as the number of buffers is greater than
-		<em>_maximum_distinct_frames</em>.
+		Creates a <em>VP8Frame</em> object from a completed slot,
+		its data refers to the payload of the slot.
+
+		\pre-condition slot.present == slot.count
+
+		\return A new VP8Frame object or NULL, if the payload is not a VP8Frame.
 	*/
-	void checkFrameBuffers(unsigned int max_size);
+	VP8Frame* createFrame(const FrameSlot& slot) const;
 
 	void checkCompleteFramesQueue(unsigned int max_size);
 
-	void removeFromFrameBuffer(unsigned long long ts);
-
 private:
 	// Error handling.
 	unsigned int _last_error;
 
-	// Frame buffers.
-	unsigned int _maximum_distinct_frames;
-	DGPtrListMap _frame_buffers;
+	// Frame buffers, indexed by "frame_id % FRAME_SLOTS".
+	static const unsigned int FRAME_SLOTS = 32;
+	std::vector<FrameSlot> _frame_slots;
+	unsigned long long _newest_frame_id;
 
-	// Queue of completely received VP8Frames, sorted by it's ID/Timstamp.
+	// Rebuilt payload of recover().
+	std::vector<UDP::dg_byte_t> _recover_buffer;
+
+	// Data datagrams of the frames, which have left the buffer (see takeFractionLost()).
+	unsigned long long _expected_datagrams;
+	unsigned long long _received_datagrams;
+
+	// Completed VP8Frames, which wait for next(), sorted by it's ID/Timstamp.
+	// The oldest ones are dropped beyond "_maximum_distinct_frames".
+	unsigned int _maximum_distinct_frames;
 	std::map<unsigned long long, VP8Frame*> _complete_frames_queue;
+
+	// Distance to the referenced frame of each queued frame (temporal layers).
+	// The server may drop frames of higher temporal layers.
+	std::map<unsigned long long, int> _complete_frames_distance;
 	unsigned long long _last_completed_frame_id;
 
 	/*
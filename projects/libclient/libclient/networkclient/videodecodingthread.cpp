@@ -10,7 +10,9 @@ HUMBLE_LOGGER(HL, "networkclient.videodecodingthread");
 
 VideoDecodingThread::VideoDecodingThread(QObject* parent) :
 	QThread(parent),
-	_stopFlag(0)
+	_queue(QUEUE_CAPACITY),
+	_stopFlag(0),
+	_droppedFrames(0)
 {
 }
 
@@ -19,9 +21,9 @@ VideoDecodingThread::~VideoDecodingThread()
 	stop();
 	wait();
 
-	while (!_queue.isEmpty())
+	QPair<VP8Frame*, ocs::clientid_t> item;
+	while (_queue.pop(item))
 	{
-		auto item = _queue.dequeue();
 		delete item.first;
 	}
 }
@@ -29,15 +31,33 @@ VideoDecodingThread::~VideoDecodingThread()
 void VideoDecodingThread::stop()
 {
 	_stopFlag = 1;
-	_queueCond.wakeAll();
+	_queueSemaphore.release();
 }
 
 // Note: Enqueuing an NULL frame, will reset the internal used decoder.
-void VideoDecodingThread::enqueue(VP8Frame* frame, ocs::clientid_t senderId)
+bool VideoDecodingThread::enqueue(VP8Frame* frame, ocs::clientid_t senderId)
 {
-	QMutexLocker l(&_m);
-	_queue.enqueue(qMakePair(frame, senderId));
-	_queueCond.wakeAll();
+	if (!_queue.push(qMakePair(frame, senderId)))
+	{
+		if (frame)
+		{
+			// Decoding does not keep up, late frames are worthless anyway.
+			delete frame;
+			_droppedFrames.fetchAndAddRelaxed(1);
+			HL_WARN(HL, QString("Dropped video frame, decoding queue is full (sender-id=%1; dropped=%2)")
+					.arg(senderId).arg(_droppedFrames.load()).toStdString());
+			return false;
+		}
+		// A reset may not get lost, the queue drains while decoding.
+		while (!_queue.push(qMakePair(frame, senderId)))
+		{
+			if (_stopFlag.load() != 0)
+				return false;
+			QThread::yieldCurrentThread();
+		}
+	}
+	_queueSemaphore.release();
+	return true;
 }
 
 void VideoDecodingThread::run()
@@ -48,14 +68,10 @@ void VideoDecodingThread::run()
 	while (_stopFlag == 0)
 	{
 		// Get next frame from queue
-		QMutexLocker l(&_m);
-		if (_queue.isEmpty())
-		{
-			_queueCond.wait(&_m);
+		QPair<VP8Frame*, ocs::clientid_t> item;
+		_queueSemaphore.acquire();
+		if (!_queue.pop(item))
 			continue;
-		}
-		auto item = _queue.dequeue();
-		l.unlock();
 
 		if (/*!item.first || */item.second == 0)
 			continue;
@@ -94,8 +110,10 @@ void VideoDecodingThread::run()
 		if (!item.first)
 			continue;
 
-		// Decode
-		YuvFrameRefPtr yuv(decoder->decodeFrameRaw(item.first->data));
+		// Decode, the frame refers to the receive buffer of its datagrams
+		// (see VideoFrameUdpDecoder), which is reused after the frame is deleted.
+		const QScopedPointer<VP8Frame> frame(item.first);
+		YuvFrameRefPtr yuv(decoder->decodeFrameRaw(frame->data));
 		emit decoded(yuv, item.second);
 	}
 
@@ -3,27 +3,44 @@
 
 #include <QThread>
 #include <QScopedPointer>
-#include <QMutex>
-#include <QWaitCondition>
-#include <QQueue>
+#include <QSemaphore>
 #include <QPair>
 #include <QAtomicInt>
 
 #include "libbase/defines.h"
+#include "libbase/SpscQueue.h"
 
 #include "libapp/vp8frame.h"
 #include "libapp/yuvframe.h"
 
+/*!
+	Decodes the received frames of all senders.
+
+	The frames are handed over with a lock-free queue, which has a single
+	producer: enqueue() must always be called from the same thread (the
+	I/O thread of the MediaSocket).
+*/
 class VideoDecodingThread : public QThread
 {
 	Q_OBJECT
 
 public:
+	// Frames of all senders, which wait for decoding.
+	static const size_t QUEUE_CAPACITY = 256;
+
 	VideoDecodingThread(QObject* parent);
 	~VideoDecodingThread();
 
 	void stop();
-	void enqueue(VP8Frame* frame, ocs::clientid_t senderId);
+
+	/*! Takes ownership of "frame".
+		\return false, if the queue is full and the frame has been dropped.
+		        The decoder of the sender needs a key-frame to continue.
+	*/
+	bool enqueue(VP8Frame* frame, ocs::clientid_t senderId);
+
+	/*! Number of frames, which have been dropped by enqueue(). */
+	int droppedFrames() const { return _droppedFrames.load(); }
 
 protected:
 	void run();
@@ -32,10 +49,10 @@ signals:
 	void decoded(YuvFrameRefPtr frame, ocs::clientid_t senderId);
 
 private:
-	QMutex _m;
-	QWaitCondition _queueCond;
-	QQueue<QPair<VP8Frame*, ocs::clientid_t> > _queue;
+	SpscQueue<QPair<VP8Frame*, ocs::clientid_t> > _queue;
+	QSemaphore _queueSemaphore;  ///< Available frames, released once more by stop().
 	QAtomicInt _stopFlag;
+	QAtomicInt _droppedFrames;
 };
 
 #endif
\ No newline at end of file
@@ -1,11 +1,17 @@
 #include "videoencodingthread.h"
 
+#include <algorithm>
+#include <memory>
+#include <vector>
+
 #include <QTime>
 
 #include "humblelogging/api.h"
 
 #include "libapp/ts3video.h"
 
+#include "libmediaprotocol/protocol.h"
+
 #include "vp8encoder.h"
 
 HUMBLE_LOGGER(HL, "networkclient.videoencodingthread");
@@ -13,7 +19,13 @@ HUMBLE_LOGGER(HL, "networkclient.videoencodingthread");
 VideoEncodingThread::VideoEncodingThread(QObject* parent) :
 	QThread(parent),
 	_stopFlag(0),
-	_recoveryFlag(VP8Frame::NORMAL)
+	_recoveryFlag(VP8Frame::NORMAL),
+	_reconfigureFlag(0),
+	_targetBitrate(0),
+	_targetFps(0),
+	_targetScale(0),
+	_layers(1),
+	_temporalLayers(1)
 {
 }
 
@@ -23,13 +35,19 @@ VideoEncodingThread::~VideoEncodingThread()
 	wait();
 }
 
-void VideoEncodingThread::init(int width, int height, int bitrate, int fps)
+void VideoEncodingThread::init(int width, int height, int bitrate, int fps, int layers, int temporalLayers)
 {
 	QMutexLocker l(&_m);
 	_width = width;
 	_height = height;
 	_bitrate = bitrate;
 	_fps = fps;
+	_layers = qBound(1, layers, (int)UDP::VideoFrameDatagram::MAXLAYERS);
+	_temporalLayers = qBound(1, temporalLayers, (int)UDP::VideoFrameDatagram::MAXTEMPORALLAYERS);
+	_reconfigureFlag = 0;
+	_targetBitrate = 0;
+	_targetFps = 0;
+	_targetScale = 0;
 }
 
 void VideoEncodingThread::stop()
@@ -53,17 +71,52 @@ void VideoEncodingThread::enqueueRecovery(VP8Frame::FrameType ft)
 	_queueCond.wakeAll();
 }
 
+void VideoEncodingThread::reconfigure(int bitrate, int fps, int scale)
+{
+	QMutexLocker l(&_m);
+	if (bitrate > 0)
+		_targetBitrate = bitrate;
+	if (fps > 0)
+		_targetFps = fps;
+	if (scale > 0)
+		_targetScale = qBound(25, scale, 100);
+	_reconfigureFlag = 1;
+}
+
+QSize VideoEncodingThread::layerSize(int width, int height, int layer)
+{
+	if (layer == 0)
+		return QSize(width, height);
+
+	// VP8 requires even dimensions.
+	return QSize((width >> layer) & ~1, (height >> layer) & ~1);
+}
+
+int VideoEncodingThread::layerBitrate(int bitrate, int layer)
+{
+	// Half the size has a quarter of the pixels.
+	return qMax(bitrate >> (2 * layer), 16);
+}
+
 void VideoEncodingThread::run()
 {
 	QMutexLocker l(&_m);
 	const auto width = _width;
 	const auto height = _height;
-	const auto bitrate = _bitrate;
-	const auto fps = _fps;
-	const auto fpsTimeMs = 1000 / fps;
+	auto bitrate = _bitrate;
+	auto fps = _fps;
+	auto fpsTimeMs = fps > 0 ? 1000 / fps : 0;
+	auto scale = 100;
+	const auto layers = _layers;
+	const auto temporalLayers = _temporalLayers;
 	l.unlock();
 
-	QScopedPointer<VP8Encoder> encoder;
+	std::vector<std::unique_ptr<VP8Encoder> > encoders(layers);
+
+	// Layers, whose encoder has not taken over the settings of reconfigure() yet.
+	std::vector<bool> reconfigured(layers, false);
+	auto confirm = false;
+
 	QTime fpsTimer;
 	fpsTimer.start();
 
@@ -78,6 +131,19 @@ void VideoEncodingThread::run()
 			continue;
 		}
 		auto item = _queue.dequeue();
+
+		// Take over the settings of reconfigure(), the encoders follow
+		// with the next encoded frame, skipped frames keep them pending.
+		if (_reconfigureFlag != 0)
+		{
+			_reconfigureFlag = 0;
+			bitrate = _targetBitrate > 0 ? _targetBitrate : bitrate;
+			fps = _targetFps > 0 ? _targetFps : fps;
+			fpsTimeMs = fps > 0 ? 1000 / fps : 0;
+			scale = _targetScale > 0 ? _targetScale : scale;
+			reconfigured.assign(layers, true);
+			confirm = true;
+		}
 		l.unlock();
 
 		if (item.first.isNull())
@@ -91,44 +157,66 @@ void VideoEncodingThread::run()
 		fpsTimer.restart();
 
 
-		// Convert to YuvFrame.
-		const QScopedPointer<YuvFrame> yuv(YuvFrame::fromQImage(item.first));
+		// The recovery applies to all layers, a receiver may get any of them.
+		const auto recovery = _recoveryFlag != VP8Frame::NORMAL;
+		if (recovery)
+			_recoveryFlag = VP8Frame::NORMAL;
 
-		// Get/create encoder
-		auto create = false;
-		if (!encoder)
-			create = true;
-		else if (!encoder->isValidFrame(*yuv))
-			create = true;
+		// VP8 requires even dimensions.
+		const auto scaledWidth = scale < 100 ? (width * scale / 100) & ~1 : width;
+		const auto scaledHeight = scale < 100 ? (height * scale / 100) & ~1 : height;
 
-		// Re-/create encoder
-		if (create)
+		for (auto layer = 0; layer < layers; ++layer)
 		{
-			if (encoder)
-				encoder.reset();
+			auto& encoder = encoders[layer];
+			const auto size = layerSize(scaledWidth, scaledHeight, layer);
+
+			// Convert to YuvFrame.
+			const QScopedPointer<YuvFrame> yuv(YuvFrame::fromQImage(layer == 0 && scale == 100 ? item.first : item.first.scaled(size, Qt::IgnoreAspectRatio, Qt::FastTransformation)));
+
+			// Get/create encoder, the running one takes over new settings
+			// without a restart. It can not grow beyond its initial size.
+			auto create = false;
+			if (!encoder)
+				create = true;
+			else if (reconfigured[layer] || !encoder->isValidFrame(*yuv))
+				create = !encoder->reconfigure(yuv->width, yuv->height, layerBitrate(bitrate, layer), fps) || !encoder->isValidFrame(*yuv);
+
+			// Re-/create encoder
+			if (create)
+			{
+				encoder.reset(new VP8Encoder());
+				if (!encoder->initialize(yuv->width, yuv->height, layerBitrate(bitrate, layer), fps, temporalLayers))
+				{
+					_stopFlag = 1;
+					emit error(QString("Can not initialize video encoder"));
+					break;
+				}
+			}
+			reconfigured[layer] = false;
 
-			encoder.reset(new VP8Encoder());
-			if (!encoder->initialize(width, height, bitrate, fps))
+			if (recovery)
 			{
-				_stopFlag = 1;
-				emit error(QString("Can not initialize video encoder"));
-				continue;
+				encoder->setRequestRecoveryFlag(VP8Frame::KEY);
 			}
+
+			// Encode frame
+			const QScopedPointer<VP8Frame> vp8(encoder->encode(*yuv));
+			if (!vp8)
+				continue;
+
+			// Serialize VP8Frame.
+			QByteArray data;
+			QDataStream out(&data, QIODevice::WriteOnly);
+			out << *vp8;
+			const auto temporalCode = UDP::VideoFrameDatagram::temporalCode(encoder->temporalLayers(), encoder->temporalPosition());
+			emit encoded(data, item.second, layer, temporalCode);
 		}
 
-		if (_recoveryFlag != VP8Frame::NORMAL)
+		if (confirm && std::find(reconfigured.begin(), reconfigured.end(), true) == reconfigured.end())
 		{
-			encoder->setRequestRecoveryFlag(VP8Frame::KEY);
-			_recoveryFlag = VP8Frame::NORMAL;
+			confirm = false;
+			emit bitrateApplied(bitrate);
 		}
-
-		// Encode frame
-		const QScopedPointer<VP8Frame> vp8(encoder->encode(*yuv));
-
-		// Serialize VP8Frame.
-		QByteArray data;
-		QDataStream out(&data, QIODevice::WriteOnly);
-		out << *vp8;
-		emit encoded(data, item.second);
 	}
 }
\ No newline at end of file
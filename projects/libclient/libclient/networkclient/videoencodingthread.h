@@ -8,6 +8,7 @@
 #include <QPair>
 #include <QAtomicInt>
 #include <QImage>
+#include <QSize>
 
 #include "libbase/defines.h"
 
@@ -24,17 +25,41 @@ public:
 	VideoEncodingThread(QObject* parent);
 	~VideoEncodingThread();
 
-	void init(int width, int height, int bitrate = 100, int fps = 24);
+	/*! \param layers Number of simulcast layers, each with half the size of the previous one.
+		\param temporalLayers Number of temporal layers of every simulcast layer (see VP8Encoder::initialize()).
+	*/
+	void init(int width, int height, int bitrate = 100, int fps = 24, int layers = 1, int temporalLayers = 1);
 	void stop();
 	void enqueue(const QImage& image, ocs::clientid_t senderId);
 	void enqueueRecovery(VP8Frame::FrameType ft = VP8Frame::KEY);
 
+	/*! Changes the settings of the running encoders between two frames,
+		without restarting them. Values <= 0 keep the current setting,
+		init() resets all of them.
+		\param bitrate Bitrate of layer 0 (kbit/s), the other layers are
+			scaled accordingly (see layerBitrate()).
+		\param fps Frame rate.
+		\param scale Size of layer 0 in percent (25-100) of the init() size,
+			the other layers are scaled accordingly (see layerSize()).
+			A new size starts with a key frame.
+	*/
+	void reconfigure(int bitrate, int fps = 0, int scale = 0);
+
+	/*! Size and bitrate of a simulcast layer. */
+	static QSize layerSize(int width, int height, int layer);
+	static int layerBitrate(int bitrate, int layer);
+
 protected:
 	void run();
 
 signals:
 	void error(const QString& message);
-	void encoded(QByteArray frame, ocs::clientid_t senderId);
+	void encoded(QByteArray frame, ocs::clientid_t senderId, int layer, int temporalCode);
+
+	/*! Emits after all encoders have taken over the settings of reconfigure().
+		\param bitrate Bitrate of layer 0 (kbit/s).
+	*/
+	void bitrateApplied(int bitrate);
 
 private:
 	QMutex _m;
@@ -43,11 +68,19 @@ private:
 	QAtomicInt _stopFlag;
 	QAtomicInt _recoveryFlag;
 
+	// Pending reconfigure() settings
+	QAtomicInt _reconfigureFlag;
+	int _targetBitrate;
+	int _targetFps;
+	int _targetScale;
+
 	// Video encoding attributes
 	int _width;
 	int _height;
 	int _bitrate;
 	int _fps;
+	int _layers;
+	int _temporalLayers;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,158 @@
+#include "videojitterbuffer.h"
+
+#include <cmath>
+
+#include "libapp/vp8frame.h"
+
+///////////////////////////////////////////////////////////////////////
+
+// Held frames, above it the oldest frames are released regardless of their playout time.
+static const size_t MAX_FRAMES = 64;
+
+// Larger gaps of the frame numbers (e.g. after a paused video) restart the estimation.
+static const quint64 MAX_FRAME_STEP = 30;
+
+// Bounds of the estimated frame interval.
+static const double MIN_INTERVAL_US = 5 * 1000.0;
+static const double MAX_INTERVAL_US = 1000 * 1000.0;
+
+static const double INTERVAL_GAIN = 1.0 / 32;
+static const double JITTER_GAIN = 1.0 / 16;
+
+// The nominal timeline follows later arrivals (clock drift, longer path) slowly.
+static const double DRIFT_GAIN = 1.0 / 16;
+
+// Playout delay in multiples of the jitter and its decay per frame.
+static const double JITTER_FACTOR = 3.0;
+static const double DELAY_DECAY = 1.0 / 64;
+
+///////////////////////////////////////////////////////////////////////
+
+VideoJitterBuffer::VideoJitterBuffer(int minDelay, int maxDelay) :
+	_minDelayUs(0),
+	_maxDelayUs(0),
+	_hasPrevious(false),
+	_previousTime(0),
+	_previousArrivalUs(0),
+	_intervalUs(0.0),
+	_jitterUs(0.0),
+	_delayUs(0.0),
+	_nominalUs(0),
+	_lastDueUs(0)
+{
+	setDelayRange(minDelay, maxDelay);
+}
+
+VideoJitterBuffer::~VideoJitterBuffer()
+{
+	for (auto& e : _frames)
+		delete e.frame;
+}
+
+void VideoJitterBuffer::setDelayRange(int minDelay, int maxDelay)
+{
+	_minDelayUs = (qint64)qMax(0, minDelay) * 1000;
+	_maxDelayUs = qMax(_minDelayUs, (qint64)maxDelay * 1000);
+	_delayUs = qBound((double)_minDelayUs, _delayUs, (double)_maxDelayUs);
+}
+
+void VideoJitterBuffer::add(VP8Frame* frame, qint64 arrivalUs)
+{
+	if (!frame)
+	{
+		return;
+	}
+	++_stats.frames;
+
+	// The key frame does not depend on the held frames.
+	if (frame->type == VP8Frame::KEY && _frames.size() >= MAX_FRAMES)
+	{
+		clear();
+	}
+
+	updateEstimates(frame->time, arrivalUs);
+	updateDelay();
+
+	Entry e;
+	e.frame = frame;
+	if (_maxDelayUs == 0)
+	{
+		e.dueUs = arrivalUs;
+	}
+	else
+	{
+		e.dueUs = _nominalUs + (qint64)_delayUs;
+		if (e.dueUs < arrivalUs)
+		{
+			++_stats.late;
+			e.dueUs = arrivalUs;
+		}
+		e.dueUs = qMin(qMax(e.dueUs, _lastDueUs), arrivalUs + _maxDelayUs);
+	}
+	_lastDueUs = e.dueUs;
+	_frames.push_back(e);
+}
+
+VP8Frame* VideoJitterBuffer::next(qint64 nowUs)
+{
+	if (_frames.empty())
+	{
+		return nullptr;
+	}
+	if (_frames.front().dueUs > nowUs && _frames.size() <= MAX_FRAMES)
+	{
+		return nullptr;
+	}
+	auto frame = _frames.front().frame;
+	_frames.pop_front();
+	return frame;
+}
+
+void VideoJitterBuffer::clear()
+{
+	for (auto& e : _frames)
+		delete e.frame;
+	_stats.dropped += _frames.size();
+	_frames.clear();
+}
+
+void VideoJitterBuffer::updateEstimates(quint64 time, qint64 arrivalUs)
+{
+	const auto step = time - _previousTime;
+	if (!_hasPrevious || time <= _previousTime || step > MAX_FRAME_STEP)
+	{
+		// Starts a new timeline at this frame.
+		_nominalUs = arrivalUs;
+	}
+	else
+	{
+		const auto arrivalDeltaUs = (double)(arrivalUs - _previousArrivalUs);
+		const auto sample = qBound(MIN_INTERVAL_US, arrivalDeltaUs / step, MAX_INTERVAL_US);
+		if (_intervalUs == 0.0)
+			_intervalUs = sample;
+		else
+			_intervalUs += (sample - _intervalUs) * INTERVAL_GAIN;
+
+		const auto deviationUs = arrivalDeltaUs - step * _intervalUs;
+		_jitterUs += (std::fabs(deviationUs) - _jitterUs) * JITTER_GAIN;
+
+		// Early frames move the timeline immediately, late ones slowly.
+		const auto predictedUs = _nominalUs + (qint64)(step * _intervalUs);
+		if (arrivalUs <= predictedUs)
+			_nominalUs = arrivalUs;
+		else
+			_nominalUs = predictedUs + (qint64)((arrivalUs - predictedUs) * DRIFT_GAIN);
+	}
+	_hasPrevious = true;
+	_previousTime = time;
+	_previousArrivalUs = arrivalUs;
+}
+
+void VideoJitterBuffer::updateDelay()
+{
+	const auto targetUs = qBound((double)_minDelayUs, JITTER_FACTOR * _jitterUs, (double)_maxDelayUs);
+	if (targetUs > _delayUs)
+		_delayUs = targetUs;
+	else
+		_delayUs -= (_delayUs - targetUs) * DELAY_DECAY;
+}
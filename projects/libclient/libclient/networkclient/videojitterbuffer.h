@@ -0,0 +1,103 @@
+#ifndef VIDEOJITTERBUFFER_H
+#define VIDEOJITTERBUFFER_H
+
+#include <deque>
+
+#include <QtGlobal>
+
+class VP8Frame;
+
+/*!
+	Playout buffer for the completed frames of a single sender.
+
+	The frames leave the reassembly (see VideoFrameUdpDecoder) as soon as
+	their last datagram arrives, network jitter would show up as stutter.
+	The buffer holds each frame back until its scheduled playout time:
+
+	  - The frame interval is estimated from the arrival times and the frame
+	    numbers (VP8Frame::time), frames skipped by the server count as well.
+	  - The inter-arrival jitter is the smoothed deviation from that interval
+	    (similar to RFC 3550).
+	  - The playout delay follows JITTER_FACTOR times the jitter within
+	    [minDelay, maxDelay]. It rises immediately and decays slowly.
+	  - Frames are scheduled on a nominal timeline of the earliest arrivals
+	    plus the delay. A frame, which arrives after its scheduled time, is
+	    late and released immediately.
+
+	A key frame makes all held frames obsolete, when the buffer is full.
+	The frames are handed over in the order of add(), which is the decoding order.
+
+	\note This class is NOT thread-safe.
+*/
+class VideoJitterBuffer
+{
+public:
+	class Stats
+	{
+	public:
+		quint64 frames = 0;   ///< Added frames.
+		quint64 late = 0;     ///< Frames, which arrived after their playout time.
+		quint64 dropped = 0;  ///< Frames, which have been deleted without playout.
+	};
+
+	/*! \param minDelay Lower bound of the playout delay in milliseconds.
+		\param maxDelay Upper bound of the playout delay in milliseconds, 0 = Disabled.
+	*/
+	VideoJitterBuffer(int minDelay = 0, int maxDelay = 200);
+	~VideoJitterBuffer();
+
+	void setDelayRange(int minDelay, int maxDelay);
+
+	/*! Takes ownership of "frame".
+		\param arrivalUs Time of arrival in microseconds of a monotonic clock.
+	*/
+	void add(VP8Frame* frame, qint64 arrivalUs);
+
+	/*! \return The next frame, whose playout time has come, or NULL.
+		\note The buffer releases the ownership of the object to the caller.
+	*/
+	VP8Frame* next(qint64 nowUs);
+
+	/*! Deletes all held frames, they count as dropped. */
+	void clear();
+
+	bool isEmpty() const { return _frames.empty(); }
+
+	/*! Current playout delay in milliseconds. */
+	int delay() const { return (int)(_delayUs / 1000); }
+
+	/*! Estimated inter-arrival jitter in milliseconds. */
+	double jitter() const { return _jitterUs / 1000.0; }
+
+	const Stats& stats() const { return _stats; }
+
+private:
+	class Entry
+	{
+	public:
+		VP8Frame* frame;
+		qint64 dueUs;
+	};
+
+	void updateEstimates(quint64 time, qint64 arrivalUs);
+	void updateDelay();
+
+private:
+	qint64 _minDelayUs;
+	qint64 _maxDelayUs;
+	std::deque<Entry> _frames;
+	Stats _stats;
+
+	// Previous frame.
+	bool _hasPrevious;
+	quint64 _previousTime;
+	qint64 _previousArrivalUs;
+
+	double _intervalUs;  ///< Per frame number, 0 = Unknown.
+	double _jitterUs;
+	double _delayUs;
+	qint64 _nominalUs;   ///< Expected arrival of the previous frame without jitter.
+	qint64 _lastDueUs;
+};
+
+#endif
@@ -30,18 +30,18 @@ static unsigned int mem_get_le32(const unsigned char* mem)
 	return (mem[3] << 24) | (mem[2] << 16) | (mem[1] << 8) | (mem[0]);
 }
 
-static unsigned char* extractData(const QByteArray& arr, int offset, int length)
+// Bitstream of an IVF frame, the decoder reads it without a copy.
+static const uint8_t* frameData(const QByteArray& arr, size_t& frame_sz)
 {
-	if (arr.length() - offset < length)
+	if (arr.size() < IVF_FRAME_HDR_SZ)
 		return NULL;
 
-	unsigned char* ret = (unsigned char*)malloc(sizeof(unsigned char) * length);
-	for (int i = 0; i < length; i++)
-	{
-		ret[i] = arr.at(offset + i);
-	}
+	const uchar* header = (const uchar*)arr.constData();
+	frame_sz = mem_get_le32(header);
+	if ((size_t)arr.size() - IVF_FRAME_HDR_SZ < frame_sz)
+		return NULL;
 
-	return ret;
+	return header + IVF_FRAME_HDR_SZ;
 }
 
 VP8Decoder::VP8Decoder() :
@@ -69,13 +69,11 @@ void VP8Decoder::initialize()
 QImage VP8Decoder::decodeFrame(const QByteArray& data)
 {
 	// Read frame size from header.
-	const uchar* header = extractData(data, 0, 4);
-	size_t frame_sz = mem_get_le32(header);
-	delete header;
+	size_t frame_sz = 0;
 	vpx_codec_iter_t iter = NULL;
 	vpx_image_t* img;
 
-	const uint8_t* frame = extractData(data, IVF_FRAME_HDR_SZ, frame_sz);
+	const uint8_t* frame = frameData(data, frame_sz);
 	if (!frame)  // Stuff went horribly wrong.
 	{
 		HL_ERROR(HL, QString("Can not read VP8 frame from QByteArray").toStdString());
@@ -137,9 +135,6 @@ QImage VP8Decoder::decodeFrame(const QByteArray& data)
 		delete tpv;
 	}
 
-	if (frame)
-		delete frame;
-
 	if (out)
 	{
 		QImage* qimg = new QImage(out, img->d_w, img->d_h, QImage::Format_RGB888);
@@ -156,13 +151,11 @@ QImage VP8Decoder::decodeFrame(const QByteArray& data)
 YuvFrame* VP8Decoder::decodeFrameRaw(const QByteArray& data)
 {
 	// Read frame size from header.
-	const uchar* header = extractData(data, 0, 4);
-	size_t frame_sz = mem_get_le32(header);
-	delete header;
+	size_t frame_sz = 0;
 	vpx_codec_iter_t iter = NULL;
 	vpx_image_t* img;
 
-	const uint8_t* frame = extractData(data, IVF_FRAME_HDR_SZ, frame_sz);
+	const uint8_t* frame = frameData(data, frame_sz);
 	if (!frame)  // Stuff went horribly wrong.
 	{
 		const QString msg("Failed to read frame");
@@ -275,8 +268,5 @@ YuvFrame* VP8Decoder::decodeFrameRaw(const QByteArray& data)
 		}
 	}
 
-	if (frame)
-		delete frame;
-
 	return ret;
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "vp8encoder.h"
 
+#include <cstring>
+
 #include <QDateTime>
 
 #include "libapp/vp8frame.h"
@@ -24,6 +26,31 @@ unsigned int global_recovery_flags[] =
 	VP8_EFLAG_NO_REF_LAST | VP8_EFLAG_NO_REF_GF     // ALTREF = 3
 };
 
+///////////////////////////////////////////////////////////////////////////////
+// Temporal layers
+///////////////////////////////////////////////////////////////////////////////
+
+// Frames only reference frames of their own or lower layers:
+// Layer 0 references and updates LAST, layer 1 updates GOLD (3 layers only)
+// and the highest layer does not update any reference at all.
+#define TL_NO_UPD_ALL (VP8_EFLAG_NO_UPD_LAST | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF | VP8_EFLAG_NO_UPD_ENTROPY)
+
+static const unsigned int temporal_layer_ids_2[] = { 0, 1 };
+static const vpx_enc_frame_flags_t temporal_flags_2[] =
+{
+	VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF,
+	VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF | TL_NO_UPD_ALL
+};
+
+static const unsigned int temporal_layer_ids_3[] = { 0, 2, 1, 2 };
+static const vpx_enc_frame_flags_t temporal_flags_3[] =
+{
+	VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF,
+	VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF | TL_NO_UPD_ALL,
+	VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_LAST | VP8_EFLAG_NO_UPD_ARF,
+	VP8_EFLAG_NO_REF_ARF | TL_NO_UPD_ALL
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 // Static helper functions.
 ///////////////////////////////////////////////////////////////////////////////
@@ -51,20 +78,32 @@ VP8Encoder::VP8Encoder()
 	  _cfg(),
 	  _incremental_frame_number(0),
 	  _raw(),
+	  _initialized(false),
 	  _width(0),
 	  _height(0),
-	  _request_recovery_flag(0)
+	  _request_recovery_flag(0),
+	  _temporal_layers(1),
+	  _temporal_position(0),
+	  _temporal_next_position(0)
 {
 }
 
 VP8Encoder::~VP8Encoder()
 {
+	if (_initialized)
+	{
+		vpx_img_free(&_raw);
+		vpx_codec_destroy(&_codec);
+	}
 }
 
-bool VP8Encoder::initialize(int width, int height, int bitrate, int framerate)
+bool VP8Encoder::initialize(int width, int height, int bitrate, int framerate, int temporalLayers)
 {
 	_width = width;
 	_height = height;
+	_temporal_layers = (temporalLayers == 2 || temporalLayers == 3) ? temporalLayers : 1;
+	_temporal_position = 0;
+	_temporal_next_position = 0;
 
 	// Populate encoder configuration.
 	vpx_codec_err_t res;
@@ -79,7 +118,6 @@ bool VP8Encoder::initialize(int width, int height, int bitrate, int framerate)
 	_cfg.g_w = _width;
 	_cfg.g_h = _height;
 	_cfg.rc_end_usage = VPX_CBR;
-	_cfg.rc_target_bitrate = bitrate;
 	_cfg.g_timebase.num = 1;          // Reciproce numerator of framerate.
 	_cfg.g_timebase.den = framerate;  // Framerate.
 	_cfg.g_error_resilient = 1;
@@ -87,6 +125,26 @@ bool VP8Encoder::initialize(int width, int height, int bitrate, int framerate)
 	_cfg.rc_max_quantizer = 56;
 	_cfg.kf_mode = VPX_KF_DISABLED;  // Further configured with: (VPX_KF_AUTO) _cfg.kf_max_dist = 2000;
 
+	// Temporal layers with cumulative bitrates (see setLayerBitrates()).
+	if (_temporal_layers == 2)
+	{
+		_cfg.ts_number_layers = 2;
+		_cfg.ts_periodicity = 2;
+		_cfg.ts_rate_decimator[0] = 2;
+		_cfg.ts_rate_decimator[1] = 1;
+		memcpy(_cfg.ts_layer_id, temporal_layer_ids_2, sizeof(temporal_layer_ids_2));
+	}
+	else if (_temporal_layers == 3)
+	{
+		_cfg.ts_number_layers = 3;
+		_cfg.ts_periodicity = 4;
+		_cfg.ts_rate_decimator[0] = 4;
+		_cfg.ts_rate_decimator[1] = 2;
+		_cfg.ts_rate_decimator[2] = 1;
+		memcpy(_cfg.ts_layer_id, temporal_layer_ids_3, sizeof(temporal_layer_ids_3));
+	}
+	setLayerBitrates(bitrate);
+
 	// Initialize codec.
 	if ((res = vpx_codec_enc_init(&_codec, vpxinterface, &_cfg, 0)))
 	{
@@ -98,9 +156,67 @@ bool VP8Encoder::initialize(int width, int height, int bitrate, int framerate)
 	// Initialize raw frame container, which is used
 	// later in encoding steps as some kind a buffer.
 	vpx_img_alloc(&_raw, VPX_IMG_FMT_YV12, width, height, 1);
+	_initialized = true;
 	return true;
 }
 
+bool VP8Encoder::setBitrate(int bitrate)
+{
+	return reconfigure(_cfg.g_w, _cfg.g_h, bitrate, 0);
+}
+
+bool VP8Encoder::reconfigure(int width, int height, int bitrate, int framerate)
+{
+	if (!_initialized || width > _width || height > _height)
+		return false;
+
+	const auto resized = _cfg.g_w != (unsigned int)width || _cfg.g_h != (unsigned int)height;
+	if (!resized && (bitrate <= 0 || (unsigned int)bitrate == _cfg.rc_target_bitrate) && (framerate <= 0 || framerate == _cfg.g_timebase.den))
+		return true;
+
+	_cfg.g_w = width;
+	_cfg.g_h = height;
+	if (framerate > 0)
+		_cfg.g_timebase.den = framerate;
+	if (bitrate > 0)
+		setLayerBitrates(bitrate);
+
+	vpx_codec_err_t res;
+	if ((res = vpx_codec_enc_config_set(&_codec, &_cfg)))
+	{
+		fprintf(stderr, "Failed to reconfigure VP8 encoder (width=%d; height=%d; bitrate=%d; framerate=%d; error=%s)\n",
+				width, height, bitrate, framerate, vpx_codec_err_to_string(res));
+		return false;
+	}
+
+	// Only key frames carry the frame size.
+	if (resized)
+	{
+		vpx_img_free(&_raw);
+		vpx_img_alloc(&_raw, VPX_IMG_FMT_YV12, width, height, 1);
+		setRequestRecoveryFlag(VP8Frame::KEY);
+	}
+	return true;
+}
+
+void VP8Encoder::setLayerBitrates(int bitrate)
+{
+	_cfg.rc_target_bitrate = bitrate;
+
+	// Layer 0 gets the largest share.
+	if (_temporal_layers == 2)
+	{
+		_cfg.ts_target_bitrate[0] = bitrate * 6 / 10;
+		_cfg.ts_target_bitrate[1] = bitrate;
+	}
+	else if (_temporal_layers == 3)
+	{
+		_cfg.ts_target_bitrate[0] = bitrate * 4 / 10;
+		_cfg.ts_target_bitrate[1] = bitrate * 6 / 10;
+		_cfg.ts_target_bitrate[2] = bitrate;
+	}
+}
+
 bool VP8Encoder::isValidFrame(const YuvFrame& frame) const
 {
 	if (_cfg.g_w != frame.width || _cfg.g_h != frame.height)
@@ -121,6 +237,26 @@ VP8Frame* VP8Encoder::encode(YuvFrame& yuvFrame)
 	// Add possibility for recovery.
 	vpx_enc_frame_flags_t flags = global_recovery_flags[_request_recovery_flag];
 
+	// Temporal layers: Every recovery restarts the pattern with a key frame,
+	// GOLD and ALTREF are part of the pattern.
+	if (_temporal_layers > 1)
+	{
+		if (_request_recovery_flag != VP8Frame::NORMAL)
+		{
+			_request_recovery_flag = VP8Frame::KEY;
+			_temporal_next_position = 0;
+		}
+		_temporal_position = _temporal_next_position;
+		_temporal_next_position = (_temporal_position + 1) % _cfg.ts_periodicity;
+
+		const auto layerIds = _temporal_layers == 2 ? temporal_layer_ids_2 : temporal_layer_ids_3;
+		const auto layerFlags = _temporal_layers == 2 ? temporal_flags_2 : temporal_flags_3;
+		flags = layerFlags[_temporal_position];
+		if (_request_recovery_flag == VP8Frame::KEY)
+			flags |= VPX_EFLAG_FORCE_KF;
+		vpx_codec_control(&_codec, VP8E_SET_TEMPORAL_LAYER_ID, (int)layerIds[_temporal_position]);
+	}
+
 	// Encode frame.
 	vpx_codec_err_t err_flag;
 	if ((err_flag = vpx_codec_encode(&_codec, &_raw, vp8_frame->time, 1, flags, VPX_DL_REALTIME)))
@@ -141,6 +277,10 @@ VP8Frame* VP8Encoder::encode(YuvFrame& yuvFrame)
 		{
 
 			vp8_frame->type = _request_recovery_flag;
+			if (pkt->data.frame.flags & VPX_FRAME_IS_KEY)
+			{
+				vp8_frame->type = VP8Frame::KEY;
+			}
 			if (_request_recovery_flag != VP8Frame::NORMAL)
 			{
 				_request_recovery_flag = VP8Frame::NORMAL;
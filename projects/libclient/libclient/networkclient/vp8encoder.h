@@ -34,8 +34,31 @@ public:
 	    The average bitrate which the encoder should try to use.
 	    \param[in] framerate
 	    Frame rate of the video.
+	    \param[in] temporalLayers
+	    Number of temporal layers (1-3), see UDP::VideoFrameDatagram::temporalCode().
 	*/
-	bool initialize(int width, int height, int bitrate, int framerate);
+	bool initialize(int width, int height, int bitrate, int framerate, int temporalLayers = 1);
+
+	/*!
+	    Changes the average bitrate of the initialized encoder,
+	    it applies to the next encoded frame.
+
+	    \param[in] bitrate
+	    The average bitrate in kbit/s, it is split between the temporal layers.
+	*/
+	bool setBitrate(int bitrate);
+
+	/*!
+	    Changes the frame geometry, bitrate and frame rate of the initialized
+	    encoder without restarting it, it applies to the next encoded frame.
+	    A new frame size forces a key frame, the other settings don't.
+
+	    VP8 can not grow beyond the size of ::initialize(), the encoder has
+	    to be recreated in this case.
+
+	    \return false, if the encoder could not be changed.
+	*/
+	bool reconfigure(int width, int height, int bitrate, int framerate);
 
 	/*!
 		Checks whether the frame is valid for this encoder (based on ::initialize() settings)
@@ -61,14 +84,27 @@ public:
 	*/
 	void setRequestRecoveryFlag(int recoveryFlag);
 
+	/*!
+	    Position of the last encoded frame within the temporal layer pattern.
+	*/
+	int temporalLayers() const { return _temporal_layers; }
+	int temporalPosition() const { return _temporal_position; }
+
+private:
+	void setLayerBitrates(int bitrate);
+
 private:
 	vpx_codec_ctx_t     _codec;
 	vpx_codec_enc_cfg_t _cfg;
 	vpx_image_t         _raw;
+	bool                _initialized;
 	unsigned long       _incremental_frame_number;
 	int _width;
 	int _height;
 	int _request_recovery_flag;
+	int _temporal_layers;
+	int _temporal_position;
+	int _temporal_next_position;
 };
 
 #endif
\ No newline at end of file
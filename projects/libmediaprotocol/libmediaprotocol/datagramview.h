@@ -0,0 +1,312 @@
+#ifndef UDPPROTOCOL_DATAGRAMVIEW_HEADER
+#define UDPPROTOCOL_DATAGRAMVIEW_HEADER
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "protocol.h"
+
+namespace UDP {
+
+/*!
+    Read-only view over a serialized datagram.
+
+    The views read the header fields at their fixed offsets in network
+    byte order directly from the buffer, nothing is copied or allocated.
+    The buffer has to outlive the view. Always check isValid() before
+    accessing any of the fields, it verifies the magic, type and that
+    the buffer is large enough for the header and its payload.
+
+    Wire format of the base header:
+      [0] magic
+      [1] type
+*/
+class DatagramView
+{
+public:
+	static const size_t HEADER_SIZE = sizeof(Datagram::dg_magic_t) + sizeof(Datagram::dg_type_t);
+
+	DatagramView(const void* data, size_t size) : _data(static_cast<const dg_byte_t*>(data)), _size(size) {}
+
+	bool isValid() const { return _size >= HEADER_SIZE && magic() == Datagram::MAGIC; }
+	Datagram::dg_magic_t magic() const { return _data[0]; }
+	Datagram::dg_type_t type() const { return _data[1]; }
+
+	const dg_byte_t* data() const { return _data; }
+	size_t size() const { return _size; }
+
+protected:
+	uint16_t readU16(size_t offset) const
+	{
+		return (uint16_t)(((uint16_t)_data[offset] << 8) | (uint16_t)_data[offset + 1]);
+	}
+
+	uint32_t readU32(size_t offset) const
+	{
+		return ((uint32_t)_data[offset] << 24) | ((uint32_t)_data[offset + 1] << 16) | ((uint32_t)_data[offset + 2] << 8) | (uint32_t)_data[offset + 3];
+	}
+
+	uint64_t readU64(size_t offset) const
+	{
+		return ((uint64_t)readU32(offset) << 32) | (uint64_t)readU32(offset + 4);
+	}
+
+	const dg_byte_t* _data;
+	size_t _size;
+};
+
+/*!
+    [2] size
+    [4] data (token)
+*/
+class AuthDatagramView : public DatagramView
+{
+public:
+	static const size_t OFFSET_SIZE = DatagramView::HEADER_SIZE;
+	static const size_t OFFSET_DATA = OFFSET_SIZE + sizeof(dg_size_t);
+
+	AuthDatagramView(const void* data, size_t size) : DatagramView(data, size) {}
+
+	bool isValid() const
+	{
+		return DatagramView::isValid() && type() == AuthDatagram::TYPE && _size >= OFFSET_DATA && _size >= OFFSET_DATA + tokenSize();
+	}
+	dg_size_t tokenSize() const { return readU16(OFFSET_SIZE); }
+	const dg_byte_t* token() const { return _data + OFFSET_DATA; }
+};
+
+/*!
+    No additional fields.
+*/
+class KeepAliveDatagramView : public DatagramView
+{
+public:
+	KeepAliveDatagramView(const void* data, size_t size) : DatagramView(data, size) {}
+
+	bool isValid() const { return DatagramView::isValid() && type() == KeepAliveDatagram::TYPE; }
+};
+
+/*!
+    [2] size
+    [4] padding
+*/
+class MtuProbeDatagramView : public DatagramView
+{
+public:
+	static const size_t OFFSET_SIZE = DatagramView::HEADER_SIZE;
+	static const size_t HEADER_SIZE = OFFSET_SIZE + sizeof(dg_size_t);
+
+	MtuProbeDatagramView(const void* data, size_t size) : DatagramView(data, size) {}
+
+	/*! The declared size has to match the received one, truncated probes are invalid. */
+	bool isValid() const
+	{
+		return DatagramView::isValid() && type() == MtuProbeDatagram::TYPE && _size >= HEADER_SIZE && _size == probeSize() && _size <= MtuProbeDatagram::MAXDATAGRAMSIZE;
+	}
+	dg_size_t probeSize() const { return readU16(OFFSET_SIZE); }
+};
+
+/*!
+    [2] sequence
+    [4] sendTime
+    [8] enclosed datagram
+*/
+class TransportDatagramView : public DatagramView
+{
+public:
+	static const size_t OFFSET_SEQUENCE = DatagramView::HEADER_SIZE;
+	static const size_t OFFSET_SENDTIME = OFFSET_SEQUENCE + sizeof(TransportDatagram::dg_sequence_t);
+	static const size_t OFFSET_DATA = OFFSET_SENDTIME + sizeof(TransportDatagram::dg_time_t);
+	static const size_t HEADER_SIZE = OFFSET_DATA;
+
+	TransportDatagramView(const void* data, size_t size) : DatagramView(data, size) {}
+
+	/*! The enclosed datagram has to be at least a valid DatagramView. */
+	bool isValid() const
+	{
+		return DatagramView::isValid() && type() == TransportDatagram::TYPE && _size >= HEADER_SIZE + DatagramView::HEADER_SIZE && _data[OFFSET_DATA] == Datagram::MAGIC;
+	}
+	TransportDatagram::dg_sequence_t sequence() const { return readU16(OFFSET_SEQUENCE); }
+	TransportDatagram::dg_time_t sendTime() const { return readU32(OFFSET_SENDTIME); }
+	const dg_byte_t* payload() const { return _data + OFFSET_DATA; }
+	size_t payloadSize() const { return _size - OFFSET_DATA; }
+};
+
+/*!
+    [2]  baseSequence
+    [4]  count
+    [6]  referenceTime
+    [10] arrivals
+*/
+class TransportFeedbackDatagramView : public DatagramView
+{
+public:
+	static const size_t OFFSET_BASESEQUENCE = DatagramView::HEADER_SIZE;
+	static const size_t OFFSET_COUNT = OFFSET_BASESEQUENCE + sizeof(TransportDatagram::dg_sequence_t);
+	static const size_t OFFSET_REFERENCETIME = OFFSET_COUNT + sizeof(TransportFeedbackDatagram::dg_count_t);
+	static const size_t OFFSET_ARRIVALS = OFFSET_REFERENCETIME + sizeof(TransportDatagram::dg_time_t);
+	static const size_t HEADER_SIZE = OFFSET_ARRIVALS;
+
+	TransportFeedbackDatagramView(const void* data, size_t size) : DatagramView(data, size) {}
+
+	bool isValid() const
+	{
+		return DatagramView::isValid() && type() == TransportFeedbackDatagram::TYPE && _size >= HEADER_SIZE && count() <= TransportFeedbackDatagram::MAXCOUNT && _size >= HEADER_SIZE + count() * sizeof(TransportFeedbackDatagram::dg_arrival_t);
+	}
+	TransportDatagram::dg_sequence_t baseSequence() const { return readU16(OFFSET_BASESEQUENCE); }
+	TransportFeedbackDatagram::dg_count_t count() const { return readU16(OFFSET_COUNT); }
+	TransportDatagram::dg_time_t referenceTime() const { return readU32(OFFSET_REFERENCETIME); }
+	TransportFeedbackDatagram::dg_arrival_t arrival(size_t i) const { return readU16(OFFSET_ARRIVALS + i * sizeof(TransportFeedbackDatagram::dg_arrival_t)); }
+};
+
+/*!
+    [2]  flags
+    [3]  sender
+    [7]  frameId
+    [15] index
+    [17] count
+    [19] size
+    [21] data
+*/
+class VideoFrameDatagramView : public DatagramView
+{
+public:
+	static const size_t OFFSET_FLAGS = DatagramView::HEADER_SIZE;
+	static const size_t OFFSET_SENDER = OFFSET_FLAGS + sizeof(VideoFrameDatagram::dg_flags_t);
+	static const size_t OFFSET_FRAMEID = OFFSET_SENDER + sizeof(VideoFrameDatagram::dg_sender_t);
+	static const size_t OFFSET_INDEX = OFFSET_FRAMEID + sizeof(VideoFrameDatagram::dg_frame_id_t);
+	static const size_t OFFSET_COUNT = OFFSET_INDEX + sizeof(VideoFrameDatagram::dg_data_index_t);
+	static const size_t OFFSET_SIZE = OFFSET_COUNT + sizeof(VideoFrameDatagram::dg_data_count_t);
+	static const size_t OFFSET_DATA = OFFSET_SIZE + sizeof(dg_size_t);
+	static const size_t HEADER_SIZE = OFFSET_DATA;
+
+	VideoFrameDatagramView(const void* data, size_t size) : DatagramView(data, size) {}
+
+	bool isValid() const
+	{
+		return DatagramView::isValid() && type() == VideoFrameDatagram::TYPE && _size >= HEADER_SIZE && _size >= HEADER_SIZE + payloadSize();
+	}
+	VideoFrameDatagram::dg_flags_t flags() const { return _data[OFFSET_FLAGS]; }
+	int layer() const { return VideoFrameDatagram::layer(flags()); }
+	int temporalLayer() const { return VideoFrameDatagram::temporalLayer(flags()); }
+	VideoFrameDatagram::dg_sender_t sender() const { return (VideoFrameDatagram::dg_sender_t)readU32(OFFSET_SENDER); }
+	VideoFrameDatagram::dg_frame_id_t frameId() const { return readU64(OFFSET_FRAMEID); }
+	VideoFrameDatagram::dg_data_index_t index() const { return readU16(OFFSET_INDEX); }
+	VideoFrameDatagram::dg_data_count_t count() const { return readU16(OFFSET_COUNT); }
+	dg_size_t payloadSize() const { return readU16(OFFSET_SIZE); }
+	const dg_byte_t* payload() const { return _data + OFFSET_DATA; }
+};
+
+/*!
+    [2]  sender
+    [6]  frameId
+    [14] index
+*/
+class VideoFrameRequestRecoveryDatagramView : public DatagramView
+{
+public:
+	static const size_t OFFSET_SENDER = DatagramView::HEADER_SIZE;
+	static const size_t OFFSET_FRAMEID = OFFSET_SENDER + sizeof(VideoFrameDatagram::dg_sender_t);
+	static const size_t OFFSET_INDEX = OFFSET_FRAMEID + sizeof(VideoFrameDatagram::dg_frame_id_t);
+	static const size_t HEADER_SIZE = OFFSET_INDEX + sizeof(VideoFrameDatagram::dg_data_index_t);
+
+	VideoFrameRequestRecoveryDatagramView(const void* data, size_t size) : DatagramView(data, size) {}
+
+	bool isValid() const
+	{
+		return DatagramView::isValid() && type() == VideoFrameRequestRecoveryDatagram::TYPE && _size >= HEADER_SIZE;
+	}
+	VideoFrameDatagram::dg_sender_t sender() const { return (VideoFrameDatagram::dg_sender_t)readU32(OFFSET_SENDER); }
+	VideoFrameDatagram::dg_frame_id_t frameId() const { return readU64(OFFSET_FRAMEID); }
+	VideoFrameDatagram::dg_data_index_t index() const { return readU16(OFFSET_INDEX); }
+};
+
+/*!
+    [2]  sender
+    [6]  frameId
+    [14] layer
+    [15] count
+    [17] indices
+*/
+class VideoFrameNackDatagramView : public DatagramView
+{
+public:
+	static const size_t OFFSET_SENDER = DatagramView::HEADER_SIZE;
+	static const size_t OFFSET_FRAMEID = OFFSET_SENDER + sizeof(VideoFrameDatagram::dg_sender_t);
+	static const size_t OFFSET_LAYER = OFFSET_FRAMEID + sizeof(VideoFrameDatagram::dg_frame_id_t);
+	static const size_t OFFSET_COUNT = OFFSET_LAYER + sizeof(VideoFrameNackDatagram::dg_layer_t);
+	static const size_t OFFSET_INDICES = OFFSET_COUNT + sizeof(VideoFrameNackDatagram::dg_index_count_t);
+	static const size_t HEADER_SIZE = OFFSET_INDICES;
+
+	VideoFrameNackDatagramView(const void* data, size_t size) : DatagramView(data, size) {}
+
+	bool isValid() const
+	{
+		return DatagramView::isValid() && type() == VideoFrameNackDatagram::TYPE && _size >= HEADER_SIZE && count() <= VideoFrameNackDatagram::MAXINDICES && _size >= HEADER_SIZE + count() * sizeof(VideoFrameDatagram::dg_data_index_t);
+	}
+	VideoFrameDatagram::dg_sender_t sender() const { return (VideoFrameDatagram::dg_sender_t)readU32(OFFSET_SENDER); }
+	VideoFrameDatagram::dg_frame_id_t frameId() const { return readU64(OFFSET_FRAMEID); }
+	VideoFrameNackDatagram::dg_layer_t layer() const { return _data[OFFSET_LAYER]; }
+	VideoFrameNackDatagram::dg_index_count_t count() const { return readU16(OFFSET_COUNT); }
+	VideoFrameDatagram::dg_data_index_t index(size_t i) const { return readU16(OFFSET_INDICES + i * sizeof(VideoFrameDatagram::dg_data_index_t)); }
+};
+
+/*!
+    [2] sender
+    [6] fractionLost
+*/
+class VideoReceiverReportDatagramView : public DatagramView
+{
+public:
+	static const size_t OFFSET_SENDER = DatagramView::HEADER_SIZE;
+	static const size_t OFFSET_FRACTIONLOST = OFFSET_SENDER + sizeof(VideoFrameDatagram::dg_sender_t);
+	static const size_t HEADER_SIZE = OFFSET_FRACTIONLOST + sizeof(uint8_t);
+
+	VideoReceiverReportDatagramView(const void* data, size_t size) : DatagramView(data, size) {}
+
+	bool isValid() const
+	{
+		return DatagramView::isValid() && type() == VideoReceiverReportDatagram::TYPE && _size >= HEADER_SIZE;
+	}
+	VideoFrameDatagram::dg_sender_t sender() const { return (VideoFrameDatagram::dg_sender_t)readU32(OFFSET_SENDER); }
+	uint8_t fractionLost() const { return _data[OFFSET_FRACTIONLOST]; }
+};
+
+/*!
+    [2]  level
+    [3]  sender
+    [7]  frameId
+    [15] index
+    [17] count
+    [19] size
+    [21] data
+*/
+class AudioFrameDatagramView : public DatagramView
+{
+public:
+	static const size_t OFFSET_LEVEL = DatagramView::HEADER_SIZE;
+	static const size_t OFFSET_SENDER = OFFSET_LEVEL + sizeof(AudioFrameDatagram::dg_level_t);
+	static const size_t OFFSET_FRAMEID = OFFSET_SENDER + sizeof(AudioFrameDatagram::dg_sender_t);
+	static const size_t OFFSET_INDEX = OFFSET_FRAMEID + sizeof(AudioFrameDatagram::dg_frame_id_t);
+	static const size_t OFFSET_COUNT = OFFSET_INDEX + sizeof(AudioFrameDatagram::dg_data_index_t);
+	static const size_t OFFSET_SIZE = OFFSET_COUNT + sizeof(AudioFrameDatagram::dg_data_count_t);
+	static const size_t OFFSET_DATA = OFFSET_SIZE + sizeof(dg_size_t);
+	static const size_t HEADER_SIZE = OFFSET_DATA;
+
+	AudioFrameDatagramView(const void* data, size_t size) : DatagramView(data, size) {}
+
+	bool isValid() const
+	{
+		return DatagramView::isValid() && type() == AudioFrameDatagram::TYPE && _size >= HEADER_SIZE && _size >= HEADER_SIZE + payloadSize();
+	}
+	AudioFrameDatagram::dg_level_t level() const { return _data[OFFSET_LEVEL]; }
+	AudioFrameDatagram::dg_sender_t sender() const { return (AudioFrameDatagram::dg_sender_t)readU32(OFFSET_SENDER); }
+	AudioFrameDatagram::dg_frame_id_t frameId() const { return readU64(OFFSET_FRAMEID); }
+	AudioFrameDatagram::dg_data_index_t index() const { return readU16(OFFSET_INDEX); }
+	AudioFrameDatagram::dg_data_count_t count() const { return readU16(OFFSET_COUNT); }
+	dg_size_t payloadSize() const { return readU16(OFFSET_SIZE); }
+	const dg_byte_t* payload() const { return _data + OFFSET_DATA; }
+};
+
+} // End of namespace.
+#endif
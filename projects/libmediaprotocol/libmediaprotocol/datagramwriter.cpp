@@ -0,0 +1,156 @@
+#include "datagramwriter.h"
+
+#include <cstring>
+
+namespace UDP {
+
+static_assert(VideoFrameDatagramView::HEADER_SIZE == AudioFrameDatagramView::HEADER_SIZE,
+			  "FrameDatagramWriter expects the same header layout for video and audio");
+
+static const size_t FRAME_HEADER_SIZE = VideoFrameDatagramView::HEADER_SIZE;
+
+static inline void writeU16(dg_byte_t* p, uint16_t v)
+{
+	p[0] = (dg_byte_t)(v >> 8);
+	p[1] = (dg_byte_t)v;
+}
+
+static inline void writeU32(dg_byte_t* p, uint32_t v)
+{
+	p[0] = (dg_byte_t)(v >> 24);
+	p[1] = (dg_byte_t)(v >> 16);
+	p[2] = (dg_byte_t)(v >> 8);
+	p[3] = (dg_byte_t)v;
+}
+
+static inline void writeU64(dg_byte_t* p, uint64_t v)
+{
+	writeU32(p, (uint32_t)(v >> 32));
+	writeU32(p + 4, (uint32_t)v);
+}
+
+///////////////////////////////////////////////////////////////////////
+
+FrameDatagramWriter::FrameDatagramWriter(size_t reserveDatagrams) :
+	_headers(reserveDatagrams * FRAME_HEADER_SIZE),
+	_slices(reserveDatagrams),
+	_count(0)
+{
+}
+
+size_t FrameDatagramWriter::writeVideoFrame(const dg_byte_t* data, size_t size, VideoFrameDatagram::dg_frame_id_t frameId,
+		VideoFrameDatagram::dg_sender_t sender, VideoFrameDatagram::dg_flags_t flags, dg_size_t maxPayloadSize, int fecGroupSize)
+{
+	return write(data, size, VideoFrameDatagram::TYPE, flags, sender, frameId, maxPayloadSize, fecGroupSize);
+}
+
+size_t FrameDatagramWriter::writeAudioFrame(const dg_byte_t* data, size_t size, AudioFrameDatagram::dg_frame_id_t frameId,
+		AudioFrameDatagram::dg_sender_t sender, AudioFrameDatagram::dg_level_t level, dg_size_t maxPayloadSize)
+{
+	return write(data, size, AudioFrameDatagram::TYPE, level, sender, frameId, maxPayloadSize, 0);
+}
+
+size_t FrameDatagramWriter::write(const dg_byte_t* data, size_t size, Datagram::dg_type_t type, uint8_t typeField,
+								  uint32_t sender, uint64_t frameId, dg_size_t maxPayloadSize, int fecGroupSize)
+{
+	_count = 0;
+	if (fecGroupSize > VideoFrameFec::MAXGROUPSIZE)
+	{
+		fecGroupSize = VideoFrameFec::MAXGROUPSIZE;
+	}
+	if (fecGroupSize > 0)
+	{
+		// Room for the FEC header in the parity datagrams.
+		maxPayloadSize = maxPayloadSize > VideoFrameFec::FEC_HEADER_SIZE ? (dg_size_t)(maxPayloadSize - VideoFrameFec::FEC_HEADER_SIZE) : 0;
+	}
+	if (!data || size == 0 || maxPayloadSize == 0)
+	{
+		return 0;
+	}
+	const size_t count = (size + maxPayloadSize - 1) / maxPayloadSize;
+	if (count > 0xFFFF)
+	{
+		return 0;
+	}
+	const size_t total = count + VideoFrameFec::groupCount(count, fecGroupSize);
+
+	// Grow before writing, the slices point into the arena.
+	if (_headers.size() < total * FRAME_HEADER_SIZE)
+		_headers.resize(total * FRAME_HEADER_SIZE);
+	if (_slices.size() < total)
+		_slices.resize(total);
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		const auto offset = i * maxPayloadSize;
+		const auto len = (offset + maxPayloadSize > size) ? size - offset : (size_t)maxPayloadSize;
+
+		dg_byte_t* h = _headers.data() + i * FRAME_HEADER_SIZE;
+		h[0] = Datagram::MAGIC;
+		h[1] = type;
+		h[VideoFrameDatagramView::OFFSET_FLAGS] = typeField;
+		writeU32(h + VideoFrameDatagramView::OFFSET_SENDER, sender);
+		writeU64(h + VideoFrameDatagramView::OFFSET_FRAMEID, frameId);
+		writeU16(h + VideoFrameDatagramView::OFFSET_INDEX, (uint16_t)i);
+		writeU16(h + VideoFrameDatagramView::OFFSET_COUNT, (uint16_t)count);
+		writeU16(h + VideoFrameDatagramView::OFFSET_SIZE, (uint16_t)len);
+
+		auto& s = _slices[i];
+		s.header = h;
+		s.headerSize = FRAME_HEADER_SIZE;
+		s.payload = data + offset;
+		s.payloadSize = len;
+	}
+	_count = count;
+
+	if (fecGroupSize > 0)
+	{
+		writeParity(count, fecGroupSize, maxPayloadSize);
+	}
+	return _count;
+}
+
+void FrameDatagramWriter::writeParity(size_t count, int groupSize, dg_size_t chunkSize)
+{
+	const auto groups = VideoFrameFec::groupCount(count, groupSize);
+	const size_t paritySize = VideoFrameFec::FEC_HEADER_SIZE + chunkSize;
+	if (_parity.size() < groups * paritySize)
+		_parity.resize(groups * paritySize);
+
+	for (size_t g = 0; g < groups; ++g)
+	{
+		const auto first = g * groupSize;
+		const auto last = first + groupSize < count ? first + groupSize : count;
+
+		dg_byte_t* p = _parity.data() + g * paritySize;
+		memset(p, 0, paritySize);
+		p[VideoFrameFec::OFFSET_GROUPSIZE] = (dg_byte_t)groupSize;
+		uint16_t sizes = 0;
+		size_t largest = 0;
+		for (auto i = first; i < last; ++i)
+		{
+			const auto& s = _slices[i];
+			sizes ^= (uint16_t)s.payloadSize;
+			largest = s.payloadSize > largest ? s.payloadSize : largest;
+			VideoFrameFec::xorBytes(p + VideoFrameFec::OFFSET_DATA, s.payload, s.payloadSize);
+		}
+		writeU16(p + VideoFrameFec::OFFSET_SIZE, sizes);
+
+		// Same header as the data datagrams of the group, except flags, index and size.
+		const auto& data = _slices[first];
+		dg_byte_t* h = _headers.data() + (count + g) * FRAME_HEADER_SIZE;
+		memcpy(h, data.header, FRAME_HEADER_SIZE);
+		h[VideoFrameDatagramView::OFFSET_FLAGS] |= VideoFrameDatagram::Redundant;
+		writeU16(h + VideoFrameDatagramView::OFFSET_INDEX, (uint16_t)g);
+		writeU16(h + VideoFrameDatagramView::OFFSET_SIZE, (uint16_t)(VideoFrameFec::FEC_HEADER_SIZE + largest));
+
+		auto& s = _slices[count + g];
+		s.header = h;
+		s.headerSize = FRAME_HEADER_SIZE;
+		s.payload = p;
+		s.payloadSize = VideoFrameFec::FEC_HEADER_SIZE + largest;
+	}
+	_count = count + groups;
+}
+
+} // End of namespace.
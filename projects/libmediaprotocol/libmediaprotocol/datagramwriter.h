@@ -0,0 +1,80 @@
+#ifndef UDPPROTOCOL_DATAGRAMWRITER_HEADER
+#define UDPPROTOCOL_DATAGRAMWRITER_HEADER
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+
+#include "protocol.h"
+#include "datagramview.h"
+#include "fec.h"
+
+namespace UDP {
+
+/*!
+    Serialized datagram as two slices, which can be handed to scatter-gather
+    I/O (e.g. as two iovecs): The header in the arena of the writer and the
+    payload in the buffer of the frame.
+*/
+class DatagramSlice
+{
+public:
+	const dg_byte_t* header;
+	size_t headerSize;
+	const dg_byte_t* payload;
+	size_t payloadSize;
+};
+
+/*!
+    Serializes a frame into datagrams without copying its payload.
+
+    The headers of all datagrams are written into a single arena, the
+    payload slices point into the frame buffer, which has to outlive the
+    slices. The arena is reused for every frame and only grows, so no
+    memory is allocated once it has seen the largest frame.
+
+    Produces the same wire format as VideoFrameDatagram::split() and
+    AudioFrameDatagram::split() (see VideoFrameDatagramView and
+    AudioFrameDatagramView). Video frames may get parity datagrams
+    (see VideoFrameFec), which follow the data datagrams in the slices.
+*/
+class FrameDatagramWriter
+{
+public:
+	/*! \param reserveDatagrams Initial size of the arena in datagrams. */
+	explicit FrameDatagramWriter(size_t reserveDatagrams = 64);
+
+	/*! Replaces the slices with the datagrams of a video frame.
+	    \param fecGroupSize Adds a parity datagram per "fecGroupSize" data datagrams, 0 = No parity.
+	    \return Number of datagrams including parity, 0 if "size" is 0 or the frame needs too many datagrams.
+	*/
+	size_t writeVideoFrame(const dg_byte_t* data, size_t size, VideoFrameDatagram::dg_frame_id_t frameId,
+						   VideoFrameDatagram::dg_sender_t sender, VideoFrameDatagram::dg_flags_t flags,
+						   dg_size_t maxPayloadSize = VideoFrameDatagram::MAXSIZE, int fecGroupSize = 0);
+
+	/*! Replaces the slices with the datagrams of an audio frame.
+	    \return Number of datagrams, 0 if "size" is 0 or the frame needs too many datagrams.
+	*/
+	size_t writeAudioFrame(const dg_byte_t* data, size_t size, AudioFrameDatagram::dg_frame_id_t frameId,
+						   AudioFrameDatagram::dg_sender_t sender, AudioFrameDatagram::dg_level_t level,
+						   dg_size_t maxPayloadSize = AudioFrameDatagram::MAXSIZE);
+
+	size_t count() const { return _count; }
+	const DatagramSlice* slices() const { return _slices.data(); }
+	const DatagramSlice& slice(size_t i) const { return _slices[i]; }
+
+private:
+	// Both frame types share the layout after the second header byte.
+	size_t write(const dg_byte_t* data, size_t size, Datagram::dg_type_t type, uint8_t typeField,
+				 uint32_t sender, uint64_t frameId, dg_size_t maxPayloadSize, int fecGroupSize);
+	void writeParity(size_t count, int groupSize, dg_size_t chunkSize);
+
+private:
+	std::vector<dg_byte_t> _headers;
+	std::vector<dg_byte_t> _parity;
+	std::vector<DatagramSlice> _slices;
+	size_t _count;
+};
+
+} // End of namespace.
+#endif
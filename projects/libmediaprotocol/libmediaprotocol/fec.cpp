@@ -0,0 +1,61 @@
+#include "fec.h"
+
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define UDPPROTOCOL_FEC_SSE2
+#endif
+
+namespace UDP {
+
+int VideoFrameFec::groupSizeForLoss(int fractionLost)
+{
+	// A group survives the loss of a single datagram, smaller groups
+	// for higher loss. Above ~10% a parity per two datagrams.
+	if (fractionLost < 3)
+		return 0;
+	else if (fractionLost < 6)
+		return 10;
+	else if (fractionLost < 13)
+		return 5;
+	else if (fractionLost < 26)
+		return 3;
+	return 2;
+}
+
+void VideoFrameFec::xorBytes(dg_byte_t* dst, const dg_byte_t* src, size_t len)
+{
+	size_t i = 0;
+#ifdef UDPPROTOCOL_FEC_SSE2
+	for (; i + 64 <= len; i += 64)
+	{
+		const auto a0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(dst + i)), _mm_loadu_si128((const __m128i*)(src + i)));
+		const auto a1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(dst + i + 16)), _mm_loadu_si128((const __m128i*)(src + i + 16)));
+		const auto a2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(dst + i + 32)), _mm_loadu_si128((const __m128i*)(src + i + 32)));
+		const auto a3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(dst + i + 48)), _mm_loadu_si128((const __m128i*)(src + i + 48)));
+		_mm_storeu_si128((__m128i*)(dst + i), a0);
+		_mm_storeu_si128((__m128i*)(dst + i + 16), a1);
+		_mm_storeu_si128((__m128i*)(dst + i + 32), a2);
+		_mm_storeu_si128((__m128i*)(dst + i + 48), a3);
+	}
+	for (; i + 16 <= len; i += 16)
+	{
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(_mm_loadu_si128((const __m128i*)(dst + i)), _mm_loadu_si128((const __m128i*)(src + i))));
+	}
+#else
+	// Word-wise, memcpy() keeps it free of alignment requirements.
+	for (; i + 8 <= len; i += 8)
+	{
+		uint64_t a, b;
+		memcpy(&a, dst + i, 8);
+		memcpy(&b, src + i, 8);
+		a ^= b;
+		memcpy(dst + i, &a, 8);
+	}
+#endif
+	for (; i < len; ++i)
+		dst[i] ^= src[i];
+}
+
+} // End of namespace.
@@ -0,0 +1,54 @@
+#ifndef UDPPROTOCOL_FEC_HEADER
+#define UDPPROTOCOL_FEC_HEADER
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "protocol.h"
+
+namespace UDP {
+
+/*!
+    Forward error correction for video frames (XOR parity).
+
+    The data datagrams of a frame are split into groups of "groupSize"
+    consecutive datagrams. Each group is followed by a parity datagram,
+    which is a VideoFrameDatagram with the VideoFrameDatagram::Redundant
+    flag. It has the same sender, frame-id and count (of data datagrams) as
+    the data datagrams, its index is the number of the group. A receiver
+    rebuilds a single missing datagram of each group from the parity and
+    the other datagrams of the group.
+
+    Payload of a parity datagram:
+      [0] group size
+      [1] XOR of the payload sizes of the group
+      [3] XOR of the payloads of the group, each padded with zeros
+          to the size of the largest one
+
+    The data datagrams of a frame with parity carry FEC_HEADER_SIZE bytes
+    less payload, so the parity datagrams fit into the same datagram size.
+*/
+class VideoFrameFec
+{
+public:
+	static const size_t OFFSET_GROUPSIZE = 0;
+	static const size_t OFFSET_SIZE = OFFSET_GROUPSIZE + sizeof(uint8_t);
+	static const size_t OFFSET_DATA = OFFSET_SIZE + sizeof(dg_size_t);
+	static const size_t FEC_HEADER_SIZE = OFFSET_DATA;
+
+	static const int MAXGROUPSIZE = 255;
+
+	/*! Number of parity datagrams for "count" data datagrams. */
+	static size_t groupCount(size_t count, int groupSize) { return groupSize > 0 ? (count + groupSize - 1) / groupSize : 0; }
+
+	/*! Group size for the reported fraction of lost datagrams (0-255),
+	    0 = No parity datagrams.
+	*/
+	static int groupSizeForLoss(int fractionLost);
+
+	/*! dst[i] ^= src[i] */
+	static void xorBytes(dg_byte_t* dst, const dg_byte_t* src, size_t len);
+};
+
+} // End of namespace.
+#endif
@@ -182,6 +182,32 @@ int VideoFrameDatagram::split(const dg_byte_t* data, size_t dataLength,
 	return 0;
 }
 
+// Temporal layer and reference distance by code (see VideoFrameDatagram::temporalCode()).
+static const int TEMPORAL_LAYERS[8] = { 0, 0, 1, 0, 2, 1, 2, 0 };
+static const int TEMPORAL_DISTANCES[8] = { 1, 2, 1, 4, 1, 2, 1, 1 };
+
+int VideoFrameDatagram::temporalCode(int temporalLayers, int position)
+{
+	switch (temporalLayers)
+	{
+		case 2:
+			return 1 + (position & 1);
+		case 3:
+			return 3 + (position & 3);
+	}
+	return 0;
+}
+
+int VideoFrameDatagram::temporalLayer(dg_flags_t flags)
+{
+	return TEMPORAL_LAYERS[(flags & TemporalMask) >> TEMPORAL_SHIFT];
+}
+
+int VideoFrameDatagram::temporalDistance(dg_flags_t flags)
+{
+	return TEMPORAL_DISTANCES[(flags & TemporalMask) >> TEMPORAL_SHIFT];
+}
+
 void VideoFrameDatagram::freeData(VideoFrameDatagram** datagrams,
 								  dg_data_count_t length)
 {
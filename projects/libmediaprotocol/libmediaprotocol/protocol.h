@@ -71,6 +71,97 @@ public:
 	~KeepAliveDatagram() {}
 };
 
+/*!
+    Path MTU discovery.
+
+    After the media authentication the client sends probes of decreasing
+    sizes (up to MAXDATAGRAMSIZE) with the "don't fragment" bit set.
+    The server echoes every probe with the same size, the largest echo
+    received by the client is the size of its video datagrams from then on.
+    Peers which never probe keep using DEFAULTDATAGRAMSIZE.
+
+    The largest probe received by the server only proves the uplink of the
+    client. The client confirms the size of the largest echo it received
+    ("setmediadatagramsize"), which proves its downlink as well.
+
+    The server forwards the video datagrams as they are. It sends every
+    sender the smallest size, which its receivers have confirmed
+    ("notify.mediadatagramsize"), the sender uses the smaller of both.
+    Until then DEFAULTDATAGRAMSIZE applies.
+
+    The datagram is padded with zeros up to "size".
+*/
+class MtuProbeDatagram : public Datagram
+{
+public:
+	static const dg_type_t TYPE = 0x04;
+	static const dg_size_t DEFAULTDATAGRAMSIZE = 512;
+	static const dg_size_t MAXDATAGRAMSIZE = 1400;
+
+	MtuProbeDatagram() : Datagram(TYPE), size(0) {}
+
+	dg_size_t size; ///< Total size of the datagram, including all headers.
+};
+
+///////////////////////////////////////////////////////////////////////
+// Transport
+///////////////////////////////////////////////////////////////////////
+
+/*!
+    Extended header in front of a media datagram from a client to the server.
+
+    Every datagram of a client's video (data, parity and retransmissions) is
+    sent with its own transport sequence number, regardless of the layer and
+    frame. The server removes the header before it processes the enclosed
+    datagram and reports the arrival of the sequence numbers back to the
+    client (see TransportFeedbackDatagram), which estimates the available
+    bandwidth from the delays.
+
+    The enclosed datagram follows the header with its own magic and type.
+*/
+class TransportDatagram : public Datagram
+{
+public:
+	typedef uint16_t dg_sequence_t;
+	typedef uint32_t dg_time_t;
+
+	static const dg_type_t TYPE = 0x07;
+
+	TransportDatagram() : Datagram(TYPE), sequence(0), sendTime(0) {}
+
+	dg_sequence_t sequence; ///< Transport sequence number, wraps around.
+	dg_time_t sendTime; ///< Send time in microseconds on the sender's clock, wraps around.
+};
+
+/*!
+    Send from the server to a client with the arrival of its transport
+    sequence numbers (see TransportDatagram).
+
+    Covers "count" consecutive sequence numbers starting with "baseSequence".
+    The arrival times are relative to "referenceTime" in units of
+    ARRIVAL_TICK_US, NOT_RECEIVED for datagrams which did not arrive (yet).
+    The reference time is on the server's clock, which only allows to
+    compare arrival times of the same server with each other.
+*/
+class TransportFeedbackDatagram : public Datagram
+{
+public:
+	typedef uint16_t dg_count_t;
+	typedef uint16_t dg_arrival_t;
+
+	static const dg_type_t TYPE = 0x08;
+	static const dg_count_t MAXCOUNT = 128;
+	static const int ARRIVAL_TICK_US = 250;
+	static const dg_arrival_t NOT_RECEIVED = 0xFFFF;
+
+	TransportFeedbackDatagram() : Datagram(TYPE), baseSequence(0), count(0), referenceTime(0) {}
+
+	TransportDatagram::dg_sequence_t baseSequence;
+	dg_count_t count;
+	TransportDatagram::dg_time_t referenceTime; ///< Microseconds on the server's clock, wraps around.
+	dg_arrival_t arrivals[MAXCOUNT];
+};
+
 ///////////////////////////////////////////////////////////////////////
 // Video
 ///////////////////////////////////////////////////////////////////////
@@ -124,7 +215,51 @@ public:
 										 dg_flags_t) + sizeof(dg_sender_t) + sizeof(dg_frame_id_t) + sizeof(
 										 dg_data_index_t) + sizeof(dg_data_count_t) + sizeof(dg_size_t));
 
-	enum Flags { None = 0, Encrypted = 1, Redundant = 2, Flag3 = 4, Flag4 = 8, Flag5 = 16, Flag6 = 32, Flag7 = 64, Flag8 = 128 };
+	/*!
+		KeyFrame: Set on every datagram of a frame, which can be decoded without
+		          any previous frame. Allows the server to make forwarding decisions
+		          on any datagram of the frame.
+		LayerMask: Simulcast layer of the frame (see layer()).
+		TemporalMask: Position of the frame in the temporal layer pattern (see temporalLayer()).
+	*/
+	enum Flags { None = 0, Encrypted = 1, Redundant = 2, KeyFrame = 4, Flag4 = 8, Flag5 = 16, Flag6 = 32, Flag7 = 64, Flag8 = 128, LayerMask = Flag4 | Flag5, TemporalMask = Flag6 | Flag7 | Flag8 };
+
+	/*!
+		Simulcast: A sender may encode its video in multiple resolutions at once,
+		each as its own stream with own frame-ids. Layer 0 has the resolution
+		announced by the sender, every following layer half of the previous one.
+		The server forwards a single layer to each receiver.
+	*/
+	static const int LAYER_SHIFT = 3;
+	static const int MAXLAYERS = 4;
+	static int layer(dg_flags_t flags) { return (flags & LayerMask) >> LAYER_SHIFT; }
+	static dg_flags_t withLayer(dg_flags_t flags, int layer) { return (dg_flags_t)((flags & ~LayerMask) | ((layer << LAYER_SHIFT) & LayerMask)); }
+
+	/*!
+		Temporal scalability: The encoder repeats a fixed pattern of frames,
+		in which each frame only references frames of its own or lower
+		temporal layers. Frames of higher temporal layers can be dropped,
+		without breaking the stream (2 layers = 1/2, 3 layers = 1/4 of the
+		frame rate on temporal layer 0).
+
+		  2 layers: 0, 1
+		  3 layers: 0, 2, 1, 2
+
+		The flags carry a code for the number of layers and the position
+		within the pattern (0 = No temporal layers).
+	*/
+	static const int TEMPORAL_SHIFT = 5;
+	static const int MAXTEMPORALLAYERS = 3;
+	static int temporalCode(int temporalLayers, int position);
+	static dg_flags_t withTemporalCode(dg_flags_t flags, int code) { return (dg_flags_t)((flags & ~TemporalMask) | ((code << TEMPORAL_SHIFT) & TemporalMask)); }
+
+	/*! Temporal layer of the frame (0 without temporal layers). */
+	static int temporalLayer(dg_flags_t flags);
+
+	/*! Distance to the most recent previous frame, which the frame may reference.
+		All frames in between are of higher temporal layers and may be missing.
+	*/
+	static int temporalDistance(dg_flags_t flags);
 
 	VideoFrameDatagram() : Datagram(TYPE), flags(0), sender(0), frameId(0),
 		index(0), count(0), size(0), data(0) {}
@@ -179,26 +314,92 @@ public:
 	index; ///< If greater than 0, only a single datagram of the frame will be resend.
 };
 
+/*!
+	Send from a receiver to the sender of a video frame, to request
+	a resend of the listed datagrams of the frame.
+*/
+class VideoFrameNackDatagram : public Datagram
+{
+public:
+	typedef uint8_t dg_layer_t;
+	typedef uint16_t dg_index_count_t;
+
+	const static dg_type_t TYPE = 0x06;
+	const static dg_index_count_t MAXINDICES = 64;
+
+	VideoFrameNackDatagram() :
+		Datagram(TYPE),
+		sender(0),
+		frameId(0),
+		layer(0),
+		count(0)
+	{}
+
+	VideoFrameDatagram::dg_sender_t sender; ///< ID of the sender of the frame.
+	VideoFrameDatagram::dg_frame_id_t frameId;
+	dg_layer_t layer; ///< Simulcast layer of the frame, every layer has its own frame-ids.
+	dg_index_count_t count; ///< Number of indices.
+	VideoFrameDatagram::dg_data_index_t indices[MAXINDICES]; ///< Indices of the missing datagrams.
+};
+
+/*!
+	Send periodically from a receiver of a video stream to its sender,
+	the sender adapts its forward error correction (see VideoFrameFec).
+*/
+class VideoReceiverReportDatagram : public Datagram
+{
+public:
+	const static dg_type_t TYPE = 0x05;
+
+	VideoReceiverReportDatagram() :
+		Datagram(TYPE),
+		sender(0),
+		fractionLost(0)
+	{}
+
+	VideoFrameDatagram::dg_sender_t sender; ///< ID of the sender of the video stream.
+	uint8_t fractionLost; ///< Lost datagrams since the last report (0 = None, 255 = All).
+};
+
 ///////////////////////////////////////////////////////////////////////
 // Audio
 ///////////////////////////////////////////////////////////////////////
 
 /*!
+	Every datagram of an audio frame carries the audio level of the frame,
+	which allows the server to forward the active speakers only.
 */
 class AudioFrameDatagram : public Datagram
 {
 public:
+	typedef uint8_t dg_level_t;
 	typedef ocs::clientid_t dg_sender_t;
 	typedef uint64_t dg_frame_id_t;
 	typedef uint16_t dg_data_index_t;
 	typedef uint16_t dg_data_count_t;
 
 	const static dg_type_t TYPE = 0xA0;
-	const static dg_size_t MAXSIZE = Datagram::MAXSIZE - (sizeof(
+	const static dg_size_t MAXSIZE = Datagram::MAXSIZE - (sizeof(dg_level_t) + sizeof(
 										 dg_sender_t) + sizeof(dg_frame_id_t) + sizeof(dg_data_index_t) + sizeof(
 										 dg_data_count_t) + sizeof(dg_size_t));
 
-	AudioFrameDatagram() : Datagram(TYPE) {}
+	/*!
+		Level (similar to RFC 6464):
+		  Bit 7: Voice activity.
+		  Bit 0-6: Level in -dBov (0 = Loudest, 127 = Silence).
+	*/
+	static const dg_level_t VOICE_ACTIVITY = 0x80;
+	static const dg_level_t LEVEL_MASK = 0x7F;
+	static const dg_level_t SILENCE = 127;
+
+	/*!
+		Sender-id of the streams, which are mixed by the server. Client-ids
+		start at 1, clients ignore frames with sender-id 0.
+	*/
+	static const dg_sender_t MIXED_SENDER = -1;
+
+	AudioFrameDatagram() : Datagram(TYPE), level(SILENCE), sender(0), frameId(0),
+		index(0), count(0), size(0), data(0) {}
 	bool write(FILE* f) const;
 	bool read(FILE* f);
 
@@ -207,6 +408,7 @@ public:
 					 AudioFrameDatagram::dg_data_count_t& datagramsLength_);
 	static void freeData(AudioFrameDatagram** datagrams, dg_data_count_t length);
 
+	dg_level_t level;
 	dg_sender_t sender;
 	dg_frame_id_t frameId;
 	dg_data_index_t index;
@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <vector>
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QJsonObject>
+#include <QString>
+
+#include <benchmark/benchmark.h>
+
+#include "libcorprotocol/parser.h"
+
+#include "libapp/jsonprotocolhelper.h"
+
+/*
+	Control connection: COR frame parsing (as QCorConnection does on every
+	readyRead) and decoding of the JSON requests, which the server does for
+	each action.
+*/
+
+namespace
+{
+
+QByteArray createJsonRequest()
+{
+	QJsonObject params;
+	params["width"] = 640;
+	params["height"] = 480;
+	params["bitrate"] = 300;
+	params["fps"] = 15;
+	params["layers"] = 3;
+	return JsonProtocolHelper::createJsonRequest("clientenablevideo", params);
+}
+
+// "count" COR request frames in network byte order (see QCorConnection::doNextSendItem()).
+QByteArray createCorStream(int count)
+{
+	const auto body = createJsonRequest();
+	QByteArray data;
+	QDataStream out(&data, QIODevice::WriteOnly);
+	out.setByteOrder(QDataStream::BigEndian);
+	for (auto i = 0; i < count; ++i)
+	{
+		out << (cor_version_t)1;
+		out << (cor_type_t)COR_FRAME_TYPE_REQUEST;
+		out << (cor_flags_t)0;
+		out << (cor_correlation_t)(i + 1);
+		out << (cor_data_length_t)body.size();
+		out.writeRawData(body.constData(), body.size());
+	}
+	return data;
+}
+
+class ParserCounters
+{
+public:
+	int64_t frames = 0;
+	int64_t bodyBytes = 0;
+};
+
+int onFrameEnd(cor_parser* parser)
+{
+	++static_cast<ParserCounters*>(parser->object)->frames;
+	return 0;
+}
+
+int onFrameBodyData(cor_parser* parser, const uint8_t* data, size_t length)
+{
+	benchmark::DoNotOptimize(data);
+	static_cast<ParserCounters*>(parser->object)->bodyBytes += length;
+	return 0;
+}
+
+} // namespace
+
+/*
+	Parses 16 frames, which arrive in chunks of Arg bytes (0 = all at once).
+	Incomplete headers stay in the buffer, like in QCorConnection.
+*/
+static void BM_CorParser_Parse(benchmark::State& state)
+{
+	const auto chunkSize = (int)state.range(0);
+	const auto stream = createCorStream(16);
+	const auto data = (const uint8_t*)stream.constData();
+	const size_t length = stream.size();
+
+	cor_parser_settings settings;
+	cor_parser_settings_init(&settings);
+	settings.on_frame_body_data = &onFrameBodyData;
+	settings.on_frame_end = &onFrameEnd;
+
+	ParserCounters counters;
+	cor_parser parser;
+	cor_parser_init(&parser);
+	parser.object = &counters;
+
+	for (auto _ : state)
+	{
+		size_t offset = 0;
+		size_t available = 0;
+		while (offset < length)
+		{
+			available = chunkSize > 0 ? std::min(length - offset, available + chunkSize) : length - offset;
+			const auto read = cor_parser_parse(&parser, &settings, data + offset, available);
+			offset += read;
+			available -= read;
+		}
+	}
+	state.SetItemsProcessed(counters.frames);
+	state.SetBytesProcessed(state.iterations() * (int64_t)length);
+}
+BENCHMARK(BM_CorParser_Parse)->Arg(0)->Arg(64)->Arg(1460);
+
+static void BM_JsonProtocolHelper_FromJsonRequest(benchmark::State& state)
+{
+	const auto request = createJsonRequest();
+	QString action;
+	QJsonObject params;
+	for (auto _ : state)
+	{
+		auto ok = JsonProtocolHelper::fromJsonRequest(request, action, params);
+		benchmark::DoNotOptimize(ok);
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * (int64_t)request.size());
+}
+BENCHMARK(BM_JsonProtocolHelper_FromJsonRequest);
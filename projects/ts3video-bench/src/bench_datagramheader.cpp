@@ -0,0 +1,134 @@
+#include <cstring>
+#include <vector>
+
+#include <QByteArray>
+#include <QBuffer>
+#include <QDataStream>
+
+#include <benchmark/benchmark.h>
+
+#include "libmediaprotocol/protocol.h"
+#include "libmediaprotocol/datagramview.h"
+
+/*
+	Per-packet cost of the relay's header parsing.
+
+	"QDataStream" is the way MediaSocketHandler::onReadyRead() used to parse
+	every incoming datagram: Reset a QBuffer and QDataStream over the raw
+	socket buffer and stream the fields out of it.
+	"View" reads the same fields at their fixed offsets (UDP::*DatagramView).
+*/
+
+// Creates a full-size serialized VideoFrameDatagram.
+static std::vector<char> createVideoFrameDatagram()
+{
+	const UDP::dg_size_t payloadSize = UDP::VideoFrameDatagram::MAXSIZE;
+	QByteArray buf;
+	QDataStream out(&buf, QIODevice::WriteOnly);
+	out.setByteOrder(QDataStream::BigEndian);
+	out << (quint8)UDP::Datagram::MAGIC;
+	out << (quint8)UDP::VideoFrameDatagram::TYPE;
+	out << (quint8)0;           // flags
+	out << (qint32)42;          // sender
+	out << (quint64)1234567;    // frameId
+	out << (quint16)3;          // index
+	out << (quint16)8;          // count
+	out << (quint16)payloadSize;
+	std::vector<char> payload(payloadSize, 'x');
+	out.writeRawData(payload.data(), payloadSize);
+	return std::vector<char>(buf.constData(), buf.constData() + buf.size());
+}
+
+static void BM_DatagramHeader_QDataStream(benchmark::State& state)
+{
+	auto packet = createVideoFrameDatagram();
+	QByteArray data;
+	QBuffer dataBuffer;
+	QDataStream in;
+	in.setByteOrder(QDataStream::BigEndian);
+	UDP::Datagram baseDatagram;
+
+	for (auto _ : state)
+	{
+		data.setRawData(packet.data(), (uint)packet.size());
+		dataBuffer.close();
+		dataBuffer.setBuffer(&data);
+		dataBuffer.open(QIODevice::ReadOnly);
+		in.setDevice(&dataBuffer);
+		in.resetStatus();
+
+		in >> baseDatagram.magic;
+		in >> baseDatagram.type;
+		benchmark::DoNotOptimize(baseDatagram.magic);
+		benchmark::DoNotOptimize(baseDatagram.type);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DatagramHeader_QDataStream);
+
+static void BM_DatagramHeader_View(benchmark::State& state)
+{
+	auto packet = createVideoFrameDatagram();
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(packet.data());
+		const UDP::DatagramView dg(packet.data(), packet.size());
+		auto valid = dg.isValid();
+		auto type = dg.type();
+		benchmark::DoNotOptimize(valid);
+		benchmark::DoNotOptimize(type);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DatagramHeader_View);
+
+static void BM_VideoFrameHeader_QDataStream(benchmark::State& state)
+{
+	auto packet = createVideoFrameDatagram();
+	QByteArray data;
+	QBuffer dataBuffer;
+	QDataStream in;
+	in.setByteOrder(QDataStream::BigEndian);
+	UDP::VideoFrameDatagram dg;
+
+	for (auto _ : state)
+	{
+		data.setRawData(packet.data(), (uint)packet.size());
+		dataBuffer.close();
+		dataBuffer.setBuffer(&data);
+		dataBuffer.open(QIODevice::ReadOnly);
+		in.setDevice(&dataBuffer);
+		in.resetStatus();
+
+		quint64 frameId;
+		in >> dg.magic >> dg.type >> dg.flags >> dg.sender >> frameId >> dg.index >> dg.count >> dg.size;
+		benchmark::DoNotOptimize(frameId);
+		benchmark::DoNotOptimize(dg.size);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_VideoFrameHeader_QDataStream);
+
+static void BM_VideoFrameHeader_View(benchmark::State& state)
+{
+	auto packet = createVideoFrameDatagram();
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(packet.data());
+		const UDP::VideoFrameDatagramView dg(packet.data(), packet.size());
+		auto valid = dg.isValid();
+		auto sender = dg.sender();
+		auto frameId = dg.frameId();
+		auto index = dg.index();
+		auto count = dg.count();
+		auto size = dg.payloadSize();
+		benchmark::DoNotOptimize(valid);
+		benchmark::DoNotOptimize(sender);
+		benchmark::DoNotOptimize(frameId);
+		benchmark::DoNotOptimize(index);
+		benchmark::DoNotOptimize(count);
+		benchmark::DoNotOptimize(size);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_VideoFrameHeader_View);
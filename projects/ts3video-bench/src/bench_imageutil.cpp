@@ -0,0 +1,86 @@
+#include <memory>
+#include <vector>
+
+#include <QImage>
+
+#include <benchmark/benchmark.h>
+
+#include "libapp/imageutil.h"
+#include "libapp/yuvframe.h"
+
+/*
+	Color conversion and scaling of the client's video pipeline:
+	Camera image to YV12 (encoder input), chroma upsampling and YUV to
+	QImage (decoder output). Args are the resolution.
+*/
+
+static void imageSizes(benchmark::internal::Benchmark* b)
+{
+	b->Args({320, 240});
+	b->Args({640, 480});
+	b->Args({1280, 720});
+}
+
+static void BM_RgbToYV12(benchmark::State& state)
+{
+	const auto width = (int)state.range(0);
+	const auto height = (int)state.range(1);
+	std::vector<unsigned char> rgb(width * height * 3);
+	for (size_t i = 0; i < rgb.size(); ++i)
+		rgb[i] = (unsigned char)(i * 7);
+	std::vector<unsigned char> y(width * height);
+	std::vector<unsigned char> u((width / 2) * (height / 2));
+	std::vector<unsigned char> v((width / 2) * (height / 2));
+
+	for (auto _ : state)
+	{
+		rgbToYV12(rgb.data(), width, height, y.data(), u.data(), v.data(), RGB24);
+		benchmark::DoNotOptimize(y.data());
+		benchmark::DoNotOptimize(u.data());
+		benchmark::DoNotOptimize(v.data());
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * (int64_t)rgb.size());
+}
+BENCHMARK(BM_RgbToYV12)->Apply(imageSizes);
+
+static void BM_LanczosInterp2(benchmark::State& state)
+{
+	const auto width = (int)state.range(0);
+	const auto height = (int)state.range(1);
+	std::vector<unsigned char> in((width / 2) * (height / 2));
+	for (size_t i = 0; i < in.size(); ++i)
+		in[i] = (unsigned char)(i * 3);
+	std::vector<unsigned char> out(width * height);
+
+	for (auto _ : state)
+	{
+		lanczos_interp2(in.data(), out.data(), width / 2, width, height);
+		benchmark::DoNotOptimize(out.data());
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * (int64_t)out.size());
+}
+BENCHMARK(BM_LanczosInterp2)->Apply(imageSizes);
+
+static void BM_YuvFrame_ToQImage(benchmark::State& state)
+{
+	const auto width = (int)state.range(0);
+	const auto height = (int)state.range(1);
+	std::unique_ptr<YuvFrame> frame(YuvFrame::create(width, height));
+	for (auto i = 0; i < width * height; ++i)
+		frame->y[i] = (unsigned char)i;
+	for (auto i = 0; i < (width / 2) * (height / 2); ++i)
+	{
+		frame->u[i] = (unsigned char)(i * 3);
+		frame->v[i] = (unsigned char)(i * 5);
+	}
+
+	for (auto _ : state)
+	{
+		auto image = frame->toQImage();
+		benchmark::DoNotOptimize(image.constBits());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_YuvFrame_ToQImage)->Apply(imageSizes);
@@ -0,0 +1,137 @@
+#include <memory>
+#include <vector>
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QHostAddress>
+
+#include <benchmark/benchmark.h>
+
+#include "libmediaprotocol/protocol.h"
+
+#include "mediarelay.h"
+#include "mediaroutingtable.h"
+
+/*
+	Forwarding cost of the relay per incoming video datagram.
+
+	MediaSocketHandler hands every datagram to a MediaRelay, which does the
+	routing and passes the outgoing datagrams to its Output. The Output is
+	replaced by a mock, which only counts, the numbers exclude socket I/O.
+*/
+
+namespace
+{
+
+class MockOutput : public MediaRelay::Output
+{
+public:
+	virtual bool sendDatagram(const char* data, int len, const MediaEndpoint& to)
+	{
+		benchmark::DoNotOptimize(data);
+		benchmark::DoNotOptimize(to.sockAddr());
+		++datagrams;
+		bytes += len;
+		return true;
+	}
+
+	virtual void authenticateToken(const QString&, const QHostAddress&, quint16)
+	{
+	}
+
+	virtual void probeMtu(int, const QHostAddress&, quint16)
+	{
+	}
+
+public:
+	quint64 datagrams = 0;
+	quint64 bytes = 0;
+};
+
+// Creates a full-size serialized VideoFrameDatagram of a delta frame.
+std::vector<char> createVideoFrameDatagram()
+{
+	const UDP::dg_size_t payloadSize = UDP::VideoFrameDatagram::MAXSIZE;
+	QByteArray buf;
+	QDataStream out(&buf, QIODevice::WriteOnly);
+	out.setByteOrder(QDataStream::BigEndian);
+	out << (quint8)UDP::Datagram::MAGIC;
+	out << (quint8)UDP::VideoFrameDatagram::TYPE;
+	out << (quint8)0;           // flags
+	out << (qint32)1;           // sender
+	out << (quint64)1234567;    // frameId
+	out << (quint16)0;          // index
+	out << (quint16)1;          // count
+	out << (quint16)payloadSize;
+	std::vector<char> payload(payloadSize, 'x');
+	out.writeRawData(payload.data(), payloadSize);
+	return std::vector<char>(buf.constData(), buf.constData() + buf.size());
+}
+
+// One sender (client-id 1) with "receivers" receivers on localhost.
+MediaRecipients createRecipients(int receivers)
+{
+	MediaSenderEntity sender;
+	sender.clientId = 1;
+	sender.address = QHostAddress::LocalHost;
+	sender.port = 10000;
+	for (auto i = 0; i < receivers; ++i)
+	{
+		MediaReceiverEntity receiver;
+		receiver.clientId = 2 + i;
+		receiver.address = QHostAddress::LocalHost;
+		receiver.port = (quint16)(20000 + i);
+		sender.receivers.append(receiver);
+	}
+
+	MediaRecipients rec;
+	rec.addr2sender[sender.address][sender.port] = sender;
+	return rec;
+}
+
+} // namespace
+
+static void BM_MediaRelay_ForwardVideo(benchmark::State& state)
+{
+	const auto receivers = (int)state.range(0);
+	const auto packet = createVideoFrameDatagram();
+	const auto senderEndpoint = MediaEndpoint::fromQHostAddress(QHostAddress::LocalHost, 10000, AF_INET);
+
+	MediaRoutingTableRcu rcu;
+	auto reader = rcu.createReader();
+	rcu.publish(std::unique_ptr<MediaRoutingTable>(new MediaRoutingTable(createRecipients(receivers), AF_INET)));
+
+	MockOutput output;
+	MediaRelay relay(&output, reader, nullptr, nullptr, nullptr, nullptr);
+	relay.refreshRoutes();
+
+	for (auto _ : state)
+	{
+		relay.processDatagram(packet.data(), (int)packet.size(), senderEndpoint);
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * (int64_t)packet.size());
+	state.counters["out_datagrams"] = benchmark::Counter((double)output.datagrams, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_MediaRelay_ForwardVideo)->Arg(1)->Arg(8)->Arg(32)->Arg(128);
+
+static void BM_MediaRelay_UnknownSender(benchmark::State& state)
+{
+	const auto packet = createVideoFrameDatagram();
+	const auto senderEndpoint = MediaEndpoint::fromQHostAddress(QHostAddress::LocalHost, 10001, AF_INET);
+
+	MediaRoutingTableRcu rcu;
+	auto reader = rcu.createReader();
+	rcu.publish(std::unique_ptr<MediaRoutingTable>(new MediaRoutingTable(createRecipients(8), AF_INET)));
+
+	MockOutput output;
+	MediaRelay relay(&output, reader, nullptr, nullptr, nullptr, nullptr);
+	relay.refreshRoutes();
+
+	for (auto _ : state)
+	{
+		relay.processDatagram(packet.data(), (int)packet.size(), senderEndpoint);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MediaRelay_UnknownSender);
@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <QByteArray>
+#include <QDataStream>
+
+#include <benchmark/benchmark.h>
+
+#include "libmediaprotocol/protocol.h"
+#include "libmediaprotocol/datagramwriter.h"
+#include "libmediaprotocol/fec.h"
+
+#include "libapp/vp8frame.h"
+
+#include "libclient/networkclient/udpvideoframedecoder.h"
+
+/*
+	Sender and receiver side of the video frame transport:
+	Splitting an encoded frame into datagrams (VideoFrameDatagram::split()
+	and FrameDatagramWriter, with and without parity) and reassembling the
+	frames with VideoFrameUdpDecoder, in order, reordered and with loss.
+*/
+
+namespace
+{
+
+// Serialized VP8Frame (as sent by MediaSocket) with "size" bytes of payload.
+QByteArray createSerializedFrame(quint64 time, VP8Frame::FrameType type, int size)
+{
+	VP8Frame frame;
+	frame.time = time;
+	frame.type = type;
+	frame.data = QByteArray(size, 'x');
+
+	QByteArray data;
+	QDataStream out(&data, QIODevice::WriteOnly);
+	out << frame;
+	return data;
+}
+
+// Datagrams of "frameCount" frames, which start with a key frame.
+std::vector<UDP::VideoFrameDatagram*> createDatagrams(quint64 firstFrameId, int frameCount, int frameSize)
+{
+	std::vector<UDP::VideoFrameDatagram*> all;
+	for (auto i = 0; i < frameCount; ++i)
+	{
+		const auto frameId = firstFrameId + i;
+		const auto data = createSerializedFrame(frameId, i == 0 ? VP8Frame::KEY : VP8Frame::NORMAL, frameSize);
+		UDP::VideoFrameDatagram** datagrams = nullptr;
+		UDP::VideoFrameDatagram::dg_data_count_t count = 0;
+		UDP::VideoFrameDatagram::split((const UDP::dg_byte_t*)data.constData(), data.size(), frameId, 1, &datagrams, count);
+		all.insert(all.end(), datagrams, datagrams + count);
+		delete[] datagrams;
+	}
+	return all;
+}
+
+} // namespace
+
+static void BM_VideoFrameDatagram_Split(benchmark::State& state)
+{
+	const auto data = createSerializedFrame(1, VP8Frame::NORMAL, (int)state.range(0));
+	for (auto _ : state)
+	{
+		UDP::VideoFrameDatagram** datagrams = nullptr;
+		UDP::VideoFrameDatagram::dg_data_count_t count = 0;
+		UDP::VideoFrameDatagram::split((const UDP::dg_byte_t*)data.constData(), data.size(), 1, 1, &datagrams, count);
+		benchmark::DoNotOptimize(datagrams);
+		UDP::VideoFrameDatagram::freeData(datagrams, count);
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * (int64_t)data.size());
+}
+BENCHMARK(BM_VideoFrameDatagram_Split)->Arg(1000)->Arg(10000)->Arg(100000);
+
+// Send path of MediaSocket: Headers into the reused arena, payload by reference.
+static void BM_FrameDatagramWriter_WriteVideoFrame(benchmark::State& state)
+{
+	const auto data = createSerializedFrame(1, VP8Frame::NORMAL, (int)state.range(0));
+	UDP::FrameDatagramWriter writer;
+	for (auto _ : state)
+	{
+		auto count = writer.writeVideoFrame((const UDP::dg_byte_t*)data.constData(), data.size(), 1, 1, UDP::VideoFrameDatagram::None);
+		benchmark::DoNotOptimize(count);
+		benchmark::DoNotOptimize(writer.slices());
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * (int64_t)data.size());
+}
+BENCHMARK(BM_FrameDatagramWriter_WriteVideoFrame)->Arg(1000)->Arg(10000)->Arg(100000);
+
+// Args: frame size, FEC group size.
+static void BM_FrameDatagramWriter_WriteVideoFrameFec(benchmark::State& state)
+{
+	const auto data = createSerializedFrame(1, VP8Frame::NORMAL, (int)state.range(0));
+	const auto groupSize = (int)state.range(1);
+	UDP::FrameDatagramWriter writer;
+	for (auto _ : state)
+	{
+		auto count = writer.writeVideoFrame((const UDP::dg_byte_t*)data.constData(), data.size(), 1, 1, UDP::VideoFrameDatagram::None, UDP::VideoFrameDatagram::MAXSIZE, groupSize);
+		benchmark::DoNotOptimize(count);
+		benchmark::DoNotOptimize(writer.slices());
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * (int64_t)data.size());
+}
+BENCHMARK(BM_FrameDatagramWriter_WriteVideoFrameFec)
+->Args({10000, 10})
+->Args({10000, 2})
+->Args({100000, 5});
+
+static void BM_VideoFrameFec_XorBytes(benchmark::State& state)
+{
+	std::vector<UDP::dg_byte_t> dst(state.range(0), 0x5A);
+	std::vector<UDP::dg_byte_t> src(state.range(0), 0xA5);
+	for (auto _ : state)
+	{
+		UDP::VideoFrameFec::xorBytes(dst.data(), src.data(), src.size());
+		benchmark::ClobberMemory();
+	}
+	state.SetBytesProcessed(state.iterations() * (int64_t)src.size());
+}
+BENCHMARK(BM_VideoFrameFec_XorBytes)->Arg(487)->Arg(1376);
+
+/*
+	Adds the datagrams of 64 frames (4 KB each) to a new decoder and takes
+	the completed frames with next() after every datagram.
+
+	Args: reorder window in datagrams (0 = in order), loss in percent.
+*/
+static void BM_VideoFrameUdpDecoder_AddNext(benchmark::State& state)
+{
+	const auto reorderWindow = (int)state.range(0);
+	const auto lossPercent = (int)state.range(1);
+	const auto frameCount = 64;
+	std::mt19937 rng(42);
+	quint64 frameId = 1;
+	int64_t datagramsAdded = 0;
+	int64_t framesCompleted = 0;
+
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		auto datagrams = createDatagrams(frameId, frameCount, 4000);
+		frameId += frameCount;
+		if (reorderWindow > 1)
+		{
+			for (size_t i = 0; i < datagrams.size(); i += reorderWindow)
+				std::shuffle(datagrams.begin() + i, datagrams.begin() + std::min(datagrams.size(), i + reorderWindow), rng);
+		}
+		if (lossPercent > 0)
+		{
+			auto end = std::remove_if(datagrams.begin(), datagrams.end(), [&rng, lossPercent](UDP::VideoFrameDatagram* dg)
+			{
+				if ((int)(rng() % 100) >= lossPercent)
+					return false;
+				delete dg;
+				return true;
+			});
+			datagrams.erase(end, datagrams.end());
+		}
+		state.ResumeTiming();
+
+		VideoFrameUdpDecoder decoder;
+		for (auto dg : datagrams)
+		{
+			decoder.add(dg);
+			VP8Frame* frame = nullptr;
+			while ((frame = decoder.next()) != nullptr)
+			{
+				++framesCompleted;
+				delete frame;
+			}
+		}
+		datagramsAdded += datagrams.size();
+	}
+	state.SetItemsProcessed(datagramsAdded);
+	state.counters["frames"] = benchmark::Counter((double)framesCompleted, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_VideoFrameUdpDecoder_AddNext)
+->Args({0, 0})
+->Args({8, 0})
+->Args({0, 5})
+->Args({8, 5});
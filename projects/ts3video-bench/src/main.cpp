@@ -0,0 +1,35 @@
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+/*
+	Writes the results as JSON to "ts3video-bench.json" in addition to the
+	console output, unless --benchmark_out is given. The file can be compared
+	between releases, e.g. with Google Benchmark's tools/compare.py.
+*/
+int main(int argc, char* argv[])
+{
+	std::vector<char*> args(argv, argv + argc);
+	auto hasOut = false;
+	for (auto i = 1; i < argc; ++i)
+	{
+		if (std::strncmp(argv[i], "--benchmark_out=", 16) == 0)
+			hasOut = true;
+	}
+	std::string outArg("--benchmark_out=ts3video-bench.json");
+	std::string formatArg("--benchmark_out_format=json");
+	if (!hasOut)
+	{
+		args.push_back(&outArg[0]);
+		args.push_back(&formatArg[0]);
+	}
+
+	auto count = (int)args.size();
+	benchmark::Initialize(&count, args.data());
+	if (benchmark::ReportUnrecognizedArguments(count, args.data()))
+		return 1;
+	benchmark::RunSpecifiedBenchmarks();
+	return 0;
+}
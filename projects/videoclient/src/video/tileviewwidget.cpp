@@ -196,6 +196,9 @@ void TileViewWidget::addClient(const ClientEntity& client,
 
 		d->tilesLayout->addWidget(tile);
 		d->tilesMap.insert(client.id, tile);
+
+		auto reply = d->window->networkClient()->setRemoteVideoSize(client.id, d->tilesCurrentSize);
+		QCORREPLY_AUTODELETE(reply);
 	}
 }
 
@@ -276,6 +279,14 @@ void TileViewWidget::setTileSize(const QSize& size)
 		w->setFixedSize(newSize);
 	}
 	d->tilesLayout->update();
+
+	// The server picks the size of the remote videos (simulcast) by it.
+	auto nc = d->window->networkClient();
+	foreach(auto clientId, d->tilesMap.keys())
+	{
+		auto reply = nc->setRemoteVideoSize(clientId, newSize);
+		QCORREPLY_AUTODELETE(reply);
+	}
 }
 
 #if defined(OCS_INCLUDE_AUDIO)
@@ -0,0 +1,189 @@
+#include "loadclient.h"
+
+#include <QDataStream>
+#include <QJsonObject>
+
+#include "humblelogging/api.h"
+
+#include "libqtcorprotocol/qcorreply.h"
+
+#include "libapp/cliententity.h"
+#include "libapp/jsonprotocolhelper.h"
+#include "libapp/vp8frame.h"
+
+#include "libclient/networkclient/networkclient.h"
+
+#include "syntheticvideo.h"
+#include "loadgenerator.h"
+
+HUMBLE_LOGGER(HL, "loadgen.client");
+
+// Number of remembered send times, covers several seconds of video.
+static const int SENT_FRAMES_SIZE = 512;
+
+// Frames of the first second of a sender may be replayed from the
+// relay's key frame cache, their latency is not measured.
+static const qint64 REPLAY_WINDOW_US = 1000000;
+
+///////////////////////////////////////////////////////////////////////
+
+LoadClient::LoadClient(const Options& opts, const SyntheticVideo* video, LoadGenerator* generator) :
+	QObject(generator),
+	_opts(opts),
+	_video(video),
+	_generator(generator),
+	_nc(new NetworkClient()),
+	_joined(false),
+	_nextSeq(1),
+	_sentFrames(SENT_FRAMES_SIZE)
+{
+	_frameTimer.setTimerType(Qt::PreciseTimer);
+	_frameTimer.setInterval(1000 / qMax(1, _opts.fps));
+	connect(&_frameTimer, &QTimer::timeout, this, &LoadClient::sendNextFrame);
+	_nc->setVideoFec(_opts.fec);
+
+	connect(_nc.data(), &NetworkClient::connected, this, &LoadClient::onConnected);
+	connect(_nc.data(), &NetworkClient::mediaSocketAuthenticated, this, &LoadClient::onMediaSocketAuthenticated);
+	connect(_nc.data(), &NetworkClient::serverError, this, &LoadClient::onServerError);
+	connect(_nc.data(), &NetworkClient::videoFrameReceived, this, &LoadClient::onVideoFrameReceived);
+	connect(_nc.data(), &NetworkClient::newVideoFrame, this, &LoadClient::onNewVideoFrame);
+	connect(_nc.data(), &NetworkClient::error, [this](QAbstractSocket::SocketError socketError)
+	{
+		HL_WARN(HL, QString("Connection error (client=%1; error=%2)").arg(_opts.name).arg(socketError).toStdString());
+	});
+}
+
+LoadClient::~LoadClient()
+{
+}
+
+void LoadClient::start()
+{
+	_nc->connectToHost(_opts.address, _opts.port);
+}
+
+void LoadClient::stop()
+{
+	_frameTimer.stop();
+	if (_joined)
+	{
+		QCorReply::autoDelete(_nc->goodbye());
+		_joined = false;
+	}
+}
+
+ocs::clientid_t LoadClient::clientId() const
+{
+	return _nc->clientEntity().id;
+}
+
+qint64 LoadClient::sendTimeUs(quint64 seq) const
+{
+	const auto& f = _sentFrames[seq % _sentFrames.size()];
+	return f.seq == seq ? f.timeUs : -1;
+}
+
+LoadClientStatistics LoadClient::takeStatistics()
+{
+	LoadClientStatistics stats;
+	std::swap(stats, _statistics);
+	return stats;
+}
+
+void LoadClient::onConnected()
+{
+	auto reply = _nc->auth(_opts.name, _opts.password);
+	QCorReply::autoDelete(reply);
+}
+
+void LoadClient::onMediaSocketAuthenticated()
+{
+	auto reply = _nc->joinChannelByIdentifier(_opts.channel, QString());
+	connect(reply, &QCorReply::finished, [this, reply]()
+	{
+		int status = 0;
+		QJsonObject params;
+		QString error;
+		if (!JsonProtocolHelper::fromJsonResponse(reply->frame()->data(), status, params, error) || status != 0)
+		{
+			HL_ERROR(HL, QString("Can not join channel (client=%1; channel=%2; status=%3; error=%4)").arg(_opts.name).arg(_opts.channel).arg(status).arg(error).toStdString());
+			return;
+		}
+		_joined = true;
+		emit joined();
+		if (_opts.sender)
+			startStreaming();
+	});
+	QCorReply::autoDelete(reply);
+}
+
+void LoadClient::onServerError(int errorCode, const QString& errorMessage)
+{
+	HL_WARN(HL, QString("Server error (client=%1; code=%2; message=%3)").arg(_opts.name).arg(errorCode).arg(errorMessage).toStdString());
+}
+
+void LoadClient::startStreaming()
+{
+	auto reply = _nc->enableEncodedVideoStream(_opts.width, _opts.height, _opts.bitrate, _opts.fps);
+	connect(reply, &QCorReply::finished, [this]()
+	{
+		_frameTimer.start();
+	});
+	QCorReply::autoDelete(reply);
+}
+
+void LoadClient::sendNextFrame()
+{
+	const auto seq = _nextSeq++;
+
+	// The receiver's UDP decoder uses the time as frame number.
+	VP8Frame frame = _video->frame((int)((seq - 1) % _video->frameCount()));
+	frame.time = seq;
+
+	QByteArray data;
+	QDataStream out(&data, QIODevice::WriteOnly);
+	out << frame;
+
+	auto& sent = _sentFrames[seq % _sentFrames.size()];
+	sent.seq = seq;
+	sent.timeUs = LoadGenerator::nowUs();
+	_nc->sendEncodedVideoFrame(data);
+	++_statistics.framesSent;
+}
+
+void LoadClient::onVideoFrameReceived(quint64 frameTime, ocs::clientid_t senderId)
+{
+	const auto nowUs = LoadGenerator::nowUs();
+	++_statistics.framesReceived;
+
+	auto& r = _receptions[senderId];
+	if (r.firstSeq == 0)
+	{
+		r.firstSeq = frameTime;
+		r.lastSeq = frameTime;
+		r.firstUs = nowUs;
+		++_statistics.framesExpected;
+	}
+	else if (frameTime > r.lastSeq)
+	{
+		_statistics.framesExpected += frameTime - r.lastSeq;
+		r.lastSeq = frameTime;
+	}
+
+	if (nowUs - r.firstUs < REPLAY_WINDOW_US)
+	{
+		return;
+	}
+	const auto sender = _generator->client(senderId);
+	const auto sentUs = sender ? sender->sendTimeUs(frameTime) : -1;
+	if (sentUs >= 0)
+	{
+		_statistics.latenciesUs.append(nowUs - sentUs);
+	}
+}
+
+void LoadClient::onNewVideoFrame(YuvFrameRefPtr frame, ocs::clientid_t)
+{
+	if (!frame.isNull())
+		++_statistics.framesDecoded;
+}
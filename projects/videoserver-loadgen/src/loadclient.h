@@ -0,0 +1,139 @@
+#ifndef LOADCLIENT_H
+#define LOADCLIENT_H
+
+#include <vector>
+
+#include <QObject>
+#include <QHash>
+#include <QVector>
+#include <QString>
+#include <QHostAddress>
+#include <QTimer>
+#include <QScopedPointer>
+
+#include "libbase/defines.h"
+
+#include "libapp/yuvframe.h"
+
+class NetworkClient;
+class SyntheticVideo;
+class LoadGenerator;
+
+/*! Counters of a LoadClient since the last call of LoadClient::takeStatistics().
+*/
+class LoadClientStatistics
+{
+public:
+	quint64 framesSent = 0;
+	quint64 framesReceived = 0;
+	quint64 framesDecoded = 0;
+
+	// Frames, which should have been received (by the sequence numbers of the senders).
+	quint64 framesExpected = 0;
+
+	// End-to-end latency (sender -> server -> receiver) of the received frames.
+	QVector<qint64> latenciesUs;
+};
+
+
+/*!
+	Simulated client, which uses NetworkClient without any widgets.
+
+	It authenticates, joins its channel and streams the clip of a
+	SyntheticVideo. Every sent frame gets a consecutive sequence number
+	(VP8Frame::time), which receivers map back to the send time of the
+	sender in the same process.
+*/
+class LoadClient : public QObject
+{
+	Q_OBJECT
+
+public:
+	class Options
+	{
+	public:
+		QHostAddress address = QHostAddress::LocalHost;
+		quint16 port = 13370;
+		QString name;
+		QString password;
+		QString channel;
+
+		// Streams video, otherwise only receives.
+		bool sender = true;
+
+		int width = 320;
+		int height = 240;
+		int bitrate = 200;
+		int fps = 15;
+
+		// Forward error correction (see MediaSocket::setVideoFec()).
+		int fec = -1;
+	};
+
+public:
+	LoadClient(const Options& opts, const SyntheticVideo* video, LoadGenerator* generator);
+	virtual ~LoadClient();
+
+	void start();
+	void stop();
+
+	const Options& options() const { return _opts; }
+	ocs::clientid_t clientId() const;
+	bool isJoined() const { return _joined; }
+
+	/*! Send time of the frame with the sequence number "seq".
+		\return -1, if the frame is unknown or too old.
+	*/
+	qint64 sendTimeUs(quint64 seq) const;
+
+	/*! Returns and resets the counters. */
+	LoadClientStatistics takeStatistics();
+
+signals:
+	void joined();
+
+private slots:
+	void onConnected();
+	void onMediaSocketAuthenticated();
+	void onServerError(int errorCode, const QString& errorMessage);
+	void sendNextFrame();
+	void onVideoFrameReceived(quint64 frameTime, ocs::clientid_t senderId);
+	void onNewVideoFrame(YuvFrameRefPtr frame, ocs::clientid_t senderId);
+
+private:
+	void startStreaming();
+
+private:
+	// Reception state per sender.
+	class Reception
+	{
+	public:
+		quint64 firstSeq = 0;
+		quint64 lastSeq = 0;
+		qint64 firstUs = 0;
+	};
+
+	class SentFrame
+	{
+	public:
+		quint64 seq = 0;
+		qint64 timeUs = 0;
+	};
+
+	Options _opts;
+	const SyntheticVideo* _video;
+	LoadGenerator* _generator;
+	QScopedPointer<NetworkClient> _nc;
+	QTimer _frameTimer;
+	bool _joined;
+
+	// Sending.
+	quint64 _nextSeq;
+	std::vector<SentFrame> _sentFrames;   // Ring buffer by sequence number.
+
+	// Receiving.
+	QHash<ocs::clientid_t, Reception> _receptions;
+	LoadClientStatistics _statistics;
+};
+
+#endif
@@ -0,0 +1,196 @@
+#include "loadgenerator.h"
+
+#include <algorithm>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTextStream>
+
+#include "humblelogging/api.h"
+
+#include "libapp/elws.h"
+
+HUMBLE_LOGGER(HL, "loadgen");
+
+// Length of the pre-encoded clip in seconds (= key frame interval).
+static const int CLIP_SECONDS = 2;
+
+///////////////////////////////////////////////////////////////////////
+
+static QString formatMs(qint64 us)
+{
+	return QString::number(us / 1000.0, 'f', 1);
+}
+
+static qint64 percentile(const QVector<qint64>& sorted, int p)
+{
+	if (sorted.isEmpty())
+		return 0;
+	const auto i = qMin(sorted.size() - 1, (sorted.size() * p) / 100);
+	return sorted[i];
+}
+
+static QString formatLoss(const LoadClientStatistics& stats)
+{
+	if (stats.framesExpected == 0 || stats.framesReceived >= stats.framesExpected)
+		return QString("0.0");
+	return QString::number(100.0 * (stats.framesExpected - stats.framesReceived) / stats.framesExpected, 'f', 1);
+}
+
+///////////////////////////////////////////////////////////////////////
+
+LoadGenerator::LoadGenerator(const Options& opts, QObject* parent) :
+	QObject(parent),
+	_opts(opts),
+	_nextClient(0)
+{
+	_rampUpTimer.setInterval(qMax(0, _opts.rampUp));
+	connect(&_rampUpTimer, &QTimer::timeout, this, &LoadGenerator::startNextClient);
+
+	_reportTimer.setInterval(qMax(1, _opts.reportInterval) * 1000);
+	connect(&_reportTimer, &QTimer::timeout, this, &LoadGenerator::printReport);
+
+	_durationTimer.setSingleShot(true);
+	connect(&_durationTimer, &QTimer::timeout, this, &LoadGenerator::finish);
+}
+
+LoadGenerator::~LoadGenerator()
+{
+}
+
+bool LoadGenerator::init()
+{
+	const auto& c = _opts.client;
+	if (!_video.encode(c.width, c.height, c.bitrate, c.fps, qMax(1, c.fps * CLIP_SECONDS)))
+	{
+		return false;
+	}
+	HL_INFO(HL, QString("Synthetic clip encoded (frames=%1; resolution=%2x%3; avg-frame-size=%4)").arg(_video.frameCount()).arg(c.width).arg(c.height).arg(ELWS::humanReadableSize(_video.averageFrameSize())).toStdString());
+
+	const auto senders = _opts.senders < 0 ? _opts.clients : _opts.senders;
+	for (auto i = 0; i < _opts.clients; ++i)
+	{
+		auto opts = _opts.client;
+		opts.name = QString("loadgen-client-%1").arg(i + 1);
+		opts.channel = QString("loadgen-%1").arg(i % qMax(1, _opts.channels) + 1);
+		opts.sender = i < senders;
+
+		auto client = new LoadClient(opts, &_video, this);
+		connect(client, &LoadClient::joined, this, &LoadGenerator::onClientJoined);
+		_clients.append(client);
+	}
+
+	nowUs();
+	_rampUpTimer.start();
+	_reportTimer.start();
+	if (_opts.duration > 0)
+		_durationTimer.start(_opts.duration * 1000);
+	return true;
+}
+
+LoadClient* LoadGenerator::client(ocs::clientid_t id) const
+{
+	return _joinedClients.value(id);
+}
+
+qint64 LoadGenerator::nowUs()
+{
+	static QElapsedTimer timer;
+	if (!timer.isValid())
+		timer.start();
+	return timer.nsecsElapsed() / 1000;
+}
+
+void LoadGenerator::startNextClient()
+{
+	if (_nextClient >= _clients.size())
+	{
+		_rampUpTimer.stop();
+		return;
+	}
+	_clients[_nextClient++]->start();
+}
+
+void LoadGenerator::onClientJoined()
+{
+	auto client = qobject_cast<LoadClient*>(sender());
+	if (!client)
+		return;
+	_joinedClients.insert(client->clientId(), client);
+	HL_INFO(HL, QString("Client joined (name=%1; id=%2; channel=%3; sender=%4)").arg(client->options().name).arg(client->clientId()).arg(client->options().channel).arg(client->options().sender).toStdString());
+}
+
+void LoadGenerator::printReport()
+{
+	QTextStream out(stdout);
+	out << QString("%1 %2 %3 %4 %5 %6 %7 %8 %9 %10\n")
+		.arg("client", -20).arg("id", 6).arg("sent", 8).arg("recv", 8).arg("decoded", 8)
+		.arg("loss%", 6).arg("avg-ms", 8).arg("p50-ms", 8).arg("p95-ms", 8).arg("max-ms", 8);
+
+	Totals interval;
+	for (auto client : _clients)
+	{
+		auto stats = client->takeStatistics();
+		std::sort(stats.latenciesUs.begin(), stats.latenciesUs.end());
+
+		qint64 sumUs = 0;
+		for (auto us : stats.latenciesUs)
+			sumUs += us;
+		const auto avgUs = stats.latenciesUs.isEmpty() ? 0 : sumUs / stats.latenciesUs.size();
+
+		out << QString("%1 %2 %3 %4 %5 %6 %7 %8 %9 %10\n")
+			.arg(client->options().name, -20)
+			.arg(client->isJoined() ? QString::number(client->clientId()) : QString("-"), 6)
+			.arg(stats.framesSent, 8).arg(stats.framesReceived, 8).arg(stats.framesDecoded, 8)
+			.arg(formatLoss(stats), 6)
+			.arg(formatMs(avgUs), 8)
+			.arg(formatMs(percentile(stats.latenciesUs, 50)), 8)
+			.arg(formatMs(percentile(stats.latenciesUs, 95)), 8)
+			.arg(formatMs(stats.latenciesUs.isEmpty() ? 0 : stats.latenciesUs.last()), 8);
+
+		interval.stats.framesSent += stats.framesSent;
+		interval.stats.framesReceived += stats.framesReceived;
+		interval.stats.framesDecoded += stats.framesDecoded;
+		interval.stats.framesExpected += stats.framesExpected;
+		interval.stats.latenciesUs += stats.latenciesUs;
+		interval.latencySumUs += sumUs;
+		interval.latencyCount += stats.latenciesUs.size();
+	}
+
+	std::sort(interval.stats.latenciesUs.begin(), interval.stats.latenciesUs.end());
+	out << QString("%1 %2 %3 %4 %5 %6 %7 %8 %9 %10\n")
+		.arg("total (interval)", -20).arg(_joinedClients.size(), 6)
+		.arg(interval.stats.framesSent, 8).arg(interval.stats.framesReceived, 8).arg(interval.stats.framesDecoded, 8)
+		.arg(formatLoss(interval.stats), 6)
+		.arg(formatMs(interval.latencyCount > 0 ? interval.latencySumUs / (qint64)interval.latencyCount : 0), 8)
+		.arg(formatMs(percentile(interval.stats.latenciesUs, 50)), 8)
+		.arg(formatMs(percentile(interval.stats.latenciesUs, 95)), 8)
+		.arg(formatMs(interval.stats.latenciesUs.isEmpty() ? 0 : interval.stats.latenciesUs.last()), 8);
+
+	_totals.stats.framesSent += interval.stats.framesSent;
+	_totals.stats.framesReceived += interval.stats.framesReceived;
+	_totals.stats.framesDecoded += interval.stats.framesDecoded;
+	_totals.stats.framesExpected += interval.stats.framesExpected;
+	_totals.latencySumUs += interval.latencySumUs;
+	_totals.latencyCount += interval.latencyCount;
+
+	out << QString("%1 %2 %3 %4 %5 %6 %7\n\n")
+		.arg("total (run)", -20).arg(_joinedClients.size(), 6)
+		.arg(_totals.stats.framesSent, 8).arg(_totals.stats.framesReceived, 8).arg(_totals.stats.framesDecoded, 8)
+		.arg(formatLoss(_totals.stats), 6)
+		.arg(formatMs(_totals.latencyCount > 0 ? _totals.latencySumUs / (qint64)_totals.latencyCount : 0), 8);
+	out.flush();
+}
+
+void LoadGenerator::finish()
+{
+	_rampUpTimer.stop();
+	_reportTimer.stop();
+	printReport();
+
+	for (auto client : _clients)
+		client->stop();
+
+	// Give the goodbye requests some time to leave the process.
+	QTimer::singleShot(500, qApp, &QCoreApplication::quit);
+}
@@ -0,0 +1,77 @@
+#ifndef LOADGENERATOR_H
+#define LOADGENERATOR_H
+
+#include <QObject>
+#include <QList>
+#include <QHash>
+#include <QTimer>
+
+#include "libbase/defines.h"
+
+#include "loadclient.h"
+#include "syntheticvideo.h"
+
+/*!
+	Runs N simulated clients in one process and prints their statistics.
+
+	All clients share one clock (nowUs()), which makes it possible to
+	measure the end-to-end latency of a frame by the send time of its
+	sender in the same process.
+*/
+class LoadGenerator : public QObject
+{
+	Q_OBJECT
+
+public:
+	class Options
+	{
+	public:
+		LoadClient::Options client;
+
+		int clients = 10;
+		int channels = 1;
+		int senders = -1;       ///< Number of streaming clients, -1 = all.
+		int rampUp = 100;       ///< Delay between client starts (ms).
+		int duration = 60;      ///< Run time (sec), 0 = forever.
+		int reportInterval = 5; ///< Statistic output interval (sec).
+	};
+
+public:
+	LoadGenerator(const Options& opts, QObject* parent = nullptr);
+	virtual ~LoadGenerator();
+
+	bool init();
+
+	/*! Returns the joined local client with the given server ID or nullptr. */
+	LoadClient* client(ocs::clientid_t id) const;
+
+	/*! Monotonic time of the process in microseconds. */
+	static qint64 nowUs();
+
+private slots:
+	void startNextClient();
+	void onClientJoined();
+	void printReport();
+	void finish();
+
+private:
+	class Totals
+	{
+	public:
+		LoadClientStatistics stats;
+		qint64 latencySumUs = 0;
+		quint64 latencyCount = 0;
+	};
+
+	Options _opts;
+	SyntheticVideo _video;
+	QList<LoadClient*> _clients;
+	int _nextClient;
+	QHash<ocs::clientid_t, LoadClient*> _joinedClients;
+	QTimer _rampUpTimer;
+	QTimer _reportTimer;
+	QTimer _durationTimer;
+	Totals _totals;
+};
+
+#endif
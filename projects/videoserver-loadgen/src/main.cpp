@@ -0,0 +1,71 @@
+#include <QCoreApplication>
+
+#include "humblelogging/api.h"
+
+#include "libbase/defines.h"
+
+#include "libapp/ts3video.h"
+#include "libapp/elws.h"
+
+#include "loadgenerator.h"
+
+HUMBLE_LOGGER(HL, "loadgen");
+
+/*
+	Headless load generator for the videoserver.
+
+	Usage:
+	videoserver-loadgen --address 127.0.0.1 --port 13370 --clients 50 --channels 5
+		--senders 10 --width 640 --height 480 --fps 15 --bitrate 300 --duration 60
+
+	--fec: FEC group size, -1 = Adaptive (default), 0 = Disabled.
+
+	Run the videoserver with --verify-media-recipients to check its incremental
+	media routing against a full rebuild, while the clients join, start their video and leave.
+*/
+int main(int argc, char* argv[])
+{
+	QCoreApplication a(argc, argv);
+	a.setOrganizationName("mfreiholz");
+	a.setOrganizationDomain("https://mfreiholz.de");
+	a.setApplicationName("ocs-server-loadgen");
+	a.setApplicationVersion(IFVS_SOFTWARE_VERSION_QSTRING);
+
+	qRegisterMetaType<ocs::clientid_t>("ocs::clientid_t");
+	qRegisterMetaType<ocs::channelid_t>("ocs::channelid_t");
+
+	auto& fac = humble::logging::Factory::getInstance();
+	fac.setConfiguration(new humble::logging::SimpleConfiguration(ELWS::hasArgsValue("--verbose") ? humble::logging::LogLevel::Debug : humble::logging::LogLevel::Info));
+	fac.setDefaultFormatter(new humble::logging::PatternFormatter("%date\t%lls\t%m\n"));
+	fac.registerAppender(new humble::logging::ConsoleAppender());
+
+	LoadGenerator::Options opts;
+	opts.client.address = ELWS::getQHostAddressFromString(ELWS::getArgsValue("--address", opts.client.address.toString()).toString());
+	opts.client.port = ELWS::getArgsValue("--port", opts.client.port).toUInt();
+	opts.client.password = ELWS::getArgsValue("--password", opts.client.password).toString();
+	opts.client.width = ELWS::getArgsValue("--width", opts.client.width).toInt();
+	opts.client.height = ELWS::getArgsValue("--height", opts.client.height).toInt();
+	opts.client.fps = ELWS::getArgsValue("--fps", opts.client.fps).toInt();
+	opts.client.bitrate = ELWS::getArgsValue("--bitrate", opts.client.bitrate).toInt();
+	opts.client.fec = ELWS::getArgsValue("--fec", opts.client.fec).toInt();
+	opts.clients = ELWS::getArgsValue("--clients", opts.clients).toInt();
+	opts.channels = ELWS::getArgsValue("--channels", opts.channels).toInt();
+	opts.senders = ELWS::getArgsValue("--senders", opts.senders).toInt();
+	opts.rampUp = ELWS::getArgsValue("--ramp-up", opts.rampUp).toInt();
+	opts.duration = ELWS::getArgsValue("--duration", opts.duration).toInt();
+	opts.reportInterval = ELWS::getArgsValue("--report-interval", opts.reportInterval).toInt();
+
+	HL_INFO(HL, QString("----- Load generator ----").toStdString());
+	HL_INFO(HL, QString("Server: %1:%2").arg(opts.client.address.toString()).arg(opts.client.port).toStdString());
+	HL_INFO(HL, QString("Clients: %1 (channels=%2; senders=%3; ramp-up=%4 ms)").arg(opts.clients).arg(opts.channels).arg(opts.senders < 0 ? opts.clients : opts.senders).arg(opts.rampUp).toStdString());
+	HL_INFO(HL, QString("Video: %1x%2 @ %3 fps, %4 kbit/s").arg(opts.client.width).arg(opts.client.height).arg(opts.client.fps).arg(opts.client.bitrate).toStdString());
+	HL_INFO(HL, QString("Duration: %1").arg(opts.duration > 0 ? QString("%1 sec").arg(opts.duration) : QString("forever")).toStdString());
+	HL_INFO(HL, QString("-------------------------").toStdString());
+
+	LoadGenerator generator(opts);
+	if (!generator.init())
+	{
+		return 1;
+	}
+	return a.exec();
+}
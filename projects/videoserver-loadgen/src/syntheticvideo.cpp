@@ -0,0 +1,77 @@
+#include "syntheticvideo.h"
+
+#include <memory>
+
+#include <QImage>
+
+#include "humblelogging/api.h"
+
+#include "libapp/yuvframe.h"
+
+#include "libclient/networkclient/vp8encoder.h"
+
+HUMBLE_LOGGER(HL, "loadgen.syntheticvideo");
+
+///////////////////////////////////////////////////////////////////////
+
+// Gradient, which scrolls with the frame number, and a moving box.
+// Gives the encoder some real work on every frame.
+static QImage createTestImage(int width, int height, int frameNumber)
+{
+	QImage image(width, height, QImage::Format_RGB888);
+	const auto boxSize = height / 4;
+	const auto boxX = (frameNumber * 4) % qMax(1, width - boxSize);
+	const auto boxY = (frameNumber * 2) % qMax(1, height - boxSize);
+	for (auto y = 0; y < height; ++y)
+	{
+		auto line = image.scanLine(y);
+		for (auto x = 0; x < width; ++x)
+		{
+			const auto inBox = x >= boxX && x < boxX + boxSize && y >= boxY && y < boxY + boxSize;
+			line[x * 3 + 0] = inBox ? 255 : (uchar)(x + frameNumber);
+			line[x * 3 + 1] = inBox ? 255 : (uchar)(y + frameNumber * 2);
+			line[x * 3 + 2] = inBox ? 0 : (uchar)((x + y) / 2);
+		}
+	}
+	return image;
+}
+
+bool SyntheticVideo::encode(int width, int height, int bitrate, int fps, int frameCount)
+{
+	_frames.clear();
+
+	VP8Encoder encoder;
+	if (!encoder.initialize(width, height, bitrate, fps))
+	{
+		HL_ERROR(HL, QString("Can not initialize VP8 encoder (width=%1; height=%2; bitrate=%3)").arg(width).arg(height).arg(bitrate).toStdString());
+		return false;
+	}
+
+	for (auto i = 0; i < frameCount; ++i)
+	{
+		std::unique_ptr<YuvFrame> yuv(YuvFrame::fromQImage(createTestImage(width, height, i)));
+		std::unique_ptr<VP8Frame> vp8(encoder.encode(*yuv));
+		if (!vp8)
+		{
+			HL_ERROR(HL, QString("Can not encode synthetic frame (frame=%1)").arg(i).toStdString());
+			return false;
+		}
+		_frames.append(*vp8);
+	}
+	if (_frames.isEmpty() || _frames.first().type != VP8Frame::KEY)
+	{
+		HL_ERROR(HL, QString("Synthetic clip does not start with a key frame").toStdString());
+		return false;
+	}
+	return true;
+}
+
+int SyntheticVideo::averageFrameSize() const
+{
+	if (_frames.isEmpty())
+		return 0;
+	qint64 sum = 0;
+	for (const auto& f : _frames)
+		sum += f.data.size();
+	return (int)(sum / _frames.size());
+}
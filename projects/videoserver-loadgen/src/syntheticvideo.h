@@ -0,0 +1,33 @@
+#ifndef SYNTHETICVIDEO_H
+#define SYNTHETICVIDEO_H
+
+#include <QVector>
+
+#include "libapp/vp8frame.h"
+
+/*!
+	Pre-encoded VP8 clip with a moving test pattern.
+
+	The clip starts with a key frame and is encoded once, all simulated
+	clients stream it in a loop. Looping restarts at the key frame, which
+	keeps the stream decodable without an encoder per client.
+*/
+class SyntheticVideo
+{
+public:
+	/*! \param frameCount Length of the clip, which is also the key frame interval.
+		\return false, if the encoder could not be initialized.
+	*/
+	bool encode(int width, int height, int bitrate, int fps, int frameCount);
+
+	int frameCount() const { return _frames.size(); }
+	const VP8Frame& frame(int i) const { return _frames[i]; }
+
+	/*! Average size of the encoded frames in bytes. */
+	int averageFrameSize() const;
+
+private:
+	QVector<VP8Frame> _frames;
+};
+
+#endif
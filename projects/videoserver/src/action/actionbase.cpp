@@ -313,7 +313,7 @@ void HeartbeatAction::run(const ActionData& req)
 void EnableAudioInputAction::run(const ActionData& req)
 {
 	req.session->_clientEntity->audioInputEnabled = true;
-	req.server->updateMediaRecipients();
+	req.server->onClientMediaToggled(req.session->_clientEntity->id);
 
 	sendDefaultOkResponse(req);
 
@@ -328,7 +328,7 @@ void EnableAudioInputAction::run(const ActionData& req)
 void DisableAudioInputAction::run(const ActionData& req)
 {
 	req.session->_clientEntity->audioInputEnabled = false;
-	req.server->updateMediaRecipients();
+	req.server->onClientMediaToggled(req.session->_clientEntity->id);
 
 	sendDefaultOkResponse(req);
 
@@ -404,6 +404,7 @@ void UpdateVisibilityLevelAction::run(const ActionData& req)
 	const auto vlevel = req.params["visibilitylevel"].toInt();
 
 	req.session->_clientEntity->visibilityLevel = (ServerClientEntity::VisibilityLevel) vlevel;
+	req.server->onClientVisibilityChanged(req.session->_clientEntity->id);
 
 	sendDefaultOkResponse(req);
 }
@@ -432,7 +433,7 @@ void AddDirectStreamingRelationAction::run(const ActionData& req)
 	// Add client to list
 	req.server->_sender2receiver[senderId].insert(receiverId);
 
-	req.server->updateMediaRecipients();
+	req.server->onDirectStreamingRelationChanged(senderId);
 	sendDefaultOkResponse(req);
 }
 
@@ -451,7 +452,7 @@ void RemoveDirectStreamingRelationAction::run(const ActionData& req)
 			req.server->_sender2receiver.remove(senderId);
 	}
 
-	req.server->updateMediaRecipients();
+	req.server->onDirectStreamingRelationChanged(senderId);
 	sendDefaultOkResponse(req);
 }
 
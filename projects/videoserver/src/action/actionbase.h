@@ -22,6 +22,7 @@
 /*
 	List of notifications
 		notify.mediaauthsuccess
+		notify.mediadatagramsize
 		notify.clientdisconnected
 
 		notify.clientvideoenabled
@@ -68,7 +68,6 @@ void CreateChannelAction::run(const ActionData& req)
 
 	// join channel
 	req.server->addClientToChannel(req.session->_clientEntity->id, sce->id);
-	req.server->updateMediaRecipients();
 
 	// respond
 	QJsonObject params;
@@ -122,7 +121,6 @@ void JoinChannelAction::run(const ActionData& req)
 
 	// Associate the client's membership to the channel.
 	req.server->addClientToChannel(req.session->_clientEntity->id, channelEntity->id);
-	req.server->updateMediaRecipients();
 
 	// Build response with information about the channel.
 	QJsonObject params;
@@ -172,5 +170,4 @@ void LeaveChannelAction::run(const ActionData& req)
 
 	// Leave channel.
 	req.server->removeClientFromChannel(req.session->_clientEntity->id, channelId);
-	req.server->updateMediaRecipients();
 }
\ No newline at end of file
@@ -4,6 +4,8 @@
 
 #include "libapp/virtualserverconfigentity.h"
 
+#include "libmediaprotocol/protocol.h"
+
 HUMBLE_LOGGER(HL, "server.clientconnection.action");
 
 void EnableVideoAction::run(const ActionData& req)
@@ -25,10 +27,39 @@ void EnableVideoAction::run(const ActionData& req)
 		return;
 	}
 
+	// Simulcast layers (optional, older clients send a single layer).
+	QVector<ServerClientEntity::VideoLayer> layers;
+	const auto layersParam = req.params["layers"].toArray();
+	for (auto i = 0; i < layersParam.size() && i < UDP::VideoFrameDatagram::MAXLAYERS; ++i)
+	{
+		const auto obj = layersParam.at(i).toObject();
+		ServerClientEntity::VideoLayer layer;
+		layer.width = obj["width"].toInt();
+		layer.height = obj["height"].toInt();
+		layer.bitrate = obj["bitrate"].toInt();
+		if (!VirtualServerConfigEntity::isResolutionSupported(config, QSize(layer.width, layer.height)))
+		{
+			HL_WARN(HL, QString("Client tried to enable video with unsupported layer (layer=%1; width=%2; height=%3)").arg(i).arg(layer.width).arg(layer.height).toStdString());
+			sendDefaultErrorResponse(req, IFVS_STATUS_INVALID_PARAMETERS, QString("Unsupported video layer by server (%1x%2)").arg(layer.width).arg(layer.height));
+			return;
+		}
+		layers.append(layer);
+	}
+	if (layers.isEmpty())
+	{
+		ServerClientEntity::VideoLayer layer;
+		layer.width = width;
+		layer.height = height;
+		layer.bitrate = bitrate;
+		layers.append(layer);
+	}
+
 	req.session->_clientEntity->videoEnabled = true;
 	req.session->_clientEntity->videoWidth = width;
 	req.session->_clientEntity->videoHeight = height;
-	req.server->updateMediaRecipients();
+	req.session->_clientEntity->videoBitrate = bitrate;
+	req.session->_clientEntity->videoLayers = layers;
+	req.server->onClientMediaToggled(req.session->_clientEntity->id);
 
 	sendDefaultOkResponse(req);
 
@@ -43,7 +74,8 @@ void DisableVideoAction::run(const ActionData& req)
 	req.session->_clientEntity->videoEnabled = false;
 	req.session->_clientEntity->videoWidth = 0;
 	req.session->_clientEntity->videoHeight = 0;
-	req.server->updateMediaRecipients();
+	req.session->_clientEntity->videoLayers.clear();
+	req.server->onClientMediaToggled(req.session->_clientEntity->id);
 
 	sendDefaultOkResponse(req);
 
@@ -51,4 +83,48 @@ void DisableVideoAction::run(const ActionData& req)
 	QJsonObject params;
 	params["client"] = req.session->_clientEntity->toQJsonObject();
 	broadcastNotificationToSiblingClients(req, "notify.clientvideodisabled", params);
-}
\ No newline at end of file
+}
+
+void SetRemoteVideoSizeAction::run(const ActionData& req)
+{
+	const ocs::clientid_t senderId = req.params["clientid"].toInt();
+	const QSize size(req.params["width"].toInt(), req.params["height"].toInt());
+	if (size.width() < 0 || size.height() < 0)
+	{
+		sendDefaultErrorResponse(req, IFVS_STATUS_INVALID_PARAMETERS, QString("Invalid size (%1x%2)").arg(size.width()).arg(size.height()));
+		return;
+	}
+
+	auto sender = req.server->_clients.value(senderId);
+	if (!sender || !req.session->_clientEntity->isAllowedToSee(*sender))
+	{
+		sendDefaultErrorResponse(req, IFVS_STATUS_INVALID_PARAMETERS, QString("Unknown client (clientid=%1)").arg(senderId));
+		return;
+	}
+
+	// Picks the sender's simulcast layer for this client.
+	req.session->_clientEntity->remoteVideoSizes.insert(senderId, size);
+	req.server->onClientRemoteVideoSizeChanged(senderId);
+
+	sendDefaultOkResponse(req);
+}
+
+void SetMediaDatagramSizeAction::run(const ActionData& req)
+{
+	// The server only echoes probes it received, larger sizes can not have been confirmed.
+	auto clientEntity = req.session->_clientEntity;
+	const auto size = req.params["size"].toInt();
+	if (size < (int)UDP::MtuProbeDatagram::DEFAULTDATAGRAMSIZE || size > clientEntity->mediaDatagramSize)
+	{
+		sendDefaultErrorResponse(req, IFVS_STATUS_INVALID_PARAMETERS, QString("Invalid datagram size (%1)").arg(size));
+		return;
+	}
+
+	if (size > clientEntity->mediaDownlinkDatagramSize)
+	{
+		clientEntity->mediaDownlinkDatagramSize = size;
+		req.server->onClientMediaDatagramSizeChanged(clientEntity->id);
+	}
+
+	sendDefaultOkResponse(req);
+}
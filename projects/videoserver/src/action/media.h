@@ -20,4 +20,24 @@ public:
 		return QString("clientdisablevideo");
 	}
 	void run(const ActionData& req);
-};
\ No newline at end of file
+};
+
+class SetRemoteVideoSizeAction : public ActionBase
+{
+public:
+	QString name() const
+	{
+		return QString("setremotevideosize");
+	}
+	void run(const ActionData& req);
+};
+
+class SetMediaDatagramSizeAction : public ActionBase
+{
+public:
+	QString name() const
+	{
+		return QString("setmediadatagramsize");
+	}
+	void run(const ActionData& req);
+};
@@ -64,20 +64,16 @@ ClientConnectionHandler::ClientConnectionHandler(VirtualServer* server, QSharedP
 
 ClientConnectionHandler::~ClientConnectionHandler()
 {
-	_server->removeClientFromChannels(_clientEntity->id);
-	_server->_clients.remove(_clientEntity->id);
-	_server->_connections.remove(_clientEntity->id);
-
-	// Cleanup direct-mapping (as long as it isn't used much).. it may cost time
-	_server->_sender2receiver.remove(_clientEntity->id);
-	for (auto i = _server->_sender2receiver.begin(); i != _server->_sender2receiver.end(); ++i)
-		(*i).remove(_clientEntity->id);
+	const auto clientId = _clientEntity->id;
+	_server->removeClientFromChannels(clientId);
+	_server->_clients.remove(clientId);
+	_server->_connections.remove(clientId);
 
 	delete _clientEntity;
 	_connection.clear();
 	_clientEntity = nullptr;
 
-	_server->updateMediaRecipients();
+	_server->onClientDisconnected(clientId);
 	_server = nullptr;
 }
 
@@ -90,6 +86,16 @@ void ClientConnectionHandler::sendMediaAuthSuccessNotify()
 	QCORREPLY_AUTODELETE(reply);
 }
 
+void ClientConnectionHandler::sendMediaDatagramSizeNotify(int size)
+{
+	QJsonObject params;
+	params["size"] = size;
+	QCorFrame req;
+	req.setData(JsonProtocolHelper::createJsonRequest("notify.mediadatagramsize", params));
+	auto reply = _connection->sendRequest(req);
+	QCORREPLY_AUTODELETE(reply);
+}
+
 
 void ClientConnectionHandler::onStateChanged(QAbstractSocket::SocketState state)
 {
@@ -47,6 +47,7 @@ public:
 									 QSharedPointer<QCorConnection> connection);
 	virtual ~ClientConnectionHandler();
 	void sendMediaAuthSuccessNotify();
+	void sendMediaDatagramSizeNotify(int size);
 
 private slots:
 	void onStateChanged(QAbstractSocket::SocketState state);
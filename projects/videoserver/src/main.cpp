@@ -77,6 +77,16 @@ static int updateOptionsByArgs(VirtualServerOptions& opts)
 {
 	opts.address = ELWS::getQHostAddressFromString(ELWS::getArgsValue("--address", opts.address.toString()).toString());
 	opts.port = ELWS::getArgsValue("--port", opts.port).toUInt();
+	opts.mediaRelayBackend = ELWS::getArgsValue("--media-relay-backend", opts.mediaRelayBackend).toString();
+	opts.mediaRelayBatchSize = ELWS::getArgsValue("--media-relay-batch-size", opts.mediaRelayBatchSize).toInt();
+	opts.mediaRelayWorkers = ELWS::getArgsValue("--media-relay-workers", opts.mediaRelayWorkers).toInt();
+	opts.mediaKeyFrameCache = ELWS::getArgsValue("--media-keyframe-cache", opts.mediaKeyFrameCache).toInt();
+	opts.mediaRecoveryWindow = ELWS::getArgsValue("--media-recovery-window", opts.mediaRecoveryWindow).toInt();
+	opts.mediaReceiverBandwidth = ELWS::getArgsValue("--media-receiver-bandwidth", opts.mediaReceiverBandwidth).toInt();
+	opts.mediaActiveSpeakers = ELWS::getArgsValue("--media-active-speakers", opts.mediaActiveSpeakers).toInt();
+	opts.mediaAudioMixing = ELWS::getArgsValue("--media-audio-mixing", opts.mediaAudioMixing).toInt();
+	opts.mediaAudioMixerWorkers = ELWS::getArgsValue("--media-audio-mixer-workers", opts.mediaAudioMixerWorkers).toInt();
+	opts.verifyMediaRecipients = ELWS::getArgsValue("--verify-media-recipients", opts.verifyMediaRecipients).toBool();
 	opts.wsStatusAddress = ELWS::getQHostAddressFromString(ELWS::getArgsValue("--wsstatus-address", opts.wsStatusAddress.toString()).toString());
 	opts.wsStatusPort = ELWS::getArgsValue("--wsstatus-port", opts.wsStatusPort).toUInt();
 	opts.connectionLimit = ELWS::getArgsValue("--connection-limit", opts.connectionLimit).toInt();
@@ -109,6 +119,16 @@ static int updateOptionsByConfig(VirtualServerOptions& opts, const QString& file
 	conf.beginGroup("default");
 	opts.address = ELWS::getQHostAddressFromString(conf.value("address", opts.address.toString()).toString());
 	opts.port = conf.value("port", opts.port).toUInt();
+	opts.mediaRelayBackend = conf.value("mediarelaybackend", opts.mediaRelayBackend).toString();
+	opts.mediaRelayBatchSize = conf.value("mediarelaybatchsize", opts.mediaRelayBatchSize).toInt();
+	opts.mediaRelayWorkers = conf.value("mediarelayworkers", opts.mediaRelayWorkers).toInt();
+	opts.mediaKeyFrameCache = conf.value("mediakeyframecache", opts.mediaKeyFrameCache).toInt();
+	opts.mediaRecoveryWindow = conf.value("mediarecoverywindow", opts.mediaRecoveryWindow).toInt();
+	opts.mediaReceiverBandwidth = conf.value("mediareceiverbandwidth", opts.mediaReceiverBandwidth).toInt();
+	opts.mediaActiveSpeakers = conf.value("mediaactivespeakers", opts.mediaActiveSpeakers).toInt();
+	opts.mediaAudioMixing = conf.value("mediaaudiomixing", opts.mediaAudioMixing).toInt();
+	opts.mediaAudioMixerWorkers = conf.value("mediaaudiomixerworkers", opts.mediaAudioMixerWorkers).toInt();
+	opts.verifyMediaRecipients = conf.value("verifymediarecipients", opts.verifyMediaRecipients).toBool();
 	opts.wsStatusAddress = ELWS::getQHostAddressFromString(conf.value("wsstatus-address", opts.wsStatusAddress.toString()).toString());
 	opts.wsStatusPort = conf.value("wsstatus-port", opts.wsStatusPort).toUInt();
 	opts.connectionLimit = conf.value("connectionlimit", opts.connectionLimit).toInt();
@@ -215,6 +235,16 @@ public:
 		HL_INFO(HL, QString("Connection limit: %1").arg(opts.connectionLimit).toStdString());
 		HL_INFO(HL, QString("Bandwidth read limit: %1").arg(ELWS::humanReadableBandwidth(opts.bandwidthReadLimit)).toStdString());
 		HL_INFO(HL, QString("Bandwidth write limit: %1").arg(ELWS::humanReadableBandwidth(opts.bandwidthWriteLimit)).toStdString());
+		HL_INFO(HL, QString("----- Media relay -------").toStdString());
+		HL_INFO(HL, QString("Backend: %1 (batch-size=%2)").arg(opts.mediaRelayBackend).arg(opts.mediaRelayBatchSize).toStdString());
+		HL_INFO(HL, QString("Worker threads: %1").arg(opts.mediaRelayWorkers).toStdString());
+		HL_INFO(HL, QString("Key frame cache: %1 datagrams per sender").arg(opts.mediaKeyFrameCache).toStdString());
+		HL_INFO(HL, QString("Recovery request window: %1 ms").arg(opts.mediaRecoveryWindow).toStdString());
+		HL_INFO(HL, QString("Receiver bandwidth (maximum): %1").arg(opts.mediaReceiverBandwidth > 0 ? QString("%1 kbit/s").arg(opts.mediaReceiverBandwidth) : QString("unlimited")).toStdString());
+		HL_INFO(HL, QString("Active speakers: %1").arg(opts.mediaActiveSpeakers > 0 ? QString("%1 per channel").arg(opts.mediaActiveSpeakers) : QString("all")).toStdString());
+		HL_INFO(HL, QString("Audio mixing: %1").arg(opts.mediaAudioMixing > 0 ? QString("channels with %1+ speakers (workers=%2)").arg(opts.mediaAudioMixing).arg(opts.mediaAudioMixerWorkers) : QString("off")).toStdString());
+		if (opts.verifyMediaRecipients)
+			HL_INFO(HL, QString("Verify media recipients: yes").toStdString());
 		HL_INFO(HL, QString("-------------------------").toStdString());
 
 		_server = new VirtualServer(opts, this);
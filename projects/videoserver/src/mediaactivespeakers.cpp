@@ -0,0 +1,109 @@
+#include "mediaactivespeakers.h"
+
+#include <algorithm>
+
+#include <QMutexLocker>
+#include <QSet>
+
+#include "libmediaprotocol/protocol.h"
+
+#include "mediaroutingtable.h"
+
+// Interval to update the selection of a group.
+static const qint64 SELECT_INTERVAL_MS = 200;
+
+// Speakers without frames for this time are removed from their group.
+static const qint64 SPEAKER_TIMEOUT_MS = 2000;
+
+///////////////////////////////////////////////////////////////////////
+
+MediaActiveSpeakers::MediaActiveSpeakers(int maxSpeakers) :
+	_maxSpeakers(maxSpeakers)
+{
+	_clock.start();
+}
+
+bool MediaActiveSpeakers::update(quint32 groupId, ocs::clientid_t senderId, quint8 level)
+{
+	const auto nowMs = _clock.elapsed();
+
+	std::shared_ptr<Group> group;
+	{
+		QMutexLocker l(&_mutex);
+		auto& g = _groups[groupId];
+		if (!g)
+			g = std::make_shared<Group>();
+		group = g;
+	}
+
+	QMutexLocker l(&group->mutex);
+	auto speaker = std::find_if(group->speakers.begin(), group->speakers.end(), [senderId](const Speaker & s) { return s.clientId == senderId; });
+	if (speaker == group->speakers.end())
+	{
+		Speaker s;
+		s.clientId = senderId;
+		group->speakers.append(s);
+		speaker = group->speakers.end() - 1;
+	}
+
+	// Exponential moving average, frames without voice activity count as silence.
+	const auto loudness = (level & UDP::AudioFrameDatagram::VOICE_ACTIVITY) ? UDP::AudioFrameDatagram::SILENCE - (level & UDP::AudioFrameDatagram::LEVEL_MASK) : 0;
+	speaker->loudness += (loudness * 16 - speaker->loudness) / 8;
+	speaker->lastMs = nowMs;
+
+	// New speakers take free places immediately.
+	if (!speaker->active && group->activeCount < _maxSpeakers)
+	{
+		speaker->active = true;
+		++group->activeCount;
+	}
+
+	if (nowMs - group->selectedMs >= SELECT_INTERVAL_MS)
+	{
+		const auto id = speaker->clientId;
+		select(*group, nowMs);
+		speaker = std::find_if(group->speakers.begin(), group->speakers.end(), [id](const Speaker & s) { return s.clientId == id; });
+	}
+	return speaker != group->speakers.end() && speaker->active;
+}
+
+void MediaActiveSpeakers::select(Group& group, qint64 nowMs)
+{
+	group.selectedMs = nowMs;
+
+	auto it = std::remove_if(group.speakers.begin(), group.speakers.end(), [nowMs](const Speaker & s) { return nowMs - s.lastMs > SPEAKER_TIMEOUT_MS; });
+	group.speakers.erase(it, group.speakers.end());
+
+	// Loudest first, the current speakers win ties.
+	std::stable_sort(group.speakers.begin(), group.speakers.end(), [](const Speaker & a, const Speaker & b)
+	{
+		if (a.loudness != b.loudness)
+			return a.loudness > b.loudness;
+		return a.active && !b.active;
+	});
+
+	group.activeCount = 0;
+	for (auto& s : group.speakers)
+	{
+		s.active = group.activeCount < _maxSpeakers;
+		if (s.active)
+			++group.activeCount;
+	}
+}
+
+void MediaActiveSpeakers::retain(const MediaRoutingTable& routes)
+{
+	QSet<quint32> groupIds;
+	for (auto i = 0; i < routes.senderCount(); ++i)
+		groupIds.insert(routes.sender(i).audioGroup);
+
+	QMutexLocker l(&_mutex);
+	auto it = _groups.begin();
+	while (it != _groups.end())
+	{
+		if (!groupIds.contains(it.key()))
+			it = _groups.erase(it);
+		else
+			++it;
+	}
+}
@@ -0,0 +1,74 @@
+#ifndef MEDIAACTIVESPEAKERS_H
+#define MEDIAACTIVESPEAKERS_H
+
+#include <memory>
+
+#include <QHash>
+#include <QVector>
+#include <QMutex>
+#include <QElapsedTimer>
+
+#include "libbase/defines.h"
+
+class MediaRoutingTable;
+
+/*!
+	Selects the loudest speakers of each group (channel) by the audio level
+	of their frames (see UDP::AudioFrameDatagram::level).
+
+	The relay forwards audio of the selected speakers only. The downstream
+	audio of a receiver and its number of decoded streams stay the same,
+	no matter how many clients are in the channel.
+
+	Levels are smoothed over a few frames and the selection is updated in
+	a fixed interval, which keeps speakers from flapping in and out.
+
+	The selection is shared by all relay threads of a MediaSocketHandler,
+	because the speakers of a group may arrive at any of them.
+*/
+class MediaActiveSpeakers
+{
+public:
+	/*! \param maxSpeakers Maximum number of forwarded speakers per group.
+	*/
+	explicit MediaActiveSpeakers(int maxSpeakers);
+	MediaActiveSpeakers(const MediaActiveSpeakers&) = delete;
+	MediaActiveSpeakers& operator=(const MediaActiveSpeakers&) = delete;
+
+	/*! Updates the level of a speaker.
+		\return true, if the speaker is one of the active speakers of the group.
+	*/
+	bool update(quint32 groupId, ocs::clientid_t senderId, quint8 level);
+
+	/*! Removes all groups, which are not part of "routes". */
+	void retain(const MediaRoutingTable& routes);
+
+private:
+	class Speaker
+	{
+	public:
+		ocs::clientid_t clientId = 0;
+		int loudness = 0;      // Smoothed, 1/16 dB above silence.
+		qint64 lastMs = 0;
+		bool active = false;
+	};
+
+	class Group
+	{
+	public:
+		QMutex mutex;
+		QVector<Speaker> speakers;
+		int activeCount = 0;
+		qint64 selectedMs = 0;
+	};
+
+	void select(Group& group, qint64 nowMs);
+
+private:
+	int _maxSpeakers;
+	QElapsedTimer _clock;
+	QMutex _mutex;
+	QHash<quint32, std::shared_ptr<Group> > _groups;
+};
+
+#endif
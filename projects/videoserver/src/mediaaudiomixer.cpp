@@ -0,0 +1,435 @@
+#if defined(OCS_INCLUDE_AUDIO)
+#include "mediaaudiomixer.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MEDIAAUDIOMIXER_SSE2
+#endif
+
+#include <QMutexLocker>
+#include <QElapsedTimer>
+#include <QDataStream>
+#include <QSet>
+
+#include "humblelogging/api.h"
+
+#include "libmediaprotocol/protocol.h"
+#include "libmediaprotocol/datagramview.h"
+
+#include "libapp/pcmframe.h"
+#include "libapp/opusframe.h"
+
+#include "libclient/networkclient/opusencoder.h"
+#include "libclient/networkclient/opusdecoder.h"
+
+HUMBLE_LOGGER(HL, "server.mediaaudiomixer");
+
+// Number of buffered ticks, before a speaker is mixed (jitter buffer).
+static const int PREBUFFER_TICKS = 2;
+
+// Maximum number of buffered ticks per speaker, older samples are dropped.
+static const int MAX_BUFFER_TICKS = 10;
+
+// The workers skip ticks, if they are late by more than this.
+static const int MAX_LATE_TICKS = 5;
+
+///////////////////////////////////////////////////////////////////////
+
+class MediaAudioMixer::Group::State
+{
+public:
+	class Speaker
+	{
+	public:
+		std::unique_ptr<OpusAudioDecoder> decoder;
+		std::vector<qint16> samples;
+		bool playing = false;
+	};
+
+	class Stream
+	{
+	public:
+		std::unique_ptr<OpusAudioEncoder> encoder;
+	};
+
+	std::unordered_map<ocs::clientid_t, Speaker> speakers;
+
+	// Streams of receivers which speak in the group and the one of all others.
+	std::unordered_map<ocs::clientid_t, Stream> streams;
+	Stream listenerStream;
+
+	// Shared by all streams, a receiver may switch between them.
+	quint64 nextFrameId = 1;
+
+	std::vector<qint32> acc;
+	PcmFrame pcm;
+};
+
+///////////////////////////////////////////////////////////////////////
+
+MediaAudioMixer::MediaAudioMixer(Output* output, int minSpeakers, int workers) :
+	_output(output),
+	_minSpeakers(std::max(minSpeakers, 1))
+{
+	for (auto i = 0; i < std::max(workers, 1); ++i)
+		_workers.append(new Worker(this, i));
+}
+
+MediaAudioMixer::~MediaAudioMixer()
+{
+	stop();
+	qDeleteAll(_workers);
+	_workers.clear();
+}
+
+void MediaAudioMixer::start()
+{
+	for (auto worker : _workers)
+		worker->start();
+}
+
+void MediaAudioMixer::stop()
+{
+	for (auto worker : _workers)
+		worker->stop();
+	for (auto worker : _workers)
+		worker->wait();
+}
+
+bool MediaAudioMixer::add(quint32 groupId, ocs::clientid_t senderId, const char* data, int len)
+{
+	std::shared_ptr<Group> group;
+	{
+		QMutexLocker l(&_mutex);
+		group = _groups.value(groupId);
+	}
+	if (!group)
+	{
+		return false;
+	}
+
+	QMutexLocker l(&group->mutex);
+	auto& pending = group->pending[senderId];
+	if (pending.size() < MAX_BUFFER_TICKS)
+		pending.append(QByteArray(data, len));
+	return true;
+}
+
+void MediaAudioMixer::setRoutes(const MediaRoutingTable& routes)
+{
+	// Speakers and the union of their receivers by group.
+	QHash<quint32, QVector<ocs::clientid_t> > speakers;
+	QHash<quint32, QHash<ocs::clientid_t, MediaEndpoint> > receivers;
+	for (auto i = 0; i < routes.senderCount(); ++i)
+	{
+		const auto& sender = routes.sender(i);
+		if (sender.audioGroup == 0)
+			continue;
+		speakers[sender.audioGroup].append(sender.clientId);
+		auto& groupReceivers = receivers[sender.audioGroup];
+		const auto endpoints = routes.receivers(sender);
+		const auto clientIds = routes.receiverClientIds(sender);
+		for (quint32 j = 0; j < sender.receiverCount; ++j)
+			groupReceivers.insert(clientIds[j], endpoints[j]);
+	}
+
+	QMutexLocker l(&_mutex);
+	auto it = _groups.begin();
+	while (it != _groups.end())
+	{
+		if (speakers.value(it.key()).size() < _minSpeakers)
+		{
+			HL_DEBUG(HL, QString("Stop mixing audio of group (group=%1)").arg(it.key()).toStdString());
+			it = _groups.erase(it);
+		}
+		else
+			++it;
+	}
+	for (auto its = speakers.constBegin(); its != speakers.constEnd(); ++its)
+	{
+		if (its.value().size() < _minSpeakers)
+			continue;
+		auto& group = _groups[its.key()];
+		if (!group)
+		{
+			HL_DEBUG(HL, QString("Start mixing audio of group (group=%1; speakers=%2)").arg(its.key()).arg(its.value().size()).toStdString());
+			group = std::make_shared<Group>();
+		}
+
+		QVector<Receiver> groupReceivers;
+		const auto& r = receivers[its.key()];
+		for (auto itr = r.constBegin(); itr != r.constEnd(); ++itr)
+		{
+			Receiver receiver;
+			receiver.clientId = itr.key();
+			receiver.endpoint = itr.value();
+			groupReceivers.append(receiver);
+		}
+
+		QMutexLocker lg(&group->mutex);
+		group->speakers = its.value();
+		group->receivers = groupReceivers;
+	}
+}
+
+void MediaAudioMixer::tick(int workerIndex)
+{
+	QVector<std::shared_ptr<Group> > groups;
+	{
+		QMutexLocker l(&_mutex);
+		for (auto it = _groups.constBegin(); it != _groups.constEnd(); ++it)
+		{
+			if ((int)(it.key() % (quint32)_workers.size()) == workerIndex)
+				groups.append(it.value());
+		}
+	}
+	for (const auto& group : groups)
+		mix(*group);
+}
+
+void MediaAudioMixer::mix(Group& group)
+{
+	QVector<ocs::clientid_t> speakers;
+	QVector<Receiver> receivers;
+	QHash<ocs::clientid_t, QVector<QByteArray> > pending;
+	{
+		QMutexLocker l(&group.mutex);
+		speakers = group.speakers;
+		receivers = group.receivers;
+		pending.swap(group.pending);
+	}
+
+	if (!group.state)
+	{
+		group.state.reset(new Group::State());
+		group.state->acc.resize(TICK_SAMPLES);
+		group.state->pcm.data = (char*)malloc(TICK_SAMPLES * sizeof(qint16));
+		group.state->pcm.numSamples = TICK_SAMPLES;
+		group.state->pcm.numChannels = 1;
+		group.state->pcm.samplingRate = SAMPLING_RATE;
+	}
+	auto& state = *group.state;
+
+	// Forget about clients, which left the group.
+	const auto speakerSet = QSet<ocs::clientid_t>::fromList(speakers.toList());
+	auto its = state.speakers.begin();
+	while (its != state.speakers.end())
+	{
+		if (!speakerSet.contains(its->first))
+			its = state.speakers.erase(its);
+		else
+			++its;
+	}
+	auto itt = state.streams.begin();
+	while (itt != state.streams.end())
+	{
+		if (!speakerSet.contains(itt->first))
+			itt = state.streams.erase(itt);
+		else
+			++itt;
+	}
+
+	// Decode.
+	for (auto it = pending.constBegin(); it != pending.constEnd(); ++it)
+	{
+		if (!speakerSet.contains(it.key()))
+			continue;
+		auto& speaker = state.speakers[it.key()];
+		if (!speaker.decoder)
+			speaker.decoder.reset(new OpusAudioDecoder());
+		for (const auto& data : it.value())
+		{
+			// 20 ms Opus frames always fit into a single datagram.
+			const UDP::AudioFrameDatagramView dg(data.constData(), data.size());
+			if (!dg.isValid() || dg.count() != 1)
+				continue;
+
+			OpusFrame opusFrame;
+			const auto payload = QByteArray::fromRawData((const char*)dg.payload(), dg.payloadSize());
+			QDataStream in(payload);
+			in >> opusFrame;
+			if (in.status() != QDataStream::Ok)
+				continue;
+
+			std::unique_ptr<PcmFrame> pcm(speaker.decoder->decode(opusFrame));
+			if (!pcm)
+				continue;
+			const auto samples = (const qint16*)pcm->data;
+			speaker.samples.insert(speaker.samples.end(), samples, samples + pcm->numSamples);
+		}
+		const auto maxSamples = (size_t)(MAX_BUFFER_TICKS * TICK_SAMPLES);
+		if (speaker.samples.size() > maxSamples)
+			speaker.samples.erase(speaker.samples.begin(), speaker.samples.end() - maxSamples);
+	}
+
+	// Mix one tick of every speaker.
+	std::fill(state.acc.begin(), state.acc.end(), 0);
+	QHash<ocs::clientid_t, const qint16*> contributions;
+	for (auto it = state.speakers.begin(); it != state.speakers.end(); ++it)
+	{
+		auto& speaker = it->second;
+		if (!speaker.playing && speaker.samples.size() >= (size_t)(PREBUFFER_TICKS * TICK_SAMPLES))
+			speaker.playing = true;
+		if (speaker.playing && speaker.samples.size() < (size_t)TICK_SAMPLES)
+			speaker.playing = false;
+		if (!speaker.playing)
+			continue;
+		accumulate(state.acc.data(), speaker.samples.data(), TICK_SAMPLES);
+		contributions.insert(it->first, speaker.samples.data());
+	}
+	if (contributions.isEmpty())
+	{
+		return;
+	}
+
+	// Encode and send. Every receiver gets the mix without its own voice.
+	const auto frameId = state.nextFrameId++;
+	QByteArray listenerFrame;
+	for (const auto& receiver : receivers)
+	{
+		const auto isSpeaker = speakerSet.contains(receiver.clientId);
+		if (!isSpeaker && !listenerFrame.isEmpty())
+		{
+			send(listenerFrame, frameId, receiver.endpoint);
+			continue;
+		}
+
+		auto& stream = isSpeaker ? state.streams[receiver.clientId] : state.listenerStream;
+		if (!stream.encoder)
+			stream.encoder.reset(new OpusAudioEncoder());
+		subtractSaturated(state.acc.data(), isSpeaker ? contributions.value(receiver.clientId) : nullptr, (qint16*)state.pcm.data, TICK_SAMPLES);
+		std::unique_ptr<OpusFrame> opusFrame(stream.encoder->encode(state.pcm));
+		if (!opusFrame)
+			continue;
+
+		QByteArray frame;
+		QDataStream out(&frame, QIODevice::WriteOnly);
+		out << *opusFrame;
+		send(frame, frameId, receiver.endpoint);
+		if (!isSpeaker)
+			listenerFrame = frame;
+	}
+
+	for (auto it = contributions.constBegin(); it != contributions.constEnd(); ++it)
+	{
+		auto& samples = state.speakers[it.key()].samples;
+		samples.erase(samples.begin(), samples.begin() + TICK_SAMPLES);
+	}
+}
+
+void MediaAudioMixer::send(const QByteArray& frame, quint64 frameId, const MediaEndpoint& to)
+{
+	if (frame.size() > (int)UDP::AudioFrameDatagram::MAXSIZE)
+	{
+		return;
+	}
+
+	QByteArray datagram;
+	datagram.reserve(UDP::AudioFrameDatagramView::HEADER_SIZE + frame.size());
+	QDataStream out(&datagram, QIODevice::WriteOnly);
+	out.setByteOrder(QDataStream::BigEndian);
+	out << (UDP::dg_magic_t)UDP::Datagram::MAGIC;
+	out << (UDP::dg_type_t)UDP::AudioFrameDatagram::TYPE;
+	out << (UDP::AudioFrameDatagram::dg_level_t)UDP::AudioFrameDatagram::VOICE_ACTIVITY;
+	out << (UDP::AudioFrameDatagram::dg_sender_t)MIXED_SENDER_ID;
+	out << (UDP::AudioFrameDatagram::dg_frame_id_t)frameId;
+	out << (UDP::AudioFrameDatagram::dg_data_index_t)0;
+	out << (UDP::AudioFrameDatagram::dg_data_count_t)1;
+	out << (UDP::dg_size_t)frame.size();
+	out.writeRawData(frame.constData(), frame.size());
+	_output->sendMixedDatagram(datagram.constData(), datagram.size(), to);
+}
+
+void MediaAudioMixer::accumulate(qint32* acc, const qint16* samples, int count)
+{
+	auto i = 0;
+#ifdef MEDIAAUDIOMIXER_SSE2
+	for (; i + 8 <= count; i += 8)
+	{
+		// Sign-extends eight 16 bit samples into two vectors of 32 bit.
+		const auto s = _mm_loadu_si128((const __m128i*)(samples + i));
+		const auto lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+		const auto hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+		_mm_storeu_si128((__m128i*)(acc + i), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(acc + i)), lo));
+		_mm_storeu_si128((__m128i*)(acc + i + 4), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(acc + i + 4)), hi));
+	}
+#endif
+	for (; i < count; ++i)
+		acc[i] += samples[i];
+}
+
+void MediaAudioMixer::subtractSaturated(const qint32* acc, const qint16* samples, qint16* out, int count)
+{
+	auto i = 0;
+#ifdef MEDIAAUDIOMIXER_SSE2
+	for (; i + 8 <= count; i += 8)
+	{
+		auto lo = _mm_loadu_si128((const __m128i*)(acc + i));
+		auto hi = _mm_loadu_si128((const __m128i*)(acc + i + 4));
+		if (samples)
+		{
+			const auto s = _mm_loadu_si128((const __m128i*)(samples + i));
+			lo = _mm_sub_epi32(lo, _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+			hi = _mm_sub_epi32(hi, _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+		}
+		_mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(lo, hi));
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		const auto v = acc[i] - (samples ? samples[i] : 0);
+		out[i] = (qint16)std::min(std::max(v, -32768), 32767);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+
+MediaAudioMixer::Worker::Worker(MediaAudioMixer* mixer, int index) :
+	_mixer(mixer),
+	_index(index),
+	_stopFlag(0)
+{
+}
+
+void MediaAudioMixer::Worker::stop()
+{
+	QMutexLocker l(&_mutex);
+	_stopFlag = 1;
+	_cond.wakeAll();
+}
+
+void MediaAudioMixer::Worker::run()
+{
+	QElapsedTimer clock;
+	clock.start();
+	auto nextMs = clock.elapsed();
+
+	QMutexLocker l(&_mutex);
+	while (_stopFlag == 0)
+	{
+		const auto waitMs = nextMs - clock.elapsed();
+		if (waitMs > 0)
+		{
+			_cond.wait(&_mutex, (unsigned long)waitMs);
+			continue;
+		}
+
+		l.unlock();
+		_mixer->tick(_index);
+		l.relock();
+
+		nextMs += TICK_MS;
+		if (clock.elapsed() - nextMs > MAX_LATE_TICKS * TICK_MS)
+		{
+			HL_WARN(HL, QString("Audio mixer is late, skipping ticks (worker=%1)").arg(_index).toStdString());
+			nextMs = clock.elapsed();
+		}
+	}
+}
+
+#endif
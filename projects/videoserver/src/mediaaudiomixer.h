@@ -0,0 +1,135 @@
+#ifndef MEDIAAUDIOMIXER_H
+#define MEDIAAUDIOMIXER_H
+
+#include <memory>
+#include <vector>
+
+#include <QThread>
+#include <QHash>
+#include <QVector>
+#include <QByteArray>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+
+#include "libbase/defines.h"
+#include "libmediaprotocol/protocol.h"
+
+#include "mediaroutingtable.h"
+
+/*!
+	Server-side audio mixing (MCU mode) for big channels.
+
+	Instead of forwarding one Opus stream per speaker, the relay hands the
+	audio datagrams of a mixed group (channel) to the mixer. It decodes them,
+	mixes all speakers in fixed 20 ms ticks and encodes one stream per
+	receiver, which contains every speaker except the receiver itself.
+	Receivers which do not speak in the group share a single stream.
+
+	The mixed streams are sent with sender-id MIXED_SENDER_ID, which is
+	never assigned to a client. A client plays them like any other speaker.
+
+	Groups are spread across a pool of worker threads. Relay threads only
+	queue the datagrams, decoding and encoding happens in the workers.
+
+	Requires a build with audio support (OCS_INCLUDE_AUDIO).
+*/
+class MediaAudioMixer
+{
+public:
+	class Output
+	{
+	public:
+		virtual ~Output() {}
+
+		/*! Gets called from the worker threads, must be thread-safe. */
+		virtual void sendMixedDatagram(const char* data, int len, const MediaEndpoint& to) = 0;
+	};
+
+	// Sender-id of the mixed streams.
+	static const ocs::clientid_t MIXED_SENDER_ID = UDP::AudioFrameDatagram::MIXED_SENDER;
+
+	// Length of a tick and sampling rate of the Opus streams (see OpusAudioEncoder).
+	static const int TICK_MS = 20;
+	static const int SAMPLING_RATE = 8000;
+	static const int TICK_SAMPLES = SAMPLING_RATE * TICK_MS / 1000;
+
+public:
+	/*! \param minSpeakers Groups with at least this number of senders are mixed.
+		\param workers Number of worker threads.
+	*/
+	MediaAudioMixer(Output* output, int minSpeakers, int workers);
+	~MediaAudioMixer();
+	MediaAudioMixer(const MediaAudioMixer&) = delete;
+	MediaAudioMixer& operator=(const MediaAudioMixer&) = delete;
+
+	void start();
+	void stop();
+
+	/*! Queues an audio datagram of a sender. Called by the relay threads.
+		\return false, if the group is not mixed and the datagram should be forwarded.
+	*/
+	bool add(quint32 groupId, ocs::clientid_t senderId, const char* data, int len);
+
+	/*! Updates the mixed groups with their speakers and receivers. Called by the control-plane. */
+	void setRoutes(const MediaRoutingTable& routes);
+
+	/*! Adds the samples to the 32 bit accumulator "acc". */
+	static void accumulate(qint32* acc, const qint16* samples, int count);
+
+	/*! out = acc - samples, saturated to 16 bit. "samples" may be nullptr. */
+	static void subtractSaturated(const qint32* acc, const qint16* samples, qint16* out, int count);
+
+private:
+	class Receiver
+	{
+	public:
+		ocs::clientid_t clientId = 0;
+		MediaEndpoint endpoint;
+	};
+
+	class Group
+	{
+	public:
+		// Written by the control-plane and the relay threads.
+		QMutex mutex;
+		QVector<ocs::clientid_t> speakers;
+		QVector<Receiver> receivers;
+		QHash<ocs::clientid_t, QVector<QByteArray> > pending;
+
+		// Decoding and encoding state, owned by the worker of the group.
+		class State;
+		std::unique_ptr<State> state;
+	};
+
+	class Worker : public QThread
+	{
+	public:
+		Worker(MediaAudioMixer* mixer, int index);
+		void stop();
+
+	protected:
+		virtual void run();
+
+	private:
+		MediaAudioMixer* _mixer;
+		int _index;
+		QAtomicInt _stopFlag;
+		QMutex _mutex;
+		QWaitCondition _cond;
+	};
+
+	void tick(int workerIndex);
+	void mix(Group& group);
+	void send(const QByteArray& frame, quint64 frameId, const MediaEndpoint& to);
+
+private:
+	Output* _output;
+	int _minSpeakers;
+	QVector<Worker*> _workers;
+
+	QMutex _mutex;
+	QHash<quint32, std::shared_ptr<Group> > _groups;
+};
+
+#endif
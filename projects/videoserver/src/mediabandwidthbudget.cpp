@@ -0,0 +1,105 @@
+#include "mediabandwidthbudget.h"
+
+#include <chrono>
+
+///////////////////////////////////////////////////////////////////////
+
+// Maximum burst, as time to transfer the bytes with the budget's rate.
+static const qint64 BURST_US = 250 * 1000;
+
+// Receivers report every second, the streams of a receiver share one estimate.
+static const qint64 REPORT_INTERVAL_US = 1000 * 1000;
+
+// Fraction lost (of 255), above which the estimate drops and below which it rises.
+static const int LOSS_HIGH = 26;
+static const int LOSS_LOW = 5;
+
+// Lower bound of the estimate (64 kbit/s), the receiver still gets key frames.
+static const quint64 MIN_BYTES_PER_SECOND = 8 * 1000;
+
+MediaBandwidthBudget::MediaBandwidthBudget(quint64 maxBytesPerSecond) :
+	_maxBytesPerSecond(maxBytesPerSecond),
+	_bytesPerSecond(maxBytesPerSecond),
+	_decreaseUs(0),
+	_increaseUs(0),
+	_tatUs(0)
+{
+}
+
+void MediaBandwidthBudget::setMaxBytesPerSecond(quint64 maxBytesPerSecond)
+{
+	_maxBytesPerSecond.store(maxBytesPerSecond);
+
+	// A lower maximum applies immediately, a higher one is reached by the reports.
+	// Unlimited budgets take over the maximum as it is.
+	auto rate = _bytesPerSecond.load();
+	while (maxBytesPerSecond == 0 || rate == 0 || rate > maxBytesPerSecond)
+	{
+		if (_bytesPerSecond.compare_exchange_weak(rate, maxBytesPerSecond))
+			break;
+	}
+}
+
+void MediaBandwidthBudget::report(int fractionLost, qint64 nowUs)
+{
+	const auto max = _maxBytesPerSecond.load();
+	if (max == 0 || (fractionLost > LOSS_LOW && fractionLost <= LOSS_HIGH))
+	{
+		return;
+	}
+
+	// Reports of the other streams in the same interval describe the same link.
+	const auto decrease = fractionLost > LOSS_HIGH;
+	auto lastDecrease = _decreaseUs.load();
+	if (nowUs - lastDecrease < REPORT_INTERVAL_US)
+	{
+		return;
+	}
+	auto& last = decrease ? _decreaseUs : _increaseUs;
+	auto lastUs = decrease ? lastDecrease : last.load();
+	if (nowUs - lastUs < REPORT_INTERVAL_US || !last.compare_exchange_strong(lastUs, nowUs))
+	{
+		return;
+	}
+
+	auto rate = _bytesPerSecond.load();
+	quint64 next;
+	do
+	{
+		if (decrease)
+			next = rate - rate * fractionLost / (2 * 255);
+		else
+			next = rate + rate * 8 / 100 + 1;
+		next = qMin(max, qMax(MIN_BYTES_PER_SECOND, next));
+	}
+	while (!_bytesPerSecond.compare_exchange_weak(rate, next));
+}
+
+bool MediaBandwidthBudget::consume(quint64 bytes, qint64 nowUs, bool force)
+{
+	const auto rate = _bytesPerSecond.load();
+	if (rate == 0)
+	{
+		return true;
+	}
+	const auto costUs = (qint64)(bytes * 1000000 / rate);
+
+	auto tat = _tatUs.load();
+	while (true)
+	{
+		const auto begin = tat > nowUs ? tat : nowUs;
+		if (!force && begin - nowUs > BURST_US)
+		{
+			return false;
+		}
+		if (_tatUs.compare_exchange_weak(tat, begin + costUs))
+		{
+			return true;
+		}
+	}
+}
+
+qint64 MediaBandwidthBudget::nowUs()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
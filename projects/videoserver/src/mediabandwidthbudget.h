@@ -0,0 +1,65 @@
+#ifndef MEDIABANDWIDTHBUDGET_H
+#define MEDIABANDWIDTHBUDGET_H
+
+#include <atomic>
+
+#include <QtGlobal>
+
+/*!
+	Estimated available bandwidth of a media receiver and how much of it
+	has been used (token bucket, implemented as virtual scheduling).
+
+	A receiver gets video from multiple senders, which may be relayed by
+	different threads. All of them share the receiver's budget, which is
+	updated lock-free.
+
+	The estimate starts at the configured maximum and follows the loss,
+	which the receiver reports for its video streams (loss-based control
+	of Google Congestion Control): above 10% it drops by half the loss,
+	below 2% it rises by 8%, at most once per report interval. It does not
+	rise within an interval after a drop.
+*/
+class MediaBandwidthBudget
+{
+public:
+	/*! \param maxBytesPerSecond 0 = Unlimited. */
+	explicit MediaBandwidthBudget(quint64 maxBytesPerSecond);
+	MediaBandwidthBudget(const MediaBandwidthBudget&) = delete;
+	MediaBandwidthBudget& operator=(const MediaBandwidthBudget&) = delete;
+
+	/*! Current estimate. */
+	quint64 bytesPerSecond() const { return _bytesPerSecond.load(); }
+
+	/*! Upper bound of the estimate, the estimate is lowered to it if required. */
+	quint64 maxBytesPerSecond() const { return _maxBytesPerSecond.load(); }
+	void setMaxBytesPerSecond(quint64 maxBytesPerSecond);
+
+	/*! Updates the estimate with a receiver report of one of the receiver's
+		video streams (see UDP::VideoReceiverReportDatagram).
+		\param fractionLost 0 = None, 255 = All.
+	*/
+	void report(int fractionLost, qint64 nowUs);
+
+	/*! Takes "bytes" from the budget.
+		\param force Takes the bytes even if the budget is exhausted, the
+		       following calls have to pay it back (e.g. for key frames).
+		\return false, if the budget is exhausted. Nothing has been taken then.
+	*/
+	bool consume(quint64 bytes, qint64 nowUs, bool force);
+
+	/*! Monotonic clock for consume(). */
+	static qint64 nowUs();
+
+private:
+	std::atomic<quint64> _maxBytesPerSecond;
+	std::atomic<quint64> _bytesPerSecond;
+
+	// Last changes of the estimate.
+	std::atomic<qint64> _decreaseUs;
+	std::atomic<qint64> _increaseUs;
+
+	// Theoretical time at which all consumed bytes have been transferred.
+	std::atomic<qint64> _tatUs;
+};
+
+#endif
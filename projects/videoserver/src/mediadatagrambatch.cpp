@@ -0,0 +1,196 @@
+#include "mediadatagrambatch.h"
+
+#ifdef __linux__
+
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+
+///////////////////////////////////////////////////////////////////////
+
+int createMediaSocket(const QHostAddress& address, quint16 port, bool reusePort, int* family)
+{
+	// "Any" is the only address to listen on IPv4 and IPv6 (dual-stack).
+	const auto dualStack = address == QHostAddress::Any;
+	const auto fam = (!dualStack && address.protocol() == QAbstractSocket::IPv4Protocol) ? AF_INET : AF_INET6;
+
+	auto fd = ::socket(fam, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return -1;
+
+	if (fam == AF_INET6)
+	{
+		int v6only = dualStack ? 0 : 1;
+		::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+	}
+	if (reusePort)
+	{
+		int on = 1;
+		if (::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0)
+		{
+			const auto err = errno;
+			::close(fd);
+			errno = err;
+			return -1;
+		}
+	}
+
+	sockaddr_storage ss;
+	const auto sslen = toSockAddr(dualStack ? QHostAddress(QHostAddress::AnyIPv6) : address, port, fam, ss);
+	if (::bind(fd, (const sockaddr*)&ss, sslen) != 0)
+	{
+		const auto err = errno;
+		::close(fd);
+		errno = err;
+		return -1;
+	}
+
+	if (family)
+		*family = fam;
+	return fd;
+}
+
+socklen_t toSockAddr(const QHostAddress& address, quint16 port, int family, sockaddr_storage& ss)
+{
+	std::memset(&ss, 0, sizeof(ss));
+	bool isIPv4 = false;
+	const auto ipv4 = address.toIPv4Address(&isIPv4);
+	if (family == AF_INET)
+	{
+		auto sin = (sockaddr_in*)&ss;
+		sin->sin_family = AF_INET;
+		sin->sin_port = htons(port);
+		sin->sin_addr.s_addr = htonl(ipv4);
+		return sizeof(sockaddr_in);
+	}
+	auto sin6 = (sockaddr_in6*)&ss;
+	sin6->sin6_family = AF_INET6;
+	sin6->sin6_port = htons(port);
+	if (isIPv4)
+	{
+		// IPv4-mapped IPv6 address (::ffff:a.b.c.d)
+		sin6->sin6_addr.s6_addr[10] = 0xff;
+		sin6->sin6_addr.s6_addr[11] = 0xff;
+		const auto n = htonl(ipv4);
+		std::memcpy(&sin6->sin6_addr.s6_addr[12], &n, 4);
+	}
+	else
+	{
+		const auto ipv6 = address.toIPv6Address();
+		std::memcpy(&sin6->sin6_addr, &ipv6, 16);
+	}
+	return sizeof(sockaddr_in6);
+}
+
+///////////////////////////////////////////////////////////////////////
+
+// Each received datagram usually fans out to multiple receivers.
+static const int SEND_QUEUE_FACTOR = 8;
+
+MediaDatagramBatch::MediaDatagramBatch(int fd, int capacity, int datagramSize) :
+	_fd(fd),
+	_capacity(capacity > 0 ? capacity : 1),
+	_datagramSize(datagramSize),
+	_count(0),
+	_pending(0),
+	_sendDrops(0)
+{
+	_recvBuffer.resize(_capacity * _datagramSize);
+	_recvIov.resize(_capacity);
+	_recvAddr.resize(_capacity);
+	_recvMsgs.resize(_capacity);
+	for (auto i = 0; i < _capacity; ++i)
+	{
+		_recvIov[i].iov_base = &_recvBuffer[i * _datagramSize];
+		_recvIov[i].iov_len = _datagramSize;
+		std::memset(&_recvMsgs[i], 0, sizeof(mmsghdr));
+		_recvMsgs[i].msg_hdr.msg_iov = &_recvIov[i];
+		_recvMsgs[i].msg_hdr.msg_iovlen = 1;
+		_recvMsgs[i].msg_hdr.msg_name = &_recvAddr[i];
+	}
+
+	const auto sendCapacity = _capacity * SEND_QUEUE_FACTOR;
+	_sendIov.resize(sendCapacity);
+	_sendAddr.resize(sendCapacity);
+	_sendMsgs.resize(sendCapacity);
+	for (auto i = 0; i < sendCapacity; ++i)
+	{
+		std::memset(&_sendMsgs[i], 0, sizeof(mmsghdr));
+		_sendMsgs[i].msg_hdr.msg_iov = &_sendIov[i];
+		_sendMsgs[i].msg_hdr.msg_iovlen = 1;
+		_sendMsgs[i].msg_hdr.msg_name = &_sendAddr[i];
+	}
+}
+
+int MediaDatagramBatch::receive()
+{
+	// "msg_namelen" is a value-result argument and needs to be reset each time.
+	for (auto i = 0; i < _capacity; ++i)
+	{
+		_recvMsgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+		_recvMsgs[i].msg_hdr.msg_flags = 0;
+		_recvMsgs[i].msg_len = 0;
+	}
+
+	int res;
+	do
+	{
+		res = recvmmsg(_fd, _recvMsgs.data(), _capacity, MSG_DONTWAIT, nullptr);
+	}
+	while (res < 0 && errno == EINTR);
+
+	if (res < 0)
+	{
+		_count = 0;
+		return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+	}
+	_count = res;
+	return _count;
+}
+
+void MediaDatagramBatch::enqueue(const char* data, int size, const sockaddr* address, socklen_t addressLength)
+{
+	if (_pending == (int)_sendMsgs.size())
+	{
+		flush();
+	}
+	auto& msg = _sendMsgs[_pending];
+	_sendIov[_pending].iov_base = const_cast<char*>(data);
+	_sendIov[_pending].iov_len = size;
+	std::memcpy(&_sendAddr[_pending], address, addressLength);
+	msg.msg_hdr.msg_namelen = addressLength;
+	++_pending;
+}
+
+int MediaDatagramBatch::flush()
+{
+	auto sent = 0;
+	auto drops = 0;
+	while (sent < _pending)
+	{
+		auto res = sendmmsg(_fd, &_sendMsgs[sent], _pending - sent, 0);
+		if (res < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			// EAGAIN/ENOBUFS: Same as with QUdpSocket, the datagrams are lost.
+			// Any other error is specific to the first datagram, skip it.
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+			{
+				drops += _pending - sent;
+				break;
+			}
+			++drops;
+			++sent;
+			continue;
+		}
+		sent += res;
+	}
+	auto delivered = _pending - drops;
+	_sendDrops += drops;
+	_pending = 0;
+	return delivered;
+}
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef MEDIADATAGRAMBATCH_H
+#define MEDIADATAGRAMBATCH_H
+
+#ifdef __linux__
+
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#include <QHostAddress>
+
+/*!
+	Creates a non-blocking UDP socket bound to "address" and "port".
+	The special address QHostAddress::Any creates a dual-stack (IPv4 & IPv6) socket.
+	With "reusePort" multiple sockets can be bound to the same port (SO_REUSEPORT),
+	the kernel distributes incoming datagrams by the sender's address.
+	\return File descriptor or -1 on error (see errno).
+*/
+int createMediaSocket(const QHostAddress& address, quint16 port, bool reusePort, int* family);
+
+/*! Converts QHostAddress and port to a native address of the given socket "family".
+	\return Length of the address written to "ss".
+*/
+socklen_t toSockAddr(const QHostAddress& address, quint16 port, int family, sockaddr_storage& ss);
+
+/*!
+	Receive and send buffers for the batched (recvmmsg/sendmmsg) media relay.
+
+	receive() reads up to "capacity" datagrams with a single system call.
+	Outgoing datagrams are queued with enqueue() and do not copy the payload,
+	they only reference it. Since outgoing datagrams usually reference the
+	memory of received ones, the queue needs to be flushed before the next
+	call to receive().
+
+	The class does not own the socket.
+*/
+class MediaDatagramBatch
+{
+public:
+	MediaDatagramBatch(int fd, int capacity, int datagramSize = 4096);
+	MediaDatagramBatch(const MediaDatagramBatch&) = delete;
+	MediaDatagramBatch& operator=(const MediaDatagramBatch&) = delete;
+
+	int capacity() const { return _capacity; }
+
+	/*! Reads as many datagrams as available (max. capacity()) without blocking.
+		\return Number of received datagrams, 0 if nothing is pending and -1 on error.
+	*/
+	int receive();
+	int count() const { return _count; }
+	char* data(int i) { return &_recvBuffer[i * _datagramSize]; }
+	int size(int i) const { return (int)_recvMsgs[i].msg_len; }
+	const sockaddr* source(int i) const { return (const sockaddr*)&_recvAddr[i]; }
+	socklen_t sourceLength(int i) const { return _recvMsgs[i].msg_hdr.msg_namelen; }
+
+	/*! Queues a datagram for sending, the queue gets flushed automatically if it is full.
+	*/
+	void enqueue(const char* data, int size, const sockaddr* address, socklen_t addressLength);
+	int pending() const { return _pending; }
+
+	/*! Sends all queued datagrams with as few sendmmsg() calls as possible.
+		\return Number of sent datagrams.
+	*/
+	int flush();
+
+	/*! Number of datagrams which could not be sent (e.g. full socket buffer)
+		since the last call of this function. */
+	unsigned long long takeSendDrops() { auto n = _sendDrops; _sendDrops = 0; return n; }
+
+private:
+	int _fd;
+	int _capacity;
+	int _datagramSize;
+
+	// Receive side.
+	int _count;
+	std::vector<char> _recvBuffer;
+	std::vector<iovec> _recvIov;
+	std::vector<sockaddr_storage> _recvAddr;
+	std::vector<mmsghdr> _recvMsgs;
+
+	// Send side.
+	int _pending;
+	std::vector<iovec> _sendIov;
+	std::vector<sockaddr_storage> _sendAddr;
+	std::vector<mmsghdr> _sendMsgs;
+	unsigned long long _sendDrops;
+};
+
+#endif
+#endif
@@ -0,0 +1,148 @@
+#include "mediakeyframecache.h"
+
+#include <QMutexLocker>
+
+#include "libapp/vp8frame.h"
+
+// Frames arriving later than this are taken as a restart of the stream.
+static const UDP::VideoFrameDatagram::dg_frame_id_t MAX_FRAME_REORDERING = 64;
+
+///////////////////////////////////////////////////////////////////////
+
+MediaKeyFrameCache::MediaKeyFrameCache(int maxDatagrams) :
+	_maxDatagrams(maxDatagrams)
+{
+}
+
+std::shared_ptr<MediaKeyFrameCache::Entry> MediaKeyFrameCache::entry(ocs::clientid_t senderId, int layer)
+{
+	QMutexLocker l(&_mutex);
+	auto& e = _entries[entryKey(senderId, layer)];
+	if (!e)
+		e = std::make_shared<Entry>();
+	return e;
+}
+
+bool MediaKeyFrameCache::add(Entry& entry, const UDP::VideoFrameDatagramView& dg)
+{
+	if (dg.flags() & UDP::VideoFrameDatagram::Encrypted)
+		return false;
+
+	const auto frameId = dg.frameId();
+
+	QMutexLocker l(&entry.mutex);
+	const auto keyFrameStart = isKeyFrame(dg) && (frameId > entry.keyFrameId || isRestart(frameId, entry.newestFrameId));
+	if (keyFrameStart)
+	{
+		// A restarted stream continues with lower frame-ids.
+		entry.newestFrameId = frameId;
+		entry.keyFrameId = frameId;
+		entry.keyFrameDatagrams = dg.count();
+		entry.keyFrameReceived = 0;
+		entry.keyFrameIndices.fill(false, dg.count());
+		entry.overflow = false;
+		entry.datagrams.clear();
+		entry.recovered.clear();
+	}
+	else if (entry.keyFrameId == 0 || frameId < entry.keyFrameId)
+	{
+		return false;
+	}
+	entry.newestFrameId = qMax(entry.newestFrameId, frameId);
+	if (entry.overflow)
+	{
+		return false;
+	}
+
+	if (entry.datagrams.size() >= _maxDatagrams)
+	{
+		// Too long since the last key frame, a replay would be a burst
+		// of old frames. Wait for the next key frame.
+		entry.overflow = true;
+		entry.datagrams.clear();
+		entry.recovered.clear();
+		return false;
+	}
+
+	// Parity datagrams are cached, but can not replace a missing data datagram for sure.
+	// Duplicates (e.g. retransmissions after a NACK) must not complete the key frame.
+	if (frameId == entry.keyFrameId && !(dg.flags() & UDP::VideoFrameDatagram::Redundant))
+	{
+		const auto index = (int)dg.index();
+		if (index >= entry.keyFrameIndices.size() || entry.keyFrameIndices.testBit(index))
+			return keyFrameStart;
+		entry.keyFrameIndices.setBit(index);
+		++entry.keyFrameReceived;
+	}
+	entry.datagrams.append(QByteArray((const char*)dg.data(), (int)dg.size()));
+	return keyFrameStart;
+}
+
+bool MediaKeyFrameCache::datagrams(ocs::clientid_t senderId, int layer, QVector<QByteArray>& datagrams)
+{
+	const auto e = find(senderId, layer);
+	if (!e)
+		return false;
+
+	QMutexLocker l(&e->mutex);
+	if (!isComplete(*e))
+		return false;
+	datagrams = e->datagrams;
+	return true;
+}
+
+bool MediaKeyFrameCache::datagramsForRecovery(ocs::clientid_t senderId, int layer, const MediaEndpointKey& receiver, QVector<QByteArray>& datagrams)
+{
+	const auto e = find(senderId, layer);
+	if (!e)
+		return false;
+
+	QMutexLocker l(&e->mutex);
+	if (!isComplete(*e) || e->recovered.contains(receiver))
+		return false;
+	e->recovered.insert(receiver);
+	datagrams = e->datagrams;
+	return true;
+}
+
+void MediaKeyFrameCache::retain(const MediaRoutingTable& routes)
+{
+	QSet<ocs::clientid_t> senderIds;
+	for (auto i = 0; i < routes.senderCount(); ++i)
+		senderIds.insert(routes.sender(i).clientId);
+
+	QMutexLocker l(&_mutex);
+	auto it = _entries.begin();
+	while (it != _entries.end())
+	{
+		if (!senderIds.contains(entrySenderId(it.key())))
+			it = _entries.erase(it);
+		else
+			++it;
+	}
+}
+
+bool MediaKeyFrameCache::isKeyFrame(const UDP::VideoFrameDatagramView& dg)
+{
+	if (dg.flags() & UDP::VideoFrameDatagram::KeyFrame)
+		return true;
+	if (dg.index() != 0 || (dg.flags() & UDP::VideoFrameDatagram::Redundant))
+		return false;
+	return VP8Frame::peekType((const char*)dg.payload(), dg.payloadSize()) == VP8Frame::KEY;
+}
+
+bool MediaKeyFrameCache::isRestart(UDP::VideoFrameDatagram::dg_frame_id_t frameId, UDP::VideoFrameDatagram::dg_frame_id_t newestFrameId)
+{
+	return frameId + MAX_FRAME_REORDERING < newestFrameId;
+}
+
+bool MediaKeyFrameCache::isComplete(const Entry& entry)
+{
+	return entry.keyFrameId != 0 && !entry.overflow && entry.keyFrameReceived >= entry.keyFrameDatagrams;
+}
+
+std::shared_ptr<MediaKeyFrameCache::Entry> MediaKeyFrameCache::find(ocs::clientid_t senderId, int layer)
+{
+	QMutexLocker l(&_mutex);
+	return _entries.value(entryKey(senderId, layer));
+}
@@ -0,0 +1,109 @@
+#ifndef MEDIAKEYFRAMECACHE_H
+#define MEDIAKEYFRAMECACHE_H
+
+#include <memory>
+
+#include <QHash>
+#include <QSet>
+#include <QVector>
+#include <QByteArray>
+#include <QBitArray>
+#include <QMutex>
+
+#include "libbase/defines.h"
+
+#include "libmediaprotocol/datagramview.h"
+
+#include "mediaroutingtable.h"
+
+/*!
+	Keeps the datagrams of the latest key frame of each sender, together
+	with all following frames up to now (group of pictures). Simulcast
+	layers are separate streams, they are cached independently.
+
+	Replaying the cached datagrams allows a new receiver to decode the
+	sender's video immediately, without waiting for the next key frame
+	and without forcing the sender to create one.
+
+	The cache is shared by all relay threads of a MediaSocketHandler.
+	Every sender has its own lock, which is usually only taken by the
+	relay thread of the sender.
+*/
+class MediaKeyFrameCache
+{
+public:
+	class Entry
+	{
+		friend class MediaKeyFrameCache;
+
+		QMutex mutex;
+		UDP::VideoFrameDatagram::dg_frame_id_t keyFrameId = 0;
+		UDP::VideoFrameDatagram::dg_frame_id_t newestFrameId = 0;
+		int keyFrameDatagrams = 0;
+		int keyFrameReceived = 0;      ///< Distinct indices of "keyFrameIndices".
+		QBitArray keyFrameIndices;     ///< Received data datagrams of the key frame.
+		bool overflow = false;
+		QVector<QByteArray> datagrams;
+		QSet<MediaEndpointKey> recovered;
+	};
+
+public:
+	/*! \param maxDatagrams Maximum number of cached datagrams per sender.
+			If the frames after a key frame exceed this limit, the sender's
+			cache stays empty until the next key frame.
+	*/
+	explicit MediaKeyFrameCache(int maxDatagrams);
+	MediaKeyFrameCache(const MediaKeyFrameCache&) = delete;
+	MediaKeyFrameCache& operator=(const MediaKeyFrameCache&) = delete;
+
+	/*! Returns the entry of a sender's layer and creates it, if required.
+		The entry should be kept by the relay for all following datagrams.
+	*/
+	std::shared_ptr<Entry> entry(ocs::clientid_t senderId, int layer);
+
+	/*! Adds a video datagram of the entry's sender and layer.
+		\return true, if the datagram started a new key frame.
+	*/
+	bool add(Entry& entry, const UDP::VideoFrameDatagramView& dg);
+
+	/*! Copies the cached datagrams of a sender's layer.
+		\return false, if there is no complete key frame.
+	*/
+	bool datagrams(ocs::clientid_t senderId, int layer, QVector<QByteArray>& datagrams);
+
+	/*! Same as datagrams(), but only once per receiver and key frame.
+		Repeated recovery requests of a receiver should be answered by the sender.
+	*/
+	bool datagramsForRecovery(ocs::clientid_t senderId, int layer, const MediaEndpointKey& receiver, QVector<QByteArray>& datagrams);
+
+	/*! Removes the entries of all senders, which are not part of "routes". */
+	void retain(const MediaRoutingTable& routes);
+
+	/*! Checks whether the datagram is part of a key frame.
+		Current clients set the KeyFrame flag on every datagram of a key frame.
+		For older clients only the first datagram can be recognized, it starts
+		with the serialized VP8Frame (see VP8Frame::peekType()).
+	*/
+	static bool isKeyFrame(const UDP::VideoFrameDatagramView& dg);
+
+	/*! Checks whether a key frame with "frameId" restarts the stream, e.g. the sender
+		recreated its media socket and counts from 1 again. Reordered frames of the
+		current stream are only a few frames behind "newestFrameId".
+	*/
+	static bool isRestart(UDP::VideoFrameDatagram::dg_frame_id_t frameId, UDP::VideoFrameDatagram::dg_frame_id_t newestFrameId);
+
+private:
+	static bool isComplete(const Entry& entry);
+	std::shared_ptr<Entry> find(ocs::clientid_t senderId, int layer);
+
+	// Sender's client-id and layer.
+	static quint64 entryKey(ocs::clientid_t senderId, int layer) { return ((quint64)(quint32)senderId << 8) | (quint8)layer; }
+	static ocs::clientid_t entrySenderId(quint64 key) { return (ocs::clientid_t)(quint32)(key >> 8); }
+
+private:
+	int _maxDatagrams;
+	QMutex _mutex;
+	QHash<quint64, std::shared_ptr<Entry> > _entries;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#include "mediarecoverylimiter.h"
+
+#include <QMutexLocker>
+#include <QSet>
+
+#include "mediaroutingtable.h"
+
+///////////////////////////////////////////////////////////////////////
+
+MediaRecoveryLimiter::MediaRecoveryLimiter(int windowMs) :
+	_windowMs(windowMs)
+{
+	_clock.start();
+}
+
+bool MediaRecoveryLimiter::allow(ocs::clientid_t senderId)
+{
+	const auto now = _clock.elapsed();
+
+	QMutexLocker l(&_mutex);
+	auto it = _lastForwarded.find(senderId);
+	if (it == _lastForwarded.end())
+	{
+		_lastForwarded.insert(senderId, now);
+		return true;
+	}
+	if (now - it.value() < _windowMs)
+	{
+		return false;
+	}
+	it.value() = now;
+	return true;
+}
+
+void MediaRecoveryLimiter::retain(const MediaRoutingTable& routes)
+{
+	QSet<ocs::clientid_t> senderIds;
+	for (auto i = 0; i < routes.senderCount(); ++i)
+		senderIds.insert(routes.sender(i).clientId);
+
+	QMutexLocker l(&_mutex);
+	auto it = _lastForwarded.begin();
+	while (it != _lastForwarded.end())
+	{
+		if (!senderIds.contains(it.key()))
+			it = _lastForwarded.erase(it);
+		else
+			++it;
+	}
+}
@@ -0,0 +1,45 @@
+#ifndef MEDIARECOVERYLIMITER_H
+#define MEDIARECOVERYLIMITER_H
+
+#include <QHash>
+#include <QMutex>
+#include <QElapsedTimer>
+
+#include "libbase/defines.h"
+
+class MediaRoutingTable;
+
+/*!
+	Merges the recovery requests (key frame requests) for a sender.
+
+	Every receiver of a sender asks for a new key frame after packet loss.
+	In a big channel the sender would create one key frame per receiver,
+	although a single key frame is sent to all of them. The limiter lets
+	one request per sender and window pass and suppresses the others.
+
+	The limiter is shared by all relay threads of a MediaSocketHandler,
+	because the requests for a sender may arrive at any of them.
+*/
+class MediaRecoveryLimiter
+{
+public:
+	/*! \param windowMs Minimum time between two forwarded requests for the same sender.
+	*/
+	explicit MediaRecoveryLimiter(int windowMs);
+	MediaRecoveryLimiter(const MediaRecoveryLimiter&) = delete;
+	MediaRecoveryLimiter& operator=(const MediaRecoveryLimiter&) = delete;
+
+	/*! \return true, if the request should be forwarded to the sender. */
+	bool allow(ocs::clientid_t senderId);
+
+	/*! Removes the state of all senders, which are not part of "routes". */
+	void retain(const MediaRoutingTable& routes);
+
+private:
+	qint64 _windowMs;
+	QElapsedTimer _clock;
+	QMutex _mutex;
+	QHash<ocs::clientid_t, qint64> _lastForwarded;
+};
+
+#endif
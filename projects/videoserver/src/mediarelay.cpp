@@ -0,0 +1,670 @@
+#include "mediarelay.h"
+
+#include <QJsonArray>
+
+#include "humblelogging/api.h"
+
+#include "libmediaprotocol/datagramview.h"
+
+#include "mediadatagrambatch.h"
+
+HUMBLE_LOGGER(HL, "server.mediarelay");
+
+///////////////////////////////////////////////////////////////////////
+
+static QJsonArray toQJsonArray(const QVector<quint64>& v)
+{
+	QJsonArray arr;
+	for (auto i = 0; i < v.size(); ++i)
+		arr.append((qint64)v[i]);
+	return arr;
+}
+
+void MediaRelayStatistics::merge(const MediaRelayStatistics& other)
+{
+	datagramsRead += other.datagramsRead;
+	datagramsWritten += other.datagramsWritten;
+	bytesRead += other.bytesRead;
+	bytesWritten += other.bytesWritten;
+	batches += other.batches;
+	batchedDatagrams += other.batchedDatagrams;
+	if (batchSizes.size() < other.batchSizes.size())
+		batchSizes.resize(other.batchSizes.size());
+	for (auto i = 0; i < other.batchSizes.size(); ++i)
+		batchSizes[i] += other.batchSizes[i];
+	sendDrops += other.sendDrops;
+	unknownSenders += other.unknownSenders;
+	keyFrameReplays += other.keyFrameReplays;
+	recoveryFromCache += other.recoveryFromCache;
+	recoveryForwarded += other.recoveryForwarded;
+	recoverySuppressed += other.recoverySuppressed;
+	nacksForwarded += other.nacksForwarded;
+	foreignRequests += other.foreignRequests;
+	receiverReports += other.receiverReports;
+	transportFeedbacks += other.transportFeedbacks;
+	for (auto it = other.transportJitter.constBegin(); it != other.transportJitter.constEnd(); ++it)
+		transportJitter[it.key()] = qMax(transportJitter.value(it.key()), it.value());
+	audioSuppressed += other.audioSuppressed;
+	audioMixed += other.audioMixed;
+	for (auto it = other.droppedFrames.constBegin(); it != other.droppedFrames.constEnd(); ++it)
+		droppedFrames[it.key()] += it.value();
+}
+
+QJsonObject MediaRelayStatistics::toQJsonObject() const
+{
+	QJsonObject obj;
+	obj["datagramsread"] = (qint64)datagramsRead;
+	obj["datagramswritten"] = (qint64)datagramsWritten;
+	obj["batches"] = (qint64)batches;
+	obj["batcheddatagrams"] = (qint64)batchedDatagrams;
+	obj["averagebatchsize"] = batches > 0 ? (double)batchedDatagrams / batches : 0.0;
+	obj["batchsizes"] = toQJsonArray(batchSizes);
+	obj["senddrops"] = (qint64)sendDrops;
+	obj["workerdatagrams"] = toQJsonArray(workerDatagrams);
+	obj["unknownsenders"] = (qint64)unknownSenders;
+	obj["keyframereplays"] = (qint64)keyFrameReplays;
+	obj["recoveryfromcache"] = (qint64)recoveryFromCache;
+	obj["recoveryforwarded"] = (qint64)recoveryForwarded;
+	obj["recoverysuppressed"] = (qint64)recoverySuppressed;
+	obj["nacksforwarded"] = (qint64)nacksForwarded;
+	obj["foreignrequests"] = (qint64)foreignRequests;
+	obj["receiverreports"] = (qint64)receiverReports;
+	obj["transportfeedbacks"] = (qint64)transportFeedbacks;
+	QJsonObject jitter;
+	for (auto it = transportJitter.constBegin(); it != transportJitter.constEnd(); ++it)
+		jitter[QString::number(it.key())] = (qint64)it.value();
+	obj["transportjitter"] = jitter;
+	obj["audiosuppressed"] = (qint64)audioSuppressed;
+	obj["audiomixed"] = (qint64)audioMixed;
+	QJsonObject dropped;
+	for (auto it = droppedFrames.constBegin(); it != droppedFrames.constEnd(); ++it)
+		dropped[QString::number(it.key())] = (qint64)it.value();
+	obj["droppedframes"] = dropped;
+	return obj;
+}
+
+///////////////////////////////////////////////////////////////////////
+
+MediaRelay::MediaRelay(Output* output, MediaRoutingTableRcu::Reader* routes, MediaKeyFrameCache* keyFrameCache, MediaRecoveryLimiter* recoveryLimiter, MediaActiveSpeakers* activeSpeakers, MediaAudioMixer* audioMixer) :
+	_output(output),
+	_routesReader(routes),
+	_routes(nullptr),
+	_routesVersion(0),
+	_keyFrameCache(keyFrameCache),
+	_recoveryLimiter(recoveryLimiter),
+	_activeSpeakers(activeSpeakers),
+	_audioMixer(audioMixer)
+{
+}
+
+void MediaRelay::refreshRoutes()
+{
+	// Compares versions, a new table may have the address of a deleted one.
+	_routes = _routesReader->acquire();
+	if (!_routes || _routes->version() == _routesVersion)
+	{
+		return;
+	}
+	if (_keyFrameCache)
+		replayKeyFrames();
+	retainForwardingSenders();
+	retainTransportFeedback();
+	_routesVersion = _routes->version();
+}
+
+void MediaRelay::processDatagram(const char* data, int len, const MediaEndpoint& sender)
+{
+	++_statistics.datagramsRead;
+	_statistics.bytesRead += len;
+	dispatchDatagram(data, len, sender);
+}
+
+void MediaRelay::dispatchDatagram(const char* data, int len, const MediaEndpoint& sender)
+{
+	// Reads the header fields directly from the buffer.
+	const UDP::DatagramView dg(data, len);
+	if (!dg.isValid())
+	{
+		HL_WARN(HL, QString("Received invalid datagram (size=%1; data=%2)").arg(
+					len).arg(QString::fromLatin1(data, len)).toStdString());
+		return;
+	}
+
+	switch (dg.type())
+	{
+		case UDP::AuthDatagram::TYPE:
+		{
+			const UDP::AuthDatagramView dgauth(data, len);
+			if (!dgauth.isValid())
+			{
+				return;
+			}
+			auto token = QString::fromUtf8((const char*)dgauth.token(), dgauth.tokenSize());
+			_output->authenticateToken(token, sender.address(), sender.port());
+			break;
+		}
+
+		case UDP::TransportDatagram::TYPE:
+		{
+			const UDP::TransportDatagramView dgtr(data, len);
+			if (!dgtr.isValid() || UDP::DatagramView(dgtr.payload(), dgtr.payloadSize()).type() == UDP::TransportDatagram::TYPE)
+			{
+				return;
+			}
+			const auto route = _routes ? _routes->findSender(MediaEndpointKey::fromEndpoint(sender)) : nullptr;
+			if (route)
+			{
+				receiveTransportDatagram(*route, dgtr, sender);
+			}
+
+			// The enclosed datagram is handled as if it came without the header.
+			dispatchDatagram((const char*)dgtr.payload(), (int)dgtr.payloadSize(), sender);
+			break;
+		}
+
+		case UDP::MtuProbeDatagram::TYPE:
+		{
+			const UDP::MtuProbeDatagramView dgprobe(data, len);
+			if (!dgprobe.isValid())
+			{
+				return;
+			}
+			_output->probeMtu(len, sender.address(), sender.port());
+			break;
+		}
+
+		case UDP::VideoFrameDatagram::TYPE:
+		{
+			const auto route = _routes ? _routes->findSender(MediaEndpointKey::fromEndpoint(sender)) : nullptr;
+			if (!route)
+			{
+				++_statistics.unknownSenders;
+				return;
+			}
+			if (route->budgeted || route->layers > 1)
+			{
+				forwardVideoDatagram(*route, data, len);
+			}
+			else
+			{
+				const auto receivers = _routes->receivers(*route);
+				for (quint32 i = 0; i < route->receiverCount; ++i)
+				{
+					relayDatagram(data, len, receivers[i]);
+				}
+			}
+			if (_keyFrameCache)
+			{
+				cacheVideoDatagram(*route, data, len);
+			}
+			break;
+		}
+
+		case UDP::VideoFrameRequestRecoveryDatagram::TYPE:
+		{
+			const UDP::VideoFrameRequestRecoveryDatagramView dgrec(data, len);
+			if (!dgrec.isValid())
+			{
+				return;
+			}
+
+			// Only receivers of the sender may request its video.
+			ReceiverRoute rr;
+			if (!findReceiverRoute(dgrec.sender(), sender, rr))
+			{
+				++_statistics.foreignRequests;
+				return;
+			}
+
+			// Answer from cache, if possible.
+			if (_keyFrameCache && answerRecoveryFromCache(rr, dgrec.sender(), sender))
+			{
+				++_statistics.recoveryFromCache;
+				return;
+			}
+
+			// The sender's next key frame reaches all receivers anyway.
+			if (_recoveryLimiter && !_recoveryLimiter->allow(dgrec.sender()))
+			{
+				++_statistics.recoverySuppressed;
+				return;
+			}
+			relayDatagram(data, len, *rr.senderEndpoint);
+			++_statistics.recoveryForwarded;
+			break;
+		}
+
+		case UDP::VideoFrameNackDatagram::TYPE:
+		{
+			// The sender resends the datagrams from its own cache.
+			const UDP::VideoFrameNackDatagramView dgnack(data, len);
+			if (!dgnack.isValid())
+			{
+				return;
+			}
+			ReceiverRoute rr;
+			if (!findReceiverRoute(dgnack.sender(), sender, rr))
+			{
+				++_statistics.foreignRequests;
+				return;
+			}
+			relayDatagram(data, len, *rr.senderEndpoint);
+			++_statistics.nacksForwarded;
+			break;
+		}
+
+		case UDP::VideoReceiverReportDatagram::TYPE:
+		{
+			const UDP::VideoReceiverReportDatagramView dgrep(data, len);
+			if (!dgrep.isValid())
+			{
+				return;
+			}
+			// Only receivers of the sender may change its FEC and their own budget.
+			ReceiverRoute rr;
+			if (!findReceiverRoute(dgrep.sender(), sender, rr))
+			{
+				++_statistics.foreignRequests;
+				return;
+			}
+			relayDatagram(data, len, *rr.senderEndpoint);
+			reportReceiverLoss(rr, dgrep.fractionLost());
+			++_statistics.receiverReports;
+			break;
+		}
+
+		case UDP::AudioFrameDatagram::TYPE:
+		{
+			const auto route = _routes ? _routes->findSender(MediaEndpointKey::fromEndpoint(sender)) : nullptr;
+			if (!route)
+			{
+				++_statistics.unknownSenders;
+				return;
+			}
+#if defined(OCS_INCLUDE_AUDIO)
+			if (_audioMixer && route->audioGroup != 0 && _audioMixer->add(route->audioGroup, route->clientId, data, len))
+			{
+				++_statistics.audioMixed;
+				return;
+			}
+#endif
+			if (_activeSpeakers && route->audioGroup != 0)
+			{
+				const UDP::AudioFrameDatagramView dga(data, len);
+				if (!dga.isValid())
+				{
+					return;
+				}
+				if (!_activeSpeakers->update(route->audioGroup, route->clientId, dga.level()))
+				{
+					++_statistics.audioSuppressed;
+					return;
+				}
+			}
+			const auto receivers = _routes->receivers(*route);
+			for (quint32 i = 0; i < route->receiverCount; ++i)
+			{
+				relayDatagram(data, len, receivers[i]);
+			}
+			break;
+		}
+
+	}
+}
+
+#ifdef __linux__
+int MediaRelay::processBatch(MediaDatagramBatch& batch)
+{
+	refreshRoutes();
+
+	const auto count = batch.receive();
+	if (count < 0)
+	{
+		return count;
+	}
+
+	if (count > 0)
+	{
+		++_statistics.batches;
+		_statistics.batchedDatagrams += count;
+		if (_statistics.batchSizes.size() <= batch.capacity())
+			_statistics.batchSizes.resize(batch.capacity() + 1);
+		++_statistics.batchSizes[count];
+
+		for (auto i = 0; i < count; ++i)
+		{
+			processDatagram(batch.data(i), batch.size(i), MediaEndpoint::fromSockAddr(batch.source(i)));
+		}
+	}
+
+	// Payloads of queued datagrams point into the receive buffers
+	// and the replayed datagrams.
+	batch.flush();
+	_statistics.sendDrops += batch.takeSendDrops();
+	releaseDatagrams();
+	return count;
+}
+#endif
+
+void MediaRelay::receiveTransportDatagram(const MediaRoutingTable::Sender& route, const UDP::TransportDatagramView& dg, const MediaEndpoint& sender)
+{
+	const auto nowUs = MediaBandwidthBudget::nowUs();
+	auto& feedback = _transportFeedback[route.clientId];
+	auto sendFeedback = [this, &feedback, &sender]()
+	{
+		const auto datagram = feedback.take();
+		if (datagram.isEmpty())
+		{
+			return;
+		}
+		// Sent with the next flush, like the replayed datagrams.
+		_replayDatagrams.append(datagram);
+		relayDatagram(datagram.constData(), datagram.size(), sender);
+		++_statistics.transportFeedbacks;
+	};
+
+	if (!feedback.add(dg.sequence(), dg.sendTime(), nowUs))
+	{
+		sendFeedback();
+		feedback.add(dg.sequence(), dg.sendTime(), nowUs);
+	}
+	if (feedback.due(nowUs))
+	{
+		sendFeedback();
+		_statistics.transportJitter[route.clientId] = feedback.jitterUs();
+	}
+}
+
+void MediaRelay::retainTransportFeedback()
+{
+	auto it = _transportFeedback.begin();
+	while (it != _transportFeedback.end())
+	{
+		if (!_routes->findClient(it.key()))
+		{
+			_statistics.transportJitter.remove(it.key());
+			it = _transportFeedback.erase(it);
+		}
+		else
+			++it;
+	}
+}
+
+void MediaRelay::relayDatagram(const char* data, int len, const MediaEndpoint& to)
+{
+	if (!_output->sendDatagram(data, len, to))
+	{
+		++_statistics.sendDrops;
+		return;
+	}
+	++_statistics.datagramsWritten;
+	_statistics.bytesWritten += len;
+}
+
+void MediaRelay::cacheVideoDatagram(const MediaRoutingTable::Sender& route, const char* data, int len)
+{
+	const UDP::VideoFrameDatagramView dg(data, len);
+	if (!dg.isValid())
+	{
+		return;
+	}
+	auto& sender = _keyFrameSenders[route.clientId];
+	auto& entry = sender.entries[dg.layer()];
+	if (!entry)
+	{
+		sender.key = route.key;
+		entry = _keyFrameCache->entry(route.clientId, dg.layer());
+	}
+	_keyFrameCache->add(*entry, dg);
+}
+
+void MediaRelay::releaseDatagrams()
+{
+	_replayDatagrams.clear();
+}
+
+void MediaRelay::replayKeyFrames()
+{
+	auto it = _keyFrameSenders.begin();
+	while (it != _keyFrameSenders.end())
+	{
+		const auto route = _routes->findSender(it.value().key);
+		if (!route || route->clientId != it.key())
+		{
+			// The sender is gone.
+			it = _keyFrameSenders.erase(it);
+			continue;
+		}
+
+		// Replay to receivers, which have been added or switched their
+		// layer since the last table.
+		const auto receivers = _routes->receivers(*route);
+		const auto versions = _routes->receiverVersions(*route);
+		const auto layers = _routes->receiverLayers(*route);
+		QVector<QByteArray> datagrams[UDP::VideoFrameDatagram::MAXLAYERS];
+		bool available[UDP::VideoFrameDatagram::MAXLAYERS] = {};
+		bool fetched[UDP::VideoFrameDatagram::MAXLAYERS] = {};
+		for (quint32 i = 0; i < route->receiverCount; ++i)
+		{
+			if (versions[i] <= _routesVersion)
+				continue;
+			const auto layer = layers[i];
+			if (!fetched[layer])
+			{
+				available[layer] = _keyFrameCache->datagrams(route->clientId, layer, datagrams[layer]);
+				fetched[layer] = true;
+			}
+			if (!available[layer])
+				continue;
+			for (const auto& dg : datagrams[layer])
+				relayDatagram(dg.constData(), dg.size(), receivers[i]);
+			++_statistics.keyFrameReplays;
+		}
+		for (const auto& d : datagrams)
+			_replayDatagrams += d;
+		++it;
+	}
+}
+
+bool MediaRelay::findReceiverRoute(ocs::clientid_t senderId, const MediaEndpoint& receiver, ReceiverRoute& rr) const
+{
+	if (!_routes)
+	{
+		return false;
+	}
+	rr.senderEndpoint = _routes->findClient(senderId);
+	rr.route = rr.senderEndpoint ? _routes->findSender(MediaEndpointKey::fromEndpoint(*rr.senderEndpoint)) : nullptr;
+	if (!rr.route)
+	{
+		return false;
+	}
+	const auto receiverKey = MediaEndpointKey::fromEndpoint(receiver);
+	const auto receivers = _routes->receivers(*rr.route);
+	for (rr.index = 0; rr.index < rr.route->receiverCount; ++rr.index)
+	{
+		if (MediaEndpointKey::fromEndpoint(receivers[rr.index]) == receiverKey)
+			return true;
+	}
+	return false;
+}
+
+bool MediaRelay::answerRecoveryFromCache(const ReceiverRoute& rr, ocs::clientid_t senderId, const MediaEndpoint& receiver)
+{
+	QVector<QByteArray> datagrams;
+	const auto layer = _routes->receiverLayers(*rr.route)[rr.index];
+	if (!_keyFrameCache->datagramsForRecovery(senderId, layer, MediaEndpointKey::fromEndpoint(receiver), datagrams))
+	{
+		return false;
+	}
+	for (const auto& dg : datagrams)
+	{
+		relayDatagram(dg.constData(), dg.size(), receiver);
+	}
+	_replayDatagrams += datagrams;
+	return true;
+}
+
+void MediaRelay::forwardVideoDatagram(const MediaRoutingTable::Sender& route, const char* data, int len)
+{
+	const auto receivers = _routes->receivers(route);
+	const UDP::VideoFrameDatagramView dg(data, len);
+	if (!dg.isValid())
+	{
+		// Without a layer, the datagram can not be assigned to any receiver.
+		if (route.layers > 1)
+		{
+			return;
+		}
+		for (quint32 i = 0; i < route.receiverCount; ++i)
+		{
+			relayDatagram(data, len, receivers[i]);
+		}
+		return;
+	}
+
+	const auto layers = _routes->receiverLayers(route);
+	const auto layer = dg.layer();
+	const auto budgets = _routes->receiverBudgets(route);
+	const auto receiverIds = _routes->receiverClientIds(route);
+	const auto sender = route.budgeted ? &forwardingSender(route) : nullptr;
+	const auto frameId = dg.frameId();
+	const auto keyFrame = MediaKeyFrameCache::isKeyFrame(dg);
+	const auto temporalLayer = dg.temporalLayer();
+	const auto nowUs = MediaBandwidthBudget::nowUs();
+
+	// The decision is made for the entire frame on its first datagram, which
+	// may be any of them. Senders split their frames with a single datagram
+	// size (see UDP::MtuProbeDatagram), only the last datagram is smaller.
+	if (sender && dg.index() + 1 < dg.count() && !(dg.flags() & UDP::VideoFrameDatagram::Redundant))
+		sender->stride = len;
+	const auto stride = sender && sender->stride > 0 ? sender->stride : qMax(len, (int)UDP::MtuProbeDatagram::DEFAULTDATAGRAMSIZE);
+	const auto frameBytes = dg.count() > 1 ? (quint64)dg.count() * stride : (quint64)len;
+
+	for (quint32 i = 0; i < route.receiverCount; ++i)
+	{
+		if (layers[i] != layer)
+		{
+			continue;
+		}
+		if (!budgets[i])
+		{
+			relayDatagram(data, len, receivers[i]);
+			continue;
+		}
+
+		auto& r = sender->receivers[i];
+		if (keyFrame && MediaKeyFrameCache::isRestart(frameId, r.frameId))
+		{
+			// The sender restarted its stream, the frame-ids start over.
+			r.frameId = 0;
+			r.forward = true;
+			r.waitForKeyFrame = false;
+			r.temporalLimit = UDP::VideoFrameDatagram::MAXTEMPORALLAYERS;
+		}
+		auto forward = r.forward;
+		if (frameId > r.frameId)
+		{
+			// A dropped frame breaks all following frames up to the next key frame.
+			// Frames of higher temporal layers only break the following frames
+			// of their own and higher layers, up to the next frame of a lower layer.
+			r.frameId = frameId;
+			if (keyFrame)
+			{
+				budgets[i]->consume(frameBytes, nowUs, true);
+				r.forward = true;
+				r.waitForKeyFrame = false;
+				r.temporalLimit = UDP::VideoFrameDatagram::MAXTEMPORALLAYERS;
+			}
+			else if (r.waitForKeyFrame || temporalLayer >= r.temporalLimit)
+			{
+				r.forward = false;
+			}
+			else
+			{
+				r.temporalLimit = UDP::VideoFrameDatagram::MAXTEMPORALLAYERS;
+				r.forward = budgets[i]->consume(frameBytes, nowUs, false);
+				if (!r.forward && temporalLayer > 0)
+					r.temporalLimit = temporalLayer;
+				else if (!r.forward)
+					r.waitForKeyFrame = true;
+			}
+			if (!r.forward)
+			{
+				++_statistics.droppedFrames[receiverIds[i]];
+			}
+			forward = r.forward;
+		}
+		else if (frameId < r.frameId)
+		{
+			// Late datagram of a previous frame.
+			forward = !r.waitForKeyFrame;
+		}
+
+		if (forward)
+		{
+			relayDatagram(data, len, receivers[i]);
+		}
+	}
+}
+
+void MediaRelay::reportReceiverLoss(const ReceiverRoute& rr, int fractionLost)
+{
+	// The loss of the stream updates the receiver's bandwidth estimate (see MediaBandwidthBudget).
+	const auto budget = _routes->receiverBudgets(*rr.route)[rr.index];
+	if (budget)
+	{
+		budget->report(fractionLost, MediaBandwidthBudget::nowUs());
+	}
+}
+
+MediaRelay::ForwardingSender& MediaRelay::forwardingSender(const MediaRoutingTable::Sender& route)
+{
+	auto& sender = _forwardingSenders[route.clientId];
+	if (sender.version == _routesVersion && sender.receivers.size() == route.receiverCount)
+	{
+		return sender;
+	}
+
+	// Receivers keep their state, but may have moved within the table.
+	QHash<ocs::clientid_t, ForwardingReceiver> previous;
+	for (const auto& r : sender.receivers)
+		previous.insert(r.clientId, r);
+
+	const auto receiverIds = _routes->receiverClientIds(route);
+	const auto layers = _routes->receiverLayers(route);
+	sender.key = route.key;
+	sender.version = _routesVersion;
+	sender.receivers.resize(route.receiverCount);
+	for (quint32 i = 0; i < route.receiverCount; ++i)
+	{
+		auto r = previous.value(receiverIds[i]);
+		if (r.layer != layers[i])
+			r = ForwardingReceiver();
+		r.clientId = receiverIds[i];
+		r.layer = layers[i];
+		sender.receivers[i] = r;
+	}
+	return sender;
+}
+
+void MediaRelay::retainForwardingSenders()
+{
+	auto it = _forwardingSenders.begin();
+	while (it != _forwardingSenders.end())
+	{
+		const auto route = _routes->findSender(it.value().key);
+		if (!route || route->clientId != it.key() || !route->budgeted)
+			it = _forwardingSenders.erase(it);
+		else
+			++it;
+	}
+
+	auto itDropped = _statistics.droppedFrames.begin();
+	while (itDropped != _statistics.droppedFrames.end())
+	{
+		if (!_routes->findClient(itDropped.key()))
+			itDropped = _statistics.droppedFrames.erase(itDropped);
+		else
+			++itDropped;
+	}
+}
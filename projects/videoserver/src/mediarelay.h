@@ -0,0 +1,301 @@
+#ifndef MEDIARELAY_H
+#define MEDIARELAY_H
+
+#include <QVector>
+#include <QString>
+#include <QHostAddress>
+#include <QHash>
+#include <QJsonObject>
+
+#include <memory>
+#include <vector>
+
+#include "libbase/defines.h"
+
+#include "libmediaprotocol/protocol.h"
+
+#include "mediaroutingtable.h"
+#include "mediakeyframecache.h"
+#include "mediarecoverylimiter.h"
+#include "mediaactivespeakers.h"
+#include "mediaaudiomixer.h"
+#include "mediatransportfeedback.h"
+
+class MediaSenderEntity;
+class MediaReceiverEntity;
+class MediaRecipients;
+class MediaDatagramBatch;
+namespace UDP { class TransportDatagramView; }
+
+
+class MediaSenderEntity
+{
+public:
+	ocs::clientid_t clientId = 0;
+	QHostAddress address;
+	quint16 port = 0;
+	QVector<MediaReceiverEntity> receivers;
+
+	// Number of simulcast layers of the sender's video.
+	int videoLayers = 1;
+
+	// Channel in which the sender competes with other speakers (see MediaActiveSpeakers).
+	// 0 = Audio is always forwarded.
+	quint32 audioGroup = 0;
+};
+
+
+class MediaReceiverEntity
+{
+public:
+	ocs::clientid_t clientId = 0;
+	QHostAddress address;
+	quint16 port = 0;
+
+	// Estimated available bandwidth of the receiver in bytes per second.
+	// 0 = Unlimited.
+	quint64 bandwidth = 0;
+
+	// Simulcast layer of the sender's video, which is forwarded to the receiver.
+	int videoLayer = 0;
+};
+
+
+/*!
+	Recipients as maintained by the control-plane.
+	The relay threads work on a MediaRoutingTable, which is compiled from it.
+*/
+class MediaRecipients
+{
+public:
+	// Maps a SENDER's address+port to itself.
+	QHash<QHostAddress, QHash<quint16, MediaSenderEntity> > addr2sender;
+
+	// Maps a RECEIVER's client-id to itself.
+	QHash<ocs::clientid_t, MediaReceiverEntity> clientid2receiver;
+};
+
+
+/*! Counters of the media relay I/O.
+*/
+class MediaRelayStatistics
+{
+public:
+	/*! Adds the counters of "other" to this object. */
+	void merge(const MediaRelayStatistics& other);
+	QJsonObject toQJsonObject() const;
+
+public:
+	quint64 datagramsRead = 0;
+	quint64 datagramsWritten = 0;
+	quint64 bytesRead = 0;
+	quint64 bytesWritten = 0;
+
+	// Number of recvmmsg() batches and the datagrams they contained.
+	quint64 batches = 0;
+	quint64 batchedDatagrams = 0;
+
+	// Histogram of batch sizes: batchSizes[n] = Number of batches with "n" datagrams.
+	QVector<quint64> batchSizes;
+
+	// Outgoing datagrams which have been dropped by the socket (e.g. full buffer).
+	quint64 sendDrops = 0;
+
+	// Number of incoming datagrams per relay worker thread.
+	QVector<quint64> workerDatagrams;
+
+	// Video datagrams from addresses without routing table entry.
+	quint64 unknownSenders = 0;
+
+	// Key frame cache: Number of replays to new receivers and recovery
+	// requests, which have been answered from the cache or have been
+	// forwarded to the sender.
+	quint64 keyFrameReplays = 0;
+	quint64 recoveryFromCache = 0;
+	quint64 recoveryForwarded = 0;
+
+	// Recovery requests, which have been merged with a previously
+	// forwarded request for the same sender (see MediaRecoveryLimiter).
+	quint64 recoverySuppressed = 0;
+
+	// Requests for single datagrams (NACK), which have been forwarded to the sender.
+	quint64 nacksForwarded = 0;
+
+	// Recovery requests, NACKs and receiver reports from endpoints,
+	// which are not a receiver of the named sender. They are dropped.
+	quint64 foreignRequests = 0;
+
+	// Receiver reports, which have been forwarded to the sender of the video.
+	quint64 receiverReports = 0;
+
+	// Transport feedbacks, which have been sent to the senders (see MediaTransportFeedback).
+	quint64 transportFeedbacks = 0;
+
+	// Interarrival jitter in microseconds (by client-id of the sender).
+	QHash<ocs::clientid_t, quint32> transportJitter;
+
+	// Audio datagrams of senders, which have not been one of the
+	// active speakers of their channel (see MediaActiveSpeakers).
+	quint64 audioSuppressed = 0;
+
+	// Audio datagrams, which have been handed to the MediaAudioMixer.
+	quint64 audioMixed = 0;
+
+	// Number of video frames, which have not been forwarded to a
+	// receiver because of its bandwidth (by client-id of the receiver).
+	QHash<ocs::clientid_t, quint64> droppedFrames;
+};
+
+
+/*!
+	Relay logic for incoming media datagrams.
+
+	The relay does not do any socket I/O by itself, it hands everything
+	to its Output. Each relay thread owns its own MediaRelay object,
+	the class is not thread-safe. All relays share the routing table,
+	which is read through their own MediaRoutingTableRcu::Reader, the
+	optional MediaKeyFrameCache, MediaRecoveryLimiter, MediaActiveSpeakers
+	and MediaAudioMixer.
+*/
+class MediaRelay
+{
+public:
+	class Output
+	{
+	public:
+		virtual ~Output() {}
+
+		/*! Sends a datagram to the given endpoint of the routing table.
+			\return false, if the datagram has been dropped.
+		*/
+		virtual bool sendDatagram(const char* data, int len, const MediaEndpoint& to) = 0;
+
+		/*! Gets called for every incoming authentication from a client. */
+		virtual void authenticateToken(const QString& token, const QHostAddress& address, quint16 port) = 0;
+
+		/*! Gets called for every valid MTU probe (see UDP::MtuProbeDatagram). */
+		virtual void probeMtu(int size, const QHostAddress& address, quint16 port) = 0;
+	};
+
+public:
+	/*! \param keyFrameCache Optional, may be nullptr.
+		\param recoveryLimiter Optional, may be nullptr.
+		\param activeSpeakers Optional, may be nullptr (forwards every speaker).
+		\param audioMixer Optional, may be nullptr (forwards audio of all groups).
+	*/
+	MediaRelay(Output* output, MediaRoutingTableRcu::Reader* routes, MediaKeyFrameCache* keyFrameCache, MediaRecoveryLimiter* recoveryLimiter, MediaActiveSpeakers* activeSpeakers, MediaAudioMixer* audioMixer);
+	MediaRelay(const MediaRelay&) = delete;
+	MediaRelay& operator=(const MediaRelay&) = delete;
+
+	/*! Drops the current routing table and picks up the latest one.
+		Must be called regularly, replaced tables can not be deleted
+		before every relay called it. processBatch() calls it by itself.
+
+		Replays cached key frames to new receivers of the relay's senders,
+		which may queue outgoing datagrams in the Output.
+	*/
+	void refreshRoutes();
+
+	void processDatagram(const char* data, int len, const MediaEndpoint& sender);
+
+	/*! Releases the datagrams, which have been replayed from the key frame cache.
+		Must be called after the Output has sent all queued datagrams.
+	*/
+	void releaseDatagrams();
+
+#ifdef __linux__
+	/*! Receives a single batch from "batch", processes all of its
+		datagrams and flushes the outgoing datagrams.
+		\return Number of processed datagrams or -1 on error.
+	*/
+	int processBatch(MediaDatagramBatch& batch);
+#endif
+
+	const MediaRelayStatistics& statistics() const { return _statistics; }
+
+private:
+	void dispatchDatagram(const char* data, int len, const MediaEndpoint& sender);
+	void receiveTransportDatagram(const MediaRoutingTable::Sender& route, const UDP::TransportDatagramView& dg, const MediaEndpoint& sender);
+	void retainTransportFeedback();
+	void relayDatagram(const char* data, int len, const MediaEndpoint& to);
+	void forwardVideoDatagram(const MediaRoutingTable::Sender& route, const char* data, int len);
+	void cacheVideoDatagram(const MediaRoutingTable::Sender& route, const char* data, int len);
+	void replayKeyFrames();
+	class ReceiverRoute;
+	bool findReceiverRoute(ocs::clientid_t senderId, const MediaEndpoint& receiver, ReceiverRoute& rr) const;
+	bool answerRecoveryFromCache(const ReceiverRoute& rr, ocs::clientid_t senderId, const MediaEndpoint& receiver);
+	void reportReceiverLoss(const ReceiverRoute& rr, int fractionLost);
+
+	class ForwardingSender;
+	ForwardingSender& forwardingSender(const MediaRoutingTable::Sender& route);
+	void retainForwardingSenders();
+
+private:
+	// Route of a sender, which "receiver" of findReceiverRoute() receives.
+	class ReceiverRoute
+	{
+	public:
+		const MediaEndpoint* senderEndpoint = nullptr;
+		const MediaRoutingTable::Sender* route = nullptr;
+		quint32 index = 0;
+	};
+
+	class KeyFrameSender
+	{
+	public:
+		MediaEndpointKey key;
+		std::shared_ptr<MediaKeyFrameCache::Entry> entries[UDP::VideoFrameDatagram::MAXLAYERS];
+	};
+
+	// Forwarding state of a receiver with limited bandwidth.
+	class ForwardingReceiver
+	{
+	public:
+		ocs::clientid_t clientId = 0;
+		quint8 layer = 0;
+		UDP::VideoFrameDatagram::dg_frame_id_t frameId = 0;
+		bool forward = true;
+		bool waitForKeyFrame = false;
+
+		// Frames of this and higher temporal layers are dropped.
+		int temporalLimit = UDP::VideoFrameDatagram::MAXTEMPORALLAYERS;
+	};
+
+	// Receivers in the order of the routing table with "version".
+	class ForwardingSender
+	{
+	public:
+		MediaEndpointKey key;
+		quint64 version = 0;
+		std::vector<ForwardingReceiver> receivers;
+
+		// Size of the full datagrams of the sender's frames, all but the last one of a frame.
+		int stride = 0;
+	};
+
+	Output* _output;
+	MediaRoutingTableRcu::Reader* _routesReader;
+	const MediaRoutingTable* _routes;
+	quint64 _routesVersion;
+	MediaRelayStatistics _statistics;
+
+	// Senders handled by this relay, which have cached key frames.
+	MediaKeyFrameCache* _keyFrameCache;
+	QHash<ocs::clientid_t, KeyFrameSender> _keyFrameSenders;
+
+	// Replayed datagrams, which may be referenced by queued datagrams of the Output.
+	QVector<QByteArray> _replayDatagrams;
+
+	MediaRecoveryLimiter* _recoveryLimiter;
+	MediaActiveSpeakers* _activeSpeakers;
+	MediaAudioMixer* _audioMixer;
+
+	// Transport feedback of the senders, whose datagrams arrive at this relay.
+	QHash<ocs::clientid_t, MediaTransportFeedback> _transportFeedback;
+
+	// Senders with at least one receiver with limited bandwidth.
+	// Frame-ids are per layer, receivers on another layer start over.
+	QHash<ocs::clientid_t, ForwardingSender> _forwardingSenders;
+};
+
+#endif
@@ -0,0 +1,137 @@
+#include "mediarelayworker.h"
+
+#ifdef __linux__
+
+#include <cerrno>
+
+#include <unistd.h>
+#include <poll.h>
+
+#include <QElapsedTimer>
+#include <QMutexLocker>
+
+#include "humblelogging/api.h"
+
+#include "mediadatagrambatch.h"
+
+HUMBLE_LOGGER(HL, "server.mediarelay.worker");
+
+///////////////////////////////////////////////////////////////////////
+
+// Maximum time the worker blocks without checking the stop flag and
+// without going through a quiescent state of the routing table.
+static const int POLL_TIMEOUT_MS = 100;
+
+// Interval to publish the statistics to the control-plane.
+static const int STATISTICS_INTERVAL_MS = 500;
+
+MediaRelayWorker::MediaRelayWorker(int id, int fd, int batchSize, MediaRoutingTableRcu::Reader* routes, MediaKeyFrameCache* keyFrameCache, MediaRecoveryLimiter* recoveryLimiter, MediaActiveSpeakers* activeSpeakers, MediaAudioMixer* audioMixer, QObject* parent) :
+	QThread(parent),
+	_id(id),
+	_fd(fd),
+	_batchSize(batchSize),
+	_stopFlag(0),
+	_relay(this, routes, keyFrameCache, recoveryLimiter, activeSpeakers, audioMixer),
+	_batch(nullptr)
+{
+}
+
+MediaRelayWorker::~MediaRelayWorker()
+{
+	stop();
+	wait();
+	if (_fd != -1)
+		::close(_fd);
+}
+
+void MediaRelayWorker::stop()
+{
+	_stopFlag = 1;
+}
+
+MediaRelayStatistics MediaRelayWorker::statistics() const
+{
+	QMutexLocker l(&_statisticsMutex);
+	return _statistics;
+}
+
+void MediaRelayWorker::run()
+{
+	MediaDatagramBatch batch(_fd, _batchSize);
+	_batch = &batch;
+
+	pollfd pfd;
+	pfd.fd = _fd;
+	pfd.events = POLLIN;
+
+	QElapsedTimer statisticsTimer;
+	statisticsTimer.start();
+
+	HL_DEBUG(HL, QString("Relay worker started (id=%1)").arg(_id).toStdString());
+	while (_stopFlag.load() == 0)
+	{
+		// Also releases the table while the socket is idle.
+		_relay.refreshRoutes();
+		if (batch.pending() > 0)
+		{
+			batch.flush();
+			_relay.releaseDatagrams();
+		}
+
+		pfd.revents = 0;
+		const auto res = ::poll(&pfd, 1, POLL_TIMEOUT_MS);
+		if (res < 0 && errno != EINTR)
+		{
+			HL_ERROR(HL, QString("poll() failed (id=%1; errno=%2)").arg(_id).arg(errno).toStdString());
+			break;
+		}
+		else if (res > 0)
+		{
+			// Drain the socket, but check the stop flag from time to time.
+			for (auto round = 0; round < 16; ++round)
+			{
+				const auto count = _relay.processBatch(batch);
+				if (count < 0)
+				{
+					HL_ERROR(HL, QString("recvmmsg() failed (id=%1; errno=%2)").arg(_id).arg(errno).toStdString());
+					break;
+				}
+				else if (count < batch.capacity())
+				{
+					break;
+				}
+			}
+		}
+
+		if (statisticsTimer.elapsed() >= STATISTICS_INTERVAL_MS)
+		{
+			QMutexLocker l(&_statisticsMutex);
+			_statistics = _relay.statistics();
+			statisticsTimer.restart();
+		}
+	}
+
+	QMutexLocker l(&_statisticsMutex);
+	_statistics = _relay.statistics();
+	_batch = nullptr;
+	HL_DEBUG(HL, QString("Relay worker stopped (id=%1)").arg(_id).toStdString());
+}
+
+bool MediaRelayWorker::sendDatagram(const char* data, int len, const MediaEndpoint& to)
+{
+	_batch->enqueue(data, len, to.sockAddr(), to.sockAddrLength());
+	return true;
+}
+
+void MediaRelayWorker::authenticateToken(const QString& token, const QHostAddress& address, quint16 port)
+{
+	// Delivered as queued signal into the control-plane thread.
+	emit tokenAuthentication(token, address, port);
+}
+
+void MediaRelayWorker::probeMtu(int size, const QHostAddress& address, quint16 port)
+{
+	emit mtuProbe(size, address, port);
+}
+
+#endif
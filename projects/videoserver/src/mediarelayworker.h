@@ -0,0 +1,64 @@
+#ifndef MEDIARELAYWORKER_H
+#define MEDIARELAYWORKER_H
+
+#ifdef __linux__
+
+#include <QThread>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QString>
+#include <QHostAddress>
+
+#include "mediarelay.h"
+
+class MediaDatagramBatch;
+
+/*!
+	Media relay thread with its own SO_REUSEPORT socket.
+
+	Every worker reads the shared routing table through its own RCU reader
+	and picks up new tables between two batches, without any lock.
+*/
+class MediaRelayWorker : public QThread, private MediaRelay::Output
+{
+	Q_OBJECT
+
+public:
+	/*! Takes ownership of the socket "fd". */
+	MediaRelayWorker(int id, int fd, int batchSize, MediaRoutingTableRcu::Reader* routes, MediaKeyFrameCache* keyFrameCache, MediaRecoveryLimiter* recoveryLimiter, MediaActiveSpeakers* activeSpeakers, MediaAudioMixer* audioMixer, QObject* parent);
+	virtual ~MediaRelayWorker();
+
+	int id() const { return _id; }
+	void stop();
+
+	/*! Thread-safe. Returns a snapshot, which is updated by the worker every ~500ms. */
+	MediaRelayStatistics statistics() const;
+
+signals:
+	void tokenAuthentication(const QString& token, const QHostAddress& address, quint16 port);
+	void mtuProbe(int size, const QHostAddress& address, quint16 port);
+
+protected:
+	virtual void run();
+
+private:
+	virtual bool sendDatagram(const char* data, int len, const MediaEndpoint& to);
+	virtual void authenticateToken(const QString& token, const QHostAddress& address, quint16 port);
+	virtual void probeMtu(int size, const QHostAddress& address, quint16 port);
+
+private:
+	int _id;
+	int _fd;
+	int _batchSize;
+	QAtomicInt _stopFlag;
+
+	// Owned by the worker thread.
+	MediaRelay _relay;
+	MediaDatagramBatch* _batch;
+
+	mutable QMutex _statisticsMutex;
+	MediaRelayStatistics _statistics;
+};
+
+#endif
+#endif
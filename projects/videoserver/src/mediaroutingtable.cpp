@@ -0,0 +1,427 @@
+#include "mediaroutingtable.h"
+
+#include <cstring>
+
+#include <QPair>
+
+#include "mediarelay.h"
+
+///////////////////////////////////////////////////////////////////////
+
+MediaEndpoint::MediaEndpoint()
+{
+	std::memset(&_addr, 0, sizeof(_addr));
+	_addr.sa.sa_family = AF_UNSPEC;
+}
+
+MediaEndpoint MediaEndpoint::fromSockAddr(const sockaddr* sa)
+{
+	MediaEndpoint ep;
+	if (sa->sa_family == AF_INET)
+		std::memcpy(&ep._addr.v4, sa, sizeof(sockaddr_in));
+	else if (sa->sa_family == AF_INET6)
+		std::memcpy(&ep._addr.v6, sa, sizeof(sockaddr_in6));
+	return ep;
+}
+
+MediaEndpoint MediaEndpoint::fromQHostAddress(const QHostAddress& address, quint16 port, int family)
+{
+	MediaEndpoint ep;
+	bool isIPv4 = false;
+	const auto ipv4 = address.toIPv4Address(&isIPv4);
+
+	if (isIPv4 && family != AF_INET6)
+	{
+		ep._addr.v4.sin_family = AF_INET;
+		ep._addr.v4.sin_port = htons(port);
+		ep._addr.v4.sin_addr.s_addr = htonl(ipv4);
+	}
+	else if (isIPv4)
+	{
+		// IPv4-mapped IPv6 address (::ffff:a.b.c.d)
+		ep._addr.v6.sin6_family = AF_INET6;
+		ep._addr.v6.sin6_port = htons(port);
+		ep._addr.v6.sin6_addr.s6_addr[10] = 0xff;
+		ep._addr.v6.sin6_addr.s6_addr[11] = 0xff;
+		const quint32 n = htonl(ipv4);
+		std::memcpy(&ep._addr.v6.sin6_addr.s6_addr[12], &n, 4);
+	}
+	else if (address.protocol() == QAbstractSocket::IPv6Protocol && family != AF_INET)
+	{
+		const auto ipv6 = address.toIPv6Address();
+		ep._addr.v6.sin6_family = AF_INET6;
+		ep._addr.v6.sin6_port = htons(port);
+		std::memcpy(&ep._addr.v6.sin6_addr, &ipv6, 16);
+	}
+	return ep;
+}
+
+socklen_t MediaEndpoint::sockAddrLength() const
+{
+	switch (_addr.sa.sa_family)
+	{
+		case AF_INET:
+			return sizeof(sockaddr_in);
+		case AF_INET6:
+			return sizeof(sockaddr_in6);
+	}
+	return 0;
+}
+
+QHostAddress MediaEndpoint::address() const
+{
+	if (isNull())
+		return QHostAddress();
+
+	QHostAddress address(&_addr.sa);
+	if (_addr.sa.sa_family == AF_INET6)
+	{
+		// Dual-stack socket: Make IPv4 clients look like on a QUdpSocket.
+		bool ok = false;
+		const auto ipv4 = address.toIPv4Address(&ok);
+		if (ok)
+			address.setAddress(ipv4);
+	}
+	return address;
+}
+
+quint16 MediaEndpoint::port() const
+{
+	switch (_addr.sa.sa_family)
+	{
+		case AF_INET:
+			return ntohs(_addr.v4.sin_port);
+		case AF_INET6:
+			return ntohs(_addr.v6.sin6_port);
+	}
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////
+
+MediaEndpointKey MediaEndpointKey::fromEndpoint(const MediaEndpoint& endpoint)
+{
+	MediaEndpointKey key;
+	const auto sa = endpoint.sockAddr();
+	if (sa->sa_family == AF_INET)
+	{
+		const auto sin = (const sockaddr_in*)sa;
+		key.lo = (Q_UINT64_C(0xffff) << 32) | (quint64)ntohl(sin->sin_addr.s_addr);
+		key.port = ntohs(sin->sin_port);
+	}
+	else if (sa->sa_family == AF_INET6)
+	{
+		const auto sin6 = (const sockaddr_in6*)sa;
+		const auto b = sin6->sin6_addr.s6_addr;
+		for (auto i = 0; i < 8; ++i)
+		{
+			key.hi = (key.hi << 8) | b[i];
+			key.lo = (key.lo << 8) | b[i + 8];
+		}
+		key.port = ntohs(sin6->sin6_port);
+	}
+	return key;
+}
+
+quint64 MediaEndpointKey::hash() const
+{
+	// Multiply and fold (MurmurHash3 finalizer).
+	auto h = hi * Q_UINT64_C(0x9e3779b97f4a7c15) ^ lo ^ ((quint64)port << 48);
+	h ^= h >> 33;
+	h *= Q_UINT64_C(0xff51afd7ed558ccd);
+	h ^= h >> 33;
+	h *= Q_UINT64_C(0xc4ceb9fe1a85ec53);
+	h ^= h >> 33;
+	return h;
+}
+
+///////////////////////////////////////////////////////////////////////
+
+// Open addressing with linear probing, the load factor stays below 50%.
+static size_t slotCountFor(size_t n)
+{
+	size_t slots = 16;
+	while (slots < n * 2)
+		slots <<= 1;
+	return slots;
+}
+
+static quint64 hashClientId(ocs::clientid_t id)
+{
+	auto h = (quint64)(quint32)id * Q_UINT64_C(0x9e3779b97f4a7c15);
+	return h ^ (h >> 32);
+}
+
+MediaRoutingTable::MediaRoutingTable(const MediaRecipients& rec, int family, const MediaRoutingTable* previous) :
+	_version(previous ? previous->_version + 1 : 1)
+{
+	// Senders and their receivers.
+	for (auto itAddr = rec.addr2sender.constBegin(), endAddr = rec.addr2sender.constEnd(); itAddr != endAddr; ++itAddr)
+	{
+		for (auto itPort = itAddr.value().constBegin(), endPort = itAddr.value().constEnd(); itPort != endPort; ++itPort)
+		{
+			addSender(itAddr.key(), itPort.key(), itPort.value(), family, previous);
+		}
+	}
+
+	// Clients by ID.
+	for (auto it = rec.clientid2receiver.constBegin(), end = rec.clientid2receiver.constEnd(); it != end; ++it)
+	{
+		addClient(it.value(), family);
+	}
+
+	buildSlots();
+}
+
+MediaRoutingTable::MediaRoutingTable(const MediaRoutingTable& previous, const MediaRecipients& rec, const QSet<ocs::clientid_t>& changedClientIds, int family) :
+	_version(previous._version + 1)
+{
+	// Changed senders, looked up by their RECEIVER entity (senders only, see VirtualServer::updateMediaSender()).
+	QSet<MediaEndpointKey> changedKeys;
+	for (const auto clientId : changedClientIds)
+	{
+		const auto itReceiver = rec.clientid2receiver.constFind(clientId);
+		if (itReceiver == rec.clientid2receiver.constEnd())
+			continue;
+		const auto itAddr = rec.addr2sender.constFind(itReceiver.value().address);
+		if (itAddr == rec.addr2sender.constEnd())
+			continue;
+		const auto itPort = itAddr.value().constFind(itReceiver.value().port);
+		if (itPort == itAddr.value().constEnd() || itPort.value().clientId != clientId)
+			continue;
+		const auto key = addSender(itAddr.key(), itPort.key(), itPort.value(), family, &previous);
+		changedKeys.insert(key);
+		addClient(itReceiver.value(), family);
+	}
+
+	// Unchanged senders are copied without conversion, the budgets stay shared.
+	for (const auto& previousSender : previous._senders)
+	{
+		if (changedClientIds.contains(previousSender.clientId) || changedKeys.contains(previousSender.key))
+			continue;
+		auto sender = previousSender;
+		sender.receiverOffset = (quint32)_receiverEndpoints.size();
+		const auto begin = previousSender.receiverOffset;
+		const auto end = previousSender.receiverOffset + previousSender.receiverCount;
+		_receiverEndpoints.insert(_receiverEndpoints.end(), previous._receiverEndpoints.begin() + begin, previous._receiverEndpoints.begin() + end);
+		_receiverClientIds.insert(_receiverClientIds.end(), previous._receiverClientIds.begin() + begin, previous._receiverClientIds.begin() + end);
+		_receiverVersions.insert(_receiverVersions.end(), previous._receiverVersions.begin() + begin, previous._receiverVersions.begin() + end);
+		_receiverBudgets.insert(_receiverBudgets.end(), previous._receiverBudgets.begin() + begin, previous._receiverBudgets.begin() + end);
+		_receiverLayers.insert(_receiverLayers.end(), previous._receiverLayers.begin() + begin, previous._receiverLayers.begin() + end);
+		for (auto i = begin; i < end; ++i)
+		{
+			if (previous._receiverBudgets[i] && !_budgets.contains(previous._receiverClientIds[i]))
+				_budgets.insert(previous._receiverClientIds[i], previous._budgets.value(previous._receiverClientIds[i]));
+		}
+		_senders.push_back(sender);
+	}
+
+	// Unchanged clients.
+	for (size_t i = 0; i < previous._clientIds.size(); ++i)
+	{
+		if (changedClientIds.contains(previous._clientIds[i]))
+			continue;
+		_clientIds.push_back(previous._clientIds[i]);
+		_clientEndpoints.push_back(previous._clientEndpoints[i]);
+	}
+
+	buildSlots();
+}
+
+MediaEndpointKey MediaRoutingTable::addSender(const QHostAddress& address, quint16 port, const MediaSenderEntity& senderEntity, int family, const MediaRoutingTable* previous)
+{
+	Sender sender;
+	sender.key = MediaEndpointKey::fromEndpoint(MediaEndpoint::fromQHostAddress(address, port));
+	sender.clientId = senderEntity.clientId;
+	sender.layers = senderEntity.videoLayers;
+	sender.audioGroup = senderEntity.audioGroup;
+	sender.receiverOffset = (quint32)_receiverEndpoints.size();
+
+	// Receivers of the previous table keep their version, as long as
+	// they stay on the same layer.
+	QHash<MediaEndpointKey, QPair<quint64, quint8> > previousReceivers;
+	const auto previousSender = previous ? previous->findSender(sender.key) : nullptr;
+	if (previousSender && previousSender->clientId == sender.clientId)
+	{
+		const auto endpoints = previous->receivers(*previousSender);
+		const auto versions = previous->receiverVersions(*previousSender);
+		const auto layers = previous->receiverLayers(*previousSender);
+		for (quint32 i = 0; i < previousSender->receiverCount; ++i)
+			previousReceivers.insert(MediaEndpointKey::fromEndpoint(endpoints[i]), qMakePair(versions[i], layers[i]));
+	}
+
+	for (auto i = 0; i < senderEntity.receivers.size(); ++i)
+	{
+		const auto& receiverEntity = senderEntity.receivers[i];
+		const auto ep = MediaEndpoint::fromQHostAddress(receiverEntity.address, receiverEntity.port, family);
+		if (ep.isNull())
+			continue;
+		const auto layer = (quint8)qBound(0, receiverEntity.videoLayer, sender.layers - 1);
+		const auto previousReceiver = previousReceivers.value(MediaEndpointKey::fromEndpoint(ep), qMakePair(_version, layer));
+		_receiverEndpoints.push_back(ep);
+		_receiverClientIds.push_back(receiverEntity.clientId);
+		_receiverVersions.push_back(previousReceiver.second == layer ? previousReceiver.first : _version);
+		_receiverLayers.push_back(layer);
+		_receiverBudgets.push_back(budget(receiverEntity, previous));
+		sender.budgeted = sender.budgeted || _receiverBudgets.back();
+	}
+	sender.receiverCount = (quint32)_receiverEndpoints.size() - sender.receiverOffset;
+	_senders.push_back(sender);
+	return sender.key;
+}
+
+void MediaRoutingTable::addClient(const MediaReceiverEntity& client, int family)
+{
+	const auto ep = MediaEndpoint::fromQHostAddress(client.address, client.port, family);
+	if (ep.isNull() || ep.port() == 0)
+		return;
+	_clientIds.push_back(client.clientId);
+	_clientEndpoints.push_back(ep);
+}
+
+void MediaRoutingTable::buildSlots()
+{
+	_senderSlots.assign(slotCountFor(_senders.size()), -1);
+	const auto senderMask = _senderSlots.size() - 1;
+	for (size_t i = 0; i < _senders.size(); ++i)
+	{
+		auto slot = _senders[i].key.hash() & senderMask;
+		while (_senderSlots[slot] != -1)
+			slot = (slot + 1) & senderMask;
+		_senderSlots[slot] = (qint32)i;
+	}
+
+	_clientSlots.assign(slotCountFor(_clientIds.size()), -1);
+	const auto clientMask = _clientSlots.size() - 1;
+	for (size_t i = 0; i < _clientIds.size(); ++i)
+	{
+		auto slot = hashClientId(_clientIds[i]) & clientMask;
+		while (_clientSlots[slot] != -1)
+			slot = (slot + 1) & clientMask;
+		_clientSlots[slot] = (qint32)i;
+	}
+}
+
+MediaBandwidthBudget* MediaRoutingTable::budget(const MediaReceiverEntity& receiver, const MediaRoutingTable* previous)
+{
+	if (receiver.bandwidth == 0)
+	{
+		return nullptr;
+	}
+
+	// One budget per client, which keeps its state across tables.
+	auto& b = _budgets[receiver.clientId];
+	if (!b)
+	{
+		b = previous ? previous->_budgets.value(receiver.clientId) : nullptr;
+		if (!b)
+			b = std::make_shared<MediaBandwidthBudget>(receiver.bandwidth);
+	}
+	b->setMaxBytesPerSecond(receiver.bandwidth);
+	return b.get();
+}
+
+const MediaRoutingTable::Sender* MediaRoutingTable::findSender(const MediaEndpointKey& key) const
+{
+	const auto mask = _senderSlots.size() - 1;
+	for (auto slot = key.hash() & mask; ; slot = (slot + 1) & mask)
+	{
+		const auto index = _senderSlots[slot];
+		if (index == -1)
+			return nullptr;
+		if (_senders[index].key == key)
+			return &_senders[index];
+	}
+}
+
+const MediaEndpoint* MediaRoutingTable::findClient(ocs::clientid_t clientId) const
+{
+	const auto mask = _clientSlots.size() - 1;
+	for (auto slot = hashClientId(clientId) & mask; ; slot = (slot + 1) & mask)
+	{
+		const auto index = _clientSlots[slot];
+		if (index == -1)
+			return nullptr;
+		if (_clientIds[index] == clientId)
+			return &_clientEndpoints[index];
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+
+MediaRoutingTableRcu::Reader::Reader(MediaRoutingTableRcu* rcu) :
+	_rcu(rcu),
+	_epoch(rcu->_epoch.load())
+{
+}
+
+const MediaRoutingTable* MediaRoutingTableRcu::Reader::acquire()
+{
+	// Quiescent state: The reader does not hold any table at this point.
+	// Tables which have been replaced up to the observed epoch can be deleted.
+	_epoch.store(_rcu->_epoch.load());
+	return _rcu->_current.load();
+}
+
+///////////////////////////////////////////////////////////////////////
+
+MediaRoutingTableRcu::MediaRoutingTableRcu() :
+	_current(nullptr),
+	_epoch(0)
+{
+}
+
+MediaRoutingTableRcu::~MediaRoutingTableRcu()
+{
+	for (const auto& r : _retired)
+		delete r.table;
+	delete _current.load();
+}
+
+MediaRoutingTableRcu::Reader* MediaRoutingTableRcu::createReader()
+{
+	_readers.emplace_back(new Reader(this));
+	return _readers.back().get();
+}
+
+void MediaRoutingTableRcu::publish(std::unique_ptr<MediaRoutingTable> table)
+{
+	const auto old = _current.exchange(table.release());
+	const auto epoch = _epoch.fetch_add(1) + 1;
+	if (old)
+	{
+		Retired r;
+		r.table = old;
+		r.epoch = epoch;
+		_retired.push_back(r);
+	}
+	reclaim();
+}
+
+void MediaRoutingTableRcu::reclaim()
+{
+	if (_retired.empty())
+		return;
+
+	auto minEpoch = _epoch.load();
+	for (const auto& reader : _readers)
+	{
+		const auto e = reader->_epoch.load();
+		if (e < minEpoch)
+			minEpoch = e;
+	}
+
+	auto it = _retired.begin();
+	while (it != _retired.end())
+	{
+		if (it->epoch <= minEpoch)
+		{
+			delete it->table;
+			it = _retired.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
@@ -0,0 +1,259 @@
+#ifndef MEDIAROUTINGTABLE_H
+#define MEDIAROUTINGTABLE_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+
+#include <QtGlobal>
+#include <QHostAddress>
+#include <QHash>
+#include <QSet>
+
+#include "libbase/defines.h"
+
+#include "mediabandwidthbudget.h"
+
+class MediaRecipients;
+class MediaSenderEntity;
+class MediaReceiverEntity;
+
+/*!
+	Native IPv4 or IPv6 socket address, which can be passed as it is
+	to sendto() or sendmmsg().
+*/
+class MediaEndpoint
+{
+public:
+	MediaEndpoint();
+
+	static MediaEndpoint fromSockAddr(const sockaddr* sa);
+
+	/*! Creates the address for a socket of the given "family".
+		AF_INET6 converts IPv4 addresses to IPv4-mapped IPv6 addresses (dual-stack),
+		AF_INET can not hold IPv6 addresses and 0 keeps the address as it is.
+		\return A null endpoint, if the address can not be represented.
+	*/
+	static MediaEndpoint fromQHostAddress(const QHostAddress& address, quint16 port, int family = 0);
+
+	bool isNull() const { return _addr.sa.sa_family == AF_UNSPEC; }
+	const sockaddr* sockAddr() const { return &_addr.sa; }
+	socklen_t sockAddrLength() const;
+
+	/*! IPv4-mapped IPv6 addresses are returned as plain IPv4 addresses. */
+	QHostAddress address() const;
+	quint16 port() const;
+
+private:
+	union
+	{
+		sockaddr sa;
+		sockaddr_in v4;
+		sockaddr_in6 v6;
+	} _addr;
+};
+
+
+/*!
+	Packed address and port of an endpoint.
+	IPv4 addresses are stored as IPv4-mapped IPv6 addresses, which makes
+	keys from IPv4 and dual-stack sockets comparable.
+*/
+class MediaEndpointKey
+{
+public:
+	static MediaEndpointKey fromEndpoint(const MediaEndpoint& endpoint);
+
+	bool operator==(const MediaEndpointKey& other) const
+	{
+		return hi == other.hi && lo == other.lo && port == other.port;
+	}
+	quint64 hash() const;
+
+public:
+	quint64 hi = 0;
+	quint64 lo = 0;
+	quint16 port = 0;
+};
+
+inline uint qHash(const MediaEndpointKey& key, uint seed = 0)
+{
+	return (uint)key.hash() ^ seed;
+}
+
+
+/*!
+	Read-only routing table of the media relay, compiled from MediaRecipients.
+
+	Senders are looked up by their packed address with open addressing.
+	The receivers of a sender are stored as contiguous array of native
+	socket addresses, which can be handed to the socket without conversion.
+
+	Every table has a version and remembers for each receiver the version
+	in which it has been added to the sender. It allows relays to detect
+	new receivers, even if they skipped some versions. A receiver, which
+	switched to another simulcast layer, counts as new receiver.
+
+	Receivers with limited bandwidth have a MediaBandwidthBudget, which is
+	shared by all of their senders and taken over from the previous table.
+
+	The table never changes after construction and can be read by
+	any number of threads.
+*/
+class MediaRoutingTable
+{
+public:
+	class Sender
+	{
+	public:
+		MediaEndpointKey key;
+		ocs::clientid_t clientId = 0;
+		quint32 receiverOffset = 0;
+		quint32 receiverCount = 0;
+
+		// At least one receiver has a limited bandwidth.
+		bool budgeted = false;
+
+		// Number of simulcast layers of the sender's video.
+		int layers = 1;
+
+		// See MediaSenderEntity::audioGroup.
+		quint32 audioGroup = 0;
+	};
+
+	/*! \param family Socket family of the relay socket (see MediaEndpoint::fromQHostAddress()).
+		\param previous The table which will be replaced by this one (may be nullptr).
+	*/
+	MediaRoutingTable(const MediaRecipients& rec, int family, const MediaRoutingTable* previous = nullptr);
+
+	/*! Patches "previous" with the senders of "changedClientIds" from "rec".
+		Only their receivers are compiled again, the receivers of all other
+		senders are copied as they are.
+	*/
+	MediaRoutingTable(const MediaRoutingTable& previous, const MediaRecipients& rec, const QSet<ocs::clientid_t>& changedClientIds, int family);
+
+	quint64 version() const { return _version; }
+
+	/*! \return nullptr, if "key" is not a known sender. */
+	const Sender* findSender(const MediaEndpointKey& key) const;
+	const MediaEndpoint* receivers(const Sender& sender) const { return _receiverEndpoints.data() + sender.receiverOffset; }
+	const ocs::clientid_t* receiverClientIds(const Sender& sender) const { return _receiverClientIds.data() + sender.receiverOffset; }
+
+	/*! Version of the table, in which the receivers have been added to the sender. */
+	const quint64* receiverVersions(const Sender& sender) const { return _receiverVersions.data() + sender.receiverOffset; }
+
+	/*! Budgets of the receivers, nullptr for receivers with unlimited bandwidth. */
+	MediaBandwidthBudget* const* receiverBudgets(const Sender& sender) const { return _receiverBudgets.data() + sender.receiverOffset; }
+
+	/*! Simulcast layer of the sender's video, which is forwarded to the receivers. */
+	const quint8* receiverLayers(const Sender& sender) const { return _receiverLayers.data() + sender.receiverOffset; }
+
+	/*! Looks up the endpoint of a client (e.g. to send a recovery request to a sender).
+		\return nullptr, if the client is unknown.
+	*/
+	const MediaEndpoint* findClient(ocs::clientid_t clientId) const;
+
+	int senderCount() const { return (int)_senders.size(); }
+	const Sender& sender(int i) const { return _senders[i]; }
+	int receiverCount() const { return (int)_receiverEndpoints.size(); }
+
+private:
+	MediaEndpointKey addSender(const QHostAddress& address, quint16 port, const MediaSenderEntity& sender, int family, const MediaRoutingTable* previous);
+	void addClient(const MediaReceiverEntity& client, int family);
+	void buildSlots();
+	MediaBandwidthBudget* budget(const MediaReceiverEntity& receiver, const MediaRoutingTable* previous);
+
+private:
+	quint64 _version;
+	std::vector<Sender> _senders;
+	std::vector<qint32> _senderSlots;   // Index into _senders or -1.
+
+	std::vector<MediaEndpoint> _receiverEndpoints;
+	std::vector<ocs::clientid_t> _receiverClientIds;
+	std::vector<quint64> _receiverVersions;
+	std::vector<MediaBandwidthBudget*> _receiverBudgets;
+	std::vector<quint8> _receiverLayers;
+	QHash<ocs::clientid_t, std::shared_ptr<MediaBandwidthBudget> > _budgets;
+
+	std::vector<ocs::clientid_t> _clientIds;
+	std::vector<MediaEndpoint> _clientEndpoints;
+	std::vector<qint32> _clientSlots;   // Index into _clientIds or -1.
+};
+
+
+/*!
+	Publishes routing tables from the control-plane to the relay threads
+	(read-copy-update with quiescent states).
+
+	There is a single writer, which calls publish() and reclaim(). Every
+	relay thread owns a Reader and calls Reader::acquire() whenever it does
+	not hold a table, e.g. before each batch. A reader never blocks and never
+	waits for the writer. Replaced tables are deleted as soon as every reader
+	went through acquire() after the replacement.
+
+	Readers are created by the writer before they start and live as long
+	as this object.
+*/
+class MediaRoutingTableRcu
+{
+public:
+	class Reader
+	{
+	public:
+		/*! Returns the current table, which stays valid until the next
+			call of acquire() by this reader. May return nullptr.
+		*/
+		const MediaRoutingTable* acquire();
+
+	private:
+		friend class MediaRoutingTableRcu;
+		explicit Reader(MediaRoutingTableRcu* rcu);
+
+		MediaRoutingTableRcu* _rcu;
+		std::atomic<quint64> _epoch;
+	};
+
+public:
+	MediaRoutingTableRcu();
+	~MediaRoutingTableRcu();
+	MediaRoutingTableRcu(const MediaRoutingTableRcu&) = delete;
+	MediaRoutingTableRcu& operator=(const MediaRoutingTableRcu&) = delete;
+
+	/*! Writer only. */
+	Reader* createReader();
+
+	/*! Writer only. The latest published table (may be nullptr). */
+	const MediaRoutingTable* current() const { return _current.load(); }
+
+	/*! Writer only. Replaces the current table. */
+	void publish(std::unique_ptr<MediaRoutingTable> table);
+
+	/*! Writer only. Deletes replaced tables, which are not used by any reader anymore. */
+	void reclaim();
+
+	/*! Writer only. Number of replaced tables waiting for deletion. */
+	int retiredCount() const { return (int)_retired.size(); }
+
+private:
+	class Retired
+	{
+	public:
+		const MediaRoutingTable* table;
+		quint64 epoch;
+	};
+
+	std::atomic<const MediaRoutingTable*> _current;
+	std::atomic<quint64> _epoch;
+	std::vector<std::unique_ptr<Reader> > _readers;
+	std::vector<Retired> _retired;
+};
+
+#endif
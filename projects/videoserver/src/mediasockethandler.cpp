@@ -2,185 +2,287 @@
 
 #include <QString>
 #include <QTimer>
+#include <QSocketNotifier>
+#include <QMutexLocker>
+
+#ifdef __linux__
+#include <cerrno>
+#include <unistd.h>
+#endif
 
 #include "humblelogging/api.h"
 
+#include "libmediaprotocol/datagramview.h"
+
 #include "virtualserver.h"
+#include "mediadatagrambatch.h"
+#include "mediarelayworker.h"
 
 HUMBLE_LOGGER(HL, "server.mediasocket");
 
-#ifdef __linux__
-/*  QDataStream& operator<<(QDataStream& out, const UDP::VideoFrameDatagram::dg_frame_id_t& val)
-    {
-	out << (quint64)val;
-	return out;
-    }
-
-    QDataStream& operator>>(QDataStream& in, UDP::VideoFrameDatagram::dg_frame_id_t& val)
-    {
-	quint64 i;
-	in >> i;
-	val = i;
-	return in;
-    }*/
-#endif
-
 ///////////////////////////////////////////////////////////////////////
 
-MediaSocketHandler::MediaSocketHandler(const QHostAddress& address,
-									   quint16 port, QObject* parent) :
+MediaSocketHandler::MediaSocketHandler(const Options& opts, QObject* parent) :
 	QObject(parent),
-	_address(address),
-	_port(port),
+	_opts(opts),
 	_socket(this),
+	_routes(),
+	_keyFrameCache(opts.keyFrameCacheSize > 0 ? new MediaKeyFrameCache(opts.keyFrameCacheSize) : nullptr),
+	_recoveryLimiter(opts.recoveryWindowMs > 0 ? new MediaRecoveryLimiter(opts.recoveryWindowMs) : nullptr),
+	_activeSpeakers(opts.activeSpeakers > 0 ? new MediaActiveSpeakers(opts.activeSpeakers) : nullptr),
+#if defined(OCS_INCLUDE_AUDIO)
+	_audioMixer(opts.audioMixing > 0 ? new MediaAudioMixer(this, opts.audioMixing, opts.audioMixerWorkers) : nullptr),
+	_relay(this, _routes.createReader(), _keyFrameCache.get(), _recoveryLimiter.get(), _activeSpeakers.get(), _audioMixer.get()),
+#else
+	_relay(this, _routes.createReader(), _keyFrameCache.get(), _recoveryLimiter.get(), _activeSpeakers.get(), nullptr),
+#endif
 	_networkUsage(),
 	_networkUsageHelper(_networkUsage)
 {
+	qRegisterMetaType<QHostAddress>("QHostAddress");
+
 	connect(&_socket, &QUdpSocket::readyRead, this,
 			&MediaSocketHandler::onReadyRead);
 	connect(&_socket,
 			static_cast<void(QUdpSocket::*)(QAbstractSocket::SocketError)>
 			(&QUdpSocket::error), this, &MediaSocketHandler::onError);
 
-	_in.setByteOrder(QDataStream::BigEndian);
-
 	// Update bandwidth status every X seconds.
 	auto bandwidthTimer = new QTimer(this);
 	bandwidthTimer->setInterval(1500);
 	bandwidthTimer->start();
 	QObject::connect(bandwidthTimer, &QTimer::timeout, [this]()
 	{
+		updateStatistics();
+		_routes.reclaim();
 		_networkUsageHelper.recalculate();
 		emit networkUsageUpdated(_networkUsage);
+		emit relayStatisticsUpdated(_relayStatistics);
 	});
 }
 
 MediaSocketHandler::~MediaSocketHandler()
 {
+#if defined(OCS_INCLUDE_AUDIO)
+	// The mixer sends through the sockets of the workers.
+	if (_audioMixer)
+		_audioMixer->stop();
+#endif
+	stopWorkers();
 	_socket.close();
+#ifdef __linux__
+	delete _batchNotifier;
+	_batch.reset();
+	if (_batchSocket != -1)
+		::close(_batchSocket);
+#endif
 }
 
 bool MediaSocketHandler::init()
 {
-	if (!_socket.bind(_address, _port, QAbstractSocket::DontShareAddress))
+	if (!initSockets())
+	{
+		return false;
+	}
+#if defined(OCS_INCLUDE_AUDIO)
+	if (_audioMixer)
+	{
+		_audioMixer->start();
+		HL_INFO(HL, QString("Using audio mixer (min-speakers=%1; workers=%2)").arg(_opts.audioMixing).arg(_opts.audioMixerWorkers).toStdString());
+	}
+#else
+	if (_opts.audioMixing > 0)
+	{
+		HL_WARN(HL, QString("Audio mixing is not supported by this build, forwarding audio").toStdString());
+	}
+#endif
+	return true;
+}
+
+bool MediaSocketHandler::initSockets()
+{
+	if (_opts.workers > 0)
+	{
+#ifdef __linux__
+		return initWorkers();
+#else
+		HL_WARN(HL, QString("Media relay workers are not supported on this platform, relaying in main thread").toStdString());
+		_opts.workers = 0;
+#endif
+	}
+	if (_opts.backend == BatchedBackend)
+	{
+#ifdef __linux__
+		return initBatchedBackend();
+#else
+		HL_WARN(HL, QString("Batched media relay is not supported on this platform, using QUdpSocket").toStdString());
+		_opts.backend = QtBackend;
+#endif
+	}
+	if (!_socket.bind(_opts.address, _opts.port, QAbstractSocket::DontShareAddress))
 	{
 		HL_ERROR(HL, QString("Can not bind to UDP port (port=%1)").arg(
-					 _port).toStdString());
+					 _opts.port).toStdString());
 		return false;
 	}
 	return true;
 }
 
-void MediaSocketHandler::setRecipients(MediaRecipients&& rec)
+bool MediaSocketHandler::initBatchedBackend()
 {
-	_recipients = rec;
+#ifdef __linux__
+	_batchSocket = createMediaSocket(_opts.address, _opts.port, false, &_socketFamily);
+	if (_batchSocket == -1)
+	{
+		HL_ERROR(HL, QString("Can not bind to UDP port (port=%1; errno=%2)").arg(
+					 _opts.port).arg(errno).toStdString());
+		return false;
+	}
+
+	_directSocket = _batchSocket;
+	_batch.reset(new MediaDatagramBatch(_batchSocket, _opts.batchSize));
+	_batchNotifier = new QSocketNotifier(_batchSocket, QSocketNotifier::Read, this);
+	connect(_batchNotifier, &QSocketNotifier::activated, this, &MediaSocketHandler::onBatchReadyRead);
+	HL_INFO(HL, QString("Using batched media relay (batch-size=%1)").arg(_batch->capacity()).toStdString());
+	return true;
+#else
+	return false;
+#endif
+}
 
-	/*  printf("\n");
-	    foreach (const auto& senderAddress, rec.addr2sender.keys())
-	    {
-		foreach (const auto& senderPort, rec.addr2sender[senderAddress].keys())
+bool MediaSocketHandler::initWorkers()
+{
+#ifdef __linux__
+	// Bind all sockets first, a failure should not leave running workers behind.
+	QVector<int> fds;
+	QVector<int> families;
+	for (auto i = 0; i < _opts.workers; ++i)
+	{
+		int family = 0;
+		auto fd = createMediaSocket(_opts.address, _opts.port, true, &family);
+		if (fd == -1)
 		{
-			printf("FROM %s:%d\n", senderAddress.toString().toStdString().c_str(), senderPort);
-			foreach (const auto& receiver, rec.addr2sender[senderAddress][senderPort].receivers)
-			{
-				printf("\tTO %s:%d\n", receiver.address.toString().toStdString().c_str(), receiver.port);
-			}
+			HL_ERROR(HL, QString("Can not bind to UDP port with SO_REUSEPORT (port=%1; errno=%2)").arg(
+						 _opts.port).arg(errno).toStdString());
+			for (auto j = 0; j < fds.size(); ++j)
+				::close(fds[j]);
+			return false;
 		}
-	    }
-	    printf("\n");*/
+		fds.append(fd);
+		families.append(family);
+	}
+
+	// All sockets are bound to the same address, which results in the same family.
+	_socketFamily = families.first();
+	_directSocket = fds.first();
+	for (auto i = 0; i < fds.size(); ++i)
+	{
+#if defined(OCS_INCLUDE_AUDIO)
+		auto worker = new MediaRelayWorker(i, fds[i], _opts.batchSize, _routes.createReader(), _keyFrameCache.get(), _recoveryLimiter.get(), _activeSpeakers.get(), _audioMixer.get(), this);
+#else
+		auto worker = new MediaRelayWorker(i, fds[i], _opts.batchSize, _routes.createReader(), _keyFrameCache.get(), _recoveryLimiter.get(), _activeSpeakers.get(), nullptr, this);
+#endif
+		connect(worker, &MediaRelayWorker::tokenAuthentication, this, &MediaSocketHandler::tokenAuthentication);
+		connect(worker, &MediaRelayWorker::mtuProbe, this, &MediaSocketHandler::mtuProbe);
+		_workers.append(worker);
+		worker->start();
+	}
+	HL_INFO(HL, QString("Using media relay workers (workers=%1; batch-size=%2)").arg(_workers.size()).arg(_opts.batchSize).toStdString());
+	return true;
+#else
+	return false;
+#endif
 }
 
-void MediaSocketHandler::onReadyRead()
+void MediaSocketHandler::stopWorkers()
 {
-	while (_socket.hasPendingDatagrams())
+#ifdef __linux__
+	for (auto worker : _workers)
+		worker->stop();
+	for (auto worker : _workers)
 	{
-		_bufferLen = _socket.readDatagram(_buffer, 4096, &_senderAddress, &_senderPort);
+		worker->wait();
+		delete worker;
+	}
+	_workers.clear();
+#endif
+}
+
+void MediaSocketHandler::setRecipients(MediaRecipients&& rec)
+{
+	publishRoutes(std::unique_ptr<MediaRoutingTable>(new MediaRoutingTable(rec, _socketFamily, _routes.current())));
+}
 
-		_data.setRawData(_buffer, _bufferLen);
+void MediaSocketHandler::setRecipients(const MediaRecipients& rec, const QSet<ocs::clientid_t>& changedClientIds)
+{
+	const auto current = _routes.current();
+	if (!current)
+	{
+		publishRoutes(std::unique_ptr<MediaRoutingTable>(new MediaRoutingTable(rec, _socketFamily)));
+		return;
+	}
+	publishRoutes(std::unique_ptr<MediaRoutingTable>(new MediaRoutingTable(*current, rec, changedClientIds, _socketFamily)));
+}
 
-		_dataBuffer.close();
-		_dataBuffer.setBuffer(&_data);
-		_dataBuffer.open(QIODevice::ReadOnly);
+void MediaSocketHandler::publishRoutes(std::unique_ptr<MediaRoutingTable> routes)
+{
+	if (_keyFrameCache)
+		_keyFrameCache->retain(*routes);
+	if (_recoveryLimiter)
+		_recoveryLimiter->retain(*routes);
+	if (_activeSpeakers)
+		_activeSpeakers->retain(*routes);
+#if defined(OCS_INCLUDE_AUDIO)
+	if (_audioMixer)
+		_audioMixer->setRoutes(*routes);
+#endif
+	_routes.publish(std::move(routes));
 
-		_in.setDevice(&_dataBuffer);
-		_in.resetStatus();
+	// The local relay runs in this thread and does not hold the table right now.
+	_relay.refreshRoutes();
+#ifdef __linux__
+	if (_batch)
+	{
+		_batch->flush();
+		_relayStatistics.sendDrops += _batch->takeSendDrops();
+	}
+#endif
+	_relay.releaseDatagrams();
+	_routes.reclaim();
+}
 
-		_networkUsage.bytesRead += _bufferLen;
+void MediaSocketHandler::onReadyRead()
+{
+	while (_socket.hasPendingDatagrams())
+	{
+		_bufferLen = _socket.readDatagram(_buffer, sizeof(_buffer), &_senderAddress, &_senderPort);
+		if (_bufferLen < 0)
+			continue;
+		_senderEndpoint = MediaEndpoint::fromQHostAddress(_senderAddress, _senderPort);
+		_relay.processDatagram(_buffer, _bufferLen, _senderEndpoint);
+	}
+	_relay.releaseDatagrams();
+}
 
-		_in >> _baseDatagram.magic;
-		if (_baseDatagram.magic != UDP::Datagram::MAGIC)
+void MediaSocketHandler::onBatchReadyRead()
+{
+#ifdef __linux__
+	// Limit the number of rounds to not block the event loop forever,
+	// the socket notifier will activate again for the remaining datagrams.
+	for (auto round = 0; round < 16; ++round)
+	{
+		const auto count = _relay.processBatch(*_batch);
+		if (count < 0)
 		{
-			HL_WARN(HL, QString("Received invalid datagram (size=%1; data=%2)").arg(
-						_data.size()).arg(QString(_data)).toStdString());
-			continue;
+			HL_ERROR(HL, QString("recvmmsg() failed (errno=%1)").arg(errno).toStdString());
+			break;
 		}
-
-		_in >> _baseDatagram.type;
-		switch (_baseDatagram.type)
+		else if (count < _batch->capacity())
 		{
-			case UDP::AuthDatagram::TYPE:
-			{
-				UDP::AuthDatagram dgauth;
-				_in >> dgauth.size;
-				dgauth.data = new UDP::dg_byte_t[dgauth.size];
-				auto read = _in.readRawData((char*)dgauth.data, dgauth.size);
-				if (read != dgauth.size)
-				{
-					continue;
-				}
-				auto token = QString::fromUtf8((char*)dgauth.data, dgauth.size);
-				emit tokenAuthentication(token, _senderAddress, _senderPort);
-				break;
-			}
-
-			case UDP::VideoFrameDatagram::TYPE:
-			{
-				//const auto senderId = MediaSenderEntity::createIdent(_senderAddress, _senderPort);
-				//const auto& senderEntity = _recipients.ident2sender[senderId];
-				const auto& senderEntity = _recipients.addr2sender[_senderAddress][_senderPort];
-				for (auto i = 0, end = senderEntity.receivers.size(); i < end; ++i)
-				{
-					const auto& receiverEntity = senderEntity.receivers[i];
-					_socket.writeDatagram(_buffer, _bufferLen, receiverEntity.address,
-										  receiverEntity.port);
-					_networkUsage.bytesWritten += _bufferLen;
-				}
-				break;
-			}
-
-			case UDP::VideoFrameRequestRecoveryDatagram::TYPE:
-			{
-				UDP::VideoFrameRequestRecoveryDatagram dgrec;
-				_in >> dgrec.sender;
-
-				// Send to specific receiver only.
-				const auto& receiver = _recipients.clientid2receiver[dgrec.sender];
-				if (receiver.address.isNull() || receiver.port == 0)
-				{
-					HL_WARN(HL, QString("Unknown receiver for recovery frame (client-id=%1)").arg(
-								dgrec.sender).toStdString());
-					continue;
-				}
-				_socket.writeDatagram(_data, receiver.address, receiver.port);
-				_networkUsage.bytesWritten += _data.size();
-				break;
-			}
-
-				/*  case UDP::AudioFrameDatagram::TYPE:
-				    {
-					const auto senderId = MediaSenderEntity::createIdent(senderAddress, senderPort);
-					const auto& senderEntity = _recipients.ident2sender[senderId];
-					for (auto i = 0; i < senderEntity.receivers.size(); ++i)
-					{
-						const auto& receiverEntity = senderEntity.receivers[i];
-						_socket.writeDatagram(data, receiverEntity.address, receiverEntity.port);
-						_networkUsage.bytesWritten += data.size();
-					}
-					break;
-				    }*/
-
+			break;
 		}
 	}
+#endif
 }
 
 void MediaSocketHandler::onError(QAbstractSocket::SocketError socketError)
@@ -188,3 +290,85 @@ void MediaSocketHandler::onError(QAbstractSocket::SocketError socketError)
 	HL_ERROR(HL, QString("socket error (err=%1; message=%2)").arg(socketError).arg(
 				 _socket.errorString()).toStdString());
 }
+
+void MediaSocketHandler::updateStatistics()
+{
+	_relayStatistics = _relay.statistics();
+#ifdef __linux__
+	for (auto worker : _workers)
+	{
+		const auto stats = worker->statistics();
+		_relayStatistics.merge(stats);
+		_relayStatistics.workerDatagrams.append(stats.datagramsRead);
+	}
+#endif
+	_networkUsage.bytesRead = _relayStatistics.bytesRead;
+	_networkUsage.bytesWritten = _relayStatistics.bytesWritten;
+}
+
+bool MediaSocketHandler::sendDatagram(const char* data, int len, const MediaEndpoint& to)
+{
+#ifdef __linux__
+	if (_batch)
+	{
+		_batch->enqueue(data, len, to.sockAddr(), to.sockAddrLength());
+		return true;
+	}
+#endif
+	return _socket.writeDatagram(data, len, to.address(), to.port()) >= 0;
+}
+
+void MediaSocketHandler::sendMixedDatagram(const char* data, int len, const MediaEndpoint& to)
+{
+	sendDirectDatagram(data, len, to);
+}
+
+void MediaSocketHandler::sendMtuProbeReply(int size, const QHostAddress& address, quint16 port)
+{
+	if (size < (int)UDP::MtuProbeDatagramView::HEADER_SIZE || size > (int)UDP::MtuProbeDatagram::MAXDATAGRAMSIZE)
+	{
+		return;
+	}
+	QByteArray data(size, 0);
+	data[0] = (char)UDP::Datagram::MAGIC;
+	data[1] = (char)UDP::MtuProbeDatagram::TYPE;
+	data[(int)UDP::MtuProbeDatagramView::OFFSET_SIZE] = (char)(size >> 8);
+	data[(int)UDP::MtuProbeDatagramView::OFFSET_SIZE + 1] = (char)size;
+	sendDirectDatagram(data.constData(), data.size(), MediaEndpoint::fromQHostAddress(address, port));
+}
+
+void MediaSocketHandler::sendDirectDatagram(const char* data, int len, const MediaEndpoint& to)
+{
+#ifdef __linux__
+	if (_directSocket != -1)
+	{
+		::sendto(_directSocket, data, len, MSG_DONTWAIT, to.sockAddr(), to.sockAddrLength());
+		return;
+	}
+#endif
+	QMutexLocker l(&_directDatagramsMutex);
+	if (_directDatagrams.isEmpty())
+		QMetaObject::invokeMethod(this, "flushDirectDatagrams", Qt::QueuedConnection);
+	_directDatagrams.append(qMakePair(QByteArray(data, len), to));
+}
+
+void MediaSocketHandler::flushDirectDatagrams()
+{
+	QVector<QPair<QByteArray, MediaEndpoint> > datagrams;
+	{
+		QMutexLocker l(&_directDatagramsMutex);
+		datagrams.swap(_directDatagrams);
+	}
+	for (const auto& dg : datagrams)
+		_socket.writeDatagram(dg.first, dg.second.address(), dg.second.port());
+}
+
+void MediaSocketHandler::authenticateToken(const QString& token, const QHostAddress& address, quint16 port)
+{
+	emit tokenAuthentication(token, address, port);
+}
+
+void MediaSocketHandler::probeMtu(int size, const QHostAddress& address, quint16 port)
+{
+	emit mtuProbe(size, address, port);
+}
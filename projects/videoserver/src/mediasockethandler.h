@@ -6,12 +6,12 @@
 #include <QVector>
 #include <QTime>
 #include <QString>
-#include <QCache>
-#include <QBuffer>
-#include <QDataStream>
 #include <QHostAddress>
 #include <QByteArray>
-#include <QHash>
+#include <QMutex>
+#include <QPair>
+
+#include <memory>
 
 #include "libbase/defines.h"
 
@@ -19,69 +19,146 @@
 
 #include "libapp/networkusageentity.h"
 
-class MediaSenderEntity;
-class MediaReceiverEntity;
-class MediaRecipients;
-
+#include "mediarelay.h"
 
-class MediaSenderEntity
-{
-public:
-	ocs::clientid_t clientId;
-	QHostAddress address;
-	quint16 port;
-	QVector<MediaReceiverEntity> receivers;
-};
+class QSocketNotifier;
+class MediaDatagramBatch;
+class MediaRelayWorker;
 
 
-class MediaReceiverEntity
+class MediaSocketHandler : public QObject, private MediaRelay::Output, private MediaAudioMixer::Output
 {
-public:
-	ocs::clientid_t clientId;
-	QHostAddress address;
-	quint16 port;
-};
-
+	Q_OBJECT
 
-class MediaRecipients
-{
 public:
-	// Maps a SENDER's address+port to itself.
-	QHash<QHostAddress, QHash<quint16, MediaSenderEntity> > addr2sender;
-
-	// Maps a RECEIVER's client-id to itself.
-	QHash<ocs::clientid_t, MediaReceiverEntity> clientid2receiver;
-};
-
-
-class MediaSocketHandler : public QObject
-{
-	Q_OBJECT
+	enum Backend
+	{
+		QtBackend,     ///< QUdpSocket, reads and writes one datagram per system call.
+		BatchedBackend ///< recvmmsg() and sendmmsg(), Linux only.
+	};
+
+	class Options
+	{
+	public:
+		// Address and port to listen for media data.
+		QHostAddress address = QHostAddress::Any;
+		quint16 port = 0;
+
+		// I/O backend, which falls back to QtBackend on unsupported platforms.
+		Backend backend = QtBackend;
+
+		// Maximum number of datagrams read by a single recvmmsg() call.
+		int batchSize = 64;
+
+		// Number of relay worker threads with their own SO_REUSEPORT socket (Linux only).
+		// 0 = Relay in the thread of this object.
+		// The workers always use the batched backend.
+		int workers = 0;
+
+		// Maximum number of cached datagrams per sender (see MediaKeyFrameCache).
+		// 0 = Disables the key frame cache.
+		int keyFrameCacheSize = 256;
+
+		// Recovery requests for the same sender within this window are merged
+		// into a single one (see MediaRecoveryLimiter).
+		// 0 = Forwards every request.
+		int recoveryWindowMs = 500;
+
+		// Maximum number of forwarded speakers per channel (see MediaActiveSpeakers).
+		// 0 = Forwards every speaker.
+		int activeSpeakers = 3;
+
+		// Channels with at least this number of speakers are mixed by the server
+		// (see MediaAudioMixer). Requires a build with audio support.
+		// 0 = Disables mixing.
+		int audioMixing = 0;
+
+		// Number of audio mixer threads.
+		int audioMixerWorkers = 2;
+	};
 
 public:
-	MediaSocketHandler(const QHostAddress& address, quint16 port, QObject* parent);
+	MediaSocketHandler(const Options& opts, QObject* parent);
 	virtual ~MediaSocketHandler();
 
 	bool init();
 	void setRecipients(MediaRecipients&& rec);
 
+	/*! Updates the routes of the senders of "changedClientIds" only.
+		\see MediaRoutingTable
+	*/
+	void setRecipients(const MediaRecipients& rec, const QSet<ocs::clientid_t>& changedClientIds);
+
+	/*! Echoes an MTU probe of "size" bytes to the client (see UDP::MtuProbeDatagram). */
+	void sendMtuProbeReply(int size, const QHostAddress& address, quint16 port);
+
 signals:
 	/*! Emits for every incoming authentication from a client. */
 	void tokenAuthentication(const QString& token, const QHostAddress& address, quint16 port);
 
+	/*! Emits for every incoming MTU probe. */
+	void mtuProbe(int size, const QHostAddress& address, quint16 port);
+
 	/*! Emits whenever the transfer rates have been recalculated and updated.
 	    It gets calculated every X seconds by an internal timer. */
 	void networkUsageUpdated(const NetworkUsageEntity&);
 
+	/*! Emits together with networkUsageUpdated(). */
+	void relayStatisticsUpdated(const MediaRelayStatistics&);
+
 private slots:
 	void onReadyRead();
+	void onBatchReadyRead();
 	void onError(QAbstractSocket::SocketError socketError);
+	void flushDirectDatagrams();
+
+private:
+	bool initSockets();
+	bool initBatchedBackend();
+	bool initWorkers();
+	void stopWorkers();
+	void updateStatistics();
+	void publishRoutes(std::unique_ptr<MediaRoutingTable> routes);
+
+	virtual bool sendDatagram(const char* data, int len, const MediaEndpoint& to);
+	virtual void authenticateToken(const QString& token, const QHostAddress& address, quint16 port);
+	virtual void probeMtu(int size, const QHostAddress& address, quint16 port);
+	virtual void sendMixedDatagram(const char* data, int len, const MediaEndpoint& to);
+
+	// Thread-safe, sends outside of the relay's batches.
+	void sendDirectDatagram(const char* data, int len, const MediaEndpoint& to);
 
 private:
-	QHostAddress _address;
-	quint16 _port;
+	Options _opts;
 	QUdpSocket _socket;
-	MediaRecipients _recipients;
+
+	// Routing tables (written here, read by _relay and the workers).
+	// Socket family of the relay sockets for the endpoints in the table, 0 = QUdpSocket.
+	MediaRoutingTableRcu _routes;
+	int _socketFamily = 0;
+	std::unique_ptr<MediaKeyFrameCache> _keyFrameCache;
+	std::unique_ptr<MediaRecoveryLimiter> _recoveryLimiter;
+	std::unique_ptr<MediaActiveSpeakers> _activeSpeakers;
+#if defined(OCS_INCLUDE_AUDIO)
+	std::unique_ptr<MediaAudioMixer> _audioMixer;
+#endif
+	MediaRelay _relay;
+
+	// Batched backend.
+	int _batchSocket = -1;
+	QSocketNotifier* _batchNotifier = nullptr;
+	std::unique_ptr<MediaDatagramBatch> _batch;
+
+	// Relay workers (replace the sockets above).
+	QVector<MediaRelayWorker*> _workers;
+	MediaRelayStatistics _relayStatistics;
+
+	// Mixed audio from the mixer threads and MTU probe replies. Sent directly
+	// through the relay socket, if there is a native one, otherwise queued
+	// for this thread.
+	int _directSocket = -1;
+	QMutex _directDatagramsMutex;
+	QVector<QPair<QByteArray, MediaEndpoint> > _directDatagrams;
 
 	/* onReadyRead() related variables */
 
@@ -92,14 +169,9 @@ private:
 	char _buffer[4096];
 	int _bufferLen = 0;
 
-	QByteArray _data;
-	QBuffer _dataBuffer;
-	QDataStream _in;
-
 	QHostAddress _senderAddress;
 	quint16 _senderPort = 0;
-
-	UDP::Datagram _baseDatagram;
+	MediaEndpoint _senderEndpoint;
 
 	/* network usage */
 
@@ -0,0 +1,118 @@
+#include "mediatransportfeedback.h"
+
+#include <cstdlib>
+
+#include <QDataStream>
+
+#include "libmediaprotocol/datagramview.h"
+
+///////////////////////////////////////////////////////////////////////
+
+// Maximum time between the first arrival of a feedback and its report.
+static const qint64 FEEDBACK_INTERVAL_US = 50 * 1000;
+
+MediaTransportFeedback::MediaTransportFeedback() :
+	_started(false),
+	_baseSequence(0),
+	_count(0),
+	_firstArrivalUs(0),
+	_hasTransit(false),
+	_lastTransit(0),
+	_jitterUs(0.0)
+{
+}
+
+bool MediaTransportFeedback::add(UDP::TransportDatagram::dg_sequence_t sequence, UDP::TransportDatagram::dg_time_t sendTime, qint64 arrivalUs)
+{
+	// Transit time on the difference of both clocks, only its changes matter.
+	const auto transit = (UDP::TransportDatagram::dg_time_t)arrivalUs - sendTime;
+	if (_hasTransit)
+	{
+		const auto d = std::abs((qint64)(qint32)(transit - _lastTransit));
+		_jitterUs += ((double)d - _jitterUs) / 16.0;
+	}
+	_lastTransit = transit;
+	_hasTransit = true;
+
+	if (!_started || (_count == 0 && (UDP::TransportDatagram::dg_sequence_t)(sequence - _baseSequence) >= UDP::TransportFeedbackDatagram::MAXCOUNT))
+	{
+		// First datagram or too far ahead of the last feedback, the gap is not reported.
+		_started = true;
+		_baseSequence = sequence;
+	}
+
+	const auto offset = (UDP::TransportDatagram::dg_sequence_t)(sequence - _baseSequence);
+	if (offset >= 0x8000)
+	{
+		// Late, it has already been reported as lost.
+		return true;
+	}
+	if (offset >= UDP::TransportFeedbackDatagram::MAXCOUNT)
+	{
+		return false;
+	}
+
+	if (_count == 0)
+	{
+		_firstArrivalUs = arrivalUs;
+	}
+	for (; _count <= offset; ++_count)
+	{
+		_arrivalsUs[_count] = -1;
+	}
+	if (_arrivalsUs[offset] == -1)
+	{
+		_arrivalsUs[offset] = arrivalUs;
+	}
+	return true;
+}
+
+bool MediaTransportFeedback::due(qint64 nowUs) const
+{
+	return _count >= UDP::TransportFeedbackDatagram::MAXCOUNT || (_count > 0 && nowUs - _firstArrivalUs >= FEEDBACK_INTERVAL_US);
+}
+
+QByteArray MediaTransportFeedback::take()
+{
+	if (_count == 0)
+	{
+		return QByteArray();
+	}
+
+	// Datagrams may arrive out of order, the earliest arrival is the reference.
+	auto referenceUs = _firstArrivalUs;
+	for (auto i = 0; i < _count; ++i)
+	{
+		if (_arrivalsUs[i] != -1 && _arrivalsUs[i] < referenceUs)
+			referenceUs = _arrivalsUs[i];
+	}
+
+	UDP::TransportFeedbackDatagram dg;
+	dg.baseSequence = _baseSequence;
+	dg.count = (UDP::TransportFeedbackDatagram::dg_count_t)_count;
+	dg.referenceTime = (UDP::TransportDatagram::dg_time_t)referenceUs;
+
+	QByteArray data;
+	data.reserve((int)(UDP::TransportFeedbackDatagramView::HEADER_SIZE + _count * sizeof(UDP::TransportFeedbackDatagram::dg_arrival_t)));
+	QDataStream out(&data, QIODevice::WriteOnly);
+	out.setByteOrder(QDataStream::BigEndian);
+	out << dg.magic;
+	out << dg.type;
+	out << dg.baseSequence;
+	out << dg.count;
+	out << dg.referenceTime;
+	for (auto i = 0; i < _count; ++i)
+	{
+		UDP::TransportFeedbackDatagram::dg_arrival_t arrival = UDP::TransportFeedbackDatagram::NOT_RECEIVED;
+		if (_arrivalsUs[i] != -1)
+		{
+			const auto ticks = (_arrivalsUs[i] - referenceUs) / UDP::TransportFeedbackDatagram::ARRIVAL_TICK_US;
+			arrival = (UDP::TransportFeedbackDatagram::dg_arrival_t)qMin(ticks, (qint64)UDP::TransportFeedbackDatagram::NOT_RECEIVED - 1);
+		}
+		out << arrival;
+	}
+
+	_baseSequence = (UDP::TransportDatagram::dg_sequence_t)(_baseSequence + _count);
+	_count = 0;
+	return data;
+}
@@ -0,0 +1,53 @@
+#ifndef MEDIATRANSPORTFEEDBACK_H
+#define MEDIATRANSPORTFEEDBACK_H
+
+#include <QByteArray>
+
+#include "libmediaprotocol/protocol.h"
+
+/*!
+	Collects the arrival times of a client's transport sequence numbers
+	(see UDP::TransportDatagram) for its next UDP::TransportFeedbackDatagram.
+
+	Consecutive feedbacks continue with the sequence number after the last
+	reported one, datagrams which never arrived are reported as lost.
+	A datagram, which arrives after its feedback has been sent, is ignored.
+
+	Each relay thread keeps its own objects for the senders it receives,
+	the class is not thread-safe.
+*/
+class MediaTransportFeedback
+{
+public:
+	MediaTransportFeedback();
+
+	/*! Adds the arrival of a datagram.
+		\return false, if the sequence number does not fit into the current
+		feedback anymore. It has to be sent with take() before.
+	*/
+	bool add(UDP::TransportDatagram::dg_sequence_t sequence, UDP::TransportDatagram::dg_time_t sendTime, qint64 arrivalUs);
+
+	/*! \return true, if the feedback should be sent. */
+	bool due(qint64 nowUs) const;
+
+	/*! Serializes the feedback and starts the next one.
+		\return Empty, if there is nothing to report.
+	*/
+	QByteArray take();
+
+	/*! Interarrival jitter (RFC 3550) in microseconds. */
+	quint32 jitterUs() const { return (quint32)_jitterUs; }
+
+private:
+	bool _started;
+	UDP::TransportDatagram::dg_sequence_t _baseSequence;
+	int _count;
+	qint64 _firstArrivalUs;
+	qint64 _arrivalsUs[UDP::TransportFeedbackDatagram::MAXCOUNT];
+
+	bool _hasTransit;
+	UDP::TransportDatagram::dg_time_t _lastTransit;
+	double _jitterUs;
+};
+
+#endif
@@ -5,7 +5,10 @@ ServerClientEntity::ServerClientEntity() :
 	authenticated(false),
 	admin(false),
 	visibilityLevel(VL_Default),
-	visibilityLevelAllowed(VL_Default)
+	visibilityLevelAllowed(VL_Default),
+	mediaDatagramSize(UDP::MtuProbeDatagram::DEFAULTDATAGRAMSIZE),
+	mediaDownlinkDatagramSize(UDP::MtuProbeDatagram::DEFAULTDATAGRAMSIZE),
+	mediaDatagramLimit(UDP::MtuProbeDatagram::DEFAULTDATAGRAMSIZE)
 {
 }
 
@@ -16,6 +19,11 @@ ServerClientEntity::ServerClientEntity(const ServerClientEntity& other) :
 	this->admin = other.admin;
 	this->visibilityLevel = other.visibilityLevel;
 	this->visibilityLevelAllowed = other.visibilityLevelAllowed;
+	this->videoLayers = other.videoLayers;
+	this->remoteVideoSizes = other.remoteVideoSizes;
+	this->mediaDatagramSize = other.mediaDatagramSize;
+	this->mediaDownlinkDatagramSize = other.mediaDownlinkDatagramSize;
+	this->mediaDatagramLimit = other.mediaDatagramLimit;
 }
 
 ServerClientEntity& ServerClientEntity::operator=(const ServerClientEntity& other)
@@ -25,6 +33,11 @@ ServerClientEntity& ServerClientEntity::operator=(const ServerClientEntity& othe
 	this->admin = other.admin;
 	this->visibilityLevel = other.visibilityLevel;
 	this->visibilityLevelAllowed = other.visibilityLevelAllowed;
+	this->videoLayers = other.videoLayers;
+	this->remoteVideoSizes = other.remoteVideoSizes;
+	this->mediaDatagramSize = other.mediaDatagramSize;
+	this->mediaDownlinkDatagramSize = other.mediaDownlinkDatagramSize;
+	this->mediaDatagramLimit = other.mediaDatagramLimit;
 	return *this;
 }
 
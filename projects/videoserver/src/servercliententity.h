@@ -2,9 +2,14 @@
 #define SERVERCLIENTENTITY_H
 
 #include <QSet>
+#include <QHash>
+#include <QSize>
+#include <QVector>
 
 #include "libbase/defines.h"
 
+#include "libmediaprotocol/protocol.h"
+
 #include "libapp/cliententity.h"
 
 class ServerClientEntity : public ClientEntity
@@ -23,6 +28,15 @@ public:
 
 	bool isAllowedToSee(const ServerClientEntity& sce) const;
 
+	// A simulcast layer of the client's video.
+	class VideoLayer
+	{
+	public:
+		int width = 0;
+		int height = 0;
+		int bitrate = 0;
+	};
+
 public:
 	// Indicates whether the client is authenticated
 	bool authenticated;
@@ -35,6 +49,23 @@ public:
 
 	// The maximum VL this client is allowed to see.
 	VisibilityLevel visibilityLevelAllowed;
+
+	// Simulcast layers of the client's video, largest first.
+	QVector<VideoLayer> videoLayers;
+
+	// Size in which this client displays the videos of other clients.
+	QHash<ocs::clientid_t, QSize> remoteVideoSizes;
+
+	// Largest datagram, which the client has probed successfully (see UDP::MtuProbeDatagram).
+	int mediaDatagramSize;
+
+	// Largest echo of a probe, which the client confirmed to have received.
+	// Relayed datagrams of other clients must not be larger.
+	int mediaDownlinkDatagramSize;
+
+	// Largest video datagram, which the client may send. The smallest
+	// downlink size of its receivers, last sent with "notify.mediadatagramsize".
+	int mediaDatagramLimit;
 };
 
 #endif
\ No newline at end of file
@@ -1,8 +1,12 @@
 #include "virtualserver.h"
 
+#include <algorithm>
+
 #include <QCoreApplication>
 #include <QDir>
 #include <QSettings>
+#include <QStringList>
+#include <QPair>
 
 #include "humblelogging/api.h"
 
@@ -20,6 +24,10 @@
 
 HUMBLE_LOGGER(HL, "server");
 
+// Delay to collect multiple media route changes (e.g. many joining clients)
+// into a single update of the media relay.
+static const int MEDIA_RECIPIENTS_UPDATE_DELAY_MS = 20;
+
 ///////////////////////////////////////////////////////////////////////
 
 VirtualServer::VirtualServer(const VirtualServerOptions& opts, QObject* parent)
@@ -33,8 +41,13 @@ VirtualServer::VirtualServer(const VirtualServerOptions& opts, QObject* parent)
 	, _participants()
 	, _mediaSocketHandler(nullptr)
 	, _tokens()
+	, _mediaRecipientsTimer(this)
 	, _wsStatusServer(nullptr)
 {
+	_mediaRecipientsTimer.setSingleShot(true);
+	_mediaRecipientsTimer.setInterval(MEDIA_RECIPIENTS_UPDATE_DELAY_MS);
+	connect(&_mediaRecipientsTimer, &QTimer::timeout, this, &VirtualServer::onMediaRecipientsTimeout);
+
 	// Basic actions.
 	registerAction(std::make_shared<HeartbeatAction>());
 	registerAction(std::make_shared<GoodbyeAction>());
@@ -52,6 +65,8 @@ VirtualServer::VirtualServer(const VirtualServerOptions& opts, QObject* parent)
 		// Video
 		registerAction(std::make_shared<EnableVideoAction>());
 		registerAction(std::make_shared<DisableVideoAction>());
+		registerAction(std::make_shared<SetRemoteVideoSizeAction>());
+		registerAction(std::make_shared<SetMediaDatagramSizeAction>());
 
 		// Audio
 		registerAction(std::make_shared<EnableAudioInputAction>());
@@ -86,14 +101,27 @@ bool VirtualServer::init()
 	HL_INFO(HL, QString("Listening for client connections (protocol=TCP; address=%1; port=%2)").arg(_opts.address.toString()).arg(_opts.port).toStdString());
 
 	// Init media socket.
-	//_mediaSocketHandler = std::make_unique<MediaSocketHandler>(_opts.address, _opts.port, this);
-	_mediaSocketHandler.reset(new MediaSocketHandler(_opts.address, _opts.port, this));
+	MediaSocketHandler::Options mediaopts;
+	mediaopts.address = _opts.address;
+	mediaopts.port = _opts.port;
+	mediaopts.backend = _opts.mediaRelayBackend.compare("batched", Qt::CaseInsensitive) == 0 ? MediaSocketHandler::BatchedBackend : MediaSocketHandler::QtBackend;
+	mediaopts.batchSize = _opts.mediaRelayBatchSize;
+	mediaopts.workers = _opts.mediaRelayWorkers;
+	mediaopts.keyFrameCacheSize = _opts.mediaKeyFrameCache;
+	mediaopts.recoveryWindowMs = _opts.mediaRecoveryWindow;
+	mediaopts.activeSpeakers = _opts.mediaActiveSpeakers;
+	mediaopts.audioMixing = _opts.mediaAudioMixing;
+	mediaopts.audioMixerWorkers = _opts.mediaAudioMixerWorkers;
+	//_mediaSocketHandler = std::make_unique<MediaSocketHandler>(mediaopts, this);
+	_mediaSocketHandler.reset(new MediaSocketHandler(mediaopts, this));
 	if (!_mediaSocketHandler->init())
 	{
 		return false;
 	}
 	connect(_mediaSocketHandler.get(), &MediaSocketHandler::tokenAuthentication, this, &VirtualServer::onMediaSocketTokenAuthentication);
+	connect(_mediaSocketHandler.get(), &MediaSocketHandler::mtuProbe, this, &VirtualServer::onMediaSocketMtuProbe);
 	connect(_mediaSocketHandler.get(), &MediaSocketHandler::networkUsageUpdated, this, &VirtualServer::onMediaSocketNetworkUsageUpdated);
+	connect(_mediaSocketHandler.get(), &MediaSocketHandler::relayStatisticsUpdated, this, &VirtualServer::onMediaSocketRelayStatisticsUpdated);
 	HL_INFO(HL, QString("Listening for media data (protocol=UDP; address=%1; port=%2)").arg(_opts.address.toString()).arg(_opts.port).toStdString());
 
 	// Init status web-socket.
@@ -132,7 +160,7 @@ const VirtualServerOptions& VirtualServer::options() const
 	return _opts;
 }
 
-void VirtualServer::updateMediaRecipients()
+MediaRecipients VirtualServer::createMediaRecipients() const
 {
 	auto sendBackOwnVideo = false;
 
@@ -153,6 +181,8 @@ void VirtualServer::updateMediaRecipients()
 		sender.clientId = client->id;
 		sender.address = client->mediaAddress;
 		sender.port = client->mediaPort;
+		sender.videoLayers = qMax(client->videoLayers.size(), 1);
+		sender.audioGroup = audioGroup(*client);
 
 		// Fill SENDER receiver list - by conference members.
 		auto siblingClientIds = getSiblingClientIds(sender.clientId, true);
@@ -166,11 +196,7 @@ void VirtualServer::updateMediaRecipients()
 			else if (c == client && !sendBackOwnVideo)
 				continue;
 
-			MediaReceiverEntity r;
-			r.clientId = c->id;
-			r.address = c->mediaAddress;
-			r.port = c->mediaPort;
-			sender.receivers.append(std::move(r));
+			sender.receivers.append(createMediaReceiver(*c, client));
 		}
 
 		// Fill SENDER receiver list - by direct mappings.
@@ -185,24 +211,335 @@ void VirtualServer::updateMediaRecipients()
 			else if (c == client)
 				continue;
 
-			MediaReceiverEntity r;
-			r.clientId = c->id;
-			r.address = c->mediaAddress;
-			r.port = c->mediaPort;
-			sender.receivers.append(std::move(r));
+			sender.receivers.append(createMediaReceiver(*c, client));
 		}
 
 		// Create RECEIVER entity for "client".
-		MediaReceiverEntity receiver;
-		receiver.clientId = client->id;
-		receiver.address = client->mediaAddress;
-		receiver.port = client->mediaPort;
+		const auto receiver = createMediaReceiver(*client);
 
 		// Fill "recips" with created information.
 		recips.addr2sender[sender.address][sender.port] = sender;
 		recips.clientid2receiver.insert(receiver.clientId, receiver);
 	}
-	_mediaSocketHandler->setRecipients(std::move(recips));
+	return recips;
+}
+
+// Compares the SENDER and RECEIVER entities of two MediaRecipients by their
+// addresses and client-ids. The order of receivers is not important.
+static QStringList compareMediaRecipients(const MediaRecipients& expected, const MediaRecipients& actual)
+{
+	QStringList diffs;
+	QSet<QPair<QString, quint16> > senders;
+	for (auto itAddr = expected.addr2sender.constBegin(); itAddr != expected.addr2sender.constEnd(); ++itAddr)
+		for (auto itPort = itAddr.value().constBegin(); itPort != itAddr.value().constEnd(); ++itPort)
+			senders.insert(qMakePair(itAddr.key().toString(), itPort.key()));
+	for (auto itAddr = actual.addr2sender.constBegin(); itAddr != actual.addr2sender.constEnd(); ++itAddr)
+		for (auto itPort = itAddr.value().constBegin(); itPort != itAddr.value().constEnd(); ++itPort)
+			senders.insert(qMakePair(itAddr.key().toString(), itPort.key()));
+
+	for (const auto& sender : senders)
+	{
+		const QHostAddress address(sender.first);
+		const auto e = expected.addr2sender.value(address).value(sender.second);
+		const auto a = actual.addr2sender.value(address).value(sender.second);
+		const auto name = QString("%1:%2").arg(sender.first).arg(sender.second);
+		if (!expected.addr2sender.value(address).contains(sender.second))
+		{
+			diffs.append(QString("Unexpected sender (sender=%1; client-id=%2)").arg(name).arg(a.clientId));
+			continue;
+		}
+		if (!actual.addr2sender.value(address).contains(sender.second))
+		{
+			diffs.append(QString("Missing sender (sender=%1; client-id=%2)").arg(name).arg(e.clientId));
+			continue;
+		}
+		if (e.clientId != a.clientId)
+		{
+			diffs.append(QString("Different sender client-id (sender=%1; expected=%2; actual=%3)").arg(name).arg(e.clientId).arg(a.clientId));
+		}
+		if (e.videoLayers != a.videoLayers)
+		{
+			diffs.append(QString("Different sender video layers (sender=%1; expected=%2; actual=%3)").arg(name).arg(e.videoLayers).arg(a.videoLayers));
+		}
+		if (e.audioGroup != a.audioGroup)
+		{
+			diffs.append(QString("Different sender audio group (sender=%1; expected=%2; actual=%3)").arg(name).arg(e.audioGroup).arg(a.audioGroup));
+		}
+
+		QSet<QString> expectedReceivers, actualReceivers;
+		for (const auto& r : e.receivers)
+			expectedReceivers.insert(QString("%1@%2:%3/%4").arg(r.clientId).arg(r.address.toString()).arg(r.port).arg(r.videoLayer));
+		for (const auto& r : a.receivers)
+			actualReceivers.insert(QString("%1@%2:%3/%4").arg(r.clientId).arg(r.address.toString()).arg(r.port).arg(r.videoLayer));
+		if (expectedReceivers != actualReceivers)
+		{
+			diffs.append(QString("Different receivers (sender=%1; missing=%2; unexpected=%3)").arg(name)
+						 .arg(QStringList((expectedReceivers - actualReceivers).toList()).join(","))
+						 .arg(QStringList((actualReceivers - expectedReceivers).toList()).join(",")));
+		}
+	}
+
+	auto clientIds = expected.clientid2receiver.keys().toSet() + actual.clientid2receiver.keys().toSet();
+	for (const auto clientId : clientIds)
+	{
+		const auto e = expected.clientid2receiver.value(clientId);
+		const auto a = actual.clientid2receiver.value(clientId);
+		if (!expected.clientid2receiver.contains(clientId) || !actual.clientid2receiver.contains(clientId) || e.address != a.address || e.port != a.port)
+		{
+			diffs.append(QString("Different receiver (client-id=%1; expected=%2:%3; actual=%4:%5)").arg(clientId)
+						 .arg(e.address.toString()).arg(e.port).arg(a.address.toString()).arg(a.port));
+		}
+	}
+	return diffs;
+}
+
+bool VirtualServer::verifyMediaRecipients() const
+{
+	const auto diffs = compareMediaRecipients(createMediaRecipients(), _mediaRecipients);
+	for (const auto& diff : diffs)
+	{
+		HL_ERROR(HL, QString("Inconsistent media recipients: %1").arg(diff).toStdString());
+	}
+	return diffs.isEmpty();
+}
+
+void VirtualServer::onClientJoinedChannel(ocs::clientid_t clientId, ocs::channelid_t channelId)
+{
+	for (const auto participantId : _participants.value(channelId))
+	{
+		if (participantId == clientId)
+			continue;
+		++_sharedChannels[clientId][participantId];
+		++_sharedChannels[participantId][clientId];
+		invalidateMediaSender(participantId);
+	}
+	invalidateMediaSender(clientId);
+}
+
+void VirtualServer::onClientLeftChannel(ocs::clientid_t clientId, ocs::channelid_t channelId)
+{
+	for (const auto participantId : _participants.value(channelId))
+	{
+		if (participantId == clientId)
+			continue;
+		auto& a = _sharedChannels[clientId];
+		if (--a[participantId] <= 0)
+			a.remove(participantId);
+		if (a.isEmpty())
+			_sharedChannels.remove(clientId);
+
+		auto& b = _sharedChannels[participantId];
+		if (--b[clientId] <= 0)
+			b.remove(clientId);
+		if (b.isEmpty())
+			_sharedChannels.remove(participantId);
+
+		invalidateMediaSender(participantId);
+	}
+	invalidateMediaSender(clientId);
+}
+
+void VirtualServer::onClientMediaAuthenticated(ocs::clientid_t clientId)
+{
+	// The client's address changed, which affects every sender it receives from.
+	invalidateMediaSendersOf(clientId);
+	invalidateMediaSender(clientId);
+}
+
+void VirtualServer::onClientMediaDatagramSizeChanged(ocs::clientid_t clientId)
+{
+	// The senders of this client may use larger datagrams now.
+	invalidateMediaSendersOf(clientId);
+}
+
+void VirtualServer::onClientMediaToggled(ocs::clientid_t clientId)
+{
+	invalidateMediaSender(clientId);
+}
+
+void VirtualServer::onClientRemoteVideoSizeChanged(ocs::clientid_t senderId)
+{
+	invalidateMediaSender(senderId);
+}
+
+void VirtualServer::onClientVisibilityChanged(ocs::clientid_t clientId)
+{
+	const auto shared = _sharedChannels.value(clientId);
+	for (auto it = shared.constBegin(); it != shared.constEnd(); ++it)
+		invalidateMediaSender(it.key());
+	invalidateMediaSender(clientId);
+}
+
+void VirtualServer::onDirectStreamingRelationChanged(ocs::clientid_t senderId)
+{
+	invalidateMediaSender(senderId);
+}
+
+void VirtualServer::onClientDisconnected(ocs::clientid_t clientId)
+{
+	// Cleanup direct-mapping (as long as it isn't used much).. it may cost time
+	_sender2receiver.remove(clientId);
+	for (auto i = _sender2receiver.begin(); i != _sender2receiver.end(); ++i)
+	{
+		if ((*i).remove(clientId))
+			invalidateMediaSender(i.key());
+	}
+	for (auto i = _clients.begin(); i != _clients.end(); ++i)
+	{
+		(*i)->remoteVideoSizes.remove(clientId);
+	}
+	invalidateMediaSender(clientId);
+}
+
+void VirtualServer::invalidateMediaSender(ocs::clientid_t clientId)
+{
+	_mediaDirtyClients.insert(clientId);
+	if (!_mediaRecipientsTimer.isActive())
+		_mediaRecipientsTimer.start();
+}
+
+void VirtualServer::invalidateMediaSendersOf(ocs::clientid_t receiverId)
+{
+	const auto shared = _sharedChannels.value(receiverId);
+	for (auto it = shared.constBegin(); it != shared.constEnd(); ++it)
+		invalidateMediaSender(it.key());
+	for (auto it = _sender2receiver.constBegin(); it != _sender2receiver.constEnd(); ++it)
+		if (it.value().contains(receiverId))
+			invalidateMediaSender(it.key());
+}
+
+void VirtualServer::updateMediaSender(ocs::clientid_t clientId)
+{
+	// Remove current entities. Another client may have taken over the
+	// address in the meantime (e.g. same NAT mapping after a reconnect).
+	if (_mediaSenders.contains(clientId))
+	{
+		const auto old = _mediaSenders.take(clientId);
+		auto itAddr = _mediaRecipients.addr2sender.find(old.address);
+		if (itAddr != _mediaRecipients.addr2sender.end())
+		{
+			auto itPort = itAddr.value().find(old.port);
+			if (itPort != itAddr.value().end() && itPort.value().clientId == clientId)
+				itAddr.value().erase(itPort);
+			if (itAddr.value().isEmpty())
+				_mediaRecipients.addr2sender.erase(itAddr);
+		}
+	}
+	_mediaRecipients.clientid2receiver.remove(clientId);
+
+	// Validate client for streaming, only senders get a RECEIVER entity as well (see createMediaRecipients()).
+	auto client = _clients.value(clientId);
+	if (!client)
+		return;
+	else if (client->mediaAddress.isNull() || client->mediaPort <= 0)
+		return;
+	else if (!client->videoEnabled && !client->audioInputEnabled)
+		return;
+
+	MediaSenderEntity sender;
+	sender.clientId = client->id;
+	sender.address = client->mediaAddress;
+	sender.port = client->mediaPort;
+	sender.videoLayers = qMax(client->videoLayers.size(), 1);
+	sender.audioGroup = audioGroup(*client);
+
+	// Receivers by conference members and direct mappings, each receiver only once.
+	QSet<ocs::clientid_t> receiverIds;
+	const auto shared = _sharedChannels.value(clientId);
+	for (auto it = shared.constBegin(); it != shared.constEnd(); ++it)
+	{
+		auto c = _clients.value(it.key());
+		if (c && client->isAllowedToSee(*c))
+			receiverIds.insert(c->id);
+	}
+	for (const auto id : _sender2receiver.value(clientId))
+		receiverIds.insert(id);
+
+	for (const auto id : receiverIds)
+	{
+		auto c = _clients.value(id);
+		if (!c || c == client)
+			continue;
+		else if (c->mediaAddress.isNull() || c->mediaPort <= 0)
+			continue;
+
+		sender.receivers.append(createMediaReceiver(*c, client));
+	}
+
+	const auto receiver = createMediaReceiver(*client);
+	_mediaRecipients.addr2sender[sender.address][sender.port] = sender;
+	_mediaRecipients.clientid2receiver.insert(receiver.clientId, receiver);
+	_mediaSenders.insert(clientId, sender);
+}
+
+void VirtualServer::updateMediaDatagramLimit(ocs::clientid_t clientId)
+{
+	// The sender's datagrams are forwarded as they are,
+	// they must not be larger than any receiver has confirmed.
+	auto client = _clients.value(clientId);
+	const auto it = _mediaSenders.constFind(clientId);
+	if (!client || it == _mediaSenders.constEnd() || it.value().receivers.isEmpty())
+		return;
+
+	auto datagramSize = (int)UDP::MtuProbeDatagram::MAXDATAGRAMSIZE;
+	for (const auto& receiver : it.value().receivers)
+	{
+		auto c = _clients.value(receiver.clientId);
+		datagramSize = qMin(datagramSize, c ? c->mediaDownlinkDatagramSize : (int)UDP::MtuProbeDatagram::DEFAULTDATAGRAMSIZE);
+	}
+	if (datagramSize == client->mediaDatagramLimit)
+		return;
+
+	client->mediaDatagramLimit = datagramSize;
+	auto conn = _connections.value(clientId);
+	if (conn)
+		conn->sendMediaDatagramSizeNotify(datagramSize);
+}
+
+MediaReceiverEntity VirtualServer::createMediaReceiver(const ServerClientEntity& client, const ServerClientEntity* sender) const
+{
+	MediaReceiverEntity r;
+	r.clientId = client.id;
+	r.address = client.mediaAddress;
+	r.port = client.mediaPort;
+	r.bandwidth = (quint64)_opts.mediaReceiverBandwidth * 1000 / 8;
+	if (sender)
+		r.videoLayer = selectVideoLayer(*sender, client, r.bandwidth);
+	return r;
+}
+
+quint32 VirtualServer::audioGroup(const ServerClientEntity& client) const
+{
+	// Clients are usually in a single channel, the lowest channel-id keeps it stable otherwise.
+	const auto channelIds = _client2channels.value(client.id);
+	if (channelIds.isEmpty())
+		return 0;
+	return (quint32)*std::min_element(channelIds.constBegin(), channelIds.constEnd());
+}
+
+int VirtualServer::selectVideoLayer(const ServerClientEntity& sender, const ServerClientEntity& receiver, quint64 bandwidth) const
+{
+	const auto& layers = sender.videoLayers;
+	if (layers.size() <= 1)
+		return 0;
+
+	// The smallest layer, which is at least as large as the displayed video.
+	// Without a known size the receiver gets the full resolution.
+	auto layer = 0;
+	const auto size = receiver.remoteVideoSizes.value(sender.id);
+	if (size.isValid())
+	{
+		while (layer + 1 < layers.size() && layers[layer + 1].width >= size.width() && layers[layer + 1].height >= size.height())
+			++layer;
+	}
+
+	// Step down, while the layer does not fit into the receiver's bandwidth (kbit/s vs. bytes/s).
+	if (bandwidth > 0)
+	{
+		while (layer + 1 < layers.size() && (quint64)layers[layer].bitrate * 1000 / 8 > bandwidth)
+			++layer;
+	}
+	return layer;
 }
 
 std::shared_ptr<ActionBase> VirtualServer::findHandlerByName(const QString& name) const
@@ -265,15 +602,23 @@ ServerChannelEntity* VirtualServer::addClientToChannel(ocs::clientid_t clientId,
 		HL_ERROR(HL, QString("Channel does not exist (channelId=%1)").arg(channelId).toStdString());
 		return nullptr;
 	}
+	if (_participants[channelEntity->id].contains(clientId))
+	{
+		return channelEntity;
+	}
 	_participants[channelEntity->id].insert(clientId);
 	_client2channels[clientId].insert(channelEntity->id);
+	onClientJoinedChannel(clientId, channelEntity->id);
 	return channelEntity;
 }
 
 void VirtualServer::removeClientFromChannel(ocs::clientid_t clientId, ocs::channelid_t channelId)
 {
 	// Remove from channel.
-	_participants[channelId].remove(clientId);
+	if (_participants[channelId].remove(clientId))
+	{
+		onClientLeftChannel(clientId, channelId);
+	}
 	_client2channels[clientId].remove(channelId);
 
 	// Delete channel and free some resources, if there are no more participants.
@@ -391,7 +736,58 @@ void VirtualServer::onMediaSocketTokenAuthentication(const QString& token, const
 	{
 		conn->sendMediaAuthSuccessNotify();
 	}
-	this->updateMediaRecipients();
+	onClientMediaAuthenticated(clientId);
+}
+
+void VirtualServer::onMediaSocketMtuProbe(int size, const QHostAddress& address, quint16 port)
+{
+	// Only authenticated endpoints get an answer,
+	// the server should not be usable to reflect traffic elsewhere.
+	ServerClientEntity* clientEntity = nullptr;
+	foreach (auto c, _clients)
+	{
+		if (c->mediaPort == port && c->mediaAddress == address)
+		{
+			clientEntity = c;
+			break;
+		}
+	}
+	if (!clientEntity)
+	{
+		HL_DEBUG(HL, QString("MTU probe from unknown endpoint (size=%1; address=%2; port=%3)").arg(size).arg(address.toString()).arg(port).toStdString());
+		return;
+	}
+
+	if (size > clientEntity->mediaDatagramSize)
+	{
+		clientEntity->mediaDatagramSize = size;
+		HL_DEBUG(HL, QString("Increased media datagram size (client-id=%1; size=%2)").arg(clientEntity->id).arg(size).toStdString());
+	}
+	_mediaSocketHandler->sendMtuProbeReply(size, address, port);
+}
+
+void VirtualServer::onMediaRecipientsTimeout()
+{
+	if (!_mediaSocketHandler)
+	{
+		return;
+	}
+
+	const auto dirtyClients = _mediaDirtyClients;
+	_mediaDirtyClients.clear();
+	for (const auto clientId : dirtyClients)
+	{
+		updateMediaSender(clientId);
+		updateMediaDatagramLimit(clientId);
+	}
+
+	// Only the routes of the changed senders are compiled again.
+	_mediaSocketHandler->setRecipients(_mediaRecipients, dirtyClients);
+
+	if (_opts.verifyMediaRecipients)
+	{
+		verifyMediaRecipients();
+	}
 }
 
 void VirtualServer::onMediaSocketNetworkUsageUpdated(const NetworkUsageEntity& networkUsage)
@@ -399,6 +795,11 @@ void VirtualServer::onMediaSocketNetworkUsageUpdated(const NetworkUsageEntity& n
 	_networkUsageMediaSocket = networkUsage;
 }
 
+void VirtualServer::onMediaSocketRelayStatisticsUpdated(const MediaRelayStatistics& relayStatistics)
+{
+	_mediaRelayStatistics = relayStatistics;
+}
+
 void VirtualServer::registerAction(std::shared_ptr<ActionBase> action)
 {
 	if (_actions.contains(action->name()))
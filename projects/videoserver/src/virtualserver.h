@@ -10,6 +10,7 @@
 #include <QSet>
 #include <QHostAddress>
 #include <QSharedPointer>
+#include <QTimer>
 
 #include "libqtcorprotocol/qcorserver.h"
 
@@ -19,9 +20,9 @@
 #include "libapp/networkusageentity.h"
 
 #include "virtualserveroptions.h"
+#include "mediasockethandler.h"
 
 class ClientConnectionHandler;
-class MediaSocketHandler;
 class WebSocketStatusServer;
 class ServerClientEntity;
 class ServerChannelEntity;
@@ -41,7 +42,6 @@ public:
 	void stop();
 
 	const VirtualServerOptions& options() const;
-	void updateMediaRecipients();
 
 	std::shared_ptr<ActionBase> findHandlerByName(const QString& name) const;
 
@@ -52,6 +52,23 @@ public:
 	void removeClientFromChannels(ocs::clientid_t clientId);
 	QList<ocs::clientid_t> getSiblingClientIds(ocs::clientid_t clientId, bool filterByVisibilityLevel) const;
 
+	// Incremental media routing updates.
+	// Each function updates the routes of the affected clients only,
+	// the changes are published to the media relay with a short delay.
+	void onClientJoinedChannel(ocs::clientid_t clientId, ocs::channelid_t channelId);
+	void onClientLeftChannel(ocs::clientid_t clientId, ocs::channelid_t channelId);
+	void onClientMediaAuthenticated(ocs::clientid_t clientId);
+	void onClientMediaToggled(ocs::clientid_t clientId);
+	void onClientRemoteVideoSizeChanged(ocs::clientid_t senderId);
+	void onClientMediaDatagramSizeChanged(ocs::clientid_t clientId);
+	void onClientVisibilityChanged(ocs::clientid_t clientId);
+	void onDirectStreamingRelationChanged(ocs::clientid_t senderId);
+	void onClientDisconnected(ocs::clientid_t clientId);
+
+	// Full rebuild of the media routes (reference for the incremental updates).
+	MediaRecipients createMediaRecipients() const;
+	bool verifyMediaRecipients() const;
+
 	// Ban / unban clients.
 	void ban(const QHostAddress& address);
 	void unban(const QHostAddress& address);
@@ -59,11 +76,21 @@ public:
 
 private slots:
 	void onNewConnection(QCorConnection* c);
+	void onMediaRecipientsTimeout();
 	void onMediaSocketTokenAuthentication(const QString& token, const QHostAddress& address, quint16 port);
+	void onMediaSocketMtuProbe(int size, const QHostAddress& address, quint16 port);
 	void onMediaSocketNetworkUsageUpdated(const NetworkUsageEntity& networkUsage);
+	void onMediaSocketRelayStatisticsUpdated(const MediaRelayStatistics& relayStatistics);
 
 private:
 	void registerAction(std::shared_ptr<ActionBase> action);
+	void invalidateMediaSender(ocs::clientid_t clientId);
+	void invalidateMediaSendersOf(ocs::clientid_t receiverId);
+	void updateMediaSender(ocs::clientid_t clientId);
+	void updateMediaDatagramLimit(ocs::clientid_t clientId);
+	MediaReceiverEntity createMediaReceiver(const ServerClientEntity& client, const ServerClientEntity* sender = nullptr) const;
+	int selectVideoLayer(const ServerClientEntity& sender, const ServerClientEntity& receiver, quint64 bandwidth) const;
+	quint32 audioGroup(const ServerClientEntity& client) const;
 
 public:
 	VirtualServerOptions _opts;         // Complete configuration for this VirtualServer instance.
@@ -91,11 +118,19 @@ public:
 	std::unique_ptr<MediaSocketHandler> _mediaSocketHandler;
 	QHash<QString, ocs::clientid_t> _tokens; // Maps auth-tokens to client-ids.
 
+	// Incrementally updated media routes.
+	QHash<ocs::clientid_t, QHash<ocs::clientid_t, int> > _sharedChannels; // Maps client-ids to the clients they share channels with (and the number of shared channels).
+	QHash<ocs::clientid_t, MediaSenderEntity> _mediaSenders;               // Maps client-ids to their current SENDER entity in _mediaRecipients.
+	MediaRecipients _mediaRecipients;
+	QSet<ocs::clientid_t> _mediaDirtyClients;                             // Clients whose SENDER entity needs to be updated.
+	QTimer _mediaRecipientsTimer;
+
 	// Web-socket status server.
 	std::unique_ptr<WebSocketStatusServer> _wsStatusServer;
 
 	// Network usages (COR, Media, WebSocket, ...)
 	NetworkUsageEntity _networkUsageMediaSocket;
+	MediaRelayStatistics _mediaRelayStatistics;
 };
 
 #endif
\ No newline at end of file
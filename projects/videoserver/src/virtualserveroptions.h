@@ -18,6 +18,52 @@ public:
 	QHostAddress address = QHostAddress::Any;
 	quint16 port = IFVS_SERVER_CONNECTION_PORT;
 
+	// I/O backend of the media relay ("qt" or "batched").
+	// The "batched" backend reads and writes multiple UDP datagrams
+	// per system call (recvmmsg/sendmmsg) and is only available on Linux.
+	QString mediaRelayBackend = "qt";
+	int mediaRelayBatchSize = 64;
+
+	// Number of media relay worker threads, each with its own
+	// SO_REUSEPORT socket on the media port (Linux only).
+	// 0 = Relay media in the main thread.
+	int mediaRelayWorkers = 0;
+
+	// Maximum number of datagrams per sender, which are cached since the
+	// sender's last key frame. New receivers get them immediately.
+	// 0 = Disables the key frame cache.
+	int mediaKeyFrameCache = 256;
+
+	// Recovery (key frame) requests for the same sender within this
+	// window are merged and only the first one is forwarded.
+	// 0 = Forwards every request.
+	int mediaRecoveryWindow = 500;
+
+	// Maximum bandwidth of each media receiver (kbit/s). The server
+	// estimates the available bandwidth below it from the loss, which the
+	// receivers report. Non-key video frames are dropped as a whole for
+	// receivers above the estimate.
+	// 0 = Unlimited.
+	int mediaReceiverBandwidth = 0;
+
+	// Maximum number of speakers per channel, whose audio is forwarded.
+	// The loudest ones are selected by the audio level of their frames.
+	// 0 = Forwards every speaker.
+	int mediaActiveSpeakers = 3;
+
+	// Channels with at least this number of speakers are mixed by the server,
+	// every receiver gets a single audio stream without its own voice.
+	// Requires a server build with audio support.
+	// 0 = Disables mixing.
+	int mediaAudioMixing = 0;
+
+	// Number of threads, which mix the audio of the channels.
+	int mediaAudioMixerWorkers = 2;
+
+	// Compares the incrementally updated media routes with a full
+	// rebuild after every update and logs differences (debugging).
+	bool verifyMediaRecipients = false;
+
 	// The address and port of server's status and control WebSocket.
 	QHostAddress wsStatusAddress = QHostAddress::Any;
 	quint16 wsStatusPort = IFVS_SERVER_WSSTATUS_PORT;
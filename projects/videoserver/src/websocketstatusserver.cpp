@@ -121,6 +121,13 @@ void WebSocketStatusServer::onTextMessage(const QString& message)
 		root["data"] = getBandwidthInfo();
 		socket->sendTextMessage(QJsonDocument(root).toJson(QJsonDocument::Compact));
 	}
+	else if (action == "mediarelayinfo")
+	{
+		QJsonObject root;
+		root["action"] = action;
+		root["data"] = getMediaRelayInfo();
+		socket->sendTextMessage(QJsonDocument(root).toJson(QJsonDocument::Compact));
+	}
 	else if (action == "clients")
 	{
 		QJsonObject root;
@@ -160,6 +167,7 @@ QJsonValue WebSocketStatusServer::getAllInfo() const
 	root.insert("info", getAppInfo());
 	root.insert("memory", getMemoryUsageInfo());
 	root.insert("bandwidth", getBandwidthInfo());
+	root.insert("mediarelay", getMediaRelayInfo());
 	root.insert("clients", getClientsInfo());
 	root.insert("channels", getChannelsInfo());
 	root.insert("websockets", getWebSocketsInfo());
@@ -215,6 +223,11 @@ QJsonValue WebSocketStatusServer::getBandwidthInfo() const
 	return _server->_networkUsageMediaSocket.toQJsonObject();
 }
 
+QJsonValue WebSocketStatusServer::getMediaRelayInfo() const
+{
+	return _server->_mediaRelayStatistics.toQJsonObject();
+}
+
 QJsonValue WebSocketStatusServer::getClientsInfo() const
 {
 	QJsonArray clients;
@@ -229,6 +242,9 @@ QJsonValue WebSocketStatusServer::getClientsInfo() const
 			jsConn.insert("port", 0);
 			jsConn.insert("mediaaddress", clientEntity->mediaAddress.toString());
 			jsConn.insert("mediaport", clientEntity->mediaPort);
+			jsConn.insert("mediadatagramsize", clientEntity->mediaDatagramSize);
+			jsConn.insert("mediadownlinkdatagramsize", clientEntity->mediaDownlinkDatagramSize);
+			jsConn.insert("mediadatagramlimit", clientEntity->mediaDatagramLimit);
 			jsClient.insert("connection", jsConn);
 		}
 		clients.append(jsClient);
@@ -46,6 +46,7 @@ private:
 	QJsonValue getAppInfo() const;
 	QJsonValue getMemoryUsageInfo() const;
 	QJsonValue getBandwidthInfo() const;
+	QJsonValue getMediaRelayInfo() const;
 	QJsonValue getClientsInfo() const;
 	QJsonValue getChannelsInfo() const;
 	QJsonValue getWebSocketsInfo() const;